@@ -77,7 +77,14 @@ namespace gui
         m_labelRatioPiecesHave->setText(
             std::to_string(m_torrentState->getNumPiecesHave()) + " of " + std::to_string(torrentFile->getNumPieces()) + " pieces downloaded");
 
-        m_labelNumPeers->setText(std::to_string(m_torrentState->getNumPeers()) + " peer connections");
+        std::string peersText = std::to_string(m_torrentState->getNumPeers()) + " peer connections";
+        SwarmStats swarmStats = m_torrentState->getSwarmStats();
+        if (swarmStats.LastUpdated != 0)
+            peersText += " (" + std::to_string(swarmStats.Complete) + " seeds, " + std::to_string(swarmStats.Incomplete) + " leechers)";
+        IntegrityStats integrityStats = m_torrentState->getIntegrityStats();
+        if (integrityStats.CorruptBytes != 0)
+            peersText += ", " + bytesToReadableFmt(integrityStats.CorruptBytes) + " corrupt, " + std::to_string(integrityStats.BannedPeers) + " banned";
+        m_labelNumPeers->setText(peersText);
 
         m_labelDataUploaded->setText("Upload: " + bytesToReadableFmt(m_torrentState->getNumBytesUploaded()));
 
@@ -123,7 +130,7 @@ namespace gui
         // Peers label
         tmpPos.x = parentPos.x + 15;
         tmpPos.y = parentPos.y + (parentSize.height * 5 / 6) - 5;
-        m_labelNumPeers = objMgr->createObject<Label>(this, tmpPos, Size(parentSize.width / 4, (parentSize.height / 6) - 5), textColor,
+        m_labelNumPeers = objMgr->createObject<Label>(this, tmpPos, Size(parentSize.width / 2, (parentSize.height / 6) - 5), textColor,
             std::string(), 20);
 
         // Upload label
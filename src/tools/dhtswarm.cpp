@@ -0,0 +1,142 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/filesystem.hpp>
+
+#include "DHTNode.h"
+#include "LogHelper.h"
+
+using namespace dht;
+
+// Log helper
+LogHelper sLog;
+
+/// Port announced by the node with index N is the base plus N
+const static uint16_t AnnouncedPortBase = 10000;
+
+/// Runs the io service for the given number of milliseconds, returning the time it took in seconds
+static double runFor(boost::asio::io_service &ioService, int milliseconds)
+{
+    auto start = std::chrono::steady_clock::now();
+    ioService.run_for(std::chrono::milliseconds(milliseconds));
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/// Looks up the peers of the torrent with the given info hash from the given node, returning true if the one
+/// listening on the given port is found
+static bool findPeer(boost::asio::io_service &ioService, DHTNode &node, const NodeID &infoHash, uint16_t port)
+{
+    bool found = false;
+    node.getPeers(infoHash.getData(), [&found, port](const std::vector<boost::asio::ip::tcp::endpoint> &peers) {
+        for (const auto &peer : peers)
+            found = found || peer.port() == port;
+    });
+    runFor(ioService, 100);
+    return found;
+}
+
+/// Starts a swarm of DHT nodes on loopback, all on a single io service, that join through the first node.
+/// Every node then announces a torrent of its own, and a different node looks each one up. Finally, the
+/// routing table of one node is saved, and a node restarted from it has to find a torrent without bootstrapping.
+/// Usage: dhtswarm [nodes = 40]
+int main(int argc, char **argv)
+{
+    const int numNodes = (argc > 1) ? std::max(std::atoi(argv[1]), 3) : 40;
+    sLog.get("torrent_protocol.dht")->SetLogLevel(LOG_ERROR);
+
+    boost::asio::io_service ioService;
+    std::vector< std::shared_ptr<DHTNode> > nodes;
+    for (int i = 0; i < numNodes; ++i)
+    {
+        nodes.push_back(std::make_shared<DHTNode>(ioService));
+        if (!nodes.back()->start(0))
+        {
+            std::printf("Unable to start node %d\n", i);
+            return 1;
+        }
+    }
+
+    // The first node is the bootstrap node of every other
+    const boost::asio::ip::udp::endpoint bootstrap(boost::asio::ip::make_address("127.0.0.1"), nodes[0]->getPort());
+    for (int i = 1; i < numNodes; ++i)
+    {
+        nodes[i]->addBootstrapNode(bootstrap);
+        nodes[i]->ping(bootstrap);
+    }
+    double seconds = runFor(ioService, 250);
+
+    // Lookups of random targets fill in the routing tables
+    for (int i = 1; i < numNodes; ++i)
+        nodes[i]->getPeers(NodeID::random().getData(), [](const std::vector<boost::asio::ip::tcp::endpoint>&) {});
+    seconds += runFor(ioService, 500);
+
+    std::size_t numKnown = 0;
+    for (const auto &node : nodes)
+        numKnown += node->getNumNodes();
+    std::printf("%d nodes joined in %.2f s, knowing %.1f nodes on average\n", numNodes, seconds, double(numKnown) / numNodes);
+
+    // Every node but the bootstrap node announces a torrent of its own
+    std::vector<NodeID> infoHashes(numNodes);
+    for (int i = 1; i < numNodes; ++i)
+    {
+        infoHashes[i] = NodeID::random();
+        nodes[i]->announce(infoHashes[i].getData(), AnnouncedPortBase + i, [](const std::vector<boost::asio::ip::tcp::endpoint>&) {});
+    }
+    runFor(ioService, 500);
+
+    // Each torrent is looked up from a node other than the one that announced it
+    int numFound = 0;
+    for (int i = 1; i < numNodes; ++i)
+    {
+        int searcher = i % (numNodes - 1) + 1;
+        numFound += findPeer(ioService, *nodes[searcher], infoHashes[i], AnnouncedPortBase + i);
+    }
+    std::printf("Found %d of %d announced peers\n", numFound, numNodes - 1);
+
+    // A node restarted from a saved routing table finds a torrent without its bootstrap node
+    const boost::filesystem::path statePath = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("dhtswarm-%%%%-%%%%.dat");
+    const int restarted = numNodes / 2;
+    nodes[restarted]->saveState(statePath.string());
+    nodes[restarted]->stop();
+
+    auto restartedNode = std::make_shared<DHTNode>(ioService);
+    bool loaded = restartedNode->loadState(statePath.string()) && restartedNode->getNodeID() == nodes[restarted]->getNodeID();
+    boost::filesystem::remove(statePath);
+    restartedNode->start(0);
+    runFor(ioService, 300);
+
+    const int target = (restarted == 1) ? 2 : 1;
+    bool warmFound = loaded && findPeer(ioService, *restartedNode, infoHashes[target], AnnouncedPortBase + target);
+    std::printf("Restarted node %s its state, knows %zu nodes, %s the peer of node %d\n", loaded ? "loaded" : "did not load",
+                restartedNode->getNumNodes(), warmFound ? "found" : "did not find", target);
+
+    return (numFound == numNodes - 1 && warmFound) ? 0 : 1;
+}
@@ -0,0 +1,147 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+#include <boost/filesystem.hpp>
+
+#include "LogHelper.h"
+#include "TorrentGenerator.h"
+
+namespace fs = boost::filesystem;
+
+// Log helper
+LogHelper sLog;
+
+/// Piece length of the generated torrents, fixed so every run hashes the same pieces
+const static int64_t PieceLength = 256 * 1024;
+
+/// Fills the file at the given path with length bytes of pseudo-random data
+static bool writeRandomFile(const fs::path &path, size_t length, std::mt19937 &gen)
+{
+    std::vector<char> data(length);
+    for (size_t i = 0; i + 4 <= length; i += 4)
+    {
+        uint32_t word = gen();
+        memcpy(&data[i], &word, 4);
+    }
+
+    std::ofstream file(path.string(), std::ios::binary | std::ios::trunc);
+    file.write(data.data(), data.size());
+    return file.good();
+}
+
+/// Returns the contents of the file at the given path
+static std::string readFile(const fs::path &path)
+{
+    std::ifstream file(path.string(), std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+/// Generates a torrent of the target into outputFile, using the hash cache if its path is not empty.
+/// Prints and returns the seconds spent hashing, or a negative value on failure
+static double generate(const char *label, const fs::path &target, const fs::path &outputFile, const std::string &cachePath)
+{
+    TorrentGenerator generator;
+    generator.setAnnounceURL("http://127.0.0.1:1/announce");
+    generator.setPieceLength(PieceLength);
+    generator.setHashCache(cachePath);
+
+    auto start = std::chrono::steady_clock::now();
+    if (!generator.setTarget(target.string()) || !generator.createFile(outputFile.string()))
+    {
+        std::printf("%-32s failed\n", label);
+        return -1.0;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::printf("%-32s %8.3f s\n", label, seconds);
+    return seconds;
+}
+
+/// Measures how much the piece hash cache saves when regenerating a torrent of a directory: once
+/// with nothing changed, and once after rewriting a single file. Each cached result is compared
+/// with an uncached generation of the same tree. The files are written just before hashing, so
+/// they are read from the page cache and the timings reflect hashing rather than disk speed.
+/// Usage: genbench [files = 32] [megabytes per file = 16]
+int main(int argc, char **argv)
+{
+    const int numFiles = (argc > 1) ? std::max(std::atoi(argv[1]), 1) : 32;
+    const size_t fileLength = ((argc > 2) ? std::max(std::strtoul(argv[2], nullptr, 10), 1ul) : 16) * 1024 * 1024;
+
+    const fs::path workDir = fs::temp_directory_path() / fs::unique_path("genbench-%%%%-%%%%-%%%%");
+    const fs::path target = workDir / "data";
+    const std::string cachePath = (workDir / "hashes.cache").string();
+    fs::create_directories(target);
+
+    std::mt19937 gen(1);
+    for (int i = 0; i < numFiles; ++i)
+    {
+        if (!writeRandomFile(target / ("file" + std::to_string(i)), fileLength, gen))
+        {
+            std::printf("Unable to write test data to %s\n", target.string().c_str());
+            fs::remove_all(workDir);
+            return 1;
+        }
+    }
+    std::printf("%d files of %zu MiB, piece length %lld KiB\n", numFiles, fileLength / (1024 * 1024),
+                static_cast<long long>(PieceLength / 1024));
+
+    double uncached = generate("no cache", target, workDir / "uncached.torrent", std::string());
+    double cold = generate("empty cache", target, workDir / "cold.torrent", cachePath);
+    double warm = generate("warm cache, unchanged", target, workDir / "warm.torrent", cachePath);
+
+    // Rewrite one file, moving its modification time forward so the change is seen even when
+    // it happens within the timestamp resolution of the file system
+    const fs::path changedFile = target / ("file" + std::to_string(numFiles / 2));
+    std::time_t modifiedTime = fs::last_write_time(changedFile);
+    writeRandomFile(changedFile, fileLength, gen);
+    fs::last_write_time(changedFile, modifiedTime + 1);
+
+    double touched = generate("warm cache, one file changed", target, workDir / "touched.torrent", cachePath);
+    double reference = generate("no cache, one file changed", target, workDir / "reference.torrent", std::string());
+
+    bool ok = uncached >= 0 && cold >= 0 && warm >= 0 && touched >= 0 && reference >= 0;
+    if (ok)
+    {
+        const std::string expected = readFile(workDir / "uncached.torrent");
+        const std::string expectedChanged = readFile(workDir / "reference.torrent");
+        ok = readFile(workDir / "cold.torrent") == expected
+                && readFile(workDir / "warm.torrent") == expected
+                && readFile(workDir / "touched.torrent") == expectedChanged
+                && expectedChanged != expected;
+        std::printf("Speedup: %.1fx unchanged, %.1fx with one file changed\n", uncached / warm, reference / touched);
+        std::printf("Torrents %s\n", ok ? "match" : "DO NOT MATCH");
+    }
+
+    fs::remove_all(workDir);
+    return ok ? 0 : 1;
+}
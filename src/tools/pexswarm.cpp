@@ -0,0 +1,260 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <boost/filesystem.hpp>
+
+#include "LogHelper.h"
+#include "TorrentGenerator.h"
+#include "TorrentMgr.h"
+#include "TorrentState.h"
+
+namespace fs = boost::filesystem;
+
+/// Returns the path of the configuration used by the client of this process
+static std::string getConfigPath();
+
+// Log helper
+LogHelper sLog;
+
+/// Directory holding the files of the swarm, set up by the coordinating process
+static fs::path sWorkDir;
+
+// Torrent manager of the node running in this process
+TorrentMgr eTorrentMgr(getConfigPath());
+
+/// Default listen port of the first node, which the others connect to. Node N listens on the port N above it
+const static uint16_t DefaultBasePort = 17100;
+
+/// Length of the file described by the torrent
+const static size_t DataLength = 1024 * 1024;
+
+std::string getConfigPath()
+{
+    // Nodes are given their configuration by the coordinating process, which doesn't run its own client
+    if (const char *path = std::getenv("PEXSWARM_CONFIG"))
+        return path;
+
+    sWorkDir = fs::temp_directory_path() / fs::unique_path("pexswarm-%%%%-%%%%-%%%%");
+    fs::create_directories(sWorkDir);
+    const fs::path emptyConfig = sWorkDir / "coordinator.json";
+    std::ofstream(emptyConfig.string()) << "{}";
+    return emptyConfig.string();
+}
+
+/// Runs the node with the given index, which joins the swarm by connecting to the first node alone and finds
+/// the other nodes through peer exchange. Its number of distinct peers and of connections to them are written
+/// to the report pipe every second
+static int runNode(int nodeIdx, const std::string &torrentPath, uint16_t firstNodePort, int reportFd)
+{
+    sLog.get("torrent_protocol.network")->SetLogLevel(LOG_ERROR);
+
+    eTorrentMgr.run();
+    std::shared_ptr<TorrentState> state = eTorrentMgr.addTorrent(torrentPath);
+    if (state.get() == nullptr)
+        return 1;
+
+    if (nodeIdx != 0)
+        eTorrentMgr.getPeerConnectionMgr()->attemptConnection(boost::asio::ip::make_address("127.0.0.1"), firstNodePort, state);
+
+    // Runs until the coordinator kills the node, or goes away without doing so
+    while (dprintf(reportFd, "%d %zu %u\n", nodeIdx, state->getConnectedPeers().size(), state->getNumPeers()) > 0)
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+    return 0;
+}
+
+/// Writes the configuration of the given node, returning its path
+static std::string writeNodeConfig(int nodeIdx, uint16_t listenPort)
+{
+    const fs::path nodeDir = sWorkDir / ("node" + std::to_string(nodeIdx));
+    fs::create_directories(nodeDir);
+
+    const std::string configPath = (nodeDir / "config.json").string();
+    std::ofstream config(configPath);
+    config << "{\n"
+           << "    \"network\": { \"listen_port\": " << listenPort << ", \"max_pending_connections\": 100, "
+           << "\"local_discovery\": false, \"utp\": false },\n"
+           << "    \"disk\": { \"download_dir\": \"" << nodeDir.string() << "/\" },\n"
+           << "    \"dht\": { \"enabled\": false }\n"
+           << "}\n";
+    return configPath;
+}
+
+/// Generates the torrent the swarm shares, returning its path. No node starts out with the data, as peer
+/// exchange doesn't depend on it
+static std::string createTorrent()
+{
+    const fs::path dataPath = sWorkDir / "swarm.bin";
+    std::vector<char> data(DataLength);
+    std::mt19937 gen(1);
+    for (char &c : data)
+        c = static_cast<char>(gen());
+    std::ofstream(dataPath.string(), std::ios::binary).write(data.data(), data.size());
+
+    // Nothing listens on the announce URL, so peers can only be found through the first node and peer exchange
+    const std::string torrentPath = (sWorkDir / "swarm.torrent").string();
+    TorrentGenerator generator;
+    generator.setAnnounceURL("http://127.0.0.1:1/announce");
+    if (!generator.setTarget(dataPath.string()) || !generator.createFile(torrentPath))
+        return std::string();
+    return torrentPath;
+}
+
+/// Starts a swarm of loopback nodes, each in a process of its own as the torrent manager is global. Every node
+/// but the first connects to the first node alone, and the rest of the swarm has to be found through peer exchange.
+/// Prints the number of peers and connections of the nodes as they change, and how long the swarm took to form
+/// a full mesh, where every node is connected to every other.
+/// Usage: pexswarm [nodes = 8] [time limit in seconds = 150] [first port = 17100]
+int main(int argc, char **argv)
+{
+    if (const char *nodeIdx = std::getenv("PEXSWARM_NODE"))
+        return runNode(std::atoi(nodeIdx), std::getenv("PEXSWARM_TORRENT"), static_cast<uint16_t>(std::atoi(std::getenv("PEXSWARM_FIRST_PORT"))),
+                       std::atoi(std::getenv("PEXSWARM_REPORT_FD")));
+
+    // The torrent manager catches these signals to stop its io service, which the coordinator never runs
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+
+    const int numNodes = (argc > 1) ? std::max(std::atoi(argv[1]), 2) : 8;
+    const int timeLimit = (argc > 2) ? std::max(std::atoi(argv[2]), 1) : 150;
+    const uint16_t basePort = (argc > 3) ? static_cast<uint16_t>(std::atoi(argv[3])) : DefaultBasePort;
+
+    std::vector<std::string> configPaths;
+    for (int i = 0; i < numNodes; ++i)
+        configPaths.push_back(writeNodeConfig(i, static_cast<uint16_t>(basePort + i)));
+
+    const std::string torrentPath = createTorrent();
+    if (torrentPath.empty())
+    {
+        std::printf("Unable to create the torrent in %s\n", sWorkDir.string().c_str());
+        fs::remove_all(sWorkDir);
+        return 1;
+    }
+
+    int reportPipe[2];
+    if (pipe(reportPipe) != 0)
+        return 1;
+
+    // Each node is started from this executable, logging into its own directory
+    std::vector<pid_t> nodes;
+    for (int i = 0; i < numNodes; ++i)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            close(reportPipe[0]);
+            int logFd = open((sWorkDir / ("node" + std::to_string(i)) / "client.log").string().c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            dup2(logFd, STDOUT_FILENO);
+            dup2(logFd, STDERR_FILENO);
+            setenv("PEXSWARM_CONFIG", configPaths[i].c_str(), 1);
+            setenv("PEXSWARM_NODE", std::to_string(i).c_str(), 1);
+            setenv("PEXSWARM_TORRENT", torrentPath.c_str(), 1);
+            setenv("PEXSWARM_FIRST_PORT", std::to_string(basePort).c_str(), 1);
+            setenv("PEXSWARM_REPORT_FD", std::to_string(reportPipe[1]).c_str(), 1);
+            execv("/proc/self/exe", argv);
+            _exit(127);
+        }
+        nodes.push_back(pid);
+
+        // Let the first node start listening before anyone connects to it
+        if (i == 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    }
+    close(reportPipe[1]);
+
+    std::printf("%d nodes, listening from port %u\n", numNodes, basePort);
+    const auto start = std::chrono::steady_clock::now();
+    auto elapsed = [&]() { return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(); };
+
+    std::vector<unsigned> numPeers(numNodes, 0), numConnections(numNodes, 0);
+    std::string pending, lastSummary;
+    double fullMeshTime = -1.0;
+    while (fullMeshTime < 0 && elapsed() < timeLimit)
+    {
+        pollfd fd { reportPipe[0], POLLIN, 0 };
+        if (poll(&fd, 1, 1000) <= 0)
+            continue;
+
+        char buffer[4096];
+        ssize_t length = read(reportPipe[0], buffer, sizeof(buffer));
+        if (length <= 0)
+            break;
+        pending.append(buffer, length);
+
+        std::size_t end;
+        while ((end = pending.find('\n')) != std::string::npos)
+        {
+            int nodeIdx;
+            unsigned peers, connections;
+            if (std::sscanf(pending.c_str(), "%d %u %u", &nodeIdx, &peers, &connections) == 3 && nodeIdx >= 0 && nodeIdx < numNodes)
+            {
+                numPeers[nodeIdx] = peers;
+                numConnections[nodeIdx] = connections;
+            }
+            pending.erase(0, end + 1);
+        }
+
+        std::string summary;
+        bool fullMesh = true;
+        for (int i = 0; i < numNodes; ++i)
+        {
+            summary += ' ' + std::to_string(numPeers[i]) + '/' + std::to_string(numConnections[i]);
+            fullMesh = fullMesh && numPeers[i] >= (unsigned) (numNodes - 1);
+        }
+        if (summary != lastSummary)
+        {
+            std::printf("%6.1f s  peers/connections per node:%s\n", elapsed(), summary.c_str());
+            lastSummary = summary;
+        }
+        if (fullMesh)
+            fullMeshTime = elapsed();
+    }
+
+    if (fullMeshTime >= 0)
+        std::printf("Full mesh of %d nodes after %.1f s\n", numNodes, fullMeshTime);
+    else
+        std::printf("No full mesh after %d s\n", timeLimit);
+
+    for (pid_t pid : nodes)
+    {
+        kill(pid, SIGKILL);
+        waitpid(pid, nullptr, 0);
+    }
+    fs::remove_all(sWorkDir);
+    return (fullMeshTime >= 0) ? 0 : 1;
+}
@@ -0,0 +1,128 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+#include <openssl/evp.h>
+
+#include "LogHelper.h"
+#include "SHA1Hash.h"
+
+// Log helper
+LogHelper sLog;
+
+/// Length of each piece hashed by the batch benchmark
+const static size_t PieceLength = 256 * 1024;
+
+/// Number of pieces given to each call of SHA1Hash::hashBatch, a multiple of the AVX2 kernel's lanes
+const static size_t PiecesPerBatch = 16;
+
+/// Returns the number of seconds the function took to run
+template <typename Func>
+static double timeSeconds(Func func)
+{
+    auto start = std::chrono::steady_clock::now();
+    func();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/// Compares the SHA-1 backends on a large buffer: streamed as a single message through SHA1Hash,
+/// and as pieces through SHA1Hash::hashBatch. Every digest is checked against OpenSSL's EVP_Digest.
+/// Usage: sha1bench [megabytes = 256] [rounds = 3]
+int main(int argc, char **argv)
+{
+    const size_t megabytes = (argc > 1) ? std::max(std::strtoul(argv[1], nullptr, 10), 1ul) : 256;
+    const int rounds = (argc > 2) ? std::max(std::atoi(argv[2]), 1) : 3;
+    const size_t length = megabytes * 1024 * 1024;
+    const size_t numPieces = length / PieceLength;
+
+    std::vector<uint8_t> data(length);
+    std::mt19937 gen(1);
+    for (size_t i = 0; i + 4 <= length; i += 4)
+    {
+        uint32_t word = gen();
+        memcpy(&data[i], &word, 4);
+    }
+
+    // Reference digests of the whole buffer and of each piece
+    uint8_t expected[SHA_DIGEST_LENGTH];
+    EVP_Digest(data.data(), length, expected, nullptr, EVP_sha1(), nullptr);
+    std::vector<uint8_t> expectedPieces(numPieces * SHA_DIGEST_LENGTH);
+    for (size_t i = 0; i < numPieces; ++i)
+        EVP_Digest(&data[i * PieceLength], PieceLength, &expectedPieces[i * SHA_DIGEST_LENGTH], nullptr, EVP_sha1(), nullptr);
+
+    std::printf("%zu MiB, %zu pieces of %zu KiB, best of %d rounds\n", megabytes, numPieces, PieceLength / 1024, rounds);
+    std::printf("%-18s %14s %14s  %s\n", "backend", "stream MB/s", "batch MB/s", "digests");
+
+    const SHA1Hash::Backend original = SHA1Hash::getBackend();
+    const SHA1Hash::Backend backends[] = { SHA1Hash::Backend::OpenSSL, SHA1Hash::Backend::SHANI, SHA1Hash::Backend::AVX2MultiBuffer };
+    bool allCorrect = true;
+    for (SHA1Hash::Backend backend : backends)
+    {
+        if (!SHA1Hash::setBackend(backend))
+        {
+            std::printf("%-18s not supported on this CPU\n", SHA1Hash::getBackendName(backend));
+            continue;
+        }
+
+        bool correct = true;
+        double streamSeconds = 0, batchSeconds = 0;
+        std::vector<uint8_t> digests(numPieces * SHA_DIGEST_LENGTH);
+        for (int round = 0; round < rounds; ++round)
+        {
+            SHA1Hash hash;
+            double seconds = timeSeconds([&]() {
+                hash.update(data.data(), length);
+                hash.finalize();
+            });
+            correct = correct && memcmp(hash.getDigest(), expected, SHA_DIGEST_LENGTH) == 0;
+            streamSeconds = (round == 0) ? seconds : std::min(streamSeconds, seconds);
+
+            seconds = timeSeconds([&]() {
+                const uint8_t *messages[PiecesPerBatch];
+                for (size_t first = 0; first < numPieces; first += PiecesPerBatch)
+                {
+                    size_t count = std::min(PiecesPerBatch, numPieces - first);
+                    for (size_t i = 0; i < count; ++i)
+                        messages[i] = &data[(first + i) * PieceLength];
+                    SHA1Hash::hashBatch(messages, PieceLength, count, &digests[first * SHA_DIGEST_LENGTH]);
+                }
+            });
+            correct = correct && digests == expectedPieces;
+            batchSeconds = (round == 0) ? seconds : std::min(batchSeconds, seconds);
+        }
+
+        std::printf("%-18s %14.0f %14.0f  %s\n", SHA1Hash::getBackendName(backend), length / streamSeconds / 1e6,
+                    length / batchSeconds / 1e6, correct ? "ok" : "MISMATCH");
+        allCorrect = allCorrect && correct;
+    }
+
+    SHA1Hash::setBackend(original);
+    return allCorrect ? 0 : 1;
+}
@@ -0,0 +1,53 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <cstdint>
+
+/**
+ * @brief Stores the statistics of the data of a torrent that failed verification,
+ *        the bytes downloaded again in its place, and the peers banned for sending it.
+ */
+struct IntegrityStats
+{
+    /// Number of pieces that failed verification
+    uint32_t HashFailures;
+
+    /// Number of bytes discarded for being corrupt, or for belonging to a piece that failed verification
+    uint64_t CorruptBytes;
+
+    /// Number of bytes downloaded again in place of discarded data
+    uint64_t RetransmittedBytes;
+
+    /// Number of bytes received for fragments that another peer had already delivered
+    uint64_t RedundantBytes;
+
+    /// Number of peers banned for sending corrupt data
+    uint32_t BannedPeers;
+
+    /// Default constructor
+    IntegrityStats() : HashFailures(0), CorruptBytes(0), RetransmittedBytes(0), RedundantBytes(0), BannedPeers(0) {}
+};
@@ -0,0 +1,183 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+#include "MagnetLink.h"
+
+/// Prefix of the exact topic of a BitTorrent v1 magnet link
+const static char *BTIHPrefix = "urn:btih:";
+
+/// Returns the value of a hexadecimal digit, or -1 if the character is not one
+static int hexValue(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+MagnetLink::MagnetLink(const std::string &uri) :
+    m_isValid(false),
+    m_infoHash(),
+    m_displayName(),
+    m_trackers()
+{
+    if (!isMagnetURI(uri))
+        return;
+
+    // Parameters follow the '?', separated by '&'
+    size_t pos = uri.find('?');
+    while (pos != std::string::npos && pos < uri.size())
+    {
+        size_t end = uri.find('&', pos + 1);
+        std::string param = uri.substr(pos + 1, (end == std::string::npos) ? std::string::npos : end - pos - 1);
+        pos = end;
+
+        size_t separator = param.find('=');
+        if (separator == std::string::npos)
+            continue;
+
+        std::string key = param.substr(0, separator);
+        std::string value = decodeComponent(param.substr(separator + 1));
+
+        // Several exact topics may be given; the first BitTorrent info hash is used
+        if ((key == "xt" || key.compare(0, 3, "xt.") == 0) && !m_isValid && value.compare(0, strlen(BTIHPrefix), BTIHPrefix) == 0)
+            m_isValid = decodeInfoHash(value.substr(strlen(BTIHPrefix)));
+        else if (key == "dn")
+            m_displayName = value;
+        else if ((key == "tr" || key.compare(0, 3, "tr.") == 0) && !value.empty()
+                 && std::find(m_trackers.begin(), m_trackers.end(), value) == m_trackers.end())
+            m_trackers.push_back(value);
+    }
+}
+
+bool MagnetLink::isValid() const
+{
+    return m_isValid;
+}
+
+const uint8_t *MagnetLink::getInfoHash() const
+{
+    return m_infoHash.data();
+}
+
+const std::string &MagnetLink::getDisplayName() const
+{
+    return m_displayName;
+}
+
+std::vector< std::vector<std::string> > MagnetLink::getTrackerTiers() const
+{
+    // The link does not say how trackers are grouped, so each one is announced to
+    std::vector< std::vector<std::string> > tiers;
+    for (const std::string &tracker : m_trackers)
+        tiers.push_back(std::vector<std::string>{ tracker });
+    return tiers;
+}
+
+bool MagnetLink::isMagnetURI(const std::string &uri)
+{
+    static const char *scheme = "magnet:";
+    if (uri.size() < strlen(scheme))
+        return false;
+
+    for (size_t i = 0; i < strlen(scheme); ++i)
+    {
+        if (std::tolower(static_cast<unsigned char>(uri[i])) != scheme[i])
+            return false;
+    }
+    return true;
+}
+
+bool MagnetLink::decodeInfoHash(const std::string &encoded)
+{
+    if (encoded.size() == 40)
+    {
+        for (size_t i = 0; i < 20; ++i)
+        {
+            int high = hexValue(encoded[i * 2]);
+            int low = hexValue(encoded[i * 2 + 1]);
+            if (high < 0 || low < 0)
+                return false;
+            m_infoHash[i] = static_cast<uint8_t>((high << 4) | low);
+        }
+        return true;
+    }
+
+    if (encoded.size() == 32)
+    {
+        // Base32 (RFC 4648): each character carries 5 bits, 32 characters make up the 160-bit hash
+        uint64_t buffer = 0;
+        int numBits = 0;
+        size_t outPos = 0;
+        for (char c : encoded)
+        {
+            int value;
+            char upper = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+            if (upper >= 'A' && upper <= 'Z')
+                value = upper - 'A';
+            else if (upper >= '2' && upper <= '7')
+                value = upper - '2' + 26;
+            else
+                return false;
+
+            buffer = (buffer << 5) | static_cast<uint64_t>(value);
+            numBits += 5;
+            if (numBits >= 8)
+            {
+                numBits -= 8;
+                m_infoHash[outPos++] = static_cast<uint8_t>(buffer >> numBits);
+            }
+        }
+        return outPos == m_infoHash.size();
+    }
+
+    return false;
+}
+
+std::string MagnetLink::decodeComponent(const std::string &component)
+{
+    std::string decoded;
+    decoded.reserve(component.size());
+    for (size_t i = 0; i < component.size(); ++i)
+    {
+        if (component[i] == '%' && i + 2 < component.size() && hexValue(component[i + 1]) >= 0 && hexValue(component[i + 2]) >= 0)
+        {
+            decoded.push_back(static_cast<char>((hexValue(component[i + 1]) << 4) | hexValue(component[i + 2])));
+            i += 2;
+        }
+        else if (component[i] == '+')
+            decoded.push_back(' ');
+        else
+            decoded.push_back(component[i]);
+    }
+    return decoded;
+}
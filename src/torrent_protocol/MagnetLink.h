@@ -0,0 +1,79 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * @class MagnetLink
+ * @brief Parses a magnet URI (BEP 9) of the form "magnet:?xt=urn:btih:<info hash>&dn=<name>&tr=<tracker>",
+ *        where the info hash is given in hex (40 characters) or base32 (32 characters). A torrent can be
+ *        added from the info hash alone, its metadata being fetched from peers.
+ */
+class MagnetLink
+{
+public:
+    /// Parses the given magnet URI. Check \ref isValid before using the link
+    explicit MagnetLink(const std::string &uri);
+
+    /// Returns true if the URI is a magnet link with a BitTorrent info hash
+    bool isValid() const;
+
+    /// Returns the info hash of the torrent
+    const uint8_t *getInfoHash() const;
+
+    /// Returns the display name of the torrent, which may be empty
+    const std::string &getDisplayName() const;
+
+    /// Returns the tracker URLs of the torrent, each in its own tier
+    std::vector< std::vector<std::string> > getTrackerTiers() const;
+
+    /// Returns true if the string begins with the magnet URI scheme
+    static bool isMagnetURI(const std::string &uri);
+
+private:
+    /// Decodes the info hash in hex or base32 form, returning false if it is malformed
+    bool decodeInfoHash(const std::string &encoded);
+
+    /// Decodes the percent-encoding of a URI component, also turning '+' into a space
+    static std::string decodeComponent(const std::string &component);
+
+private:
+    /// True if the URI was parsed successfully
+    bool m_isValid;
+
+    /// Info hash of the torrent
+    std::array<uint8_t, 20> m_infoHash;
+
+    /// Display name of the torrent
+    std::string m_displayName;
+
+    /// Tracker URLs of the torrent
+    std::vector<std::string> m_trackers;
+};
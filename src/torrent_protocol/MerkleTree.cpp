@@ -0,0 +1,103 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "MerkleTree.h"
+#include "SHA256Hash.h"
+
+namespace merkle
+{
+    /// Hashes each pair of adjacent nodes of a layer, which must have an even number of nodes, into the layer above it
+    static void hashLayer(const std::vector<Hash> &layer, std::vector<Hash> &parents)
+    {
+        // The nodes of a layer are contiguous, so each pair is already a 64 byte message
+        std::vector<const uint8_t*> messages;
+        messages.reserve(layer.size() / 2);
+        for (std::size_t i = 0; i < layer.size(); i += 2)
+            messages.push_back(layer[i].data());
+
+        parents.resize(messages.size());
+        SHA256Hash::hashBatch(messages.data(), 2 * SHA256_DIGEST_LENGTH, messages.size(), parents[0].data());
+    }
+
+    /// Returns the parent of two copies of the given node
+    static Hash hashPair(const Hash &node)
+    {
+        Hash pair[2] = { node, node };
+        Hash parent;
+        SHA256Hash::hash(pair[0].data(), 2 * SHA256_DIGEST_LENGTH, parent.data());
+        return parent;
+    }
+
+    std::size_t roundUpToPowerOfTwo(std::size_t n)
+    {
+        std::size_t result = 1;
+        while (result < n)
+            result <<= 1;
+        return result;
+    }
+
+    Hash getPadHash(std::size_t numLeaves)
+    {
+        Hash pad {};
+        for (std::size_t width = 1; width < numLeaves; width <<= 1)
+            pad = hashPair(pad);
+        return pad;
+    }
+
+    void hashBlocks(const uint8_t *data, std::size_t length, std::vector<Hash> &leaves)
+    {
+        const std::size_t numFullBlocks = length / BlockSize;
+        const std::size_t first = leaves.size();
+        leaves.resize(first + numFullBlocks + ((length % BlockSize) ? 1 : 0));
+
+        std::vector<const uint8_t*> messages;
+        messages.reserve(numFullBlocks);
+        for (std::size_t i = 0; i < numFullBlocks; ++i)
+            messages.push_back(data + i * BlockSize);
+
+        if (numFullBlocks > 0)
+            SHA256Hash::hashBatch(messages.data(), BlockSize, numFullBlocks, leaves[first].data());
+
+        if (length % BlockSize)
+            SHA256Hash::hash(data + numFullBlocks * BlockSize, length % BlockSize, leaves.back().data());
+    }
+
+    Hash computeRoot(std::vector<Hash> layer, std::size_t width, const Hash &padHash)
+    {
+        Hash pad = padHash;
+        std::vector<Hash> parents;
+        for (; width > 1; width >>= 1)
+        {
+            if (layer.empty() || (layer.size() & 1))
+                layer.push_back(pad);
+
+            hashLayer(layer, parents);
+            layer.swap(parents);
+            pad = hashPair(pad);
+        }
+
+        return layer.empty() ? pad : layer[0];
+    }
+}
@@ -0,0 +1,57 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <openssl/sha.h>
+
+/// Merkle trees of SHA-256 hashes, which BitTorrent v2 (BEP 52) uses to verify the data of each file
+namespace merkle
+{
+    /// Size of the data covered by one leaf of a file's tree, in bytes
+    const uint32_t BlockSize = 16384;
+
+    /// A node of a merkle tree
+    typedef std::array<uint8_t, SHA256_DIGEST_LENGTH> Hash;
+
+    /// Returns the smallest power of two that is at least n
+    std::size_t roundUpToPowerOfTwo(std::size_t n);
+
+    /// Returns the root of a subtree with numLeaves leaves, a power of two, that lie beyond the end of a file.
+    /// Such leaves are all zeros, rather than the hash of any data
+    Hash getPadHash(std::size_t numLeaves);
+
+    /// Appends the leaf hash of each BlockSize block of the given data to leaves, where only the last block
+    /// may be shorter than BlockSize
+    void hashBlocks(const uint8_t *data, std::size_t length, std::vector<Hash> &leaves);
+
+    /// Returns the root of the tree whose base layer is the given hashes, padded with copies of padHash up to
+    /// width nodes, a power of two
+    Hash computeRoot(std::vector<Hash> layer, std::size_t width, const Hash &padHash);
+}
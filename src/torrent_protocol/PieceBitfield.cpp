@@ -0,0 +1,197 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <boost/endian/conversion.hpp>
+#include "PieceBitfield.h"
+
+PieceBitfield::PieceBitfield(uint32_t numPieces) :
+    m_numPieces(numPieces),
+    m_numWords((static_cast<std::size_t>(numPieces) + 63) / 64),
+    m_words(new std::atomic<uint64_t>[m_numWords]),
+    m_setOrder(new std::atomic<uint32_t>[numPieces]),
+    m_count(0),
+    m_sequence(0),
+    m_writeLock()
+{
+    for (std::size_t i = 0; i < m_numWords; ++i)
+        m_words[i].store(0, std::memory_order_relaxed);
+}
+
+uint32_t PieceBitfield::size() const
+{
+    return m_numPieces;
+}
+
+void PieceBitfield::resize(uint32_t numPieces)
+{
+    std::lock_guard<std::mutex> lock(m_writeLock);
+
+    if (m_count.load(std::memory_order_relaxed) != 0)
+        return;
+
+    m_numPieces = numPieces;
+    m_numWords = (static_cast<std::size_t>(numPieces) + 63) / 64;
+    m_words.reset(new std::atomic<uint64_t>[m_numWords]);
+    m_setOrder.reset(new std::atomic<uint32_t>[numPieces]);
+    for (std::size_t i = 0; i < m_numWords; ++i)
+        m_words[i].store(0, std::memory_order_relaxed);
+}
+
+uint32_t PieceBitfield::getNumBytes() const
+{
+    return (m_numPieces + 7) / 8;
+}
+
+bool PieceBitfield::test(uint32_t pieceIdx) const
+{
+    if (pieceIdx >= m_numPieces)
+        return false;
+
+    return (m_words[pieceIdx / 64].load(std::memory_order_acquire) & getMask(pieceIdx)) != 0;
+}
+
+bool PieceBitfield::set(uint32_t pieceIdx)
+{
+    if (pieceIdx >= m_numPieces)
+        return false;
+
+    std::lock_guard<std::mutex> lock(m_writeLock);
+
+    std::atomic<uint64_t> &word = m_words[pieceIdx / 64];
+    const uint64_t mask = getMask(pieceIdx);
+    if (word.load(std::memory_order_relaxed) & mask)
+        return false;
+
+    // Readers that overlap with the odd sequence number discard their copy and try again
+    const uint64_t sequence = m_sequence.load(std::memory_order_relaxed);
+    m_sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    word.fetch_or(mask, std::memory_order_relaxed);
+
+    // Publish the piece in the set order before the count that makes it visible
+    m_setOrder[m_count.load(std::memory_order_relaxed)].store(pieceIdx, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_release);
+
+    m_sequence.store(sequence + 2, std::memory_order_release);
+    return true;
+}
+
+uint32_t PieceBitfield::count() const
+{
+    return m_count.load(std::memory_order_acquire);
+}
+
+bool PieceBitfield::any() const
+{
+    return count() > 0;
+}
+
+bool PieceBitfield::all() const
+{
+    return count() == m_numPieces;
+}
+
+uint32_t PieceBitfield::getPieceSetAt(uint64_t version) const
+{
+    if (version >= count())
+        return m_numPieces;
+
+    return m_setOrder[version].load(std::memory_order_relaxed);
+}
+
+uint64_t PieceBitfield::copyTo(uint8_t *dest) const
+{
+    const std::size_t numBytes = getNumBytes();
+    for (;;)
+    {
+        const uint64_t sequence = m_sequence.load(std::memory_order_acquire);
+        if (sequence & 1)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+
+        // The padding bits after the final piece are never set, so each word can be copied as is
+        for (std::size_t i = 0, offset = 0; i < m_numWords; ++i, offset += sizeof(uint64_t))
+        {
+            const uint64_t word = m_words[i].load(std::memory_order_relaxed);
+            std::memcpy(dest + offset, &word, std::min(sizeof(uint64_t), numBytes - offset));
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (m_sequence.load(std::memory_order_relaxed) == sequence)
+            return sequence / 2;
+    }
+}
+
+bool PieceBitfield::decode(const uint8_t *data, std::size_t length, boost::dynamic_bitset<> &set)
+{
+    typedef boost::dynamic_bitset<>::block_type Block;
+
+    const std::size_t numBits = set.size();
+    if (length != (numBits + 7) / 8)
+        return false;
+
+    // The spare bits at the end of the final byte must be cleared
+    if ((numBits % 8) != 0 && (data[length - 1] & (0xFF >> (numBits % 8))) != 0)
+        return false;
+
+    std::vector<Block> blocks;
+    blocks.reserve(set.num_blocks());
+    for (std::size_t offset = 0; offset < length; offset += sizeof(uint64_t))
+    {
+        uint64_t word = 0;
+        std::memcpy(&word, data + offset, std::min(sizeof(uint64_t), length - offset));
+        boost::endian::little_to_native_inplace(word);
+
+        // Reverse the bits of each byte, moving piece 8k from the high bit of byte k to bit 8k of the word
+        word = ((word >> 1) & 0x5555555555555555ULL) | ((word & 0x5555555555555555ULL) << 1);
+        word = ((word >> 2) & 0x3333333333333333ULL) | ((word & 0x3333333333333333ULL) << 2);
+        word = ((word >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((word & 0x0F0F0F0F0F0F0F0FULL) << 4);
+
+        for (std::size_t shift = 0; shift < 64 && blocks.size() < set.num_blocks(); shift += boost::dynamic_bitset<>::bits_per_block)
+            blocks.push_back(static_cast<Block>(word >> shift));
+    }
+
+    boost::from_block_range(blocks.begin(), blocks.end(), set);
+    return true;
+}
+
+uint64_t PieceBitfield::getMask(uint32_t pieceIdx)
+{
+    // Bit position within the wire-format byte, where piece 0 is the high bit
+    const uint32_t byteIdx = (pieceIdx / 8) % 8;
+    const uint32_t bitIdx = 7 - (pieceIdx % 8);
+
+    // Place the byte at the same address it occupies in the bitfield message
+    if (boost::endian::order::native == boost::endian::order::little)
+        return uint64_t(1) << (byteIdx * 8 + bitIdx);
+    return uint64_t(1) << ((7 - byteIdx) * 8 + bitIdx);
+}
@@ -0,0 +1,117 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <boost/dynamic_bitset.hpp>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+/**
+ * @class PieceBitfield
+ * @brief Thread-safe set of the pieces the client has. Bits are stored in atomic words using the
+ *        peer wire protocol's byte order, so the set can be sent as a bitfield message without
+ *        conversion. Writers are serialized while readers never block, retrying whenever a copy
+ *        overlaps with a write, and the number of pieces set is maintained alongside the bits.
+ *        The order in which pieces were set is also recorded, so that peers can be told about
+ *        every piece completed since a given version.
+ */
+class PieceBitfield
+{
+public:
+    /// Constructs an empty bitfield holding the given number of pieces
+    explicit PieceBitfield(uint32_t numPieces);
+
+    /// Copying is not permitted
+    PieceBitfield(const PieceBitfield&) = delete;
+
+    /// Copying is not permitted
+    PieceBitfield &operator=(const PieceBitfield&) = delete;
+
+    /// Returns the number of pieces in the bitfield
+    uint32_t size() const;
+
+    /// Changes the number of pieces held by a bitfield with no piece set, as when the layout of a
+    /// torrent added from a magnet link becomes known. Only count() may be used concurrently
+    void resize(uint32_t numPieces);
+
+    /// Returns the length of the bitfield in bytes, as sent to peers
+    uint32_t getNumBytes() const;
+
+    /// Returns true if the piece at the given index is set, false if else or if the index is out of bounds
+    bool test(uint32_t pieceIdx) const;
+
+    /// Sets the piece at the given index, returning true if it had not already been set
+    bool set(uint32_t pieceIdx);
+
+    /// Returns the number of pieces that are set
+    uint32_t count() const;
+
+    /// Returns true if at least one piece is set
+    bool any() const;
+
+    /// Returns true if every piece is set
+    bool all() const;
+
+    /// Returns the index of the piece that was set when the bitfield moved from the given
+    /// version to the next one. The version must be less than count()
+    uint32_t getPieceSetAt(uint64_t version) const;
+
+    /// Copies the bitfield in wire format into the getNumBytes() bytes pointed to by dest,
+    /// returning the version of the copy, which is the number of pieces it has set
+    uint64_t copyTo(uint8_t *dest) const;
+
+    /// Decodes a bitfield received from a peer into set, which must already be sized to the number of
+    /// pieces in the torrent. Returns false if the length is wrong or any spare bit is set
+    static bool decode(const uint8_t *data, std::size_t length, boost::dynamic_bitset<> &set);
+
+private:
+    /// Returns the mask of the bit representing the given piece within its word
+    static uint64_t getMask(uint32_t pieceIdx);
+
+private:
+    /// Number of pieces in the bitfield
+    uint32_t m_numPieces;
+
+    /// Number of words holding the bitfield
+    std::size_t m_numWords;
+
+    /// Bits of the bitfield, laid out in memory in wire format
+    std::unique_ptr< std::atomic<uint64_t>[] > m_words;
+
+    /// Indices of the pieces in the order they were set
+    std::unique_ptr< std::atomic<uint32_t>[] > m_setOrder;
+
+    /// Number of pieces that are set
+    std::atomic<uint32_t> m_count;
+
+    /// Incremented before and after each write, odd while a write is in progress
+    std::atomic<uint64_t> m_sequence;
+
+    /// Serializes writers
+    std::mutex m_writeLock;
+};
@@ -0,0 +1,149 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <fstream>
+#include <iterator>
+#include "BenDictionary.h"
+#include "BenDocument.h"
+#include "BenInt.h"
+#include "BenString.h"
+#include "Encoder.h"
+#include "OutputSink.h"
+#include "PieceHashCache.h"
+#include "LogHelper.h"
+
+using namespace bencoding;
+
+/// Version of the on-disk cache format
+const static int64_t CacheFormatVersion = 1;
+
+PieceHashCache::PieceHashCache() :
+    m_path(),
+    m_entries()
+{
+}
+
+bool PieceHashCache::load(const std::string &path)
+{
+    m_path = path;
+    m_entries.clear();
+
+    std::ifstream file(path, std::ifstream::in | std::ifstream::binary);
+    if (!file.is_open())
+        return true;
+
+    std::string encodedData((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    BenDocument document;
+    BenNode root;
+    if (document.parse(std::move(encodedData)))
+        root = document.getRoot();
+
+    if (!root.isDictionary() || root.find("version").getInt() != CacheFormatVersion
+            || !root.find("files").isDictionary())
+    {
+        LOG_WARNING("torrent_protocol.PieceHashCache", "Ignoring invalid hash cache ", path);
+        return false;
+    }
+
+    BenNode files = root.find("files");
+    for (std::size_t i = 0; i < files.size(); ++i)
+    {
+        BenNode value = files.getValue(i);
+        BenNode digests = value.find("pieces");
+        if (!value.isDictionary() || !digests.isString())
+            continue;
+
+        Entry entry;
+        entry.Length = static_cast<uint64_t>(value.find("length").getInt(-1));
+        entry.ModifiedTime = value.find("mtime").getInt();
+        entry.PieceLength = value.find("piece length").getInt();
+        entry.Alignment = value.find("alignment").getInt();
+        entry.Digests = std::string(digests.getString());
+        m_entries[std::string(files.getKey(i))] = std::move(entry);
+    }
+
+    return true;
+}
+
+bool PieceHashCache::save() const
+{
+    if (m_path.empty())
+        return false;
+
+    std::shared_ptr<BenDictionary> files = std::make_shared<BenDictionary>();
+    for (const auto &it : m_entries)
+    {
+        const Entry &entry = it.second;
+        std::shared_ptr<BenDictionary> value = std::make_shared<BenDictionary>();
+        (*value)["alignment"] = std::make_shared<BenInt>(entry.Alignment);
+        (*value)["length"] = std::make_shared<BenInt>(static_cast<int64_t>(entry.Length));
+        (*value)["mtime"] = std::make_shared<BenInt>(entry.ModifiedTime);
+        (*value)["piece length"] = std::make_shared<BenInt>(entry.PieceLength);
+        (*value)["pieces"] = std::make_shared<BenString>(entry.Digests);
+        (*files)[it.first] = value;
+    }
+
+    BenDictionary root;
+    root["files"] = files;
+    root["version"] = std::make_shared<BenInt>(CacheFormatVersion);
+
+    FileSink sink(m_path);
+    if (!sink.good())
+    {
+        LOG_ERROR("torrent_protocol.PieceHashCache", "Unable to write hash cache ", m_path);
+        return false;
+    }
+
+    Encoder enc(sink);
+    root.accept(enc);
+    return sink.flush();
+}
+
+const std::string *PieceHashCache::find(const std::string &path, uint64_t length, int64_t modifiedTime,
+                                        int64_t pieceLength, int64_t alignment) const
+{
+    auto it = m_entries.find(path);
+    if (it == m_entries.end())
+        return nullptr;
+
+    const Entry &entry = it->second;
+    if (entry.Length != length || entry.ModifiedTime != modifiedTime
+            || entry.PieceLength != pieceLength || entry.Alignment != alignment)
+        return nullptr;
+
+    return &entry.Digests;
+}
+
+void PieceHashCache::store(const std::string &path, uint64_t length, int64_t modifiedTime,
+                           int64_t pieceLength, int64_t alignment, std::string digests)
+{
+    Entry &entry = m_entries[path];
+    entry.Length = length;
+    entry.ModifiedTime = modifiedTime;
+    entry.PieceLength = pieceLength;
+    entry.Alignment = alignment;
+    entry.Digests = std::move(digests);
+}
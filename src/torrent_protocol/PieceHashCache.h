@@ -0,0 +1,94 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+/**
+ * @class PieceHashCache
+ * @brief On-disk store of the piece digests computed for each file of a generated torrent,
+ *        allowing later generations to skip any file whose path, size, modification time
+ *        and piece alignment are unchanged.
+ */
+class PieceHashCache
+{
+public:
+    /// Default constructor
+    PieceHashCache();
+
+    /// Loads the cache stored at the given path. A missing file results in an empty cache,
+    /// returns false if the file exists but is not a valid cache
+    bool load(const std::string &path);
+
+    /// Writes the cache to the path it was loaded from, returning true on success
+    bool save() const;
+
+    /**
+     * Finds the digests of the whole pieces contained in a file
+     * @param path Absolute path of the file
+     * @param length Size of the file in bytes
+     * @param modifiedTime Last modification time of the file
+     * @param pieceLength Piece length of the torrent
+     * @param alignment Offset of the file within the torrent, modulo the piece length
+     * @return Pointer to the concatenated digests, or a null pointer if no entry matches
+     */
+    const std::string *find(const std::string &path, uint64_t length, int64_t modifiedTime,
+                            int64_t pieceLength, int64_t alignment) const;
+
+    /// Stores the concatenated digests of the whole pieces contained in a file,
+    /// replacing any previous entry for the same path
+    void store(const std::string &path, uint64_t length, int64_t modifiedTime,
+               int64_t pieceLength, int64_t alignment, std::string digests);
+
+private:
+    /// Cached digests of a single file, along with the properties they were computed for
+    struct Entry
+    {
+        /// Size of the file in bytes
+        uint64_t Length;
+
+        /// Last modification time of the file
+        int64_t ModifiedTime;
+
+        /// Piece length the digests were computed with
+        int64_t PieceLength;
+
+        /// Offset of the file within its torrent, modulo the piece length
+        int64_t Alignment;
+
+        /// Concatenated digests of the whole pieces inside the file
+        std::string Digests;
+    };
+
+private:
+    /// Location of the cache on disk
+    std::string m_path;
+
+    /// Cache entries, keyed by absolute file path
+    std::map<std::string, Entry> m_entries;
+};
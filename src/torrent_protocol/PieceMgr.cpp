@@ -23,7 +23,6 @@ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
-#include <cmath>
 #include <cstdlib>
 
 #include <algorithm>
@@ -32,52 +31,62 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "PieceMgr.h"
 
-#include "BenDictionary.h"
-#include "BenInt.h"
-#include "BenList.h"
-#include "BenString.h"
 #include "SHA1Hash.h"
+#include "SHA256Hash.h"
 #include "TorrentFile.h"
 #include "TorrentMgr.h"
 #include "LogHelper.h"
 
-const static uint32_t DefaultFragmentLength = 16384;
+/// Maximum number of pieces hashed together when verifying a file
+const static size_t VerifyBatchSize = 8;
 
-using namespace bencoding;
+/// Upper bound on the memory used to hold pieces being verified
+const static uint64_t MaxVerifyBufferBytes = 64 * 1024 * 1024;
+
+/// Number of recently uploaded pieces remembered for suggestions to peers
+const static size_t RecentUploadsSize = 4;
+
+/// Time after which the block hashes of a piece that failed verification are requested from another peer
+const static std::chrono::seconds BlockHashRequestTimeout(10);
+
+/// Time after which a piece that failed verification is downloaded again in its entirety, if its block
+/// hashes have not arrived
+const static std::chrono::seconds BlockHashWaitLimit(30);
+
+/// Largest number of hashes served in response to a single hash request (BEP 52)
+const static uint32_t MaxHashRequestLength = 512;
+
+/// Time after a piece failed verification during which each of its fragments is only handed to peers other than
+/// those that sent it, so that the corrupt data can be told apart. Afterwards, any peer may download it
+const static std::chrono::seconds RefetchFromOtherPeersLimit(20);
 
 PieceMgr::PieceMgr(std::shared_ptr<TorrentFile> torrentFile) :
-    m_pieceLength(torrentFile->getPieceLength()),
-    m_finalPieceLen(0),
-    m_fragmentsPerPiece(0),
-    m_fragmentsInFinalPiece(0),
-    m_fileSize(torrentFile->getFileSize()),
+    m_geometry(torrentFile->getGeometry()),
     m_bytesUploaded(0),
     m_torrentFile(torrentFile),
-    m_digestString(torrentFile->getDigestString()),
     m_currentPiece(0),
     m_pieceInfo(torrentFile->getNumPieces()),
     m_piecesAvailable(torrentFile->getNumPieces()),
+    m_noPieceAvailable(false),
     m_pieceBeingDownloaded(),
-    m_numPeersDownloading(0),
-    m_numPeersFinishedFragment(0),
+    m_fragmentStates(),
+    m_fragmentSenders(),
+    m_fragmentHistory(),
+    m_fragmentDiscarded(),
+    m_nextFragment(0),
+    m_blockHashes(),
+    m_awaitingBlockHashes(false),
+    m_hashFailureTime(),
+    m_blockHashRequestTime(),
+    m_integrityStats(),
+    m_bannedPeers(),
+    m_recentUploads(),
     m_singleFileHandle(),
     m_diskFiles()
 {
-    m_fragmentsPerPiece = std::ceil(double(m_pieceLength) / DefaultFragmentLength);
-
-    /// Calculate information about the final piece (size, number of fragments)
-    int64_t finalPieceLen = (int64_t)m_torrentFile->getNumPieces() * (int64_t)m_torrentFile->getPieceLength();
-    if (m_fileSize < finalPieceLen)
-        m_finalPieceLen = finalPieceLen - m_fileSize;
-    else if (m_fileSize > finalPieceLen)
-        m_finalPieceLen = m_fileSize - finalPieceLen;
-    else
-        m_finalPieceLen = m_pieceLength;
-
-    if (DefaultFragmentLength > finalPieceLen)
-        m_fragmentsInFinalPiece = 1;
-    else
-        m_fragmentsInFinalPiece = (uint32_t)ceil(double(m_finalPieceLen) / DefaultFragmentLength);
+    // Torrents added from a magnet link open their files once the metadata arrives
+    if (!m_torrentFile->hasMetadata())
+        return;
 
     /// Initialize file handle(s) for either single- or multi-file mode
     if (m_torrentFile->isSingleFileMode())
@@ -97,7 +106,7 @@ bool PieceMgr::havePiece(uint32_t pieceIdx) const
     // Make sure index is valid
     if (pieceIdx >= m_pieceInfo.size())
         return false;
-    return m_pieceInfo[pieceIdx];
+    return m_pieceInfo.test(pieceIdx);
 }
 
 const uint32_t &PieceMgr::getCurrentPieceNum()
@@ -109,7 +118,10 @@ const uint32_t &PieceMgr::getCurrentPieceNum()
         m_currentPiece = m_pieceInfo.size();
         return m_currentPiece;
     }
-    else if (m_pieceInfo[m_currentPiece]
+    else if (m_noPieceAvailable)
+        return m_currentPiece;
+    else if (m_currentPiece >= m_pieceInfo.size()
+            || m_pieceInfo.test(m_currentPiece)
             || !m_piecesAvailable[m_currentPiece]
             || m_pieceBeingDownloaded.empty())
         determineNextPiece();
@@ -117,12 +129,12 @@ const uint32_t &PieceMgr::getCurrentPieceNum()
     return m_currentPiece;
 }
 
-uint64_t PieceMgr::getNumPiecesHave()
+uint64_t PieceMgr::getNumPiecesHave() const
 {
     return m_pieceInfo.count();
 }
 
-const boost::dynamic_bitset<> &PieceMgr::getBitsetHave() const
+const PieceBitfield &PieceMgr::getBitsetHave() const
 {
     return m_pieceInfo;
 }
@@ -132,76 +144,171 @@ const uint64_t &PieceMgr::getNumBytesUploaded() const
     return m_bytesUploaded;
 }
 
+IntegrityStats PieceMgr::getIntegrityStats()
+{
+    std::lock_guard<std::mutex> lock(m_pieceLock);
+    return m_integrityStats;
+}
+
+bool PieceMgr::isPeerBanned(const boost::asio::ip::address &address)
+{
+    std::lock_guard<std::mutex> lock(m_pieceLock);
+    return m_bannedPeers.find(address) != m_bannedPeers.end();
+}
+
 bool PieceMgr::verifyFile()
 {
-    BenDictionary *infoDict = m_torrentFile->getInfoDictionary();
-    if (!infoDict)
+    // Torrents with only v2 metadata are verified against the subtree of each piece
+    if (m_torrentFile->getPieceHash(0) == nullptr && m_torrentFile->hasV2Hashes())
     {
-        LOG_ERROR("torrent_protocol.PieceMgr", "Could not fetch info dictionary to verify file contents!");
-        return false;
+        std::vector<uint8_t> pieceBuf(m_geometry.PieceLength);
+        for (uint32_t pieceNum = 0; pieceNum < m_pieceInfo.size(); ++pieceNum)
+        {
+            const uint64_t pieceLen = m_geometry.getPieceLength(pieceNum);
+            if (!readPiece(pieceNum, &pieceBuf[0], pieceLen) || !verifyPieceV2(pieceNum, &pieceBuf[0], pieceLen))
+            {
+                LOG_ERROR("torrent_protocol.PieceMgr", "Digest of piece ", pieceNum, " invalid!");
+                return false;
+            }
+        }
+        return true;
     }
 
     // Only verifying single-file mode downloads for now
 
-    // Attempt to fetch the torrent file's digest for the current piece
-    const std::string &digestStr = m_digestString->getValue();
-    if (digestStr.size() < SHA_DIGEST_LENGTH * m_torrentFile->getNumPieces())
+    // Make sure the torrent file has a digest for every piece
+    if (m_torrentFile->getPieceHash(m_pieceInfo.size() - 1) == nullptr)
     {
         LOG_ERROR("torrent_protocol.PieceMgr", "Digest string from torrent file is too small!");
         return false;
     }
 
-    uint8_t *pieceBuf = new uint8_t[m_pieceLength];
-    std::string digestStrTmp;
-    SHA1Hash hash;
-    for (uint32_t pieceNum = 0; pieceNum < m_pieceInfo.size(); ++pieceNum)
+    // Read and hash several pieces at a time so that the multi-buffer SHA-1 kernel can be
+    // used, while keeping the size of the read buffer bounded
+    const uint32_t numPieces = (uint32_t) m_pieceInfo.size();
+    const size_t batchSize = (size_t) std::max<uint64_t>(1, std::min<uint64_t>(VerifyBatchSize, MaxVerifyBufferBytes / m_geometry.PieceLength));
+
+    std::vector<uint8_t> pieceBuf(batchSize * m_geometry.PieceLength);
+    std::vector<const uint8_t*> pieces(batchSize);
+    std::vector<uint8_t> digests(batchSize * SHA_DIGEST_LENGTH);
+
+    uint32_t pieceNum = 0;
+    while (pieceNum < numPieces)
     {
-        digestStrTmp = digestStr.substr(pieceNum * SHA_DIGEST_LENGTH, SHA_DIGEST_LENGTH);
-        size_t pieceLen = (pieceNum == m_pieceInfo.size() - 1) ? m_finalPieceLen : m_pieceLength;
-        memset(pieceBuf, 0, m_pieceLength);
-        m_singleFileHandle.seekg(pieceNum * pieceLen);
-        m_singleFileHandle.read((char*)&pieceBuf[0], pieceLen);
+        // Every piece in a batch must have the same length, so the final piece is hashed on its own
+        uint32_t count = (uint32_t) std::min<size_t>(batchSize, numPieces - pieceNum);
+        if (count > 1 && pieceNum + count == numPieces && m_geometry.FinalPieceLength != m_geometry.PieceLength)
+            --count;
 
-        hash.update(pieceBuf, pieceLen);
-        hash.finalize();
+        const size_t pieceLen = m_geometry.getPieceLength(pieceNum + count - 1);
+        memset(&pieceBuf[0], 0, count * pieceLen);
+        m_singleFileHandle.seekg(pieceNum * m_geometry.PieceLength);
+        m_singleFileHandle.read((char*)&pieceBuf[0], count * pieceLen);
+        m_singleFileHandle.clear();
+
+        for (uint32_t i = 0; i < count; ++i)
+            pieces[i] = &pieceBuf[i * pieceLen];
 
-        // If hashes match, store the piece onto the disk, set m_pieceInfo[m_currentPiece] to 1
-        if (memcmp(hash.getDigest(), digestStrTmp.c_str(), SHA_DIGEST_LENGTH) != 0)
+        SHA1Hash::hashBatch(pieces.data(), pieceLen, count, digests.data());
+
+        for (uint32_t i = 0; i < count; ++i, ++pieceNum)
         {
-            LOG_ERROR("torrent_protocol.PieceMgr", "Digest of piece ", pieceNum, " invalid! digestPtr = ", digestStrTmp);
-            delete[] pieceBuf;
-            return false;
+            if (!m_torrentFile->checkPieceHash(pieceNum, &digests[i * SHA_DIGEST_LENGTH]))
+            {
+                LOG_ERROR("torrent_protocol.PieceMgr", "Digest of piece ", pieceNum, " invalid!");
+                return false;
+            }
         }
-        hash.initialize();
     }
 
-    delete[] pieceBuf;
     return true;
 }
 
+void PieceMgr::onMetadataReceived()
+{
+    std::lock_guard<std::mutex> lock(m_pieceLock);
+
+    const uint32_t numPieces = (uint32_t) m_torrentFile->getNumPieces();
+    m_pieceInfo.resize(numPieces);
+    m_piecesAvailable.clear();
+    m_piecesAvailable.resize(numPieces);
+    m_noPieceAvailable = false;
+    m_pieceBeingDownloaded.clear();
+    m_fragmentStates.clear();
+    m_fragmentSenders.clear();
+    m_blockHashes.clear();
+    m_awaitingBlockHashes = false;
+    m_currentPiece = 0;
+
+    if (m_torrentFile->isSingleFileMode())
+        initializeSingleFileHandle();
+    else
+        initializeMultiFileHandles();
+}
+
 void PieceMgr::markPieceAvailable(const uint32_t &pieceIdx)
 {
     // Make sure index is valid
+    std::lock_guard<std::mutex> lock(m_pieceLock);
     if (pieceIdx >= m_piecesAvailable.size())
         return;
 
     m_piecesAvailable[pieceIdx] = true;
+    m_noPieceAvailable = false;
 }
 
 void PieceMgr::readPeerBitset(const boost::dynamic_bitset<> &set)
 {
+    std::lock_guard<std::mutex> lock(m_pieceLock);
     m_piecesAvailable |= set;
+    m_noPieceAvailable = false;
 }
 
-std::shared_ptr<TorrentFragment> PieceMgr::getFragmentToDownload()
+std::shared_ptr<TorrentFragment> PieceMgr::getFragmentToDownload(const boost::asio::ip::address &requester)
 {
     std::lock_guard<std::mutex> lock(m_pieceLock);
 
     std::shared_ptr<TorrentFragment> fragPtr(nullptr);
+    if (m_pieceBeingDownloaded.empty() || m_bannedPeers.find(requester) != m_bannedPeers.end())
+        return fragPtr;
 
-    uint32_t activeFragCount = (m_numPeersDownloading + m_numPeersFinishedFragment) % m_pieceBeingDownloaded.size();
-    fragPtr = m_pieceBeingDownloaded.at(activeFragCount);
-    ++m_numPeersDownloading;
+    // A piece that failed verification waits for its block hashes, unless they are taking too long to arrive
+    if (m_awaitingBlockHashes)
+    {
+        if (std::chrono::steady_clock::now() - m_hashFailureTime < BlockHashWaitLimit)
+            return fragPtr;
+
+        LOG_WARNING("torrent_protocol.PieceMgr", "Block hashes of piece ", m_currentPiece, " did not arrive, downloading the whole piece again");
+        discardCurrentPiece();
+    }
+
+    // After a failure, fragments are kept from the peers that sent them for a while, so that the culprit can be found
+    const bool avoidPreviousSenders = std::chrono::steady_clock::now() - m_hashFailureTime < RefetchFromOtherPeersLimit;
+    auto canRequest = [&](uint32_t fragIdx, FragmentState state)
+    {
+        return m_fragmentStates[fragIdx] == state && !(avoidPreviousSenders && hasSentFragment(fragIdx, requester));
+    };
+
+    // Hand out missing fragments first, then those already requested from other peers
+    const uint32_t numFragments = (uint32_t) m_pieceBeingDownloaded.size();
+    uint32_t fragIdx = 0;
+    while (fragIdx < numFragments && !canRequest(fragIdx, FragmentState::Missing))
+        ++fragIdx;
+    for (uint32_t i = 0; fragIdx == numFragments && i < numFragments; ++i)
+    {
+        if (canRequest((m_nextFragment + i) % numFragments, FragmentState::Requested))
+            fragIdx = (m_nextFragment + i) % numFragments;
+    }
+
+    if (fragIdx == numFragments)
+        return fragPtr;
+
+    m_fragmentStates[fragIdx] = FragmentState::Requested;
+    m_nextFragment = (fragIdx + 1) % numFragments;
+
+    // Each peer downloads into a fragment of its own, so that the data sent by others is not overwritten
+    const TorrentFragment &fragment = *m_pieceBeingDownloaded[fragIdx];
+    fragPtr = std::make_shared<TorrentFragment>(fragment.PieceIdx, fragment.Offset, fragment.Length);
 
     return fragPtr;
 }
@@ -211,76 +318,262 @@ std::shared_ptr<TorrentFragment> PieceMgr::getFragmentToUpload(uint32_t pieceIdx
     std::shared_ptr<TorrentFragment> fragPtr(nullptr);
 
     // Bounds checks
-    if (pieceIdx + 1 > m_pieceInfo.size() || !m_pieceInfo[pieceIdx])
+    if (!m_pieceInfo.test(pieceIdx))
         return fragPtr;
-    if (offset + length > m_pieceLength)
+    if (offset + length > m_geometry.getPieceLength(pieceIdx))
         return fragPtr;
 
-    // Load fragment from disk
-    BenDictionary *infoDict = m_torrentFile->getInfoDictionary();
-    if (!infoDict)
-    {
-        LOG_ERROR("torrent_protocol.PieceMgr", "Unable to retrieve pointer to Info Dictionary, will not be reading data from disk.");
-        return fragPtr;
-    }
-
     // Determine if single or multi file mode
-    auto it = infoDict->find("files");
-    if (it != infoDict->end())
+    if (!m_torrentFile->isSingleFileMode())
     {
         //TODO: Multi-file mode
     }
     else
     {
         // Single-File mode
-        it = infoDict->find("name");
-        if (it != infoDict->end())
+        if (m_singleFileHandle.is_open())
         {
             // Get file length to ensure valid request
             m_singleFileHandle.seekg(0, m_singleFileHandle.end);
             uint64_t fileLen = m_singleFileHandle.tellg();
             m_singleFileHandle.seekg(0, m_singleFileHandle.beg);
 
-            if (fileLen < (m_pieceLength * pieceIdx) + offset + length)
+            if (fileLen < (m_geometry.PieceLength * pieceIdx) + offset + length)
                 return fragPtr;
 
             // Seek to position, read data into fragment structure, done
             fragPtr = std::make_shared<TorrentFragment>(pieceIdx, offset, length);
-            m_singleFileHandle.seekg(m_pieceLength * pieceIdx + offset);
+            m_singleFileHandle.seekg(m_geometry.PieceLength * pieceIdx + offset);
             m_singleFileHandle.read((char*)&(fragPtr->Data[0]), length);
 
             // Increment bytes uploaded counter
             m_bytesUploaded += length;
+
+            // Remember the piece as recently read
+            std::lock_guard<std::mutex> lock(m_pieceLock);
+            auto it = std::find(m_recentUploads.begin(), m_recentUploads.end(), pieceIdx);
+            if (it != m_recentUploads.end())
+                m_recentUploads.erase(it);
+            else if (m_recentUploads.size() == RecentUploadsSize)
+                m_recentUploads.pop_back();
+            m_recentUploads.push_front(pieceIdx);
         }
     }
     return fragPtr;
 }
 
-void PieceMgr::onFragmentDownloaded(uint32_t pieceIdx)
+void PieceMgr::onFragmentDownloaded(const TorrentFragment &fragment, const boost::asio::ip::address &sender)
 {
     std::lock_guard<std::mutex> lock(m_pieceLock);
 
-    //LOG_DEBUG("torrent_protocol.network", "onFragmentDownloaded() has been called");
+    // Data from banned peers is dropped, even if it was in flight when the peer was banned
+    if (m_bannedPeers.find(sender) != m_bannedPeers.end())
+        return;
 
-    // Sanity check
-    if (m_numPeersDownloading == 0 || pieceIdx != m_currentPiece)
+    // Sanity check, ignoring fragments that another peer has already delivered
+    const uint32_t fragIdx = fragment.Offset / TorrentGeometry::BlockLength;
+    if (fragment.PieceIdx != m_currentPiece || fragIdx >= m_fragmentStates.size() || m_fragmentStates[fragIdx] == FragmentState::Received)
+    {
+        m_integrityStats.RedundantBytes += fragment.Length;
         return;
+    }
+
+    memcpy(m_pieceBeingDownloaded[fragIdx]->Data, fragment.Data, fragment.Length);
+    m_fragmentStates[fragIdx] = FragmentState::Received;
+    m_fragmentSenders[fragIdx] = sender;
+    if (m_fragmentDiscarded[fragIdx])
+    {
+        m_integrityStats.RetransmittedBytes += fragment.Length;
+        m_fragmentDiscarded[fragIdx] = false;
+    }
 
-    // Decrement the count of peers still downloading fragments, increment the completed frag. download counter
-    --m_numPeersDownloading;
-    ++m_numPeersFinishedFragment;
+    // Once the block hashes are known, a corrupt fragment is caught as soon as it arrives
+    if (!m_blockHashes.empty() && !findCorruptFragments(std::vector<uint32_t>{ fragIdx }).empty())
+    {
+        LOG_WARNING("torrent_protocol.PieceMgr", "Fragment at offset ", fragment.Offset, " of piece ", fragment.PieceIdx, " sent by ", sender.to_string(), " is corrupt");
+        discardFragment(fragIdx);
+        banPeer(sender);
+        return;
+    }
 
     // Now check if all fragments have been downloaded
-    if (m_numPeersFinishedFragment == m_pieceBeingDownloaded.size())
+    if (std::all_of(m_fragmentStates.begin(), m_fragmentStates.end(), [](FragmentState state) { return state == FragmentState::Received; }))
         onAllFragmentsDownloaded();
 }
 
+void PieceMgr::onFragmentRejected(uint32_t pieceIdx, uint32_t offset)
+{
+    std::lock_guard<std::mutex> lock(m_pieceLock);
+
+    // The fragment becomes the first to be handed out again
+    const uint32_t fragIdx = offset / TorrentGeometry::BlockLength;
+    if (pieceIdx != m_currentPiece || fragIdx >= m_fragmentStates.size() || m_fragmentStates[fragIdx] != FragmentState::Requested)
+        return;
+
+    m_fragmentStates[fragIdx] = FragmentState::Missing;
+}
+
+bool PieceMgr::getBlockHashRequest(HashRequest &request)
+{
+    std::lock_guard<std::mutex> lock(m_pieceLock);
+
+    const auto now = std::chrono::steady_clock::now();
+    if (!m_awaitingBlockHashes || now - m_blockHashRequestTime < BlockHashRequestTimeout)
+        return false;
+
+    std::size_t fileIdx;
+    uint64_t dataLength;
+    uint32_t firstLeaf, width;
+    if (!getPieceSubtree(m_currentPiece, fileIdx, dataLength, firstLeaf, width))
+        return false;
+
+    memcpy(request.PiecesRoot.data(), m_torrentFile->getPiecesRoot(fileIdx), SHA256_DIGEST_LENGTH);
+    request.BaseLayer = 0;
+    request.Index = firstLeaf;
+    request.Length = width;
+
+    m_blockHashRequestTime = now;
+    return true;
+}
+
+std::vector<boost::asio::ip::address> PieceMgr::onBlockHashes(const HashRequest &request, const uint8_t *hashes)
+{
+    std::lock_guard<std::mutex> lock(m_pieceLock);
+
+    std::vector<boost::asio::ip::address> corruptSenders;
+
+    // Only the block hashes of the current piece are of use
+    std::size_t fileIdx;
+    uint64_t dataLength;
+    uint32_t firstLeaf, width;
+    if (m_pieceBeingDownloaded.empty() || !m_blockHashes.empty()
+            || !getPieceSubtree(m_currentPiece, fileIdx, dataLength, firstLeaf, width)
+            || request.BaseLayer != 0 || request.Index != firstLeaf || request.Length != width
+            || memcmp(request.PiecesRoot.data(), m_torrentFile->getPiecesRoot(fileIdx), SHA256_DIGEST_LENGTH) != 0)
+        return corruptSenders;
+
+    // The hashes must make up the piece's subtree
+    std::vector<merkle::Hash> leaves(width);
+    memcpy(leaves.data(), hashes, width * SHA256_DIGEST_LENGTH);
+    merkle::Hash root = merkle::computeRoot(leaves, width, merkle::Hash{});
+    if (memcmp(root.data(), m_torrentFile->getPieceLayerHash(m_currentPiece), SHA256_DIGEST_LENGTH) != 0)
+    {
+        LOG_WARNING("torrent_protocol.PieceMgr", "Block hashes received for piece ", m_currentPiece, " do not match the piece layer");
+        return corruptSenders;
+    }
+
+    // Fragments past the end of the file are padding, and have no hash of their own
+    leaves.resize(m_pieceBeingDownloaded.size());
+    m_blockHashes = std::move(leaves);
+
+    if (!m_awaitingBlockHashes)
+        return corruptSenders;
+    m_awaitingBlockHashes = false;
+
+    std::vector<uint32_t> received;
+    for (uint32_t i = 0; i < m_fragmentStates.size(); ++i)
+    {
+        if (m_fragmentStates[i] == FragmentState::Received)
+            received.push_back(i);
+    }
+
+    for (uint32_t fragIdx : findCorruptFragments(received))
+    {
+        LOG_WARNING("torrent_protocol.PieceMgr", "Fragment at offset ", fragIdx * TorrentGeometry::BlockLength, " of piece ", m_currentPiece,
+                    " sent by ", m_fragmentSenders[fragIdx].to_string(), " is corrupt");
+        discardFragment(fragIdx);
+        banPeer(m_fragmentSenders[fragIdx]);
+        corruptSenders.push_back(m_fragmentSenders[fragIdx]);
+    }
+
+    // The piece failed as a whole, so if no single fragment is at fault, none of them can be trusted
+    if (corruptSenders.empty())
+        discardCurrentPiece();
+
+    return corruptSenders;
+}
+
+void PieceMgr::onBlockHashesRejected(const HashRequest &request)
+{
+    std::lock_guard<std::mutex> lock(m_pieceLock);
+
+    std::size_t fileIdx;
+    uint64_t dataLength;
+    uint32_t firstLeaf, width;
+    if (!m_awaitingBlockHashes || !getPieceSubtree(m_currentPiece, fileIdx, dataLength, firstLeaf, width)
+            || request.BaseLayer != 0 || request.Index != firstLeaf)
+        return;
+
+    // Ask the next peer that has the piece straight away
+    m_blockHashRequestTime = std::chrono::steady_clock::time_point();
+}
+
+bool PieceMgr::getHashes(const HashRequest &request, std::vector<merkle::Hash> &hashes)
+{
+    const std::size_t fileIdx = m_torrentFile->findFileByPiecesRoot(request.PiecesRoot.data());
+    if (fileIdx >= m_geometry.Files.size() || request.Length < 2 || request.Length > MaxHashRequestLength
+            || (request.Length & (request.Length - 1)) != 0 || request.Index % request.Length != 0)
+        return false;
+
+    const TorrentFileEntry &file = m_geometry.Files[fileIdx];
+    const uint32_t blocksPerPiece = (uint32_t) (m_geometry.PieceLength / merkle::BlockSize);
+    const uint64_t firstPiece = file.Offset / m_geometry.PieceLength;
+
+    hashes.assign(request.Length, merkle::Hash{});
+
+    if (request.BaseLayer == 0)
+    {
+        // Block hashes are only served for a single piece, hashed from the data on the disk
+        const uint64_t numLeaves = (file.Length + merkle::BlockSize - 1) / merkle::BlockSize;
+        const uint32_t pieceIdx = (uint32_t) (firstPiece + request.Index / blocksPerPiece);
+        if (request.Length > blocksPerPiece || request.Index >= numLeaves || !m_pieceInfo.test(pieceIdx))
+            return false;
+
+        std::size_t pieceFile;
+        uint64_t dataLength;
+        uint32_t firstLeaf, width;
+        const uint64_t pieceLength = m_geometry.getPieceLength(pieceIdx);
+        std::vector<uint8_t> pieceData(pieceLength);
+        if (!getPieceSubtree(pieceIdx, pieceFile, dataLength, firstLeaf, width) || !readPiece(pieceIdx, &pieceData[0], pieceLength))
+            return false;
+
+        std::vector<merkle::Hash> leaves;
+        merkle::hashBlocks(&pieceData[0], dataLength, leaves);
+        for (uint32_t i = 0; i < request.Length && request.Index - firstLeaf + i < leaves.size(); ++i)
+            hashes[i] = leaves[request.Index - firstLeaf + i];
+        return true;
+    }
+
+    // Otherwise only the piece layer of a file spanning several pieces is known
+    const uint64_t numPieces = (file.Length + m_geometry.PieceLength - 1) / m_geometry.PieceLength;
+    if (file.Length <= m_geometry.PieceLength || request.BaseLayer >= 32 || (1u << request.BaseLayer) != blocksPerPiece
+            || request.Index >= numPieces)
+        return false;
+
+    const merkle::Hash padHash = merkle::getPadHash(blocksPerPiece);
+    for (uint32_t i = 0; i < request.Length; ++i)
+    {
+        const uint64_t index = request.Index + i;
+        if (index < numPieces)
+            memcpy(hashes[i].data(), m_torrentFile->getPieceLayerHash((uint32_t) (firstPiece + index)), SHA256_DIGEST_LENGTH);
+        else
+            hashes[i] = padHash;
+    }
+    return true;
+}
+
+std::vector<uint32_t> PieceMgr::getRecentlyUploadedPieces()
+{
+    std::lock_guard<std::mutex> lock(m_pieceLock);
+    return std::vector<uint32_t>(m_recentUploads.begin(), m_recentUploads.end());
+}
+
 uint32_t PieceMgr::getNumFragments(uint32_t pieceIdx)
 {
     if (pieceIdx >= m_pieceInfo.size())
         return 0;
 
-    return (pieceIdx + 1 == m_pieceInfo.size()) ? m_fragmentsInFinalPiece : m_fragmentsPerPiece;
+    return m_geometry.getNumBlocks(pieceIdx);
 }
 
 void PieceMgr::determineNextPiece()
@@ -289,9 +582,20 @@ void PieceMgr::determineNextPiece()
     uint32_t maybePiece;
     auto numPieces = m_pieceInfo.size();
 
-    boost::dynamic_bitset<> piecesToChoose = (m_piecesAvailable & (~m_pieceInfo));
-    if (!piecesToChoose.any())
-        m_currentPiece = numPieces + 1;
+    boost::dynamic_bitset<> piecesToChoose = m_piecesAvailable;
+    for (size_t i = piecesToChoose.find_first(); i < numPieces; i = piecesToChoose.find_next(i))
+    {
+        if (m_pieceInfo.test(i))
+            piecesToChoose.reset(i);
+    }
+    // Until a connected peer has a piece the client lacks, there is no piece to download
+    m_noPieceAvailable = !piecesToChoose.any();
+    if (m_noPieceAvailable)
+    {
+        m_currentPiece = numPieces;
+        m_pieceBeingDownloaded.clear();
+        return;
+    }
 
     while (true)
     {
@@ -300,16 +604,14 @@ void PieceMgr::determineNextPiece()
         {
             m_currentPiece = maybePiece;
 
-            // Reset fragment vector and set peer download counts back to 0
+            // Reset fragment vector
             m_pieceBeingDownloaded.clear();
-            m_numPeersDownloading = 0;
-            m_numPeersFinishedFragment = 0;
 
             // Populate fragment vector for the new piece
-            const uint32_t pieceLength = (m_currentPiece + 1 == m_pieceInfo.size()) ? m_finalPieceLen : m_pieceLength;
+            const uint32_t pieceLength = (uint32_t) m_geometry.getPieceLength(m_currentPiece);
             uint32_t numFragsForPiece = getNumFragments(m_currentPiece);
 
-            uint32_t currentFragmentLength = std::min(DefaultFragmentLength, pieceLength);
+            uint32_t currentFragmentLength = std::min(TorrentGeometry::BlockLength, pieceLength);
             uint32_t currentFragmentOffset = 0;
             for (uint32_t i = 0; i < numFragsForPiece; ++i)
             {
@@ -317,11 +619,30 @@ void PieceMgr::determineNextPiece()
                 m_pieceBeingDownloaded.push_back(fragment);
 
                 currentFragmentOffset += currentFragmentLength;
-                currentFragmentLength = std::min(DefaultFragmentLength, pieceLength - currentFragmentOffset);
+                currentFragmentLength = std::min(TorrentGeometry::BlockLength, pieceLength - currentFragmentOffset);
                 if (currentFragmentLength == 0)
-                    return;
+                    break;
             }
 
+            m_fragmentStates.assign(m_pieceBeingDownloaded.size(), FragmentState::Missing);
+            m_fragmentSenders.assign(m_pieceBeingDownloaded.size(), boost::asio::ip::address());
+            m_fragmentHistory.assign(m_pieceBeingDownloaded.size(), std::vector<FragmentRecord>());
+            m_fragmentDiscarded.assign(m_pieceBeingDownloaded.size(), false);
+            m_nextFragment = 0;
+            m_hashFailureTime = std::chrono::steady_clock::time_point();
+            m_awaitingBlockHashes = false;
+            m_blockHashRequestTime = std::chrono::steady_clock::time_point();
+            m_blockHashes.clear();
+
+            // A subtree of one leaf is its own block hash, so the piece's fragments can be checked as they arrive
+            std::size_t fileIdx;
+            uint64_t dataLength;
+            uint32_t firstLeaf, width;
+            if (getPieceSubtree(m_currentPiece, fileIdx, dataLength, firstLeaf, width) && width == 1)
+            {
+                m_blockHashes.resize(m_pieceBeingDownloaded.size());
+                memcpy(m_blockHashes[0].data(), m_torrentFile->getPieceLayerHash(m_currentPiece), SHA256_DIGEST_LENGTH);
+            }
             return;
         }
     }
@@ -331,7 +652,7 @@ void PieceMgr::determineNextPiece()
 void PieceMgr::onAllFragmentsDownloaded()
 {
     // Determine piece length (either standard or length of the final piece)
-    size_t pieceLength = (m_currentPiece + 1 == m_pieceInfo.size()) ? m_finalPieceLen : m_pieceLength;
+    size_t pieceLength = m_geometry.getPieceLength(m_currentPiece);
 
     // Combine data from each fragment into one array, get the digest, compare to expected value
     uint8_t *pieceData = new uint8_t[pieceLength];
@@ -339,55 +660,262 @@ void PieceMgr::onAllFragmentsDownloaded()
     for (auto fragment : m_pieceBeingDownloaded)
         memcpy(&pieceData[fragment->Offset], fragment->Data, fragment->Length);
 
-    // Calculate digest value
-    SHA1Hash hash;
-    hash.update(pieceData, pieceLength);
-    hash.finalize();
-
-    // Attempt to fetch the torrent file's digest for the current piece
-    const std::string &digestStr = m_digestString->getValue();
-    if (digestStr.size() < SHA_DIGEST_LENGTH * m_pieceInfo.size())
+    // Pieces of v2 and hybrid torrents are checked against their merkle subtree, others against their SHA-1 digest
+    bool isValid;
+    if (m_torrentFile->hasV2Hashes())
+        isValid = verifyPieceV2(m_currentPiece, pieceData, pieceLength);
+    else
     {
-        LOG_ERROR("torrent_protocol.PieceMgr", "Digest string from torrent file is too small!");
-        delete[] pieceData;
-        return;
+        SHA1Hash hash;
+        hash.update(pieceData, pieceLength);
+        hash.finalize();
+        isValid = m_torrentFile->checkPieceHash(m_currentPiece, hash.getDigest());
     }
 
-    /*uint8_t *digestPtr = (uint8_t*)digestStr.c_str();
-    digestPtr += (SHA_DIGEST_LENGTH * m_currentPiece);*/
-    std::string digestStrTmp = digestStr.substr(m_currentPiece * SHA_DIGEST_LENGTH, SHA_DIGEST_LENGTH);
-
     // If hashes match, store the piece onto the disk, set m_pieceInfo[m_currentPiece] to 1
-    if (memcmp(hash.getDigest(), digestStrTmp.c_str(), SHA_DIGEST_LENGTH) == 0)
+    if (isValid)
     {
+        banCorruptSenders();
         writePieceToDisk(pieceData, pieceLength);
         LOG_INFO("torrent_protocol.PieceMgr", "Verified piece ", m_currentPiece, ", writing to disk. Have downloaded ", m_pieceInfo.count(), " of ", m_pieceInfo.size(), " pieces.");
     }
+    else if (m_torrentFile->hasV2Hashes() && m_blockHashes.empty())
+    {
+        // Keep the fragments until the block hashes show which of them are corrupt
+        LOG_WARNING("torrent_protocol.PieceMgr", "Piece ", m_currentPiece, " failed verification, requesting its block hashes");
+        ++m_integrityStats.HashFailures;
+        m_awaitingBlockHashes = true;
+        m_hashFailureTime = std::chrono::steady_clock::now();
+        m_blockHashRequestTime = std::chrono::steady_clock::time_point();
+    }
     else
     {
-        // Attempt to re-download the fragment
-        m_numPeersFinishedFragment = 0;
+        // Attempt to re-download the piece, from other peers where possible
+        LOG_WARNING("torrent_protocol.PieceMgr", "Piece ", m_currentPiece, " failed verification, downloading it again");
+        ++m_integrityStats.HashFailures;
+        discardCurrentPiece();
     }
 
     // Free memory that was allocated ot pieceData
     delete[] pieceData;
 }
 
-void PieceMgr::writePieceToDisk(uint8_t *data, size_t pieceLength)
+bool PieceMgr::getPieceSubtree(uint32_t pieceIdx, std::size_t &fileIdx, uint64_t &dataLength, uint32_t &firstLeaf, uint32_t &width) const
+{
+    if (!m_torrentFile->hasV2Hashes() || pieceIdx >= m_geometry.NumPieces)
+        return false;
+
+    // Each file of a v2 torrent begins at a piece boundary, so the piece lies in exactly one file
+    const uint64_t pieceOffset = uint64_t(pieceIdx) * m_geometry.PieceLength;
+    fileIdx = m_geometry.findFile(pieceOffset);
+    if (fileIdx >= m_geometry.Files.size() || m_geometry.Files[fileIdx].Offset > pieceOffset)
+        return false;
+
+    const TorrentFileEntry &file = m_geometry.Files[fileIdx];
+    dataLength = std::min<uint64_t>(m_geometry.getPieceLength(pieceIdx), file.Offset + file.Length - pieceOffset);
+    firstLeaf = (uint32_t) ((pieceOffset - file.Offset) / merkle::BlockSize);
+
+    // The tree of a file no larger than a piece is only as wide as the file's own blocks need
+    if (file.Length <= m_geometry.PieceLength)
+        width = (uint32_t) merkle::roundUpToPowerOfTwo((file.Length + merkle::BlockSize - 1) / merkle::BlockSize);
+    else
+        width = (uint32_t) (m_geometry.PieceLength / merkle::BlockSize);
+    return true;
+}
+
+bool PieceMgr::verifyPieceV2(uint32_t pieceIdx, const uint8_t *data, uint64_t pieceLength) const
+{
+    std::size_t fileIdx;
+    uint64_t dataLength;
+    uint32_t firstLeaf, width;
+    const uint8_t *expected = m_torrentFile->getPieceLayerHash(pieceIdx);
+    if (expected == nullptr || !getPieceSubtree(pieceIdx, fileIdx, dataLength, firstLeaf, width))
+        return false;
+
+    // Data past the end of the file is padding, which must be zeros
+    if (!std::all_of(data + dataLength, data + pieceLength, [](uint8_t b) { return b == 0; }))
+        return false;
+
+    std::vector<merkle::Hash> leaves;
+    merkle::hashBlocks(data, dataLength, leaves);
+    merkle::Hash root = merkle::computeRoot(std::move(leaves), width, merkle::Hash{});
+    return memcmp(root.data(), expected, SHA256_DIGEST_LENGTH) == 0;
+}
+
+std::vector<uint32_t> PieceMgr::findCorruptFragments(const std::vector<uint32_t> &fragments) const
+{
+    std::vector<uint32_t> corrupt;
+
+    std::size_t fileIdx;
+    uint64_t dataLength;
+    uint32_t firstLeaf, width;
+    if (!getPieceSubtree(m_currentPiece, fileIdx, dataLength, firstLeaf, width))
+        return corrupt;
+
+    // Full blocks are hashed together on the multi-buffer backend, the block at the end of the file on its own
+    std::vector<uint32_t> fullBlocks;
+    std::vector<const uint8_t*> messages;
+    for (uint32_t fragIdx : fragments)
+    {
+        const TorrentFragment &fragment = *m_pieceBeingDownloaded[fragIdx];
+        const uint64_t fileBytes = (fragment.Offset < dataLength) ? std::min<uint64_t>(fragment.Length, dataLength - fragment.Offset) : 0;
+
+        if (!std::all_of(fragment.Data + fileBytes, fragment.Data + fragment.Length, [](uint8_t b) { return b == 0; }))
+            corrupt.push_back(fragIdx);
+        else if (fileBytes == merkle::BlockSize)
+        {
+            fullBlocks.push_back(fragIdx);
+            messages.push_back(fragment.Data);
+        }
+        else if (fileBytes > 0)
+        {
+            merkle::Hash leaf;
+            SHA256Hash::hash(fragment.Data, fileBytes, leaf.data());
+            if (leaf != m_blockHashes[fragIdx])
+                corrupt.push_back(fragIdx);
+        }
+    }
+
+    std::vector<merkle::Hash> leaves(messages.size());
+    if (!messages.empty())
+        SHA256Hash::hashBatch(messages.data(), merkle::BlockSize, messages.size(), leaves[0].data());
+
+    for (size_t i = 0; i < leaves.size(); ++i)
+    {
+        if (leaves[i] != m_blockHashes[fullBlocks[i]])
+            corrupt.push_back(fullBlocks[i]);
+    }
+    return corrupt;
+}
+
+void PieceMgr::resetCurrentPiece()
+{
+    std::fill(m_fragmentStates.begin(), m_fragmentStates.end(), FragmentState::Missing);
+    m_awaitingBlockHashes = false;
+    m_blockHashRequestTime = std::chrono::steady_clock::time_point();
+}
+
+void PieceMgr::discardFragment(uint32_t fragIdx)
+{
+    m_fragmentStates[fragIdx] = FragmentState::Missing;
+    m_fragmentDiscarded[fragIdx] = true;
+    m_integrityStats.CorruptBytes += m_pieceBeingDownloaded[fragIdx]->Length;
+}
+
+void PieceMgr::discardCurrentPiece()
+{
+    // Remember what each peer sent, so that it can be compared with the data of the piece once verified
+    std::set<boost::asio::ip::address> senders;
+    for (uint32_t fragIdx = 0; fragIdx < m_pieceBeingDownloaded.size(); ++fragIdx)
+    {
+        if (m_fragmentStates[fragIdx] != FragmentState::Received)
+            continue;
+
+        const TorrentFragment &fragment = *m_pieceBeingDownloaded[fragIdx];
+        FragmentRecord record;
+        record.Sender = m_fragmentSenders[fragIdx];
+        SHA1Hash hash;
+        hash.update(fragment.Data, fragment.Length);
+        hash.finalize();
+        memcpy(record.Digest.data(), hash.getDigest(), SHA_DIGEST_LENGTH);
+
+        std::vector<FragmentRecord> &history = m_fragmentHistory[fragIdx];
+        if (std::none_of(history.begin(), history.end(),
+                [&record](const FragmentRecord &other) { return other.Sender == record.Sender && other.Digest == record.Digest; }))
+            history.push_back(record);
+
+        senders.insert(record.Sender);
+        discardFragment(fragIdx);
+    }
+
+    // A piece sent by a single peer leaves no doubt as to who corrupted it
+    if (senders.size() == 1)
+        banPeer(*senders.begin());
+
+    resetCurrentPiece();
+    m_hashFailureTime = std::chrono::steady_clock::now();
+}
+
+void PieceMgr::banCorruptSenders()
 {
-    // Get info dictionary to determine file name
-    BenDictionary *infoDict = m_torrentFile->getInfoDictionary();
-    if (!infoDict)
+    for (uint32_t fragIdx = 0; fragIdx < m_fragmentHistory.size(); ++fragIdx)
     {
-        LOG_ERROR("torrent_protocol.PieceMgr", "Unable to retrieve pointer to Info Dictionary, will not be writing data to disk.");
+        std::vector<FragmentRecord> &history = m_fragmentHistory[fragIdx];
+        if (history.empty())
+            continue;
+
+        const TorrentFragment &fragment = *m_pieceBeingDownloaded[fragIdx];
+        SHA1Hash hash;
+        hash.update(fragment.Data, fragment.Length);
+        hash.finalize();
+
+        for (const FragmentRecord &record : history)
+        {
+            if (memcmp(record.Digest.data(), hash.getDigest(), SHA_DIGEST_LENGTH) == 0)
+                continue;
+
+            LOG_WARNING("torrent_protocol.PieceMgr", "Fragment at offset ", fragment.Offset, " of piece ", m_currentPiece,
+                        " sent by ", record.Sender.to_string(), " was corrupt");
+            banPeer(record.Sender);
+        }
+        history.clear();
+    }
+}
+
+bool PieceMgr::hasSentFragment(uint32_t fragIdx, const boost::asio::ip::address &sender) const
+{
+    const std::vector<FragmentRecord> &history = m_fragmentHistory[fragIdx];
+    return std::any_of(history.begin(), history.end(), [&sender](const FragmentRecord &record) { return record.Sender == sender; });
+}
+
+void PieceMgr::banPeer(const boost::asio::ip::address &address)
+{
+    if (!m_bannedPeers.insert(address).second)
         return;
+
+    LOG_WARNING("torrent_protocol.PieceMgr", "Banning peer ", address.to_string(), " for sending corrupt data");
+    ++m_integrityStats.BannedPeers;
+}
+
+bool PieceMgr::readPiece(uint32_t pieceIdx, uint8_t *data, uint64_t pieceLength)
+{
+    memset(data, 0, pieceLength);
+
+    const uint64_t pieceOffset = uint64_t(pieceIdx) * m_geometry.PieceLength;
+    if (m_torrentFile->isSingleFileMode())
+    {
+        if (!m_singleFileHandle.is_open())
+            return false;
+
+        m_singleFileHandle.seekg(pieceOffset);
+        m_singleFileHandle.read((char*)data, pieceLength);
+        m_singleFileHandle.clear();
+        return true;
+    }
+
+    // Parts of the piece that lie in no file, such as the gaps between the files of v2 torrents, are left as zeros
+    const uint64_t endPos = pieceOffset + pieceLength;
+    for (auto &file : m_diskFiles)
+    {
+        if (file->Length == 0 || file->Offset >= endPos || file->Offset + file->Length <= pieceOffset)
+            continue;
+
+        const uint64_t start = std::max(pieceOffset, file->Offset);
+        const uint64_t end = std::min(endPos, file->Offset + file->Length);
+        file->Handle.seekg(start - file->Offset);
+        file->Handle.read((char*)&data[start - pieceOffset], end - start);
+        file->Handle.clear();
     }
+    return true;
+}
 
+void PieceMgr::writePieceToDisk(uint8_t *data, size_t pieceLength)
+{
     // Determine if single or multi file mode
-    if (m_diskFiles.size() > 1)
+    if (!m_torrentFile->isSingleFileMode())
     {
         // Multi-File mode
-        uint64_t pieceOffset = m_currentPiece * m_pieceLength;
+        uint64_t pieceOffset = m_currentPiece * m_geometry.PieceLength;
         uint64_t endPos = pieceOffset + (uint64_t)pieceLength;
         for (size_t i = 0; i < m_diskFiles.size(); ++i)
         {
@@ -416,7 +944,7 @@ void PieceMgr::writePieceToDisk(uint8_t *data, size_t pieceLength)
     {
         // Single-File mode
         // Seek to appropriate position in file
-        m_singleFileHandle.seekp(m_currentPiece * m_pieceLength);
+        m_singleFileHandle.seekp(m_currentPiece * m_geometry.PieceLength);
 
         // Write data
         m_singleFileHandle.write((char*)&data[0], pieceLength);
@@ -424,29 +952,20 @@ void PieceMgr::writePieceToDisk(uint8_t *data, size_t pieceLength)
     }
 
     // If able to write to disk, mark it as downloaded
-    m_pieceInfo[m_currentPiece] = true;
+    m_pieceInfo.set(m_currentPiece);
 }
 
 void PieceMgr::initializeSingleFileHandle()
 {
-    // Get info dictionary to determine file name
-    BenDictionary *infoDict = m_torrentFile->getInfoDictionary();
-    if (!infoDict)
-    {
-        LOG_ERROR("torrent_protocol.PieceMgr", "Unable to retrieve pointer to Info Dictionary, will not be reading or writing data to disk.");
-        return;
-    }
-
     // Single-File mode
-    auto it = infoDict->find("name");
-    if (it == infoDict->end())
+    if (m_geometry.Name.empty())
     {
         LOG_ERROR("torrent_protocol.PieceMgr", "Unable to find \"name\" key in Info Dictionary. Will not be able to write to disk.");
         return;
     }
 
     // Get path to file: Should be {Download Directory} / {File Name}
-    std::string pathStr = eTorrentMgr.getDownloadDirectory() + bencast<BenString*>(it->second)->getValue();
+    std::string pathStr = eTorrentMgr.getDownloadDirectory() + m_geometry.Name;
     boost::filesystem::path filePath(pathStr);
 
     // Open file
@@ -459,12 +978,12 @@ void PieceMgr::initializeSingleFileHandle()
         m_singleFileHandle.close();
 
         boost::system::error_code ec;
-        if (boost::filesystem::file_size(filePath, ec) < m_fileSize)
+        if (boost::filesystem::file_size(filePath, ec) < m_geometry.TotalSize)
         {
             if (ec)
                 LOG_ERROR("torrent_protocol.PieceMgr", "Error reported from calling boost::filesystem::file_size on ", pathStr, " , Error message: ", ec.message());
 
-            boost::filesystem::resize_file(filePath, m_fileSize, ec);
+            boost::filesystem::resize_file(filePath, m_geometry.TotalSize, ec);
 
             if (ec)
                 LOG_ERROR("torrent_protocol.PieceMgr", "Error reported from calling boost::filesystem::resize_file on ", pathStr, " , Error message: ", ec.message());
@@ -477,27 +996,14 @@ void PieceMgr::initializeSingleFileHandle()
 
 void PieceMgr::initializeMultiFileHandles()
 {
-    // Get info dictionary and file list 
-    BenDictionary *infoDict = m_torrentFile->getInfoDictionary();
-    if (!infoDict)
-    {
-        LOG_ERROR("torrent_protocol.PieceMgr", "Unable to retrieve pointer to Info Dictionary, will not be reading or writing data to disk.");
-        return;
-    }
-    auto it = infoDict->find("files");
-    if (it == infoDict->end())
+    if (m_geometry.Files.empty())
     {
         LOG_ERROR("torrent_protocol.PieceMgr", "Unable to get file information from info dictionary. No file I/O will be performed.");
         return;
     }
 
-    BenList *fileList = bencast<BenList*>(it->second);
-
     // Get the path which files will be placed into
-    std::string basePathStr = eTorrentMgr.getDownloadDirectory();
-    it = infoDict->find("name");
-    if (it != infoDict->end())
-        basePathStr.append(bencast<BenString*>(it->second)->getValue());
+    std::string basePathStr = eTorrentMgr.getDownloadDirectory() + m_geometry.Name;
     boost::filesystem::path basePath(basePathStr);
 
     // Create base directory if not already extant
@@ -506,42 +1012,23 @@ void PieceMgr::initializeMultiFileHandles()
         boost::filesystem::create_directory(basePath, ec);
 
     // Iterate through list of files, opening and/or creating them before appending to vector of FileInfo structures 
-    uint64_t offset = 0;
-    for (auto fileIt = fileList->begin(); fileIt != fileList->end(); ++fileIt)
+    for (const TorrentFileEntry &entry : m_geometry.Files)
     {
         std::unique_ptr<FileInfo> currentFile(new FileInfo);
 
-        BenDictionary *fileDict = bencast<BenDictionary*>(*fileIt);
-        auto lengthIt = fileDict->find("length");
-        if (lengthIt == fileDict->end())
-        {
-            LOG_ERROR("torrent_protocol.PieceMgr", "Unable to get length of file from info dictionary. Skipping file...");
-            continue;
-        }
+        // Set length and offset of current file
+        currentFile->Length = entry.Length;
+        currentFile->Offset = entry.Offset;
 
-        // Set length and offset of current file, then set the offset of the next file
-        currentFile->Length = bencast<BenInt*>(lengthIt->second)->getValue();
-        currentFile->Offset = offset;
-        offset += currentFile->Length;
-
-        // Get path to file
-        auto pathItr = fileDict->find("path");
-        if (pathItr == fileDict->end())
-        {
-            LOG_ERROR("torrent_protocol.PieceMgr", "Unable to find path of file in info dictionary. Skipping...");
-            continue;
-        }
-        
         // Iterate through path list, creating any subdirectories along the way that do not exist
-        BenList *pathList = bencast<BenList*>(pathItr->second);
-        auto pathListLen = pathList->size();
+        auto pathListLen = entry.Path.size();
 
         boost::filesystem::path filePath = basePath;
         size_t currentPathLen = 1;
 
-        for (auto pathItr2 = pathList->begin(); pathItr2 != pathList->end(); ++pathItr2)
+        for (const std::string &pathElement : entry.Path)
         {
-            boost::filesystem::path subPath(bencast<BenString*>(*pathItr2)->getValue());
+            boost::filesystem::path subPath(pathElement);
             filePath /= subPath;
 
             // determine if parent directory needs to be created (every element in list except last refers to a directory)
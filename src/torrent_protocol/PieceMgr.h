@@ -25,16 +25,26 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #pragma once
 
+#include <boost/asio/ip/address.hpp>
 #include <boost/dynamic_bitset.hpp>
+#include <array>
+#include <chrono>
+#include <deque>
 #include <fstream>
 #include <memory>
+#include <set>
 #include <vector>
 
+#include <openssl/sha.h>
+
+#include "IntegrityStats.h"
+#include "MerkleTree.h"
+#include "PieceBitfield.h"
 #include "TorrentFragment.h"
 
 class TorrentFile;
+struct TorrentGeometry;
 class TorrentState;
-namespace bencoding { class BenString; }
 
 /// Stores information about a file on the disk such as its length and offset (in bytes);
 /// also contains a handle to the file
@@ -50,6 +60,23 @@ struct FileInfo
     std::fstream Handle;
 };
 
+/// Identifies a range of nodes in one layer of a file's merkle tree, as exchanged through the hash
+/// request, hashes and hash reject messages of BitTorrent v2 (BEP 52)
+struct HashRequest
+{
+    /// Root of the merkle tree of the file
+    merkle::Hash PiecesRoot;
+
+    /// Layer of the tree the nodes belong to, counted from the leaves (layer 0)
+    uint32_t BaseLayer;
+
+    /// Index of the first node within its layer
+    uint32_t Index;
+
+    /// Number of nodes, a power of two
+    uint32_t Length;
+};
+
 /**
  * @class PieceMgr
  * @brief Responsible for storing information on the state of each piece in
@@ -79,14 +106,20 @@ public:
     const uint32_t &getCurrentPieceNum();
 
     /// Returns the total number of pieces that have been downloaded & verified
-    uint64_t getNumPiecesHave();
+    uint64_t getNumPiecesHave() const;
 
-    /// Returns a bitset of the pieces that the client has
-    const boost::dynamic_bitset<> &getBitsetHave() const;
+    /// Returns the set of pieces that the client has, which may be read from any thread
+    const PieceBitfield &getBitsetHave() const;
 
     /// Returns the number of bytes uploaded to other peers
     const uint64_t &getNumBytesUploaded() const;
 
+    /// Returns the statistics of the data that failed verification and of the peers banned for sending it
+    IntegrityStats getIntegrityStats();
+
+    /// Returns true if the peer with the given address has been banned for sending corrupt data
+    bool isPeerBanned(const boost::asio::ip::address &address);
+
     /// Verifies the contents of the torrent file, returning true on successful verification
     bool verifyFile();
 
@@ -94,6 +127,10 @@ public:
     //      so application can resume downloading after program exits
 
 protected:
+    /// Called once the info dictionary of a torrent added from a magnet link has been received,
+    /// sizing the piece sets to the torrent's layout and opening its files
+    void onMetadataReceived();
+
     /// Sets the flag for the piece at the given index as being available for downloading from a peer
     void markPieceAvailable(const uint32_t &pieceIdx);
 
@@ -101,22 +138,110 @@ protected:
     /// pieces to the union of the currently available pieces and the peer's pieces
     void readPeerBitset(const boost::dynamic_bitset<> &set);
 
-    /// Returns a pointer to a torrent fragment structure that needs to be downloaded.
-    /// If the fragments associated with the current piece have already been assigned,
-    /// returns a null pointer.
-    std::shared_ptr<TorrentFragment> getFragmentToDownload();
+    /// Returns a pointer to a torrent fragment structure that needs to be downloaded by the peer with the given
+    /// address, into which the peer writes the data it receives. If the fragments associated with the current
+    /// piece have already been assigned, or the peer is banned, returns a null pointer.
+    std::shared_ptr<TorrentFragment> getFragmentToDownload(const boost::asio::ip::address &requester);
 
     /// If the client has the given fragment, it will return a shared pointer to a structure containing its data.
     /// Otherwise, returns a null pointer
     std::shared_ptr<TorrentFragment> getFragmentToUpload(uint32_t pieceIdx, uint32_t offset, uint32_t length);
 
-    /// Called by a peer once a fragment has been downloaded in its entirety
-    void onFragmentDownloaded(uint32_t pieceIdx);
+    /// Called by a peer once a fragment has been downloaded in its entirety, with the address of the peer that sent it.
+    /// Once the hashes of the piece's blocks are known (v2), a corrupt fragment is caught here and downloaded again
+    void onFragmentDownloaded(const TorrentFragment &fragment, const boost::asio::ip::address &sender);
+
+    /// Called by a peer when its request for a fragment of the given piece was rejected,
+    /// allowing the fragment to be assigned to another peer
+    void onFragmentRejected(uint32_t pieceIdx, uint32_t offset);
+
+    /// Returns true, filling in the request, if the hashes of the blocks of the current piece should be requested
+    /// from a peer that has the piece. This is the case after the piece failed verification (v2), so that only the
+    /// corrupt blocks need to be downloaded again
+    bool getBlockHashRequest(HashRequest &request);
+
+    /// Called with the hashes sent by a peer in response to a hash request. Returns the addresses of the peers that
+    /// sent the blocks of the current piece which the hashes show to be corrupt, who are banned
+    std::vector<boost::asio::ip::address> onBlockHashes(const HashRequest &request, const uint8_t *hashes);
+
+    /// Called when a peer rejects a hash request, allowing the block hashes to be requested from another peer
+    void onBlockHashesRejected(const HashRequest &request);
+
+    /// Fills hashes with the nodes of a merkle tree described by a hash request from a peer. Returns false
+    /// if the request can not be served: only whole piece layers, and the block hashes of pieces the client has,
+    /// are known
+    bool getHashes(const HashRequest &request, std::vector<merkle::Hash> &hashes);
+
+    /// Returns the pieces most recently read from disk for uploading, newest first. Their
+    /// data is likely still cached, which makes them cheap to serve again
+    std::vector<uint32_t> getRecentlyUploadedPieces();
+
+private:
+    /// Download state of each fragment of the current piece
+    enum class FragmentState : uint8_t
+    {
+        /// Not yet handed out to a peer
+        Missing,
+
+        /// Requested from at least one peer
+        Requested,
+
+        /// Received from a peer
+        Received
+    };
+
+    /// The data of a fragment that was part of a piece which failed verification, and the peer that sent it
+    struct FragmentRecord
+    {
+        /// Address of the peer that sent the fragment
+        boost::asio::ip::address Sender;
+
+        /// SHA-1 digest of the fragment's data
+        std::array<uint8_t, SHA_DIGEST_LENGTH> Digest;
+    };
 
 private:
     /// Returns the number of fragments that make up the piece with the given index
     uint32_t getNumFragments(uint32_t pieceIdx);
 
+    /// Locates the piece with the given index in the merkle tree of its file (v2), giving the index of the file,
+    /// the number of bytes of the piece that belong to the file, the index of the piece's first leaf in the
+    /// file's tree, and the number of leaves in the piece's subtree. Returns false if the piece lies in no file
+    bool getPieceSubtree(uint32_t pieceIdx, std::size_t &fileIdx, uint64_t &dataLength, uint32_t &firstLeaf, uint32_t &width) const;
+
+    /// Returns true if the given piece data matches the root of the piece's subtree, and the data past the end
+    /// of the piece's file is all zeros (v2)
+    bool verifyPieceV2(uint32_t pieceIdx, const uint8_t *data, uint64_t pieceLength) const;
+
+    /// Returns the indices of the given fragments of the current piece whose data does not match the expected
+    /// block hashes, or which hold anything but zeros past the end of the piece's file
+    std::vector<uint32_t> findCorruptFragments(const std::vector<uint32_t> &fragments) const;
+
+    /// Marks every fragment of the current piece as missing, so that the whole piece is downloaded again
+    void resetCurrentPiece();
+
+    /// Marks the given fragment of the current piece as missing, counting its data as corrupt
+    void discardFragment(uint32_t fragIdx);
+
+    /// Discards every fragment of the current piece after it failed verification without the corrupt fragments
+    /// being known. The data of each fragment is remembered along with its sender, and the fragments are downloaded
+    /// again from other peers, so that the senders of corrupt fragments can be found once the piece is verified
+    void discardCurrentPiece();
+
+    /// Called once the current piece has been verified, banning the peers whose data for any of its fragments
+    /// differed from the verified data when the piece failed verification before
+    void banCorruptSenders();
+
+    /// Returns true if the peer with the given address sent the given fragment of the current piece when the
+    /// piece failed verification
+    bool hasSentFragment(uint32_t fragIdx, const boost::asio::ip::address &sender) const;
+
+    /// Bans the peer with the given address for sending corrupt data, so that it no longer takes part in the download
+    void banPeer(const boost::asio::ip::address &address);
+
+    /// Reads the piece with the given index from the disk into data. Returns false if it could not be read
+    bool readPiece(uint32_t pieceIdx, uint8_t *data, uint64_t pieceLength);
+
     /// Called after a piece has been downloaded in its entirety, calculating the next piece to be downloaded
     void determineNextPiece();
 
@@ -133,20 +258,8 @@ private:
     void initializeMultiFileHandles();
 
 private:
-    /// Number of bytes per typical piece
-    uint32_t m_pieceLength;
-
-    /// Number of bytes in the final piece of the torrent
-    int64_t m_finalPieceLen;
-
-    /// Number of fragments per typical piece
-    uint32_t m_fragmentsPerPiece;
-
-    /// Number of fragments in the final piece of the torrent
-    uint32_t m_fragmentsInFinalPiece;
-
-    /// Size of the torrent file
-    uint64_t m_fileSize;
+    /// Layout of the torrent's pieces and files, owned by the torrent file
+    const TorrentGeometry &m_geometry;
 
     /// Number of bytes uploaded to remote peers (info sent to tracker)
     uint64_t m_bytesUploaded;
@@ -154,31 +267,63 @@ private:
     /// Shared pointer to the torrent file
     std::shared_ptr<TorrentFile> m_torrentFile;
 
-    /// Bencoded string of SHA-1 hash values of each piece in the torrent file
-    std::shared_ptr<bencoding::BenString> m_digestString;
-
     /// Index of the current piece being downloaded
     uint32_t m_currentPiece;
 
-    /// Bitset representing pieces of the torrent that have or haven't yet been
+    /// Set of pieces of the torrent that have or haven't yet been
     /// downloaded. 1 = Downloaded, 0 = Not Downloaded
-    boost::dynamic_bitset<> m_pieceInfo;
+    PieceBitfield m_pieceInfo;
 
     /// Bitset which is the union of peer's bitsets representing the pieces they have
     boost::dynamic_bitset<> m_piecesAvailable;
 
+    /// True if no peer had a piece the client lacks when the next piece was last chosen. The choice is not
+    /// made again until a peer announces more pieces
+    bool m_noPieceAvailable;
+
     /// Stores the blocks/fragments of the piece currently being downloaded
     std::vector< std::shared_ptr<TorrentFragment> >m_pieceBeingDownloaded;
 
-    /// Number of peers downloading the fragments in m_pieceBeingDownloaded
-    uint32_t m_numPeersDownloading;
+    /// Download state of each fragment in m_pieceBeingDownloaded
+    std::vector<FragmentState> m_fragmentStates;
+
+    /// Address of the peer that sent each received fragment in m_pieceBeingDownloaded
+    std::vector<boost::asio::ip::address> m_fragmentSenders;
+
+    /// Data and sender of each fragment in m_pieceBeingDownloaded, for every time the current piece failed verification
+    std::vector< std::vector<FragmentRecord> > m_fragmentHistory;
+
+    /// True for each fragment in m_pieceBeingDownloaded whose data was discarded, until it is downloaded again
+    std::vector<bool> m_fragmentDiscarded;
+
+    /// Index of the fragment after the one most recently handed out, where the search for a
+    /// fragment to request from several peers at once begins
+    uint32_t m_nextFragment;
 
-    /// Number of peers that have finished downloading a fragment in m_pieceBeingDownloaded
-    uint32_t m_numPeersFinishedFragment;
+    /// Expected hash of each block of the current piece, empty until known (v2)
+    std::vector<merkle::Hash> m_blockHashes;
+
+    /// True if the current piece failed verification and its blocks are kept until their hashes arrive (v2)
+    bool m_awaitingBlockHashes;
+
+    /// Time at which the current piece last failed verification
+    std::chrono::steady_clock::time_point m_hashFailureTime;
+
+    /// Time at which the block hashes of the current piece were last requested from a peer
+    std::chrono::steady_clock::time_point m_blockHashRequestTime;
+
+    /// Statistics of the data that failed verification
+    IntegrityStats m_integrityStats;
+
+    /// Addresses of the peers banned for sending corrupt data
+    std::set<boost::asio::ip::address> m_bannedPeers;
 
     /// Used to synchronize requests about piece downloading or information
     std::mutex m_pieceLock;
 
+    /// Indices of the pieces most recently read for uploading, newest first
+    std::deque<uint32_t> m_recentUploads;
+
     /// Handle used when performing I/O in single file download mode
     std::fstream m_singleFileHandle;
 
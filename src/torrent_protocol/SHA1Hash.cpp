@@ -23,11 +23,73 @@ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <openssl/evp.h>
+
 #include "LogHelper.h"
 #include "SHA1Hash.h"
+#include "SHA1Kernels.h"
+
+/// Initial value of the SHA-1 state
+const static uint32_t InitialState[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+
+/// Returns the fastest backend supported by the CPU. The multi-buffer kernel has the highest
+/// throughput on batches of pieces, while OpenSSL's own assembly keeps up with the SHA-NI
+/// kernel on single messages
+static SHA1Hash::Backend detectBackend()
+{
+    if (sha1::isAVX2Supported())
+        return SHA1Hash::Backend::AVX2MultiBuffer;
+    if (sha1::isSHANISupported())
+        return SHA1Hash::Backend::SHANI;
+    return SHA1Hash::Backend::OpenSSL;
+}
+
+/// Backend used by new hashes and batches
+static std::atomic<SHA1Hash::Backend> &activeBackend()
+{
+    static std::atomic<SHA1Hash::Backend> backend(detectBackend());
+    return backend;
+}
+
+/// Writes the SHA-1 padding and message length into buffer, which holds bufferLen bytes of
+/// unprocessed data. Returns the number of blocks (1 or 2) that must then be processed
+static size_t padFinalBlocks(uint8_t *buffer, size_t bufferLen, uint64_t messageLen)
+{
+    const size_t numBlocks = (bufferLen + 9 <= sha1::BlockSize) ? 1 : 2;
+    const size_t end = numBlocks * sha1::BlockSize;
+
+    buffer[bufferLen] = 0x80;
+    memset(buffer + bufferLen + 1, 0, end - bufferLen - 1);
+
+    const uint64_t bitLen = messageLen * 8;
+    for (size_t i = 0; i < 8; ++i)
+        buffer[end - 1 - i] = uint8_t(bitLen >> (8 * i));
+
+    return numBlocks;
+}
+
+/// Writes the big-endian digest of the given state
+static void storeDigest(const uint32_t state[5], uint8_t *digest)
+{
+    for (size_t i = 0; i < 5; ++i)
+    {
+        digest[i * 4]     = uint8_t(state[i] >> 24);
+        digest[i * 4 + 1] = uint8_t(state[i] >> 16);
+        digest[i * 4 + 2] = uint8_t(state[i] >> 8);
+        digest[i * 4 + 3] = uint8_t(state[i]);
+    }
+}
 
 SHA1Hash::SHA1Hash() :
-    m_ctx(),
+    m_native(false),
+    m_evpCtx(nullptr),
+    m_state(),
+    m_buffer(),
+    m_bufferLen(0),
+    m_messageLen(0),
     m_digest(),
     m_finalized(false)
 {
@@ -36,29 +98,89 @@ SHA1Hash::SHA1Hash() :
 
 SHA1Hash::~SHA1Hash()
 {
-    finalize();
+    if (m_evpCtx)
+        EVP_MD_CTX_free(m_evpCtx);
 }
 
 void SHA1Hash::initialize()
 {
     m_finalized = false;
 
-    if (SHA1_Init(&m_ctx) != 1)
+    m_native = (getBackend() == Backend::SHANI);
+
+    if (m_native)
+    {
+        memcpy(m_state, InitialState, sizeof(m_state));
+        m_bufferLen = 0;
+        m_messageLen = 0;
+        return;
+    }
+
+    if (!m_evpCtx)
+        m_evpCtx = EVP_MD_CTX_new();
+
+    if (!m_evpCtx || EVP_DigestInit_ex(m_evpCtx, EVP_sha1(), nullptr) != 1)
         LOG_ERROR("torrent_protocol", "Unable to initialize SHA1 context!");
 }
 
 void SHA1Hash::update(const uint8_t *data, size_t length)
 {
-    if (SHA1_Update(&m_ctx, data, length) != 1)
-        LOG_ERROR("torrent_protocol", "SHA1Hash::update - Unable to update message context!");
+    if (!m_native)
+    {
+        if (EVP_DigestUpdate(m_evpCtx, data, length) != 1)
+            LOG_ERROR("torrent_protocol", "SHA1Hash::update - Unable to update message context!");
+        return;
+    }
+
+    m_messageLen += length;
+
+    // Complete any partially filled block first
+    if (m_bufferLen > 0)
+    {
+        size_t toCopy = std::min(length, sha1::BlockSize - m_bufferLen);
+        memcpy(m_buffer + m_bufferLen, data, toCopy);
+        m_bufferLen += toCopy;
+        data += toCopy;
+        length -= toCopy;
+
+        if (m_bufferLen < sha1::BlockSize)
+            return;
+
+        compressBlocks(m_buffer, 1);
+        m_bufferLen = 0;
+    }
+
+    // Hash complete blocks directly from the input, then keep the remainder for later
+    size_t numBlocks = length / sha1::BlockSize;
+    compressBlocks(data, numBlocks);
+    data += numBlocks * sha1::BlockSize;
+    length -= numBlocks * sha1::BlockSize;
+
+    memcpy(m_buffer, data, length);
+    m_bufferLen = length;
 }
 
 void SHA1Hash::finalize()
 {
-    if (SHA1_Final(&m_digest[0], &m_ctx) != 1)
-        LOG_ERROR("torrent_protocol", "SHA1Hash::finalize - Unable to finalize message digest!");
-    else
+    if (m_finalized)
+        return;
+
+    if (!m_native)
+    {
+        if (EVP_DigestFinal_ex(m_evpCtx, &m_digest[0], nullptr) != 1)
+        {
+            LOG_ERROR("torrent_protocol", "SHA1Hash::finalize - Unable to finalize message digest!");
+            return;
+        }
         m_finalized = true;
+        return;
+    }
+
+    uint8_t finalBlocks[sha1::BlockSize * 2];
+    memcpy(finalBlocks, m_buffer, m_bufferLen);
+    compressBlocks(finalBlocks, padFinalBlocks(finalBlocks, m_bufferLen, m_messageLen));
+    storeDigest(m_state, m_digest);
+    m_finalized = true;
 }
 
 uint8_t *SHA1Hash::getDigest()
@@ -68,3 +190,129 @@ uint8_t *SHA1Hash::getDigest()
 
     return &m_digest[0];
 }
+
+void SHA1Hash::hashBatch(const uint8_t *const *messages, size_t length, size_t count, uint8_t *digests)
+{
+    Backend backend = getBackend();
+
+    // Messages are hashed one at a time unless the multi-buffer kernel is in use and there
+    // is more than one message to fill its lanes with
+    if (backend != Backend::AVX2MultiBuffer || count < 2)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (backend == Backend::SHANI)
+            {
+                hashNative(messages[i], length, digests + i * SHA_DIGEST_LENGTH);
+                continue;
+            }
+
+            SHA1Hash hash;
+            hash.update(messages[i], length);
+            hash.finalize();
+            memcpy(digests + i * SHA_DIGEST_LENGTH, hash.getDigest(), SHA_DIGEST_LENGTH);
+        }
+        return;
+    }
+
+    const size_t numBlocks = length / sha1::BlockSize;
+    const size_t remainder = length % sha1::BlockSize;
+
+    uint32_t state[sha1::NumLanes][5];
+    const uint8_t *lanes[sha1::NumLanes];
+    uint8_t finalBlocks[sha1::NumLanes][sha1::BlockSize * 2];
+    const uint8_t *finalLanes[sha1::NumLanes];
+
+    for (size_t first = 0; first < count; first += sha1::NumLanes)
+    {
+        // Unused lanes repeat the first message of the group, and their results are discarded
+        const size_t numMessages = std::min(sha1::NumLanes, count - first);
+        for (size_t lane = 0; lane < sha1::NumLanes; ++lane)
+        {
+            lanes[lane] = messages[first + (lane < numMessages ? lane : 0)];
+            memcpy(state[lane], InitialState, sizeof(InitialState));
+        }
+
+        sha1::compressAVX2(state, lanes, numBlocks);
+
+        // Every message has the same length, so every lane pads to the same number of blocks
+        size_t numFinalBlocks = 0;
+        for (size_t lane = 0; lane < sha1::NumLanes; ++lane)
+        {
+            memcpy(finalBlocks[lane], lanes[lane] + numBlocks * sha1::BlockSize, remainder);
+            numFinalBlocks = padFinalBlocks(finalBlocks[lane], remainder, length);
+            finalLanes[lane] = finalBlocks[lane];
+        }
+
+        sha1::compressAVX2(state, finalLanes, numFinalBlocks);
+
+        for (size_t lane = 0; lane < numMessages; ++lane)
+            storeDigest(state[lane], digests + (first + lane) * SHA_DIGEST_LENGTH);
+    }
+}
+
+bool SHA1Hash::isBackendSupported(Backend backend)
+{
+    switch (backend)
+    {
+        case Backend::OpenSSL:
+            return true;
+        case Backend::SHANI:
+            return sha1::isSHANISupported();
+        case Backend::AVX2MultiBuffer:
+            return sha1::isAVX2Supported();
+    }
+    return false;
+}
+
+SHA1Hash::Backend SHA1Hash::getBackend()
+{
+    return activeBackend().load(std::memory_order_relaxed);
+}
+
+bool SHA1Hash::setBackend(Backend backend)
+{
+    if (!isBackendSupported(backend))
+        return false;
+
+    activeBackend().store(backend, std::memory_order_relaxed);
+    LOG_INFO("torrent_protocol", "Using SHA-1 backend ", getBackendName(backend));
+    return true;
+}
+
+const char *SHA1Hash::getBackendName(Backend backend)
+{
+    switch (backend)
+    {
+        case Backend::OpenSSL:
+            return "OpenSSL";
+        case Backend::SHANI:
+            return "SHA-NI";
+        case Backend::AVX2MultiBuffer:
+            return "AVX2 multi-buffer";
+    }
+    return "Unknown";
+}
+
+void SHA1Hash::compressBlocks(const uint8_t *data, size_t numBlocks)
+{
+    if (numBlocks > 0)
+        sha1::compressSHANI(m_state, data, numBlocks);
+}
+
+void SHA1Hash::hashNative(const uint8_t *data, size_t length, uint8_t *digest)
+{
+    uint32_t state[5];
+    memcpy(state, InitialState, sizeof(state));
+
+    const size_t numBlocks = length / sha1::BlockSize;
+    if (numBlocks > 0)
+        sha1::compressSHANI(state, data, numBlocks);
+
+    uint8_t finalBlocks[sha1::BlockSize * 2];
+    const size_t remainder = length % sha1::BlockSize;
+    memcpy(finalBlocks, data + numBlocks * sha1::BlockSize, remainder);
+    sha1::compressSHANI(state, finalBlocks, padFinalBlocks(finalBlocks, remainder, length));
+
+    storeDigest(state, digest);
+}
@@ -25,15 +25,35 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <openssl/sha.h>
 
+struct evp_md_ctx_st;
+
 /**
  * @class SHA1Hash
- * @brief Acts as a wrapper for openssl or libressl's SHA-1 hash functions
+ * @brief Computes SHA-1 message digests. Acts as a facade over several implementations,
+ *        chosen at runtime from the features of the CPU: OpenSSL's EVP interface, a kernel
+ *        using the x86 SHA extensions, and a multi-buffer AVX2 kernel that hashes several
+ *        equal-length messages (such as torrent pieces) at once through \ref hashBatch.
  */
 class SHA1Hash
 {
+public:
+    /// Available implementations of SHA-1
+    enum class Backend
+    {
+        /// OpenSSL's EVP digest interface
+        OpenSSL,
+
+        /// Kernel using the x86 SHA extensions (SHA-NI)
+        SHANI,
+
+        /// Multi-buffer AVX2 kernel for batches, with single messages hashed by OpenSSL
+        AVX2MultiBuffer
+    };
+
 public:
     /// SHA1Hash constructor - initializes the internal message digest
     SHA1Hash();
@@ -41,6 +61,9 @@ public:
     /// SHA1Hash destructor - frees the sha context
     ~SHA1Hash();
 
+    SHA1Hash(const SHA1Hash&) = delete;
+    SHA1Hash &operator=(const SHA1Hash&) = delete;
+
     /// Initializes / Re-initializes the SHA context
     void initialize();
 
@@ -54,9 +77,49 @@ public:
     /// if the message could not be hashed
     uint8_t *getDigest();
 
+public:
+    /// Hashes count messages of the same length, storing the digest of messages[i] at
+    /// digests + i * SHA_DIGEST_LENGTH
+    static void hashBatch(const uint8_t *const *messages, size_t length, size_t count, uint8_t *digests);
+
+    /// Returns true if the given backend can be used on this machine
+    static bool isBackendSupported(Backend backend);
+
+    /// Returns the backend used by new hashes and batches
+    static Backend getBackend();
+
+    /// Sets the backend used by new hashes and batches. Returns false, leaving the backend
+    /// unchanged, if it is not supported on this machine
+    static bool setBackend(Backend backend);
+
+    /// Returns the name of the given backend
+    static const char *getBackendName(Backend backend);
+
+private:
+    /// Processes numBlocks complete blocks of data into the native state
+    void compressBlocks(const uint8_t *data, size_t numBlocks);
+
+    /// Hashes a single message in one call using the native kernel, writing its digest to the given buffer
+    static void hashNative(const uint8_t *data, size_t length, uint8_t *digest);
+
 private:
-    /// Structure that holds the context of the hash
-    SHA_CTX m_ctx;
+    /// True if the SHA-NI kernel is used for this message, false if OpenSSL is used
+    bool m_native;
+
+    /// OpenSSL digest context, used when m_native is false
+    evp_md_ctx_st *m_evpCtx;
+
+    /// Intermediate hash state, used when m_native is true
+    uint32_t m_state[5];
+
+    /// Data that has not yet filled a complete block
+    uint8_t m_buffer[64];
+
+    /// Number of bytes in use at the front of m_buffer
+    size_t m_bufferLen;
+
+    /// Total length of the message so far, in bytes
+    uint64_t m_messageLen;
 
     /// Message digest
     uint8_t m_digest[SHA_DIGEST_LENGTH];
@@ -0,0 +1,295 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "SHA1Kernels.h"
+#include "TransposeAVX2.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SHA1_X86_KERNELS 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+namespace sha1
+{
+#ifdef SHA1_X86_KERNELS
+    bool isSHANISupported()
+    {
+        unsigned int eax, ebx, ecx, edx;
+        if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+            return false;
+
+        // SSSE3 (ecx bit 9) and SSE4.1 (ecx bit 19) are needed alongside the SHA instructions
+        if (!(ecx & (1u << 9)) || !(ecx & (1u << 19)))
+            return false;
+
+        if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+            return false;
+
+        return (ebx & (1u << 29)) != 0;
+    }
+
+    bool isAVX2Supported()
+    {
+        unsigned int eax, ebx, ecx, edx;
+        if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+            return false;
+
+        // The OS must have enabled the AVX register state (OSXSAVE, then XCR0 bits 1 and 2)
+        if (!(ecx & (1u << 27)) || !(ecx & (1u << 28)))
+            return false;
+
+        unsigned int xcrLow, xcrHigh;
+        __asm__("xgetbv" : "=a"(xcrLow), "=d"(xcrHigh) : "c"(0));
+        if ((xcrLow & 6) != 6)
+            return false;
+
+        if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+            return false;
+
+        return (ebx & (1u << 5)) != 0;
+    }
+
+    /// Four rounds of the SHA-NI schedule from round 16 onward, with the message words rotating through m0..m3
+#define SHA1_SHANI_ROUNDS(eIn, eOut, m0, m1, m2, m3, func)  \
+    eIn = _mm_sha1nexte_epu32(eIn, m0);                     \
+    eOut = abcd;                                            \
+    m1 = _mm_sha1msg2_epu32(m1, m0);                        \
+    abcd = _mm_sha1rnds4_epu32(abcd, eIn, func);            \
+    m3 = _mm_sha1msg1_epu32(m3, m0);                        \
+    m2 = _mm_xor_si128(m2, m0);
+
+    __attribute__((target("sha,sse4.1,ssse3")))
+    void compressSHANI(uint32_t state[5], const uint8_t *data, std::size_t numBlocks)
+    {
+        const __m128i byteSwap = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+
+        __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*) state), 0x1B);
+        __m128i e0 = _mm_set_epi32((int) state[4], 0, 0, 0);
+        __m128i e1, msg0, msg1, msg2, msg3;
+
+        for (; numBlocks > 0; --numBlocks, data += BlockSize)
+        {
+            const __m128i abcdSave = abcd;
+            const __m128i eSave = e0;
+
+            // Rounds 0-3
+            msg0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) data), byteSwap);
+            e0 = _mm_add_epi32(e0, msg0);
+            e1 = abcd;
+            abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+            // Rounds 4-7
+            msg1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (data + 16)), byteSwap);
+            e1 = _mm_sha1nexte_epu32(e1, msg1);
+            e0 = abcd;
+            abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+            msg0 = _mm_sha1msg1_epu32(msg0, msg1);
+
+            // Rounds 8-11
+            msg2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (data + 32)), byteSwap);
+            e0 = _mm_sha1nexte_epu32(e0, msg2);
+            e1 = abcd;
+            abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+            msg1 = _mm_sha1msg1_epu32(msg1, msg2);
+            msg0 = _mm_xor_si128(msg0, msg2);
+
+            // Rounds 12-15
+            msg3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (data + 48)), byteSwap);
+            e1 = _mm_sha1nexte_epu32(e1, msg3);
+            e0 = abcd;
+            msg0 = _mm_sha1msg2_epu32(msg0, msg3);
+            abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+            msg2 = _mm_sha1msg1_epu32(msg2, msg3);
+            msg1 = _mm_xor_si128(msg1, msg3);
+
+            // Rounds 16-67
+            SHA1_SHANI_ROUNDS(e0, e1, msg0, msg1, msg2, msg3, 0)
+            SHA1_SHANI_ROUNDS(e1, e0, msg1, msg2, msg3, msg0, 1)
+            SHA1_SHANI_ROUNDS(e0, e1, msg2, msg3, msg0, msg1, 1)
+            SHA1_SHANI_ROUNDS(e1, e0, msg3, msg0, msg1, msg2, 1)
+            SHA1_SHANI_ROUNDS(e0, e1, msg0, msg1, msg2, msg3, 1)
+            SHA1_SHANI_ROUNDS(e1, e0, msg1, msg2, msg3, msg0, 1)
+            SHA1_SHANI_ROUNDS(e0, e1, msg2, msg3, msg0, msg1, 2)
+            SHA1_SHANI_ROUNDS(e1, e0, msg3, msg0, msg1, msg2, 2)
+            SHA1_SHANI_ROUNDS(e0, e1, msg0, msg1, msg2, msg3, 2)
+            SHA1_SHANI_ROUNDS(e1, e0, msg1, msg2, msg3, msg0, 2)
+            SHA1_SHANI_ROUNDS(e0, e1, msg2, msg3, msg0, msg1, 2)
+            SHA1_SHANI_ROUNDS(e1, e0, msg3, msg0, msg1, msg2, 3)
+            SHA1_SHANI_ROUNDS(e0, e1, msg0, msg1, msg2, msg3, 3)
+
+            // Rounds 68-71
+            e1 = _mm_sha1nexte_epu32(e1, msg1);
+            e0 = abcd;
+            msg2 = _mm_sha1msg2_epu32(msg2, msg1);
+            abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+            msg3 = _mm_xor_si128(msg3, msg1);
+
+            // Rounds 72-75
+            e0 = _mm_sha1nexte_epu32(e0, msg2);
+            e1 = abcd;
+            msg3 = _mm_sha1msg2_epu32(msg3, msg2);
+            abcd = _mm_sha1rnds4_epu32(abcd, e0, 3);
+
+            // Rounds 76-79
+            e1 = _mm_sha1nexte_epu32(e1, msg3);
+            e0 = abcd;
+            abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+
+            // Add this block's result to the state
+            e0 = _mm_sha1nexte_epu32(e0, eSave);
+            abcd = _mm_add_epi32(abcd, abcdSave);
+        }
+
+        _mm_storeu_si128((__m128i*) state, _mm_shuffle_epi32(abcd, 0x1B));
+        state[4] = (uint32_t) _mm_extract_epi32(e0, 3);
+    }
+
+#undef SHA1_SHANI_ROUNDS
+
+#define SHA1_ROL(x, n) _mm256_or_si256(_mm256_slli_epi32(x, n), _mm256_srli_epi32(x, 32 - (n)))
+
+    /// One round of SHA-1 on every lane, given the value of the round function
+#define SHA1_AVX2_ROUND(f, k, w)                                                            \
+    {                                                                                       \
+        __m256i temp = _mm256_add_epi32(_mm256_add_epi32(SHA1_ROL(a, 5), f),                \
+                                        _mm256_add_epi32(_mm256_add_epi32(e, k), w));       \
+        e = d;                                                                              \
+        d = c;                                                                              \
+        c = SHA1_ROL(b, 30);                                                                \
+        b = a;                                                                              \
+        a = temp;                                                                           \
+    }
+
+    __attribute__((target("avx2")))
+    void compressAVX2(uint32_t state[NumLanes][5], const uint8_t *const data[NumLanes], std::size_t numBlocks)
+    {
+        const __m256i byteSwap = _mm256_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+                                                 12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+        const __m256i k0 = _mm256_set1_epi32(0x5A827999);
+        const __m256i k1 = _mm256_set1_epi32(0x6ED9EBA1);
+        const __m256i k2 = _mm256_set1_epi32((int) 0x8F1BBCDC);
+        const __m256i k3 = _mm256_set1_epi32((int) 0xCA62C1D6);
+
+        // Lane i of each vector holds the state of message i
+        __m256i a = _mm256_setr_epi32(state[0][0], state[1][0], state[2][0], state[3][0], state[4][0], state[5][0], state[6][0], state[7][0]);
+        __m256i b = _mm256_setr_epi32(state[0][1], state[1][1], state[2][1], state[3][1], state[4][1], state[5][1], state[6][1], state[7][1]);
+        __m256i c = _mm256_setr_epi32(state[0][2], state[1][2], state[2][2], state[3][2], state[4][2], state[5][2], state[6][2], state[7][2]);
+        __m256i d = _mm256_setr_epi32(state[0][3], state[1][3], state[2][3], state[3][3], state[4][3], state[5][3], state[6][3], state[7][3]);
+        __m256i e = _mm256_setr_epi32(state[0][4], state[1][4], state[2][4], state[3][4], state[4][4], state[5][4], state[6][4], state[7][4]);
+
+        __m256i w[16];
+        for (std::size_t block = 0; block < numBlocks; ++block)
+        {
+            const std::size_t offset = block * BlockSize;
+
+            // Load the message schedule, one 32-bit word per lane
+            for (std::size_t half = 0; half < 2; ++half)
+            {
+                __m256i *rows = &w[half * 8];
+                for (std::size_t lane = 0; lane < NumLanes; ++lane)
+                    rows[lane] = _mm256_loadu_si256((const __m256i*) (data[lane] + offset + half * 32));
+
+                transpose8x8(rows);
+                for (std::size_t i = 0; i < 8; ++i)
+                    rows[i] = _mm256_shuffle_epi8(rows[i], byteSwap);
+            }
+
+            const __m256i aSave = a, bSave = b, cSave = c, dSave = d, eSave = e;
+
+            for (std::size_t t = 0; t < 80; ++t)
+            {
+                if (t >= 16)
+                {
+                    __m256i x = _mm256_xor_si256(_mm256_xor_si256(w[(t - 3) & 15], w[(t - 8) & 15]),
+                                                 _mm256_xor_si256(w[(t - 14) & 15], w[t & 15]));
+                    w[t & 15] = SHA1_ROL(x, 1);
+                }
+
+                if (t < 20)
+                {
+                    __m256i f = _mm256_xor_si256(d, _mm256_and_si256(b, _mm256_xor_si256(c, d)));
+                    SHA1_AVX2_ROUND(f, k0, w[t & 15])
+                }
+                else if (t < 40)
+                {
+                    __m256i f = _mm256_xor_si256(_mm256_xor_si256(b, c), d);
+                    SHA1_AVX2_ROUND(f, k1, w[t & 15])
+                }
+                else if (t < 60)
+                {
+                    __m256i f = _mm256_or_si256(_mm256_and_si256(b, c), _mm256_and_si256(d, _mm256_or_si256(b, c)));
+                    SHA1_AVX2_ROUND(f, k2, w[t & 15])
+                }
+                else
+                {
+                    __m256i f = _mm256_xor_si256(_mm256_xor_si256(b, c), d);
+                    SHA1_AVX2_ROUND(f, k3, w[t & 15])
+                }
+            }
+
+            a = _mm256_add_epi32(a, aSave);
+            b = _mm256_add_epi32(b, bSave);
+            c = _mm256_add_epi32(c, cSave);
+            d = _mm256_add_epi32(d, dSave);
+            e = _mm256_add_epi32(e, eSave);
+        }
+
+        alignas(32) uint32_t words[5][NumLanes];
+        _mm256_store_si256((__m256i*) words[0], a);
+        _mm256_store_si256((__m256i*) words[1], b);
+        _mm256_store_si256((__m256i*) words[2], c);
+        _mm256_store_si256((__m256i*) words[3], d);
+        _mm256_store_si256((__m256i*) words[4], e);
+        for (std::size_t lane = 0; lane < NumLanes; ++lane)
+        {
+            for (std::size_t i = 0; i < 5; ++i)
+                state[lane][i] = words[i][lane];
+        }
+    }
+
+#undef SHA1_AVX2_ROUND
+#undef SHA1_ROL
+
+#else
+    bool isSHANISupported()
+    {
+        return false;
+    }
+
+    bool isAVX2Supported()
+    {
+        return false;
+    }
+
+    void compressSHANI(uint32_t[5], const uint8_t*, std::size_t)
+    {
+    }
+
+    void compressAVX2(uint32_t[NumLanes][5], const uint8_t *const[NumLanes], std::size_t)
+    {
+    }
+#endif
+}
@@ -0,0 +1,52 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/// Hardware accelerated implementations of the SHA-1 compression function, used by \ref SHA1Hash
+namespace sha1
+{
+    /// Size of a SHA-1 message block, in bytes
+    const std::size_t BlockSize = 64;
+
+    /// Number of messages hashed at once by the multi-buffer kernel
+    const std::size_t NumLanes = 8;
+
+    /// Returns true if the CPU supports the SHA extensions (SHA-NI), along with SSSE3 and SSE4.1
+    bool isSHANISupported();
+
+    /// Returns true if the CPU and operating system support AVX2
+    bool isAVX2Supported();
+
+    /// Processes numBlocks consecutive 64-byte blocks of a single message using the SHA extensions
+    void compressSHANI(uint32_t state[5], const uint8_t *data, std::size_t numBlocks);
+
+    /// Processes numBlocks consecutive 64-byte blocks from each of NumLanes independent messages
+    /// using AVX2, where state[i] and data[i] belong to the i'th message
+    void compressAVX2(uint32_t state[NumLanes][5], const uint8_t *const data[NumLanes], std::size_t numBlocks);
+}
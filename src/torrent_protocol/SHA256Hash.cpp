@@ -0,0 +1,219 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <openssl/evp.h>
+
+#include "LogHelper.h"
+#include "SHA1Kernels.h"
+#include "SHA256Hash.h"
+#include "SHA256Kernels.h"
+
+/// Initial value of the SHA-256 state
+const static uint32_t InitialState[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                          0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+
+/// Backend used by batches, the multi-buffer kernel whenever the CPU supports it
+static std::atomic<SHA256Hash::Backend> &activeBackend()
+{
+    static std::atomic<SHA256Hash::Backend> backend(sha1::isAVX2Supported() ? SHA256Hash::Backend::AVX2MultiBuffer
+                                                                            : SHA256Hash::Backend::OpenSSL);
+    return backend;
+}
+
+/// Writes the SHA-256 padding and message length into buffer, which holds bufferLen bytes of
+/// unprocessed data. Returns the number of blocks (1 or 2) that must then be processed
+static size_t padFinalBlocks(uint8_t *buffer, size_t bufferLen, uint64_t messageLen)
+{
+    const size_t numBlocks = (bufferLen + 9 <= sha256::BlockSize) ? 1 : 2;
+    const size_t end = numBlocks * sha256::BlockSize;
+
+    buffer[bufferLen] = 0x80;
+    memset(buffer + bufferLen + 1, 0, end - bufferLen - 1);
+
+    const uint64_t bitLen = messageLen * 8;
+    for (size_t i = 0; i < 8; ++i)
+        buffer[end - 1 - i] = uint8_t(bitLen >> (8 * i));
+
+    return numBlocks;
+}
+
+/// Writes the big-endian digest of the given state
+static void storeDigest(const uint32_t state[8], uint8_t *digest)
+{
+    for (size_t i = 0; i < 8; ++i)
+    {
+        digest[i * 4]     = uint8_t(state[i] >> 24);
+        digest[i * 4 + 1] = uint8_t(state[i] >> 16);
+        digest[i * 4 + 2] = uint8_t(state[i] >> 8);
+        digest[i * 4 + 3] = uint8_t(state[i]);
+    }
+}
+
+SHA256Hash::SHA256Hash() :
+    m_evpCtx(nullptr),
+    m_digest(),
+    m_finalized(false)
+{
+    initialize();
+}
+
+SHA256Hash::~SHA256Hash()
+{
+    if (m_evpCtx)
+        EVP_MD_CTX_free(m_evpCtx);
+}
+
+void SHA256Hash::initialize()
+{
+    m_finalized = false;
+
+    if (!m_evpCtx)
+        m_evpCtx = EVP_MD_CTX_new();
+
+    if (!m_evpCtx || EVP_DigestInit_ex(m_evpCtx, EVP_sha256(), nullptr) != 1)
+        LOG_ERROR("torrent_protocol", "Unable to initialize SHA256 context!");
+}
+
+void SHA256Hash::update(const uint8_t *data, size_t length)
+{
+    if (EVP_DigestUpdate(m_evpCtx, data, length) != 1)
+        LOG_ERROR("torrent_protocol", "SHA256Hash::update - Unable to update message context!");
+}
+
+void SHA256Hash::finalize()
+{
+    if (m_finalized)
+        return;
+
+    if (EVP_DigestFinal_ex(m_evpCtx, &m_digest[0], nullptr) != 1)
+    {
+        LOG_ERROR("torrent_protocol", "SHA256Hash::finalize - Unable to finalize message digest!");
+        return;
+    }
+    m_finalized = true;
+}
+
+uint8_t *SHA256Hash::getDigest()
+{
+    if (!m_finalized)
+        return nullptr;
+
+    return &m_digest[0];
+}
+
+void SHA256Hash::hash(const uint8_t *data, size_t length, uint8_t *digest)
+{
+    if (EVP_Digest(data, length, digest, nullptr, EVP_sha256(), nullptr) != 1)
+        LOG_ERROR("torrent_protocol", "SHA256Hash::hash - Unable to compute message digest!");
+}
+
+void SHA256Hash::hashBatch(const uint8_t *const *messages, size_t length, size_t count, uint8_t *digests)
+{
+    // Messages are hashed one at a time unless the multi-buffer kernel is in use and there
+    // is more than one message to fill its lanes with
+    if (getBackend() != Backend::AVX2MultiBuffer || count < 2)
+    {
+        for (size_t i = 0; i < count; ++i)
+            hash(messages[i], length, digests + i * SHA256_DIGEST_LENGTH);
+        return;
+    }
+
+    const size_t numBlocks = length / sha256::BlockSize;
+    const size_t remainder = length % sha256::BlockSize;
+
+    uint32_t state[sha256::NumLanes][8];
+    const uint8_t *lanes[sha256::NumLanes];
+    uint8_t finalBlocks[sha256::NumLanes][sha256::BlockSize * 2];
+    const uint8_t *finalLanes[sha256::NumLanes];
+
+    for (size_t first = 0; first < count; first += sha256::NumLanes)
+    {
+        // Unused lanes repeat the first message of the group, and their results are discarded
+        const size_t numMessages = std::min(sha256::NumLanes, count - first);
+        for (size_t lane = 0; lane < sha256::NumLanes; ++lane)
+        {
+            lanes[lane] = messages[first + (lane < numMessages ? lane : 0)];
+            memcpy(state[lane], InitialState, sizeof(InitialState));
+        }
+
+        sha256::compressAVX2(state, lanes, numBlocks);
+
+        // Every message has the same length, so every lane pads to the same number of blocks
+        size_t numFinalBlocks = 0;
+        for (size_t lane = 0; lane < sha256::NumLanes; ++lane)
+        {
+            memcpy(finalBlocks[lane], lanes[lane] + numBlocks * sha256::BlockSize, remainder);
+            numFinalBlocks = padFinalBlocks(finalBlocks[lane], remainder, length);
+            finalLanes[lane] = finalBlocks[lane];
+        }
+
+        sha256::compressAVX2(state, finalLanes, numFinalBlocks);
+
+        for (size_t lane = 0; lane < numMessages; ++lane)
+            storeDigest(state[lane], digests + (first + lane) * SHA256_DIGEST_LENGTH);
+    }
+}
+
+bool SHA256Hash::isBackendSupported(Backend backend)
+{
+    switch (backend)
+    {
+        case Backend::OpenSSL:
+            return true;
+        case Backend::AVX2MultiBuffer:
+            return sha1::isAVX2Supported();
+    }
+    return false;
+}
+
+SHA256Hash::Backend SHA256Hash::getBackend()
+{
+    return activeBackend().load(std::memory_order_relaxed);
+}
+
+bool SHA256Hash::setBackend(Backend backend)
+{
+    if (!isBackendSupported(backend))
+        return false;
+
+    activeBackend().store(backend, std::memory_order_relaxed);
+    LOG_INFO("torrent_protocol", "Using SHA-256 backend ", getBackendName(backend));
+    return true;
+}
+
+const char *SHA256Hash::getBackendName(Backend backend)
+{
+    switch (backend)
+    {
+        case Backend::OpenSSL:
+            return "OpenSSL";
+        case Backend::AVX2MultiBuffer:
+            return "AVX2 multi-buffer";
+    }
+    return "Unknown";
+}
@@ -0,0 +1,107 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <openssl/sha.h>
+
+struct evp_md_ctx_st;
+
+/**
+ * @class SHA256Hash
+ * @brief Computes SHA-256 message digests, as used by the merkle trees of BitTorrent v2.
+ *        Single messages are hashed with OpenSSL's EVP interface, while batches of equal-length
+ *        messages (such as the blocks and tree nodes of a piece) can be hashed by a multi-buffer
+ *        AVX2 kernel through \ref hashBatch.
+ */
+class SHA256Hash
+{
+public:
+    /// Available implementations of SHA-256 for batches of messages
+    enum class Backend
+    {
+        /// OpenSSL's EVP digest interface
+        OpenSSL,
+
+        /// Multi-buffer AVX2 kernel for batches, with single messages hashed by OpenSSL
+        AVX2MultiBuffer
+    };
+
+public:
+    /// SHA256Hash constructor - initializes the internal message digest
+    SHA256Hash();
+
+    /// SHA256Hash destructor - frees the sha context
+    ~SHA256Hash();
+
+    SHA256Hash(const SHA256Hash&) = delete;
+    SHA256Hash &operator=(const SHA256Hash&) = delete;
+
+    /// Initializes / Re-initializes the SHA context
+    void initialize();
+
+    /// Updates the message with length bytes of data
+    void update(const uint8_t *data, size_t length);
+
+    /// Finalizes the message digest, must be called before accessing the digest
+    void finalize();
+
+    /// Returns a pointer to the digest upon success, or a null pointer
+    /// if the message could not be hashed
+    uint8_t *getDigest();
+
+public:
+    /// Hashes a single message, writing its digest to the given buffer
+    static void hash(const uint8_t *data, size_t length, uint8_t *digest);
+
+    /// Hashes count messages of the same length, storing the digest of messages[i] at
+    /// digests + i * SHA256_DIGEST_LENGTH
+    static void hashBatch(const uint8_t *const *messages, size_t length, size_t count, uint8_t *digests);
+
+    /// Returns true if the given backend can be used on this machine
+    static bool isBackendSupported(Backend backend);
+
+    /// Returns the backend used by batches
+    static Backend getBackend();
+
+    /// Sets the backend used by batches. Returns false, leaving the backend
+    /// unchanged, if it is not supported on this machine
+    static bool setBackend(Backend backend);
+
+    /// Returns the name of the given backend
+    static const char *getBackendName(Backend backend);
+
+private:
+    /// OpenSSL digest context
+    evp_md_ctx_st *m_evpCtx;
+
+    /// Message digest
+    uint8_t m_digest[SHA256_DIGEST_LENGTH];
+
+    /// True if digest has been finalized, false if else
+    bool m_finalized;
+};
@@ -0,0 +1,143 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "SHA256Kernels.h"
+#include "TransposeAVX2.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SHA256_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+namespace sha256
+{
+#ifdef SHA256_X86_KERNELS
+    /// Round constants of SHA-256
+    const static uint32_t RoundConstants[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+    };
+
+#define SHA256_ROR(x, n) _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - (n)))
+
+    __attribute__((target("avx2")))
+    void compressAVX2(uint32_t state[NumLanes][8], const uint8_t *const data[NumLanes], std::size_t numBlocks)
+    {
+        const __m256i byteSwap = _mm256_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+                                                 12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+
+        // Lane i of each vector holds the state of message i
+        __m256i s[8];
+        for (std::size_t i = 0; i < 8; ++i)
+        {
+            s[i] = _mm256_setr_epi32(state[0][i], state[1][i], state[2][i], state[3][i],
+                                     state[4][i], state[5][i], state[6][i], state[7][i]);
+        }
+
+        __m256i w[16];
+        for (std::size_t block = 0; block < numBlocks; ++block)
+        {
+            const std::size_t offset = block * BlockSize;
+
+            // Load the message schedule, one 32-bit word per lane
+            for (std::size_t half = 0; half < 2; ++half)
+            {
+                __m256i *rows = &w[half * 8];
+                for (std::size_t lane = 0; lane < NumLanes; ++lane)
+                    rows[lane] = _mm256_loadu_si256((const __m256i*) (data[lane] + offset + half * 32));
+
+                transpose8x8(rows);
+                for (std::size_t i = 0; i < 8; ++i)
+                    rows[i] = _mm256_shuffle_epi8(rows[i], byteSwap);
+            }
+
+            __m256i a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+
+            for (std::size_t t = 0; t < 64; ++t)
+            {
+                if (t >= 16)
+                {
+                    const __m256i w15 = w[(t - 15) & 15], w2 = w[(t - 2) & 15];
+                    __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(SHA256_ROR(w15, 7), SHA256_ROR(w15, 18)),
+                                                  _mm256_srli_epi32(w15, 3));
+                    __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(SHA256_ROR(w2, 17), SHA256_ROR(w2, 19)),
+                                                  _mm256_srli_epi32(w2, 10));
+                    w[t & 15] = _mm256_add_epi32(_mm256_add_epi32(w[t & 15], s0),
+                                                 _mm256_add_epi32(w[(t - 7) & 15], s1));
+                }
+
+                __m256i sum1 = _mm256_xor_si256(_mm256_xor_si256(SHA256_ROR(e, 6), SHA256_ROR(e, 11)), SHA256_ROR(e, 25));
+                __m256i choose = _mm256_xor_si256(g, _mm256_and_si256(e, _mm256_xor_si256(f, g)));
+                __m256i temp1 = _mm256_add_epi32(_mm256_add_epi32(h, sum1),
+                                                 _mm256_add_epi32(_mm256_add_epi32(choose, w[t & 15]),
+                                                                  _mm256_set1_epi32((int) RoundConstants[t])));
+                __m256i sum0 = _mm256_xor_si256(_mm256_xor_si256(SHA256_ROR(a, 2), SHA256_ROR(a, 13)), SHA256_ROR(a, 22));
+                __m256i majority = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_or_si256(a, b)));
+                __m256i temp2 = _mm256_add_epi32(sum0, majority);
+
+                h = g;
+                g = f;
+                f = e;
+                e = _mm256_add_epi32(d, temp1);
+                d = c;
+                c = b;
+                b = a;
+                a = _mm256_add_epi32(temp1, temp2);
+            }
+
+            s[0] = _mm256_add_epi32(s[0], a);
+            s[1] = _mm256_add_epi32(s[1], b);
+            s[2] = _mm256_add_epi32(s[2], c);
+            s[3] = _mm256_add_epi32(s[3], d);
+            s[4] = _mm256_add_epi32(s[4], e);
+            s[5] = _mm256_add_epi32(s[5], f);
+            s[6] = _mm256_add_epi32(s[6], g);
+            s[7] = _mm256_add_epi32(s[7], h);
+        }
+
+        alignas(32) uint32_t words[8][NumLanes];
+        for (std::size_t i = 0; i < 8; ++i)
+            _mm256_store_si256((__m256i*) words[i], s[i]);
+        for (std::size_t lane = 0; lane < NumLanes; ++lane)
+        {
+            for (std::size_t i = 0; i < 8; ++i)
+                state[lane][i] = words[i][lane];
+        }
+    }
+
+#undef SHA256_ROR
+
+#else
+    void compressAVX2(uint32_t[NumLanes][8], const uint8_t *const[NumLanes], std::size_t)
+    {
+    }
+#endif
+}
@@ -0,0 +1,54 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+
+/**
+ * @brief Stores the statistics of a torrent's swarm as reported by a tracker,
+ *        either through a scrape or an announce response.
+ */
+struct SwarmStats
+{
+    /// Number of peers with the entire file (seeders)
+    uint32_t Complete;
+
+    /// Number of peers that do not yet have the entire file (leechers)
+    uint32_t Incomplete;
+
+    /// Number of times the tracker has registered a completed download
+    uint32_t Downloaded;
+
+    /// Timestamp of the most recent update, or 0 if no statistics have been received
+    time_t LastUpdated;
+
+    /// Default constructor
+    SwarmStats() : Complete(0), Incomplete(0), Downloaded(0), LastUpdated(0) {}
+
+    /// Returns the total number of peers in the swarm
+    uint32_t getSwarmSize() const { return Complete + Incomplete; }
+};
@@ -23,96 +23,216 @@ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
-#include <cmath>
+#include <cstring>
 #include <fstream>
 
 #include "LogHelper.h"
 
-#include "Decoder.h"
+#include "SHA256Hash.h"
 #include "TorrentFile.h"
 
 using namespace bencoding;
 
 TorrentFile::TorrentFile(std::string path) :
-    m_numPieces(0),
-    m_size(0),
+    m_geometry(),
     m_infoHash(),
-    m_singleFileMode(false),
+    m_infoDictionary(),
+    m_hasMetadata(false),
+    m_pieceHashes(),
+    m_piecesRoots(),
+    m_pieceLayerHashes(),
     m_metaInfo()
 {
     parseFile(path);
 }
 
+TorrentFile::TorrentFile(const uint8_t *infoHash, const std::string &name) :
+    m_geometry(),
+    m_infoHash(),
+    m_infoDictionary(),
+    m_hasMetadata(false),
+    m_pieceHashes(),
+    m_piecesRoots(),
+    m_pieceLayerHashes(),
+    m_metaInfo()
+{
+    memcpy(m_infoHash.data(), infoHash, SHA_DIGEST_LENGTH);
+    m_geometry.Name = name;
+}
+
 http::URL TorrentFile::getAnnounceURL()
 {
-    auto it = m_metaInfo->find("announce");
-    if (it == m_metaInfo->end())
+    BenNode announce = m_metaInfo.getRoot().find("announce");
+    if (!announce.isString())
     {
         LOG_ERROR("torrent_protocol.TorrentFile", "Unable to get announce URL from metainfo!");
         return http::URL("");
     }
 
-    return http::URL(bencast<BenString*>(it->second)->getValue());
+    return http::URL(std::string(announce.getString()));
 }
 
-std::shared_ptr<BenString> TorrentFile::getDigestString()
+std::vector< std::vector<std::string> > TorrentFile::getAnnounceList()
 {
-    std::shared_ptr<BenString> retVal(nullptr);
+    std::vector< std::vector<std::string> > tiers;
+
+    BenNode root = m_metaInfo.getRoot();
+    for (BenNode tierList : root.find("announce-list"))
+    {
+        std::vector<std::string> tier;
+        for (BenNode url : tierList)
+        {
+            if (url.isString())
+                tier.emplace_back(url.getString());
+        }
+
+        if (!tier.empty())
+            tiers.push_back(std::move(tier));
+    }
 
-    BenDictionary *infoDict = getInfoDictionary();
-    if (infoDict)
+    // Fall back to the announce key if there is no usable announce-list
+    if (tiers.empty())
     {
-        auto itr = infoDict->find("pieces");
-        if (itr != infoDict->end())
-            retVal = std::static_pointer_cast<BenString>(itr->second);
+        BenNode announce = root.find("announce");
+        if (announce.isString())
+            tiers.push_back(std::vector<std::string>{ std::string(announce.getString()) });
     }
 
-    return retVal;
+    return tiers;
 }
 
-BenDictionary *TorrentFile::getInfoDictionary()
+BenNode TorrentFile::getInfoDictionary() const
 {
-    BenDictionary::iterator infoItr = m_metaInfo->find("info");
-    if (infoItr == m_metaInfo->end())
+    BenNode infoDict = m_metaInfo.getRoot().find("info");
+    if (!infoDict.isDictionary())
     {
         LOG_ERROR("torrent_protocol.TorrentFile", "Unable to get info dictionary");
-        return nullptr;
+        return BenNode();
     }
 
-    return bencast<BenDictionary*>(infoItr->second);
+    return infoDict;
+}
+
+const std::string &TorrentFile::getInfoDictionaryData() const
+{
+    return m_infoDictionary;
+}
+
+bool TorrentFile::setInfoDictionary(const std::string &encoded)
+{
+    if (m_hasMetadata)
+        return false;
+
+    SHA1Hash digest;
+    digest.update((const uint8_t*)encoded.data(), encoded.size());
+    digest.finalize();
+    if (digest.getDigest() == nullptr || memcmp(digest.getDigest(), m_infoHash.data(), SHA_DIGEST_LENGTH) != 0)
+    {
+        LOG_WARNING("torrent_protocol.TorrentFile", "Info dictionary does not match the info hash");
+        return false;
+    }
+
+    // Wrap the dictionary into a metainfo document, so that it is read exactly like one from a file
+    if (!m_metaInfo.parse("d4:info" + encoded + "e") || !getInfoDictionary())
+    {
+        LOG_WARNING("torrent_protocol.TorrentFile", "Info dictionary received from peers is malformed");
+        m_metaInfo.clear();
+        return false;
+    }
+
+    m_geometry = TorrentGeometry();
+    m_piecesRoots.clear();
+    m_pieceLayerHashes.clear();
+    parseInfoDictionary();
+    return m_hasMetadata;
+}
+
+bool TorrentFile::hasMetadata() const
+{
+    return m_hasMetadata;
+}
+
+const uint8_t *TorrentFile::getPieceHash(uint32_t pieceIdx) const
+{
+    if (pieceIdx >= m_pieceHashes.size())
+        return nullptr;
+
+    return m_pieceHashes[pieceIdx].data();
+}
+
+bool TorrentFile::checkPieceHash(uint32_t pieceIdx, const uint8_t *digest) const
+{
+    const uint8_t *expected = getPieceHash(pieceIdx);
+    return expected != nullptr && digest != nullptr && memcmp(expected, digest, SHA_DIGEST_LENGTH) == 0;
+}
+
+bool TorrentFile::hasV2Hashes() const
+{
+    return !m_pieceLayerHashes.empty();
+}
+
+const uint8_t *TorrentFile::getPieceLayerHash(uint32_t pieceIdx) const
+{
+    if (pieceIdx >= m_pieceLayerHashes.size())
+        return nullptr;
+
+    return m_pieceLayerHashes[pieceIdx].data();
+}
+
+const uint8_t *TorrentFile::getPiecesRoot(std::size_t fileIdx) const
+{
+    if (m_pieceLayerHashes.empty() || fileIdx >= m_piecesRoots.size())
+        return nullptr;
+
+    return m_piecesRoots[fileIdx].data();
+}
+
+std::size_t TorrentFile::findFileByPiecesRoot(const uint8_t *piecesRoot) const
+{
+    if (m_pieceLayerHashes.empty())
+        return m_geometry.Files.size();
+
+    for (std::size_t i = 0; i < m_piecesRoots.size(); ++i)
+    {
+        if (m_geometry.Files[i].Length > 0 && memcmp(m_piecesRoots[i].data(), piecesRoot, SHA256_DIGEST_LENGTH) == 0)
+            return i;
+    }
+    return m_geometry.Files.size();
 }
 
 uint8_t *TorrentFile::getInfoHash()
 {
-    return m_infoHash.getDigest();
+    return m_infoHash.data();
+}
+
+const TorrentGeometry &TorrentFile::getGeometry() const
+{
+    return m_geometry;
 }
 
 const uint64_t &TorrentFile::getFileSize() const
 {
-    return m_size;
+    return m_geometry.TotalSize;
 }
 
 const uint64_t &TorrentFile::getNumPieces() const
 {
-    return m_numPieces;
+    return m_geometry.NumPieces;
 }
 
-uint64_t TorrentFile::getPieceLength()
+const uint64_t &TorrentFile::getPieceLength() const
 {
-    if (BenDictionary *infoDict = getInfoDictionary())
-    {
-        auto it = infoDict->find("piece length");
-        if (it != infoDict->end())
-            return bencast<BenInt*>(it->second)->getValue();
-    }
-    
-    LOG_ERROR("torrent_protocol.TorrentFile", "Unable to fetch piece length");
-    return 0;
+    return m_geometry.PieceLength;
 }
 
 bool TorrentFile::isSingleFileMode() const
 {
-    return m_singleFileMode;
+    return m_geometry.SingleFile;
+}
+
+void TorrentFile::releaseMetaInfo()
+{
+    m_metaInfo.clear();
 }
 
 void TorrentFile::parseFile(const std::string &path)
@@ -134,71 +254,335 @@ void TorrentFile::parseFile(const std::string &path)
     encodedData.assign((std::istreambuf_iterator<char>(file)),
             std::istreambuf_iterator<char>());
 
-    // Decode dictionary and set it as metainfo
-    Decoder decoder;
-    m_metaInfo = std::static_pointer_cast<BenDictionary>(decoder.decode(encodedData));
+    // Validate and index the file in a single pass
+    if (!m_metaInfo.parse(std::move(encodedData)) || !m_metaInfo.getRoot().isDictionary())
+    {
+        LOG_ERROR("torrent_protocol.TorrentFile", "File ", path, " is not a valid torrent file");
+        m_metaInfo.clear();
+        return;
+    }
 
-    // Get digest of info dictionary
-    auto infoBeginPos = encodedData.find("4:info");
-    if (infoBeginPos != std::string::npos)
+    // Get digest of info dictionary, using its original bytes from the file
+    BenNode infoDict = getInfoDictionary();
+    std::string_view infoDictStr = infoDict.getEncoded();
+    if (!infoDictStr.empty() && infoDict.find("meta version").getInt() == 2 && !infoDict.find("pieces"))
     {
-        // Determine length of dictionary, get substring and then hash the value
-        infoBeginPos += 6;
-        std::string infoDictStr = encodedData.substr(infoBeginPos);
-        decoder.decode(infoDictStr);
+        // Torrents with only v2 metadata are identified by a SHA-256 digest, truncated to fit the wire protocol
+        merkle::Hash digest;
+        SHA256Hash::hash((const uint8_t*)infoDictStr.data(), infoDictStr.size(), digest.data());
+        memcpy(m_infoHash.data(), digest.data(), SHA_DIGEST_LENGTH);
+    }
+    else if (!infoDictStr.empty())
+    {
+        SHA1Hash digest;
+        digest.update((const uint8_t*)infoDictStr.data(), infoDictStr.size());
+        digest.finalize();
+        if (digest.getDigest() != nullptr)
+            memcpy(m_infoHash.data(), digest.getDigest(), SHA_DIGEST_LENGTH);
+    }
+
+    parseInfoDictionary();
+}
 
-        auto infoEndPos = decoder.getIndex();
-        infoDictStr = encodedData.substr(infoBeginPos, infoEndPos);
+void TorrentFile::parseInfoDictionary()
+{
+    std::string_view infoDictStr = getInfoDictionary().getEncoded();
+    if (infoDictStr.empty())
+        return;
+
+    // Keep the dictionary's bytes for peers that fetch the metadata from the client
+    m_infoDictionary.assign(infoDictStr.data(), infoDictStr.size());
+
+    // Determine the layout of the pieces and files
+    parseGeometry();
+
+    // Copy the digest of each piece into a flat table. Torrents with only v2 metadata have none
+    BenNode infoDict = getInfoDictionary();
+    if (infoDict.find("pieces") || infoDict.find("meta version").getInt() != 2)
+        loadPieceHashes();
 
-        m_infoHash.update((const uint8_t*)infoDictStr.c_str(), infoDictStr.size());
-        m_infoHash.finalize();
+    // Hybrid torrents carry a v2 file tree alongside the v1 file list, which was read along with the geometry
+    // for torrents with only v2 metadata
+    if (infoDict.find("meta version").getInt() == 2)
+    {
+        if (m_piecesRoots.empty())
+            loadFileTree();
+        loadPieceLayers();
     }
 
-    // Calculate total file size
-    calculateFileSize();
+    m_hasMetadata = (m_geometry.NumPieces > 0 && (m_pieceHashes.size() == m_geometry.NumPieces || hasV2Hashes()));
 }
 
-void TorrentFile::calculateFileSize()
+void TorrentFile::parseGeometry()
 {
-    BenDictionary *infoDict = getInfoDictionary();
+    BenNode infoDict = getInfoDictionary();
     if (!infoDict)
         return;
 
+    m_geometry.Name = std::string(infoDict.find("name").getString());
+    if (!isValidPathElement(m_geometry.Name))
+    {
+        LOG_ERROR("torrent_protocol.TorrentFile", "Torrent name \"", m_geometry.Name, "\" is not a valid file name");
+        return;
+    }
+
+    // The piece length is read first, as the files of v2 torrents are aligned to piece boundaries
+    int64_t pieceLength = infoDict.find("piece length").getInt();
+    if (pieceLength <= 0)
+    {
+        LOG_ERROR("torrent_protocol.TorrentFile", "Unable to fetch piece length");
+        return;
+    }
+    if ((uint64_t) pieceLength > TorrentGeometry::MaxPieceLength)
+    {
+        LOG_ERROR("torrent_protocol.TorrentFile", "Piece length of ", pieceLength, " bytes is not supported");
+        return;
+    }
+    m_geometry.PieceLength = (uint64_t) pieceLength;
+
     // If single file mode, file size will be assicated with key "length"
-    auto it = infoDict->find("length");
-    if (it != infoDict->end())
+    BenNode length = infoDict.find("length");
+    BenNode fileList = infoDict.find("files");
+    if (length.isInt())
     {
-        m_size = (uint64_t) bencast<BenInt*>(it->second)->getValue();
-        m_singleFileMode = true;
+        m_geometry.SingleFile = true;
+        m_geometry.TotalSize = (uint64_t) length.getInt();
+        m_geometry.Files.push_back(TorrentFileEntry{ m_geometry.TotalSize, 0, std::vector<std::string>{ m_geometry.Name } });
+    }
+    else if (fileList.isList())
+    {
+        // For multi-file mode, the total size is the sum of each file's respective length
+        m_geometry.SingleFile = false;
+
+        // Next, iterate through list of files, placing each one directly after the last
+        m_geometry.Files.reserve(fileList.size());
+        for (BenNode fileDict : fileList)
+        {
+            int64_t fileLength = fileDict.find("length").getInt(-1);
+            if (fileLength < 0)
+            {
+                LOG_ERROR("torrent_protocol.TorrentFile", "Unable to get length of file from info dictionary. Skipping file...");
+                continue;
+            }
+
+            // Pad files (BEP 47) align the next file to a piece boundary, and are never written to disk
+            if (fileDict.find("attr").getString().find('p') != std::string_view::npos)
+            {
+                m_geometry.TotalSize += (uint64_t) fileLength;
+                continue;
+            }
+
+            TorrentFileEntry entry{ (uint64_t) fileLength, m_geometry.TotalSize, std::vector<std::string>() };
+            for (BenNode pathElement : fileDict.find("path"))
+            {
+                // A file must not be written outside of the torrent's directory
+                std::string_view element = pathElement.getString();
+                if (!isValidPathElement(element))
+                {
+                    LOG_ERROR("torrent_protocol.TorrentFile", "Path of file in info dictionary has invalid component \"", element, "\"");
+                    m_geometry.Files.clear();
+                    m_geometry.TotalSize = 0;
+                    return;
+                }
+                entry.Path.emplace_back(element);
+            }
+
+            if (entry.Path.empty())
+            {
+                LOG_ERROR("torrent_protocol.TorrentFile", "Unable to find path of file in info dictionary. Skipping...");
+                continue;
+            }
+
+            m_geometry.TotalSize += entry.Length;
+            m_geometry.Files.push_back(std::move(entry));
+        }
+    }
+    else if (infoDict.find("meta version").getInt() == 2)
+    {
+        // Torrents with only v2 metadata describe their files through the file tree alone
+        loadFileTree();
     }
     else
     {
-        // For multi-file mode, must calculate the sum of each file's respective length
-        m_singleFileMode = false;
+        LOG_ERROR("torrent_protocol.TorrentFile", "Torrent is missing file information");
+        return;
+    }
+
+    // Also determine piece count and the size of the final piece based on total size
+    const uint64_t blockLength = TorrentGeometry::BlockLength;
+    m_geometry.NumPieces = (m_geometry.TotalSize + m_geometry.PieceLength - 1) / m_geometry.PieceLength;
+    if (m_geometry.NumPieces > 0)
+        m_geometry.FinalPieceLength = m_geometry.TotalSize - (m_geometry.NumPieces - 1) * m_geometry.PieceLength;
+    m_geometry.BlocksPerPiece = (uint32_t) ((m_geometry.PieceLength + blockLength - 1) / blockLength);
+    m_geometry.BlocksInFinalPiece = (uint32_t) ((m_geometry.FinalPieceLength + blockLength - 1) / blockLength);
+}
+
+bool TorrentFile::isValidPathElement(std::string_view element)
+{
+    return !element.empty() && element != "." && element != ".."
+            && element.find_first_of(std::string_view("/\\\0", 3)) == std::string_view::npos;
+}
 
-        // First get files list
-        it = infoDict->find("files");
-        if (it == infoDict->end())
+void TorrentFile::loadPieceHashes()
+{
+    std::string_view digestStr = getInfoDictionary().find("pieces").getString();
+    if (digestStr.size() != SHA_DIGEST_LENGTH * m_geometry.NumPieces)
+    {
+        LOG_ERROR("torrent_protocol.TorrentFile", "Expected ", m_geometry.NumPieces, " piece digests, torrent has ",
+                  digestStr.size() / SHA_DIGEST_LENGTH);
+        return;
+    }
+
+    m_pieceHashes.resize(m_geometry.NumPieces);
+    memcpy(m_pieceHashes.data(), digestStr.data(), digestStr.size());
+}
+
+bool TorrentFile::parseFileTree(const BenNode &node, std::vector<std::string> &path,
+                                std::vector<TorrentFileEntry> &files, std::vector<merkle::Hash> &roots)
+{
+    if (!node.isDictionary())
+        return false;
+
+    for (std::size_t pos = 0; pos < node.size(); ++pos)
+    {
+        std::string_view key = node.getKey(pos);
+        BenNode value = node.getValue(pos);
+
+        // A file is a node with an empty key, below the node named after the file
+        if (key.empty())
         {
-            LOG_ERROR("torrent_protocol.TorrentFile", "Torrent is missing file information");
-            return;
+            int64_t fileLength = value.find("length").getInt(-1);
+            if (path.empty() || fileLength < 0)
+                return false;
+
+            merkle::Hash root {};
+            if (fileLength > 0)
+            {
+                std::string_view rootStr = value.find("pieces root").getString();
+                if (rootStr.size() != root.size())
+                    return false;
+                memcpy(root.data(), rootStr.data(), root.size());
+            }
+
+            files.push_back(TorrentFileEntry{ (uint64_t) fileLength, 0, path });
+            roots.push_back(root);
+            continue;
         }
-        BenList *fileList = bencast<BenList*>(it->second);
 
-        // Next, iterate through list of files
-        for (auto fileIt = fileList->begin(); fileIt != fileList->end(); ++fileIt)
+        if (!isValidPathElement(key))
+            return false;
+
+        path.emplace_back(key);
+        if (!parseFileTree(value, path, files, roots))
+            return false;
+        path.pop_back();
+    }
+
+    return true;
+}
+
+void TorrentFile::loadFileTree()
+{
+    std::vector<std::string> path;
+    std::vector<TorrentFileEntry> files;
+    std::vector<merkle::Hash> roots;
+    if (!parseFileTree(getInfoDictionary().find("file tree"), path, files, roots) || files.empty())
+    {
+        LOG_ERROR("torrent_protocol.TorrentFile", "File tree of the torrent is missing or malformed");
+        return;
+    }
+
+    // Hybrid torrent: the file tree must describe the same files as the v1 file list
+    if (!m_geometry.Files.empty())
+    {
+        bool matches = (files.size() == m_geometry.Files.size());
+        for (std::size_t i = 0; matches && i < files.size(); ++i)
+        {
+            const TorrentFileEntry &file = m_geometry.Files[i];
+            matches = (files[i].Length == file.Length && files[i].Path == file.Path
+                       && (file.Length == 0 || file.Offset % m_geometry.PieceLength == 0));
+        }
+
+        if (!matches)
         {
-            BenDictionary *fileDict = bencast<BenDictionary*>(*fileIt);
-            auto lenIt = fileDict->find("length");
-            if (lenIt != fileDict->end())
-                m_size += bencast<BenInt*>(lenIt->second)->getValue();
+            LOG_WARNING("torrent_protocol.TorrentFile", "File tree of hybrid torrent does not match its file list, only v1 hashes will be used");
+            return;
         }
+
+        m_piecesRoots = std::move(roots);
+        return;
+    }
+
+    // Every file that has data begins at a piece boundary, with the gaps between files not part of any file
+    for (TorrentFileEntry &file : files)
+    {
+        if (file.Length > 0)
+            m_geometry.TotalSize = (m_geometry.TotalSize + m_geometry.PieceLength - 1) / m_geometry.PieceLength * m_geometry.PieceLength;
+
+        file.Offset = m_geometry.TotalSize;
+        m_geometry.TotalSize += file.Length;
+    }
+
+    m_geometry.SingleFile = (files.size() == 1 && files[0].Path.size() == 1 && files[0].Path[0] == m_geometry.Name);
+    m_geometry.Files = std::move(files);
+    m_piecesRoots = std::move(roots);
+}
+
+void TorrentFile::loadPieceLayers()
+{
+    if (m_piecesRoots.empty() || m_geometry.NumPieces == 0)
+        return;
+
+    const uint64_t pieceLength = m_geometry.PieceLength;
+    if (pieceLength < merkle::BlockSize || (pieceLength & (pieceLength - 1)) != 0)
+    {
+        LOG_ERROR("torrent_protocol.TorrentFile", "Piece length of ", pieceLength, " is not valid for a v2 torrent");
+        return;
     }
 
-    // Also determine piece count based on total size
-    it = infoDict->find("piece length");
-    if (it != infoDict->end())
+    // Subtrees of a piece layer beyond the end of a file are made of pieces whose leaves are all padding
+    BenNode pieceLayers = m_metaInfo.getRoot().find("piece layers");
+    const merkle::Hash padHash = merkle::getPadHash(pieceLength / merkle::BlockSize);
+
+    std::vector<merkle::Hash> hashes(m_geometry.NumPieces);
+    for (std::size_t i = 0; i < m_geometry.Files.size(); ++i)
     {
-        m_numPieces = (uint64_t) ceill( ((long double)m_size) / bencast<BenInt*>(it->second)->getValue() );
+        const TorrentFileEntry &file = m_geometry.Files[i];
+        if (file.Length == 0)
+            continue;
+
+        const uint64_t firstPiece = file.Offset / pieceLength;
+        const uint64_t numPieces = (file.Length + pieceLength - 1) / pieceLength;
+        if (file.Offset % pieceLength != 0 || firstPiece + numPieces > m_geometry.NumPieces)
+        {
+            LOG_ERROR("torrent_protocol.TorrentFile", "File ", i, " of the torrent is not aligned to a piece boundary");
+            return;
+        }
+
+        // The tree of a file that fits in one piece has the piece's subtree as its root
+        if (file.Length <= pieceLength)
+        {
+            hashes[firstPiece] = m_piecesRoots[i];
+            continue;
+        }
+
+        std::string_view layer = pieceLayers.find(std::string_view((const char*)m_piecesRoots[i].data(), SHA256_DIGEST_LENGTH)).getString();
+        if (layer.size() != numPieces * SHA256_DIGEST_LENGTH)
+        {
+            LOG_WARNING("torrent_protocol.TorrentFile", "Torrent has no piece layer for file ", i, ", v2 hashes will not be used");
+            return;
+        }
+
+        std::vector<merkle::Hash> fileHashes(numPieces);
+        memcpy(fileHashes.data(), layer.data(), layer.size());
+        if (merkle::computeRoot(fileHashes, merkle::roundUpToPowerOfTwo(numPieces), padHash) != m_piecesRoots[i])
+        {
+            LOG_ERROR("torrent_protocol.TorrentFile", "Piece layer of file ", i, " does not match the root of its tree");
+            return;
+        }
+
+        std::copy(fileHashes.begin(), fileHashes.end(), hashes.begin() + firstPiece);
     }
+
+    m_pieceLayerHashes = std::move(hashes);
 }
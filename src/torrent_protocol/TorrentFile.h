@@ -25,21 +25,26 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #pragma once
 
+#include <array>
+#include <atomic>
 #include <string>
+#include <string_view>
+#include <vector>
 
-#include "BenDictionary.h"
-#include "BenInt.h"
-#include "BenList.h"
-#include "BenString.h"
+#include "BenDocument.h"
 
+#include "MerkleTree.h"
 #include "SHA1Hash.h"
+#include "TorrentGeometry.h"
 
 #include "URL.h"
 
 /**
  * @class TorrentFile
  * @brief Represents a .torrent file stored on the local machine, used to
- *        download one or more files through the torrent protocol.
+ *        download one or more files through the torrent protocol. Both v1 torrents,
+ *        with a SHA-1 digest per piece, and v2 or hybrid torrents (BEP 52), with a
+ *        SHA-256 merkle tree per file, are understood.
  */
 class TorrentFile
 {
@@ -47,18 +52,62 @@ public:
     /// Constructs the torrent file object with the path to a torrent file on the local machine
     explicit TorrentFile(std::string path);
 
+    /// Constructs a torrent file that only knows its info hash, as added from a magnet link. The
+    /// name is shown until the info dictionary is set through \ref setInfoDictionary
+    TorrentFile(const uint8_t *infoHash, const std::string &name);
+
     /// Returns the announce URL
     http::URL getAnnounceURL();
 
-    /// Returns a shared pointer to the string containing the digests of each piece in the torrent file
-    std::shared_ptr<bencoding::BenString> getDigestString();
+    /// Returns the tiers of tracker URLs from the announce-list key (BEP 12). If the torrent
+    /// has no announce-list, a single tier containing the announce URL is returned
+    std::vector< std::vector<std::string> > getAnnounceList();
+
+    /// Returns the info dictionary associated with the torrent file, or an invalid node if it is missing
+    /// or the metainfo has been released
+    bencoding::BenNode getInfoDictionary() const;
+
+    /// Returns the bencoded info dictionary, which remains available after the metainfo is released
+    /// so that it can be sent to peers (ut_metadata). Empty until the metadata is known
+    const std::string &getInfoDictionaryData() const;
+
+    /// Sets the info dictionary of a torrent added from a magnet link, given its bencoded form as
+    /// received from peers. Returns false if it does not match the info hash or is malformed
+    bool setInfoDictionary(const std::string &encoded);
+
+    /// Returns true once the info dictionary, and with it the layout of the torrent, is known
+    bool hasMetadata() const;
+
+    /// Returns a pointer to the expected SHA-1 digest of the piece with the given index, or a null
+    /// pointer if the index is out of range
+    const uint8_t *getPieceHash(uint32_t pieceIdx) const;
 
-    /// Returns a pointer to the info dictionary associated with the torrent file
-    bencoding::BenDictionary *getInfoDictionary();
+    /// Returns true if the given digest matches the expected digest of the piece with the given index
+    bool checkPieceHash(uint32_t pieceIdx, const uint8_t *digest) const;
 
-    /// Returns the digest of the value of the info key from the torrent file
+    /// Returns true if the torrent has the merkle trees of BitTorrent v2, so that pieces and the blocks
+    /// within them can be verified with \ref getPieceLayerHash
+    bool hasV2Hashes() const;
+
+    /// Returns a pointer to the expected root of the merkle subtree spanning the piece with the given index,
+    /// or a null pointer if the index is out of range or the torrent has no v2 hashes
+    const uint8_t *getPieceLayerHash(uint32_t pieceIdx) const;
+
+    /// Returns a pointer to the root of the merkle tree of the file at the given index of the geometry's
+    /// file list, or a null pointer if the index is out of range or the torrent has no v2 hashes
+    const uint8_t *getPiecesRoot(std::size_t fileIdx) const;
+
+    /// Returns the index of the file whose merkle tree has the given root, or the number of files if
+    /// there is no such file
+    std::size_t findFileByPiecesRoot(const uint8_t *piecesRoot) const;
+
+    /// Returns the digest of the value of the info key from the torrent file. For torrents with only
+    /// v2 metadata, this is the SHA-256 digest truncated to 20 bytes, as used on the wire
     uint8_t *getInfoHash();
 
+    /// Returns the layout of the torrent's pieces and files
+    const TorrentGeometry &getGeometry() const;
+
     /// Returns the total length in bytes of the file(s) associated with the torrent
     const uint64_t &getFileSize() const;
 
@@ -66,31 +115,66 @@ public:
     const uint64_t &getNumPieces() const;
 
     /// Returns the number of bytes in each piece of the file (final piece be of a different length)
-    uint64_t getPieceLength();
+    const uint64_t &getPieceLength() const;
 
     /// Returns true if torrent represents a single file, false if else
     bool isSingleFileMode() const;
 
+    /// Frees the decoded metainfo, once all the information needed from it has been read.
+    /// Only the values cached by the torrent file (size, piece information, info hash) remain available
+    void releaseMetaInfo();
+
 private:
     /// Parses the torrent file with the given path, storing the decoded data into the meta info dictionary
     void parseFile(const std::string &path);
 
-    /// Calculates and sets the total byte size of the file(s) associated with the torrent
-    void calculateFileSize();
+    /// Reads the info dictionary of the parsed metainfo: its digest, the torrent's layout and piece digests
+    void parseInfoDictionary();
+
+    /// Reads the layout of the torrent's pieces and files from the info dictionary
+    void parseGeometry();
+
+    /// Returns true if the given name of a file or directory can be used as a single component of a path
+    /// below the download directory, i.e. it is not empty, "." or "..", and contains no separator
+    static bool isValidPathElement(std::string_view element);
+
+    /// Copies the digest of each piece from the info dictionary into the piece hash table
+    void loadPieceHashes();
+
+    /// Appends each file of the given node of a v2 file tree, and those of the nodes below it, to files,
+    /// along with the root of its merkle tree. Returns false if the tree is malformed
+    bool parseFileTree(const bencoding::BenNode &node, std::vector<std::string> &path,
+                       std::vector<TorrentFileEntry> &files, std::vector<merkle::Hash> &roots);
+
+    /// Reads the v2 file tree from the info dictionary. The files of v2 torrents are laid out from it, each one
+    /// starting at a piece boundary, while for hybrid torrents it must match the files already read from the v1 file list
+    void loadFileTree();
+
+    /// Reads the piece layer of each file from the metainfo, checking it against the root of the file's tree
+    void loadPieceLayers();
 
 private:
-    /// Total number of pieces that make up the torrent file
-    uint64_t m_numPieces;
+    /// Layout of the torrent's pieces and files
+    TorrentGeometry m_geometry;
+
+    /// Digest of the value of the info key from the torrent file
+    std::array<uint8_t, SHA_DIGEST_LENGTH> m_infoHash;
+
+    /// Bencoded info dictionary
+    std::string m_infoDictionary;
+
+    /// True once the info dictionary is known
+    std::atomic_bool m_hasMetadata;
 
-    /// Total size of the file(s) associated with the torrent, in bytes
-    uint64_t m_size;
+    /// Expected SHA-1 digest of each piece, indexed by piece number
+    std::vector< std::array<uint8_t, SHA_DIGEST_LENGTH> > m_pieceHashes;
 
-    /// Stores the digest of the value of the info key from the torrent file
-    SHA1Hash m_infoHash;
+    /// Root of the merkle tree of each file in the geometry's file list, all zeros for empty files (v2)
+    std::vector<merkle::Hash> m_piecesRoots;
 
-    /// True if single file mode, false if else
-    bool m_singleFileMode;
+    /// Expected root of the merkle subtree spanning each piece, indexed by piece number (v2)
+    std::vector<merkle::Hash> m_pieceLayerHashes;
 
     /// Metainfo contained in the torrent file
-    std::shared_ptr<bencoding::BenDictionary> m_metaInfo;
+    bencoding::BenDocument m_metaInfo;
 };
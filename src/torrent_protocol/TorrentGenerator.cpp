@@ -23,16 +23,49 @@ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
-#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <fstream>
+#include <mutex>
+#include <thread>
+#include <boost/filesystem.hpp>
 #include "BenInt.h"
+#include "BenList.h"
 #include "BenString.h"
 #include "Encoder.h"
+#include "OutputSink.h"
+#include "PieceHashCache.h"
 #include "SHA1Hash.h"
 #include "TorrentGenerator.h"
+#include "LogHelper.h"
 
 using namespace bencoding;
 
+/// Smallest piece length picked when none has been set
+const static int64_t MinAutoPieceLength = 16 * 1024;
+
+/// Largest piece length picked when none has been set
+const static int64_t MaxAutoPieceLength = 16 * 1024 * 1024;
+
+/// Number of pieces the automatic piece length aims for
+const static uint64_t TargetPieceCount = 1500;
+
+/// Maximum number of consecutive pieces read and hashed as one job
+const static uint64_t HashBatchSize = 8;
+
+/// Upper bound on the memory held by piece buffers while hashing
+const static uint64_t MaxHashBufferBytes = 128 * 1024 * 1024;
+
+TorrentGenerator::TorrentGenerator() :
+    m_metaInfo(),
+    m_numThreads(0),
+    m_progressHandler(),
+    m_hashCachePath()
+{
+}
+
 bool TorrentGenerator::createFile(const std::string &outputFile)
 {
     // Check if required key-value pairs are in metainfo dictionary
@@ -53,15 +86,14 @@ bool TorrentGenerator::createFile(const std::string &outputFile)
     if (infoDict->find("length") == infoDict->end() && infoDict->find("files") == infoDict->end())
         return false;
 
-    // Good to go
-    std::ofstream f(outputFile, std::ofstream::out | std::ofstream::trunc);
-    Encoder enc;
+    // Good to go, stream the encoded metainfo straight into the file
+    FileSink sink(outputFile);
+    if (!sink.good())
+        return false;
+
+    Encoder enc(sink);
     m_metaInfo.accept(enc);
-    const std::string &contents = enc.getData();
-    f.write(contents.c_str(), contents.size());
-    f.flush();
-    f.close();
-    return true;
+    return sink.flush();
 }
 
 void TorrentGenerator::setAnnounceURL(const std::string &url)
@@ -105,20 +137,423 @@ void TorrentGenerator::setPieceLength(int64_t length)
     infoDict->insert(std::make_pair("piece length", pieceLen));
 }
 
-void TorrentGenerator::setTarget(const std::string &path)
+void TorrentGenerator::setNumThreads(unsigned int numThreads)
 {
+    m_numThreads = numThreads;
+}
+
+void TorrentGenerator::setProgressHandler(ProgressHandler handler)
+{
+    m_progressHandler = std::move(handler);
+}
+
+void TorrentGenerator::setHashCache(const std::string &path)
+{
+    m_hashCachePath = path;
+}
+
+bool TorrentGenerator::setTarget(const std::string &path)
+{
+    namespace fs = boost::filesystem;
+
+    // Strip trailing separators so the last path element names the torrent
+    std::string trimmedPath = path;
+    while (trimmedPath.size() > 1 && trimmedPath.back() == '/')
+        trimmedPath.pop_back();
+
     // Check if path points to a file or a directory, or simply doesn't exist
     boost::system::error_code ec;
-    boost::filesystem::path p(path);
-    if (!boost::filesystem::exists(p, ec))
-        return;
+    fs::path root(trimmedPath);
+    if (!fs::exists(root, ec))
+    {
+        LOG_ERROR("torrent_protocol.TorrentGenerator", "Target ", path, " does not exist");
+        return false;
+    }
+
+    std::vector<InputFile> files;
+    const bool singleFile = !fs::is_directory(root, ec);
+    if (singleFile)
+    {
+        if (!fs::is_regular_file(root, ec))
+        {
+            LOG_ERROR("torrent_protocol.TorrentGenerator", "Target ", path, " is not a regular file");
+            return false;
+        }
+        files.push_back(InputFile{ root, 0, 0, 0, {} });
+    }
+    else
+    {
+        for (fs::recursive_directory_iterator it(root, ec), end; it != end; it.increment(ec))
+        {
+            if (ec)
+                break;
+
+            if (!fs::is_regular_file(it->status()))
+                continue;
+
+            InputFile file { it->path(), 0, 0, 0, {} };
+            for (const fs::path &element : file.Path.lexically_relative(root))
+                file.PathElements.push_back(element.string());
+            files.push_back(std::move(file));
+        }
+        if (ec)
+        {
+            LOG_ERROR("torrent_protocol.TorrentGenerator", "Unable to walk directory ", path, ", Error message: ", ec.message());
+            return false;
+        }
+
+        // Directory iteration order is unspecified, sort so the same tree always yields the same torrent
+        std::sort(files.begin(), files.end(), [](const InputFile &a, const InputFile &b) {
+            return a.PathElements < b.PathElements;
+        });
+    }
+
+    if (files.empty())
+    {
+        LOG_ERROR("torrent_protocol.TorrentGenerator", "Target ", path, " contains no files");
+        return false;
+    }
+
+    uint64_t totalSize = 0;
+    for (InputFile &file : files)
+    {
+        file.Length = fs::file_size(file.Path, ec);
+        if (ec)
+        {
+            LOG_ERROR("torrent_protocol.TorrentGenerator", "Error reported from calling boost::filesystem::file_size on ",
+                      file.Path.string(), " , Error message: ", ec.message());
+            return false;
+        }
+
+        file.ModifiedTime = static_cast<int64_t>(fs::last_write_time(file.Path, ec));
+        if (ec)
+        {
+            LOG_ERROR("torrent_protocol.TorrentGenerator", "Error reported from calling boost::filesystem::last_write_time on ",
+                      file.Path.string(), " , Error message: ", ec.message());
+            return false;
+        }
+
+        file.Offset = totalSize;
+        totalSize += file.Length;
+    }
+
+    // Use the configured piece length, or pick one from the size of the target
+    int64_t pieceLength = 0;
+    auto infoItr = m_metaInfo.find("info");
+    if (infoItr != m_metaInfo.end())
+    {
+        BenDictionary *infoDict = bencast<BenDictionary*>(infoItr->second);
+        auto lenItr = infoDict->find("piece length");
+        if (lenItr != infoDict->end())
+            pieceLength = bencast<BenInt*>(lenItr->second)->getValue();
+    }
+    if (pieceLength <= 0)
+    {
+        pieceLength = choosePieceLength(totalSize);
+        setPieceLength(pieceLength);
+    }
+
+    // An unreadable cache only costs a full rehash, so carry on without it
+    std::unique_ptr<PieceHashCache> cache;
+    if (!m_hashCachePath.empty())
+    {
+        cache = std::make_unique<PieceHashCache>();
+        cache->load(m_hashCachePath);
+    }
+
+    std::string pieces;
+    if (!hashFiles(files, totalSize, pieceLength, cache.get(), pieces))
+        return false;
 
-    if (boost::filesystem::is_directory(p, ec))
+    if (cache && !cache->save())
+        LOG_WARNING("torrent_protocol.TorrentGenerator", "Unable to update hash cache ", m_hashCachePath);
+
+    // Rebuild the info dictionary, keeping any keys unrelated to the target
+    std::shared_ptr<BenDictionary> oldInfo = std::static_pointer_cast<BenDictionary>(m_metaInfo["info"]);
+    std::shared_ptr<BenDictionary> infoDict = std::make_shared<BenDictionary>();
+    for (auto it = oldInfo->begin(); it != oldInfo->end(); ++it)
     {
-        // multi file torrent
+        if (it->first != "name" && it->first != "pieces" && it->first != "length" && it->first != "files")
+            infoDict->insert(*it);
     }
+
+    (*infoDict)["name"] = std::make_shared<BenString>(root.filename().string());
+    (*infoDict)["pieces"] = std::make_shared<BenString>(std::move(pieces));
+
+    if (singleFile)
+        (*infoDict)["length"] = std::make_shared<BenInt>(static_cast<int64_t>(totalSize));
     else
     {
-        // single file torrent
+        std::shared_ptr<BenList> fileList = std::make_shared<BenList>();
+        for (const InputFile &file : files)
+        {
+            std::shared_ptr<BenList> pathList = std::make_shared<BenList>();
+            for (const std::string &element : file.PathElements)
+                pathList->push_back(std::make_shared<BenString>(element));
+
+            std::shared_ptr<BenDictionary> fileDict = std::make_shared<BenDictionary>();
+            (*fileDict)["length"] = std::make_shared<BenInt>(static_cast<int64_t>(file.Length));
+            (*fileDict)["path"] = pathList;
+            fileList->push_back(fileDict);
+        }
+        (*infoDict)["files"] = fileList;
+    }
+
+    m_metaInfo["info"] = infoDict;
+    return true;
+}
+
+int64_t TorrentGenerator::choosePieceLength(uint64_t totalSize)
+{
+    int64_t length = MinAutoPieceLength;
+    while (length < MaxAutoPieceLength && totalSize / static_cast<uint64_t>(length) > TargetPieceCount)
+        length <<= 1;
+    return length;
+}
+
+bool TorrentGenerator::hashFiles(const std::vector<InputFile> &files, uint64_t totalSize, int64_t pieceLength,
+                                 PieceHashCache *cache, std::string &pieces)
+{
+    namespace fs = boost::filesystem;
+
+    const uint64_t pieceLen = static_cast<uint64_t>(pieceLength);
+    const uint64_t numPieces = (totalSize + pieceLen - 1) / pieceLen;
+    pieces.assign(numPieces * SHA_DIGEST_LENGTH, '\0');
+    if (numPieces == 0)
+        return true;
+
+    // Only pieces lying entirely within a single file can be cached, as their digests depend on
+    // nothing but that file's contents and its alignment against piece boundaries
+    auto getWholePieces = [&](const InputFile &file) {
+        const uint64_t first = (file.Offset + pieceLen - 1) / pieceLen;
+        const uint64_t last = (file.Offset + file.Length) / pieceLen;
+        return std::make_pair(first, std::max(first, last));
+    };
+
+    std::vector<std::string> cacheKeys;
+    std::vector<bool> cachedPieces(numPieces, false);
+    uint64_t cachedBytes = 0;
+    if (cache != nullptr)
+    {
+        for (const InputFile &file : files)
+        {
+            cacheKeys.push_back(fs::absolute(file.Path).lexically_normal().string());
+
+            auto range = getWholePieces(file);
+            const std::string *digests = cache->find(cacheKeys.back(), file.Length, file.ModifiedTime, pieceLength,
+                                                     static_cast<int64_t>(file.Offset % pieceLen));
+            if (range.first == range.second || digests == nullptr
+                    || digests->size() != (range.second - range.first) * SHA_DIGEST_LENGTH)
+                continue;
+
+            pieces.replace(range.first * SHA_DIGEST_LENGTH, digests->size(), *digests);
+            for (uint64_t i = range.first; i < range.second; ++i)
+                cachedPieces[i] = true;
+            cachedBytes += (range.second - range.first) * pieceLen;
+        }
+    }
+
+    // A job is a run of consecutive pieces in one buffer. Only a couple of jobs per thread are
+    // kept in flight, so memory stays bounded no matter how large the target is
+    unsigned int numThreads = m_numThreads;
+    if (numThreads == 0)
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+
+    const uint64_t batchSize = std::max<uint64_t>(1, std::min<uint64_t>(HashBatchSize, MaxHashBufferBytes / (pieceLen * 2)));
+    const uint64_t batchBytes = batchSize * pieceLen;
+    const uint64_t numBuffers = std::max<uint64_t>(2, std::min<uint64_t>(numThreads * 2, MaxHashBufferBytes / batchBytes));
+
+    struct HashJob
+    {
+        size_t Buffer;
+        uint64_t FirstPiece;
+        uint64_t Length;
+    };
+
+    std::vector< std::vector<uint8_t> > buffers(numBuffers);
+    std::vector<size_t> freeBuffers;
+    for (size_t i = 0; i < buffers.size(); ++i)
+        freeBuffers.push_back(i);
+
+    std::deque<HashJob> jobs;
+    std::mutex mutex;
+    std::condition_variable jobReady, bufferFree;
+    bool readDone = false;
+
+    std::mutex progressMutex;
+    std::atomic<uint64_t> bytesHashed(cachedBytes);
+
+    // Workers store each digest at its piece index, so the pieces string comes out in order
+    // regardless of which thread finishes first
+    auto hashWorker = [&]() {
+        std::vector<const uint8_t*> messages(batchSize);
+        for (;;)
+        {
+            HashJob job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                jobReady.wait(lock, [&]() { return !jobs.empty() || readDone; });
+                if (jobs.empty())
+                    return;
+                job = jobs.front();
+                jobs.pop_front();
+            }
+
+            const uint8_t *data = buffers[job.Buffer].data();
+            uint8_t *digests = reinterpret_cast<uint8_t*>(&pieces[job.FirstPiece * SHA_DIGEST_LENGTH]);
+
+            // Only the final piece of the torrent may be shorter than the rest
+            const uint64_t numFull = job.Length / pieceLen;
+            for (uint64_t i = 0; i < numFull; ++i)
+                messages[i] = data + i * pieceLen;
+            if (numFull > 0)
+                SHA1Hash::hashBatch(messages.data(), pieceLen, numFull, digests);
+
+            const uint64_t remainder = job.Length - numFull * pieceLen;
+            if (remainder > 0)
+            {
+                messages[0] = data + numFull * pieceLen;
+                SHA1Hash::hashBatch(messages.data(), remainder, 1, digests + numFull * SHA_DIGEST_LENGTH);
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                freeBuffers.push_back(job.Buffer);
+            }
+            bufferFree.notify_one();
+
+            bytesHashed += job.Length;
+            if (m_progressHandler)
+            {
+                std::lock_guard<std::mutex> lock(progressMutex);
+                m_progressHandler(bytesHashed.load(), totalSize);
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned int i = 0; i < numThreads; ++i)
+        workers.emplace_back(hashWorker);
+
+    // The calling thread reads every run of uncached pieces, seeking past the cached ones
+    bool success = true;
+    std::ifstream input;
+    size_t openFile = files.size();
+    uint64_t piece = 0;
+    while (success)
+    {
+        while (piece < numPieces && cachedPieces[piece])
+            ++piece;
+        if (piece == numPieces)
+            break;
+
+        uint64_t count = 1;
+        while (count < batchSize && piece + count < numPieces && !cachedPieces[piece + count])
+            ++count;
+
+        size_t bufferIdx;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            bufferFree.wait(lock, [&]() { return !freeBuffers.empty(); });
+            bufferIdx = freeBuffers.back();
+            freeBuffers.pop_back();
+        }
+
+        std::vector<uint8_t> &buffer = buffers[bufferIdx];
+        const uint64_t offset = piece * pieceLen;
+        const uint64_t length = std::min(count * pieceLen, totalSize - offset);
+        if (buffer.size() < length)
+            buffer.resize(length);
+
+        // Locate the last file starting at or before the offset, which skips any empty files
+        size_t fileIdx = std::upper_bound(files.begin(), files.end(), offset, [](uint64_t value, const InputFile &file) {
+            return value < file.Offset;
+        }) - files.begin() - 1;
+
+        uint64_t filled = 0;
+        while (filled < length)
+        {
+            const InputFile &file = files[fileIdx];
+            const uint64_t position = offset + filled - file.Offset;
+            if (position >= file.Length)
+            {
+                if (++fileIdx >= files.size())
+                {
+                    success = false;
+                    break;
+                }
+                continue;
+            }
+
+            if (openFile != fileIdx)
+            {
+                input.close();
+                input.clear();
+                input.open(file.Path.string(), std::ios_base::in | std::ios_base::binary);
+                if (!input.is_open())
+                {
+                    LOG_ERROR("torrent_protocol.TorrentGenerator", "Unable to open ", file.Path.string(), " for reading");
+                    success = false;
+                    break;
+                }
+                openFile = fileIdx;
+            }
+
+            const uint64_t chunk = std::min(file.Length - position, length - filled);
+            if (static_cast<uint64_t>(input.tellg()) != position)
+                input.seekg(static_cast<std::streamoff>(position));
+
+            input.read(reinterpret_cast<char*>(&buffer[filled]), static_cast<std::streamsize>(chunk));
+            if (static_cast<uint64_t>(input.gcount()) != chunk)
+            {
+                LOG_ERROR("torrent_protocol.TorrentGenerator", "Unexpected end of file while reading ", file.Path.string());
+                success = false;
+                break;
+            }
+            filled += chunk;
+        }
+
+        if (!success)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            freeBuffers.push_back(bufferIdx);
+            break;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(HashJob{ bufferIdx, piece, length });
+        }
+        jobReady.notify_one();
+        piece += count;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        readDone = true;
+    }
+    jobReady.notify_all();
+
+    for (std::thread &worker : workers)
+        worker.join();
+
+    if (!success)
+        return false;
+
+    // Remember the whole pieces of every file for the next generation
+    if (cache != nullptr)
+    {
+        for (size_t i = 0; i < files.size(); ++i)
+        {
+            const InputFile &file = files[i];
+            auto range = getWholePieces(file);
+            if (range.first == range.second)
+                continue;
+
+            cache->store(cacheKeys[i], file.Length, file.ModifiedTime, pieceLength, static_cast<int64_t>(file.Offset % pieceLen),
+                         pieces.substr(range.first * SHA_DIGEST_LENGTH, (range.second - range.first) * SHA_DIGEST_LENGTH));
+        }
     }
+
+    return true;
 }
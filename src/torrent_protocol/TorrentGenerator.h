@@ -27,7 +27,13 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "BenDictionary.h"
 
+#include <cstdint>
+#include <functional>
 #include <string>
+#include <vector>
+#include <boost/filesystem/path.hpp>
+
+class PieceHashCache;
 
 /**
  * @class TorrentGenerator
@@ -37,9 +43,14 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 class TorrentGenerator
 {
+public:
+    /// Callback invoked as pieces are hashed, with the number of bytes hashed so far
+    /// and the total number of bytes in the target. May be called from a worker thread.
+    typedef std::function<void(uint64_t, uint64_t)> ProgressHandler;
+
 public:
     /// Default constructor
-    TorrentGenerator() = default;
+    TorrentGenerator();
 
     /// Creates the metainfo file, outputting the contents into the file with the given path.
     /// Returns true on successful generation, otherwise false.
@@ -48,14 +59,66 @@ public:
     /// Sets the string of the announcer which will store information about the torrent
     void setAnnounceURL(const std::string &url);
 
-    /// Sets the length parameter of each piece of the torrent
+    /// Sets the length parameter of each piece of the torrent. If no piece length
+    /// is set before the target, one is chosen based on the size of the target
     void setPieceLength(int64_t length);
 
-    /// Sets the target file or directory for torrent generation.
-    /// Must only be called after the piece length is set
-    void setTarget(const std::string &path);
+    /// Sets the number of threads used to hash the target. A value of 0 uses
+    /// one thread per hardware thread
+    void setNumThreads(unsigned int numThreads);
+
+    /// Sets the function that is notified of hashing progress
+    void setProgressHandler(ProgressHandler handler);
+
+    /// Sets the location of a hash cache, which lets later calls to setTarget reuse the piece
+    /// digests of files whose size and modification time have not changed. An empty path disables
+    /// the cache
+    void setHashCache(const std::string &path);
+
+    /// Sets the target file or directory for torrent generation, building the
+    /// file list and hashing every piece of its contents. Returns true on success
+    bool setTarget(const std::string &path);
+
+private:
+    /// A regular file included in the torrent
+    struct InputFile
+    {
+        /// Location of the file on disk
+        boost::filesystem::path Path;
+
+        /// Length of the file in bytes
+        uint64_t Length;
+
+        /// Offset of the first byte of the file within the torrent
+        uint64_t Offset;
+
+        /// Last modification time of the file
+        int64_t ModifiedTime;
+
+        /// Path elements relative to the target directory
+        std::vector<std::string> PathElements;
+    };
+
+private:
+    /// Returns a power-of-two piece length suited to a target of the given size
+    static int64_t choosePieceLength(uint64_t totalSize);
+
+    /// Reads the concatenated contents of the given files, storing the SHA-1 digest of each piece in
+    /// pieces. Pieces found in the cache, if one is given, are not read. Returns false if any file
+    /// could not be read in full
+    bool hashFiles(const std::vector<InputFile> &files, uint64_t totalSize, int64_t pieceLength,
+                   PieceHashCache *cache, std::string &pieces);
 
 private:
     /// Metainfo dictionary
     bencoding::BenDictionary m_metaInfo;
+
+    /// Number of hashing threads, or 0 to match the hardware
+    unsigned int m_numThreads;
+
+    /// Progress notification callback
+    ProgressHandler m_progressHandler;
+
+    /// Location of the hash cache, empty if no cache is used
+    std::string m_hashCachePath;
 };
@@ -0,0 +1,106 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Describes a single file within a torrent, and where its data
+ *        lies in the torrent's stream of pieces.
+ */
+struct TorrentFileEntry
+{
+    /// Length of the file in bytes
+    uint64_t Length;
+
+    /// Offset of the first byte of the file in the torrent's data
+    uint64_t Offset;
+
+    /// Path of the file relative to the torrent's base directory, one element per path component
+    std::vector<std::string> Path;
+};
+
+/**
+ * @brief Layout of a torrent's data, parsed once from the info dictionary so that
+ *        no lookups into the metainfo are needed once the torrent has been loaded.
+ */
+struct TorrentGeometry
+{
+    /// Length of each block (fragment) requested from peers
+    static constexpr uint32_t BlockLength = 16384;
+
+    /// Largest piece length accepted from a torrent, as each piece being downloaded is held in memory
+    static constexpr uint64_t MaxPieceLength = 128 * 1024 * 1024;
+
+    /// Name of the file (single-file mode) or base directory (multi-file mode)
+    std::string Name;
+
+    /// Total size of the torrent's data, in bytes
+    uint64_t TotalSize;
+
+    /// Number of bytes in each piece, except possibly the final piece
+    uint64_t PieceLength;
+
+    /// Number of bytes in the final piece
+    uint64_t FinalPieceLength;
+
+    /// Number of pieces that make up the torrent
+    uint64_t NumPieces;
+
+    /// Number of blocks in each piece, except possibly the final piece
+    uint32_t BlocksPerPiece;
+
+    /// Number of blocks in the final piece
+    uint32_t BlocksInFinalPiece;
+
+    /// True if the torrent contains a single file, false if it describes a directory
+    bool SingleFile;
+
+    /// Files of the torrent, in order. Single-file torrents have one entry, whose path is the name
+    std::vector<TorrentFileEntry> Files;
+
+    /// Default constructor
+    TorrentGeometry() : Name(), TotalSize(0), PieceLength(0), FinalPieceLength(0), NumPieces(0),
+        BlocksPerPiece(0), BlocksInFinalPiece(0), SingleFile(false), Files() {}
+
+    /// Returns the length of the piece with the given index
+    uint64_t getPieceLength(uint32_t pieceIdx) const { return (pieceIdx + 1 == NumPieces) ? FinalPieceLength : PieceLength; }
+
+    /// Returns the number of blocks in the piece with the given index
+    uint32_t getNumBlocks(uint32_t pieceIdx) const { return (pieceIdx + 1 == NumPieces) ? BlocksInFinalPiece : BlocksPerPiece; }
+
+    /// Returns the index of the file containing the byte at the given offset in the torrent's data,
+    /// or Files.size() if the offset is past the end of the torrent
+    std::size_t findFile(uint64_t offset) const
+    {
+        auto it = std::upper_bound(Files.begin(), Files.end(), offset,
+                                   [](uint64_t value, const TorrentFileEntry &entry) { return value < entry.Offset + entry.Length; });
+        return it - Files.begin();
+    }
+};
@@ -26,16 +26,33 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <cstring>
 
 #include <algorithm>
+#include <chrono>
 #include <functional>
 #include <random>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "LogHelper.h"
 
 #include "TorrentMgr.h"
 #include "TorrentFile.h"
+#include "MagnetLink.h"
+#include "ExtensionRegistry.h"
+#include "MetadataExtension.h"
+#include "PexExtension.h"
 
 const char *PeerNameVersion = "-BTP001-";
 
+/// Number of minutes between each round of tracker scrapes
+const static long ScrapeIntervalMinutes = 15;
+
+/// Number of requests queued for each peer, unless configured otherwise
+const static uint32_t DefaultRequestQueueSize = 250;
+
+/// Upper bound on the configured number of requests queued for each peer
+const static uint32_t MaxRequestQueueSize = 4096;
+
 TorrentMgr::TorrentMgr(const std::string &configFile) :
     m_ioService(),
     m_signalSet(m_ioService, SIGINT, SIGTERM),
@@ -44,7 +61,14 @@ TorrentMgr::TorrentMgr(const std::string &configFile) :
     m_trackerTimers(),
     m_connectionMgr(std::make_shared< network::ConnectionMgr<network::Peer> >(m_ioService)),
     m_trackerMgr(m_ioService),
+    m_scrapeMgr(m_ioService),
+    m_scrapeTimer(m_ioService),
     m_peerListener(m_ioService),
+    m_dhtNode(std::make_shared<dht::DHTNode>(m_ioService)),
+    m_localDiscovery(std::make_shared<network::LocalServiceDiscovery>(m_ioService)),
+    m_utpSocketMgr(std::make_shared<network::UTPSocketMgr>(m_ioService)),
+    m_uploadScheduler(std::make_shared<network::UploadScheduler>(m_ioService)),
+    m_timerWheel(std::make_shared<network::TimerWheel>(m_ioService)),
     m_config()
 {
     std::random_device rd;
@@ -58,12 +82,25 @@ TorrentMgr::TorrentMgr(const std::string &configFile) :
 
     // Load configuration file
     m_config.loadFile(configFile);
+
+    // Register the extensions offered to peers through the extension protocol
+    network::ExtensionRegistry::registerExtension("ut_pex", [](network::Peer &peer) {
+        return std::unique_ptr<network::PeerExtension>(new network::PexExtension(peer));
+    });
+    network::ExtensionRegistry::registerExtension("ut_metadata", [](network::Peer &peer) {
+        return std::unique_ptr<network::PeerExtension>(new network::MetadataExtension(peer));
+    });
 }
 
 TorrentMgr::~TorrentMgr()
 {
     if (m_ioThread.get_id() != std::thread::id())
         m_ioThread.join();
+
+    // Save the routing table for a fast start next time
+    auto statePath = m_config.getValue<std::string>("dht.state_file");
+    if (m_dhtNode->isConnected() && statePath)
+        m_dhtNode->saveState(*statePath);
 }
 
 void TorrentMgr::run()
@@ -79,13 +116,34 @@ void TorrentMgr::run()
 
             // Run tracker connection manager and peer connection manager
             m_trackerMgr.run();
+            m_scrapeMgr.run();
             m_connectionMgr->run();
+            m_timerWheel->run();
+
+            // Scrape trackers shortly after startup, once the initial announces have been made
+            m_scrapeTimer.expires_from_now(boost::posix_time::seconds(30));
+            m_scrapeTimer.async_wait(std::bind(&TorrentMgr::scrapeTrackers, this, std::placeholders::_1));
 
             // Start tcp listener
             auto listenPort = m_config.getValue<int>("network.listen_port");
             auto maxConnections = m_config.getValue<int>("network.max_pending_connections");
             if (listenPort && maxConnections)
                 m_peerListener.start(*listenPort, *maxConnections, m_connectionMgr);
+
+            // uTP shares the port number of the listener, over UDP
+            auto utpEnabled = m_config.getValue<bool>("network.utp");
+            if (listenPort && maxConnections && utpEnabled && *utpEnabled)
+                startUTP(*listenPort);
+
+            auto localDiscovery = m_config.getValue<bool>("network.local_discovery");
+            if (listenPort && localDiscovery && *localDiscovery)
+                startLocalDiscovery(*listenPort);
+
+            // The UDP port of the listener's number belongs to uTP, so the DHT node defaults to the next one
+            auto dhtEnabled = m_config.getValue<bool>("dht.enabled");
+            auto dhtPort = m_config.getValue<int>("dht.port");
+            if (listenPort && dhtEnabled && *dhtEnabled)
+                startDHT(dhtPort ? *dhtPort : *listenPort + 1);
             this->m_ioService.run();
         }
     );
@@ -93,36 +151,60 @@ void TorrentMgr::run()
 
 std::shared_ptr<TorrentState> TorrentMgr::addTorrent(const std::string &torrentPath)
 {
+    if (MagnetLink::isMagnetURI(torrentPath))
+        return addMagnetLink(torrentPath);
+
     auto retVal = std::make_shared<TorrentState>(torrentPath);
 
     // Check that the torrent file is valid (if file size == 0, invalid)
     auto &torrentRef = retVal->getTorrentFile();
     if (torrentRef->getFileSize() > 0)
     {
-        // Add to map, begin download process, return shared_ptr
-        {
-            std::lock_guard<std::mutex> lock(m_torrentLock);
-            m_torrentMap[torrentRef->getInfoHash()] = retVal;
-        }
-
-
-        // Add new deadline timer for connecting to tracker
-        std::unique_ptr<boost::asio::deadline_timer> trackerTimer(new boost::asio::deadline_timer(m_ioService));
-        m_trackerTimers.push_back(std::move(trackerTimer));
-
-        // Connect to tracker immediately, then every few minutes
-        connectToTracker(m_trackerTimers.at(m_trackerTimers.size() - 1).get(), torrentRef->getInfoHash());
-
         /*if (retVal->verifyFile())
             LOG_INFO("torrent_protocol.mgr", "Each piece of file verified!");
         else
             LOG_INFO("torrent_protocol.mgr", "Could not verify file!");*/
-        return retVal;
+        return registerTorrent(retVal);
     }
 
     return std::shared_ptr<TorrentState>(nullptr);
 }
 
+std::shared_ptr<TorrentState> TorrentMgr::addMagnetLink(const std::string &uri)
+{
+    MagnetLink magnetLink(uri);
+    if (!magnetLink.isValid())
+    {
+        LOG_ERROR("torrent_protocol.mgr", "Magnet link ", uri, " is not valid");
+        return std::shared_ptr<TorrentState>(nullptr);
+    }
+
+    return registerTorrent(std::make_shared<TorrentState>(magnetLink));
+}
+
+std::shared_ptr<TorrentState> TorrentMgr::registerTorrent(std::shared_ptr<TorrentState> torrent)
+{
+    uint8_t *infoHash = torrent->getTorrentFile()->getInfoHash();
+
+    // Add to map, begin download process, return shared_ptr
+    {
+        std::lock_guard<std::mutex> lock(m_torrentLock);
+        auto it = m_torrentMap.find(infoHash);
+        if (it != m_torrentMap.end())
+            return it->second;
+
+        m_torrentMap[infoHash] = torrent;
+    }
+
+    // Add new deadline timer for connecting to tracker
+    std::unique_ptr<boost::asio::deadline_timer> trackerTimer(new boost::asio::deadline_timer(m_ioService));
+    m_trackerTimers.push_back(std::move(trackerTimer));
+
+    // Connect to tracker immediately, then every few minutes
+    connectToTracker(m_trackerTimers.at(m_trackerTimers.size() - 1).get(), infoHash);
+    return torrent;
+}
+
 bool TorrentMgr::hasTorrentFile(uint8_t *infoHash)
 {
     std::lock_guard<std::mutex> lock(m_torrentLock);
@@ -144,6 +226,46 @@ const char *TorrentMgr::getPeerID() const
     return m_peerID;
 }
 
+uint16_t TorrentMgr::getListenPort()
+{
+    auto listenPort = m_config.getValue<int>("network.listen_port");
+    return listenPort ? static_cast<uint16_t>(*listenPort) : 0;
+}
+
+std::shared_ptr< network::ConnectionMgr<network::Peer> > TorrentMgr::getPeerConnectionMgr()
+{
+    return m_connectionMgr;
+}
+
+std::shared_ptr<network::UploadScheduler> TorrentMgr::getUploadScheduler()
+{
+    return m_uploadScheduler;
+}
+
+std::shared_ptr<network::TimerWheel> TorrentMgr::getTimerWheel()
+{
+    return m_timerWheel;
+}
+
+uint32_t TorrentMgr::getRequestQueueSize()
+{
+    auto requestQueueSize = m_config.getValue<int>("network.request_queue_size");
+    if (!requestQueueSize || *requestQueueSize <= 0)
+        return DefaultRequestQueueSize;
+    return std::min(static_cast<uint32_t>(*requestQueueSize), MaxRequestQueueSize);
+}
+
+uint16_t TorrentMgr::getDHTPort()
+{
+    return m_dhtNode->isConnected() ? m_dhtNode->getPort() : 0;
+}
+
+void TorrentMgr::addDHTNode(const boost::asio::ip::udp::endpoint &endpoint)
+{
+    if (m_dhtNode->isConnected())
+        m_dhtNode->ping(endpoint);
+}
+
 std::string TorrentMgr::getDownloadDirectory()
 {
     if (auto dir = m_config.getValue<std::string>("disk.download_dir"))
@@ -161,25 +283,203 @@ void TorrentMgr::connectToTracker(boost::asio::deadline_timer *timer, uint8_t *i
     if (timer == nullptr)
         return;
 
-    auto torrent = m_torrentMap.find(infoHash);
-    if (torrent == m_torrentMap.end())
+    std::shared_ptr<TorrentState> torrentPtr = getTorrentState(infoHash);
+    if (!torrentPtr.get())
         return;
 
-    std::shared_ptr<TorrentState> torrentPtr = torrent->second;
+    // Announce to every tier concurrently, starting with the best tracker of each tier
+    TrackerList &trackers = torrentPtr->getTrackerList();
+    trackers.beginRound();
+    for (size_t tier = 0; tier < trackers.getNumTiers(); ++tier)
+        announceToTier(torrentPtr, tier, 0);
+
+    if (m_localDiscovery->isConnected())
+        m_localDiscovery->announce(infoHash);
+
+    // Find peers through the DHT as well, which is the only source of peers for trackerless torrents
+    uint16_t listenPort = getListenPort();
+    if (m_dhtNode->isConnected() && listenPort != 0)
+    {
+        std::shared_ptr< network::ConnectionMgr<network::Peer> > connectionMgr = m_connectionMgr;
+        m_dhtNode->announce(infoHash, listenPort, [torrentPtr, connectionMgr](const std::vector<boost::asio::ip::tcp::endpoint> &peers) mutable
+        {
+            for (const auto &endpoint : peers)
+            {
+                if (torrentPtr->addPeerCandidate(endpoint))
+                    connectionMgr->attemptConnection(endpoint.address(), endpoint.port(), torrentPtr);
+            }
+        });
+    }
+
+    timer->expires_from_now(boost::posix_time::minutes(5));
+    timer->async_wait(std::bind(&TorrentMgr::connectToTracker, this, timer, infoHash));
+}
+
+void TorrentMgr::announceToTier(std::shared_ptr<TorrentState> torrent, size_t tier, size_t attempt)
+{
+    TrackerList &trackers = torrent->getTrackerList();
+    std::string trackerURL = trackers.getTracker(tier, attempt);
+    if (trackerURL.empty())
+        return;
+
+    http::URL url(trackerURL);
+    network::Socket::Mode mode;
+    if (url.getScheme() == "udp")
+        mode = network::Socket::Mode::UDP;
+    else if (url.getScheme() == "http")
+        mode = network::Socket::Mode::TCP;
+    else
+    {
+        // Unsupported scheme, move on to the next tracker in the tier
+        trackers.onAnnounceFailure(tier, trackerURL);
+        announceToTier(torrent, tier, attempt + 1);
+        return;
+    }
 
     // Instantiate tracker client
-    auto trackerClient = std::make_shared<network::TrackerClient>(m_ioService, network::Socket::Mode::TCP);
+    auto trackerClient = std::make_shared<network::TrackerClient>(m_ioService, mode);
     trackerClient->setPeerID(m_peerID);
-    trackerClient->setTorrentState(torrentPtr);
+    trackerClient->setTorrentState(torrent);
     trackerClient->setConnectionMgr(m_connectionMgr);
+    trackerClient->setTrackerURL(url);
+
+    // Record the result, failing over to the next tracker of the tier if unsuccessful
+    auto startTime = std::chrono::steady_clock::now();
+    trackerClient->setResultHandler([this, torrent, tier, attempt, trackerURL, startTime](bool success)
+    {
+        TrackerList &trackerList = torrent->getTrackerList();
+        if (success)
+        {
+            auto latency = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime);
+            trackerList.onAnnounceSuccess(tier, trackerURL, (uint32_t)latency.count());
+        }
+        else
+        {
+            trackerList.onAnnounceFailure(tier, trackerURL);
+            announceToTier(torrent, tier, attempt + 1);
+        }
+    });
+
+    // Connect client to tracker service, and add it to its connection manager
+    if (trackerClient->start())
+        m_trackerMgr.addConnection(trackerClient);
+}
+
+void TorrentMgr::startLocalDiscovery(uint16_t listenPort)
+{
+    // Local peers are connected to as soon as they are announced, bypassing the retry window of peer candidates
+    m_localDiscovery->setPeerHandler([this](const std::string &infoHash, const boost::asio::ip::tcp::endpoint &endpoint)
+    {
+        uint8_t infoHashBytes[20];
+        memcpy(infoHashBytes, infoHash.data(), sizeof(infoHashBytes));
 
-    // Connect client to tracker service
-    auto trackerEndpoint = trackerClient->findTrackerEndpointTCP();
-    trackerClient->connect(trackerEndpoint);
+        std::shared_ptr<TorrentState> torrent = getTorrentState(infoHashBytes);
+        if (!torrent.get())
+            return;
 
-    // Add tracker client to its connection manager
-    m_trackerMgr.addConnection(trackerClient);
+        torrent->addLocalPeer(endpoint.address());
+        m_connectionMgr->attemptConnection(endpoint.address(), endpoint.port(), torrent);
+    });
 
-    timer->expires_from_now(boost::posix_time::minutes(5));
-    timer->async_wait(std::bind(&TorrentMgr::connectToTracker, this, timer, infoHash));
+    if (m_localDiscovery->start(listenPort))
+        LOG_INFO("torrent_protocol.mgr", "Local service discovery started");
+}
+
+void TorrentMgr::startUTP(uint16_t listenPort)
+{
+    if (!m_utpSocketMgr->start(listenPort))
+        return;
+
+    m_peerListener.acceptUTP(m_utpSocketMgr);
+    m_connectionMgr->setUTPSocketMgr(m_utpSocketMgr);
+    LOG_INFO("torrent_protocol.mgr", "uTP started on port ", listenPort);
+}
+
+void TorrentMgr::startDHT(uint16_t port)
+{
+    auto statePath = m_config.getValue<std::string>("dht.state_file");
+    if (statePath)
+        m_dhtNode->loadState(*statePath);
+
+    // Bootstrap nodes are given as a comma separated list of host:port pairs
+    auto bootstrapNodes = m_config.getValue<std::string>("dht.bootstrap_nodes");
+    std::string nodeList = bootstrapNodes ? *bootstrapNodes : std::string();
+    size_t pos = 0;
+    while (pos < nodeList.size())
+    {
+        size_t end = nodeList.find(',', pos);
+        if (end == std::string::npos)
+            end = nodeList.size();
+
+        std::string node = nodeList.substr(pos, end - pos);
+        pos = end + 1;
+
+        size_t portPos = node.rfind(':');
+        if (portPos == std::string::npos)
+            continue;
+
+        boost::system::error_code ec;
+        boost::asio::ip::udp::resolver resolver(m_ioService);
+        boost::asio::ip::udp::resolver::query query(boost::asio::ip::udp::v4(), node.substr(0, portPos), node.substr(portPos + 1));
+        auto it = resolver.resolve(query, ec);
+        if (ec || it == boost::asio::ip::udp::resolver::iterator())
+        {
+            LOG_WARNING("torrent_protocol.mgr", "Unable to resolve DHT bootstrap node ", node);
+            continue;
+        }
+        m_dhtNode->addBootstrapNode(*it);
+    }
+
+    if (m_dhtNode->start(port))
+        LOG_INFO("torrent_protocol.mgr", "DHT node started on port ", port);
+}
+
+void TorrentMgr::scrapeTrackers(const boost::system::error_code &ec)
+{
+    if (ec)
+        return;
+
+    // Group torrents by the scrape URL of their tracker
+    typedef std::pair< http::URL, std::vector< std::shared_ptr<TorrentState> > > TrackerGroup;
+    std::unordered_map<std::string, TrackerGroup> trackerGroups;
+    {
+        std::lock_guard<std::mutex> lock(m_torrentLock);
+        for (auto &torrent : m_torrentMap)
+        {
+            // Scrape the tracker currently preferred in the first tier
+            http::URL url(torrent.second->getTrackerList().getTracker(0, 0));
+            if (url.getScheme() != "udp" && !url.convertToScrape())
+                continue;
+
+            std::string key = url.getScheme() + "://" + url.getHost() + "/" + url.getPageName();
+            auto groupItr = trackerGroups.find(key);
+            if (groupItr == trackerGroups.end())
+                groupItr = trackerGroups.emplace(key, TrackerGroup(url, std::vector< std::shared_ptr<TorrentState> >())).first;
+            groupItr->second.second.push_back(torrent.second);
+        }
+    }
+
+    // Send one request per tracker for each batch of info hashes
+    for (auto &group : trackerGroups)
+    {
+        const http::URL &url = group.second.first;
+        auto &torrents = group.second.second;
+
+        network::Socket::Mode mode = (url.getScheme() == "udp") ? network::Socket::Mode::UDP : network::Socket::Mode::TCP;
+        size_t maxPerRequest = (mode == network::Socket::Mode::UDP) ? network::ScrapeClient::MaxHashesUDP : network::ScrapeClient::MaxHashesHTTP;
+
+        for (size_t i = 0; i < torrents.size(); i += maxPerRequest)
+        {
+            auto scrapeClient = std::make_shared<network::ScrapeClient>(m_ioService, mode);
+            scrapeClient->setTrackerURL(url);
+            for (size_t j = i; j < std::min(i + maxPerRequest, torrents.size()); ++j)
+                scrapeClient->addTorrent(torrents.at(j));
+
+            if (scrapeClient->start())
+                m_scrapeMgr.addConnection(scrapeClient);
+        }
+    }
+
+    m_scrapeTimer.expires_from_now(boost::posix_time::minutes(ScrapeIntervalMinutes));
+    m_scrapeTimer.async_wait(std::bind(&TorrentMgr::scrapeTrackers, this, std::placeholders::_1));
 }
@@ -33,10 +33,16 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "Configuration.h"
 #include "ConnectionMgr.h"
+#include "DHTNode.h"
 #include "Listener.h"
+#include "LocalServiceDiscovery.h"
 #include "Peer.h"
+#include "ScrapeClient.h"
+#include "TimerWheel.h"
 #include "TorrentState.h"
 #include "TrackerClient.h"
+#include "UploadScheduler.h"
+#include "UTPSocketMgr.h"
 
 #include "HashMapUtils.h"
 
@@ -65,6 +71,11 @@ public:
     /// immediately.
     std::shared_ptr<TorrentState> addTorrent(const std::string &torrentPath);
 
+    /// Adds a torrent from a magnet link. Its metadata is fetched from the peers found through the
+    /// link's trackers, the DHT and local discovery, after which the download begins.
+    /// Returns a null pointer if the link is not valid
+    std::shared_ptr<TorrentState> addMagnetLink(const std::string &uri);
+
     /// Returns true if the client has a torrent file associated with the given infoHash, false if else.
     /// Used when a peer initiates a handshake with us
     bool hasTorrentFile(uint8_t *infoHash);
@@ -75,6 +86,28 @@ public:
     /// Returns a pointer to the client's peer id
     const char *getPeerID() const;
 
+    /// Returns the port on which incoming peer connections are accepted, or 0 if not listening
+    uint16_t getListenPort();
+
+    /// Returns the peer connection manager
+    std::shared_ptr< network::ConnectionMgr<network::Peer> > getPeerConnectionMgr();
+
+    /// Returns the scheduler serving the requests of every peer
+    std::shared_ptr<network::UploadScheduler> getUploadScheduler();
+
+    /// Returns the timer wheel running the timeouts of the peer connections
+    std::shared_ptr<network::TimerWheel> getTimerWheel();
+
+    /// Returns the number of requests queued for each peer before further requests are rejected,
+    /// as advertised to peers in the extended handshake
+    uint32_t getRequestQueueSize();
+
+    /// Returns the UDP port of the client's DHT node, or 0 if the DHT is not enabled
+    uint16_t getDHTPort();
+
+    /// Offers a node to the DHT, which pings it and adds it to the routing table if it responds
+    void addDHTNode(const boost::asio::ip::udp::endpoint &endpoint);
+
     /// Returns the directory of which torrent files are to be downloaded
     std::string getDownloadDirectory();
 
@@ -82,10 +115,32 @@ public:
     void setDownloadDirectory(const std::string &dir);
 
 private:
-    /// Searches for the torrent with the given info hash, attempting to connect to its tracker service and
-    /// find peers. Runs every 5 minutes by default
+    /// Adds the torrent to the map of torrents and begins looking for peers. If a torrent with the
+    /// same info hash was already added, that torrent is returned instead
+    std::shared_ptr<TorrentState> registerTorrent(std::shared_ptr<TorrentState> torrent);
+
+    /// Searches for the torrent with the given info hash, announcing it to the trackers of every tier
+    /// to find peers. Runs every 5 minutes by default
     void connectToTracker(boost::asio::deadline_timer *timer, uint8_t *infoHash);
 
+    /// Announces the torrent to the tracker of the given tier that follows the given number of
+    /// failed attempts in the current round, failing over to the next tracker in the tier
+    void announceToTier(std::shared_ptr<TorrentState> torrent, size_t tier, size_t attempt);
+
+    /// Starts announcing torrents on the local network, connecting to the local peers found for them
+    void startLocalDiscovery(uint16_t listenPort);
+
+    /// Starts accepting and making peer connections over uTP on the UDP port of the given number
+    void startUTP(uint16_t listenPort);
+
+    /// Starts the DHT node on the given port, restoring the state of the previous session and
+    /// adding the configured bootstrap nodes
+    void startDHT(uint16_t port);
+
+    /// Requests the swarm statistics of every torrent, batching the info hashes of all torrents
+    /// that share a tracker into as few requests as possible. Runs every 15 minutes
+    void scrapeTrackers(const boost::system::error_code &ec);
+
 private:
     /// I/O service used for networking
     boost::asio::io_service m_ioService;
@@ -114,9 +169,30 @@ private:
     /// Tracker connection manager
     network::ConnectionMgr<network::TrackerClient> m_trackerMgr;
 
+    /// Scrape request connection manager
+    network::ConnectionMgr<network::ScrapeClient> m_scrapeMgr;
+
+    /// Timer used to periodically scrape the trackers of each torrent
+    boost::asio::deadline_timer m_scrapeTimer;
+
     /// Incoming peer listener
     network::Listener m_peerListener;
 
+    /// Node of the mainline DHT
+    std::shared_ptr<dht::DHTNode> m_dhtNode;
+
+    /// Local service discovery, finding peers on the local network
+    std::shared_ptr<network::LocalServiceDiscovery> m_localDiscovery;
+
+    /// Socket manager carrying the uTP peer connections
+    std::shared_ptr<network::UTPSocketMgr> m_utpSocketMgr;
+
+    /// Scheduler of the disk reads and sends that serve the requests of peers
+    std::shared_ptr<network::UploadScheduler> m_uploadScheduler;
+
+    /// Timer wheel running the timeouts of the peer connections
+    std::shared_ptr<network::TimerWheel> m_timerWheel;
+
     /// Configuration data
     Configuration m_config;
 };
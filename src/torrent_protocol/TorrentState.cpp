@@ -23,22 +23,95 @@ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include <algorithm>
+#include <cstring>
+
+#include "LogHelper.h"
+#include "MagnetLink.h"
 #include "TorrentFile.h"
 #include "TorrentState.h"
 
+/// Number of seconds before a candidate peer may be attempted again
+const static time_t PeerCandidateRetrySeconds = 240;
+
+/// Largest info dictionary that will be fetched from peers, in bytes
+const static uint32_t MaxMetadataSize = 8 * 1024 * 1024;
+
+/// Number of seconds before a piece of the info dictionary may be requested from another peer
+const static time_t MetadataRequestTimeoutSeconds = 20;
+
+/// Number of bytes reported as left to download while the metadata is pending
+const static uint64_t MetadataPendingBytesLeft = 16384;
+
 TorrentState::TorrentState(const std::string &torrentFilePath) :
     m_file(std::make_shared<TorrentFile>(torrentFilePath)),
     m_numPeers(0),
     m_numPeersCanUnchoke(10),
     m_downloadComplete(false),
     m_pieceMgr(m_file),
-    m_torrentFileName()
+    m_hasMetadata(m_file->hasMetadata()),
+    m_torrentFileName(),
+    m_trackers(m_file->getAnnounceList()),
+    m_peerCandidates(),
+    m_candidateLock(),
+    m_connectedPeers(),
+    m_connectedPeerLock(),
+    m_localPeers(),
+    m_localPeerLock(),
+    m_swarmStats(),
+    m_statsLock(),
+    m_metadata(),
+    m_metadataPiecesReceived(),
+    m_metadataRequestTimes(),
+    m_metadataSizeSource(),
+    m_untrustedMetadataPeers(),
+    m_metadataLock()
 {
     // Parse torrent file path string for "_.torrent" and set torrent file name to that substring
     auto pathPos = torrentFilePath.find_last_of('/');
     if (pathPos == std::string::npos)
         pathPos = torrentFilePath.find_last_of('\\');
     m_torrentFileName = (pathPos == std::string::npos) ? torrentFilePath : torrentFilePath.substr(pathPos + 1);
+
+    // The piece manager and tracker list have read everything they need from the metainfo
+    m_file->releaseMetaInfo();
+}
+
+TorrentState::TorrentState(const MagnetLink &magnetLink) :
+    m_file(std::make_shared<TorrentFile>(magnetLink.getInfoHash(), magnetLink.getDisplayName())),
+    m_numPeers(0),
+    m_numPeersCanUnchoke(10),
+    m_downloadComplete(false),
+    m_pieceMgr(m_file),
+    m_hasMetadata(m_file->hasMetadata()),
+    m_torrentFileName(magnetLink.getDisplayName()),
+    m_trackers(magnetLink.getTrackerTiers()),
+    m_peerCandidates(),
+    m_candidateLock(),
+    m_connectedPeers(),
+    m_connectedPeerLock(),
+    m_localPeers(),
+    m_localPeerLock(),
+    m_swarmStats(),
+    m_statsLock(),
+    m_metadata(),
+    m_metadataPiecesReceived(),
+    m_metadataRequestTimes(),
+    m_metadataSizeSource(),
+    m_untrustedMetadataPeers(),
+    m_metadataLock()
+{
+    // Without a display name, the torrent is shown by its info hash
+    if (m_torrentFileName.empty())
+    {
+        const char *hexDigits = "0123456789abcdef";
+        const uint8_t *infoHash = magnetLink.getInfoHash();
+        for (int i = 0; i < 20; ++i)
+        {
+            m_torrentFileName.push_back(hexDigits[infoHash[i] >> 4]);
+            m_torrentFileName.push_back(hexDigits[infoHash[i] & 0x0f]);
+        }
+    }
 }
 
 const std::string &TorrentState::getTorrentFileName()
@@ -51,6 +124,178 @@ std::shared_ptr<TorrentFile> &TorrentState::getTorrentFile()
     return m_file;
 }
 
+SwarmStats TorrentState::getSwarmStats()
+{
+    std::lock_guard<std::mutex> lock(m_statsLock);
+    return m_swarmStats;
+}
+
+void TorrentState::setSwarmStats(const SwarmStats &stats)
+{
+    std::lock_guard<std::mutex> lock(m_statsLock);
+    m_swarmStats = stats;
+}
+
+uint64_t TorrentState::getNumBytesLeft()
+{
+    if (!hasMetadata())
+        return MetadataPendingBytesLeft;
+
+    uint64_t fileSize = m_file->getFileSize();
+    uint64_t bytesDownloaded = std::min(getNumPiecesHave() * m_file->getPieceLength(), fileSize);
+    return fileSize - bytesDownloaded;
+}
+
+bool TorrentState::hasMetadata() const
+{
+    return m_hasMetadata;
+}
+
+bool TorrentState::setMetadataSize(uint32_t size, const boost::asio::ip::address &source)
+{
+    if (size == 0 || size > MaxMetadataSize)
+        return false;
+
+    std::lock_guard<std::mutex> lock(m_metadataLock);
+    if (hasMetadata() || m_untrustedMetadataPeers.find(source) != m_untrustedMetadataPeers.end())
+        return false;
+
+    if (!m_metadata.empty())
+        return m_metadata.size() == size;
+
+    m_metadataSizeSource = source;
+    const uint32_t numPieces = (size + MetadataPieceLength - 1) / MetadataPieceLength;
+    m_metadata.assign(size, '\0');
+    m_metadataPiecesReceived.assign(numPieces, false);
+    m_metadataRequestTimes.assign(numPieces, 0);
+    return true;
+}
+
+uint32_t TorrentState::getMetadataSize()
+{
+    std::lock_guard<std::mutex> lock(m_metadataLock);
+    return static_cast<uint32_t>(m_metadata.size());
+}
+
+bool TorrentState::getMetadataPieceToRequest(uint32_t &pieceIdx)
+{
+    time_t now = time(nullptr);
+
+    std::lock_guard<std::mutex> lock(m_metadataLock);
+    for (uint32_t i = 0; i < m_metadataPiecesReceived.size(); ++i)
+    {
+        if (m_metadataPiecesReceived[i] || now - m_metadataRequestTimes[i] < MetadataRequestTimeoutSeconds)
+            continue;
+
+        m_metadataRequestTimes[i] = now;
+        pieceIdx = i;
+        return true;
+    }
+    return false;
+}
+
+void TorrentState::onMetadataPiece(uint32_t pieceIdx, const uint8_t *data, std::size_t length)
+{
+    std::lock_guard<std::mutex> lock(m_metadataLock);
+    if (pieceIdx >= m_metadataPiecesReceived.size() || m_metadataPiecesReceived[pieceIdx])
+        return;
+
+    // Every piece but the last is full length
+    const std::size_t offset = std::size_t(pieceIdx) * MetadataPieceLength;
+    if (length != std::min<std::size_t>(MetadataPieceLength, m_metadata.size() - offset))
+    {
+        m_metadataRequestTimes[pieceIdx] = 0;
+        return;
+    }
+
+    memcpy(&m_metadata[offset], data, length);
+    m_metadataPiecesReceived[pieceIdx] = true;
+    if (std::find(m_metadataPiecesReceived.begin(), m_metadataPiecesReceived.end(), false) != m_metadataPiecesReceived.end())
+        return;
+
+    if (!m_file->setInfoDictionary(m_metadata))
+    {
+        // Start over, as there is no telling which of the peers sent bad data. The size may have been
+        // wrong too, so it is learned again from a peer other than the one that advertised it
+        LOG_WARNING("torrent_protocol.TorrentState", "Metadata received for ", m_torrentFileName, " failed verification");
+        m_untrustedMetadataPeers.insert(m_metadataSizeSource);
+        m_metadata.clear();
+        m_metadataPiecesReceived.clear();
+        m_metadataRequestTimes.clear();
+        return;
+    }
+
+    LOG_INFO("torrent_protocol.TorrentState", "Received metadata for ", m_torrentFileName);
+
+    // Peers see the metadata only once the piece manager has laid out the pieces and files
+    m_pieceMgr.onMetadataReceived();
+    m_hasMetadata = true;
+    m_file->releaseMetaInfo();
+
+    m_metadata.clear();
+    m_metadata.shrink_to_fit();
+    m_metadataPiecesReceived.clear();
+    m_metadataRequestTimes.clear();
+}
+
+void TorrentState::onMetadataPieceRejected(uint32_t pieceIdx)
+{
+    std::lock_guard<std::mutex> lock(m_metadataLock);
+    if (pieceIdx < m_metadataRequestTimes.size())
+        m_metadataRequestTimes[pieceIdx] = 0;
+}
+
+bool TorrentState::addPeerCandidate(const boost::asio::ip::tcp::endpoint &endpoint)
+{
+    if (m_pieceMgr.isPeerBanned(endpoint.address()))
+        return false;
+
+    time_t now = time(nullptr);
+
+    std::lock_guard<std::mutex> lock(m_candidateLock);
+    auto it = m_peerCandidates.find(endpoint);
+    if (it != m_peerCandidates.end())
+    {
+        if (now - it->second < PeerCandidateRetrySeconds)
+            return false;
+        it->second = now;
+        return true;
+    }
+
+    m_peerCandidates.emplace(endpoint, now);
+    return true;
+}
+
+void TorrentState::addConnectedPeer(const boost::asio::ip::tcp::endpoint &endpoint)
+{
+    std::lock_guard<std::mutex> lock(m_connectedPeerLock);
+    m_connectedPeers.insert(endpoint);
+}
+
+void TorrentState::removeConnectedPeer(const boost::asio::ip::tcp::endpoint &endpoint)
+{
+    std::lock_guard<std::mutex> lock(m_connectedPeerLock);
+    m_connectedPeers.erase(endpoint);
+}
+
+std::vector<boost::asio::ip::tcp::endpoint> TorrentState::getConnectedPeers()
+{
+    std::lock_guard<std::mutex> lock(m_connectedPeerLock);
+    return std::vector<boost::asio::ip::tcp::endpoint>(m_connectedPeers.begin(), m_connectedPeers.end());
+}
+
+void TorrentState::addLocalPeer(const boost::asio::ip::address &address)
+{
+    std::lock_guard<std::mutex> lock(m_localPeerLock);
+    m_localPeers.insert(address);
+}
+
+bool TorrentState::isLocalPeer(const boost::asio::ip::address &address)
+{
+    std::lock_guard<std::mutex> lock(m_localPeerLock);
+    return m_localPeers.find(address) != m_localPeers.end();
+}
+
 uint32_t TorrentState::getNumPeers()
 {
     return m_numPeers.load();
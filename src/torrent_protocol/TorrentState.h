@@ -29,10 +29,18 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <boost/dynamic_bitset.hpp>
 #include <cstdint>
 #include <atomic>
+#include <ctime>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
 
 #include "PieceMgr.h"
+#include "SwarmStats.h"
+#include "TrackerList.h"
 
+class MagnetLink;
 class TorrentFile;
 namespace network { class Peer; }
 
@@ -44,10 +52,18 @@ namespace network { class Peer; }
 class TorrentState
 {
     friend class network::Peer;
+public:
+    /// Length of each piece of the info dictionary exchanged with peers (ut_metadata)
+    static constexpr uint32_t MetadataPieceLength = 16384;
+
 public:
     /// TorrentState constructor - requires torrent file path
     explicit TorrentState(const std::string &torrentFilePath);
 
+    /// Constructs the state of a torrent added from a magnet link, whose metadata is pending
+    /// until it has been received from peers
+    explicit TorrentState(const MagnetLink &magnetLink);
+
     /// Returns a reference to the torrent file pointer
     std::shared_ptr<TorrentFile> &getTorrentFile();
 
@@ -60,6 +76,35 @@ public:
     /// Returns the number of pieces that have been downloaded and verified
     uint64_t getNumPiecesHave() { return m_pieceMgr.getNumPiecesHave(); }
 
+    /// Returns the number of bytes left to download, as reported to trackers. Torrents whose
+    /// metadata is pending report a nominal amount, so that trackers do not take them for seeds
+    uint64_t getNumBytesLeft();
+
+    /// Returns true if the info dictionary of the torrent is known. Torrents added from a magnet
+    /// link have no metadata until it has been fetched from peers
+    bool hasMetadata() const;
+
+    /// Sets the size in bytes of the info dictionary, as advertised by the peer with the given address.
+    /// Returns false if the size is implausible, conflicts with the size accepted from another peer, or
+    /// the peer advertised the size of a dictionary that failed verification before
+    bool setMetadataSize(uint32_t size, const boost::asio::ip::address &source);
+
+    /// Returns the size of the info dictionary, or 0 if it is not known
+    uint32_t getMetadataSize();
+
+    /// Chooses a piece of the info dictionary to request from a peer, skipping pieces that have
+    /// been received or requested from another peer recently. Returns false if there is none
+    bool getMetadataPieceToRequest(uint32_t &pieceIdx);
+
+    /// Stores a piece of the info dictionary received from a peer. Once every piece has been
+    /// received, the dictionary is checked against the info hash and the download begins. If it
+    /// does not match, the dictionary and its size are discarded
+    void onMetadataPiece(uint32_t pieceIdx, const uint8_t *data, std::size_t length);
+
+    /// Called when a peer rejected the request for a piece of the info dictionary, so that
+    /// the piece can be requested from another peer
+    void onMetadataPieceRejected(uint32_t pieceIdx);
+
     /// Returns true if the client has the given piece of the torrent data, false if else
     bool havePiece(uint32_t pieceIdx) const { return m_pieceMgr.havePiece(pieceIdx); }
 
@@ -69,9 +114,45 @@ public:
     /// Returns the total number of bytes uploaded to peers
     const uint64_t &getNumBytesUploaded() const { return m_pieceMgr.getNumBytesUploaded(); }
 
+    /// Returns the statistics of the downloaded data that failed verification and of the peers banned for sending it
+    IntegrityStats getIntegrityStats() { return m_pieceMgr.getIntegrityStats(); }
+
+    /// Returns true if the peer with the given address has been banned for sending corrupt data
+    bool isPeerBanned(const boost::asio::ip::address &address) { return m_pieceMgr.isPeerBanned(address); }
+
     /// Returns true if the integrity of the file is confirmed, false if else.
     bool verifyFile() { return m_pieceMgr.verifyFile(); }
 
+    /// Returns the most recent statistics of the torrent's swarm reported by a tracker
+    SwarmStats getSwarmStats();
+
+    /// Stores the statistics of the torrent's swarm, as reported by a tracker
+    void setSwarmStats(const SwarmStats &stats);
+
+    /// Returns the tiers of trackers associated with the torrent
+    TrackerList &getTrackerList() { return m_trackers; }
+
+    /// Merges a peer endpoint reported by any tracker into the set of connection candidates.
+    /// Returns true if a connection should be attempted, or false if the endpoint was already
+    /// attempted recently (ex: the same peer was returned by more than one tracker) or is banned
+    bool addPeerCandidate(const boost::asio::ip::tcp::endpoint &endpoint);
+
+    /// Records the listen endpoint of a connected peer, so that it can be shared with other peers
+    void addConnectedPeer(const boost::asio::ip::tcp::endpoint &endpoint);
+
+    /// Forgets the listen endpoint of a peer that has disconnected
+    void removeConnectedPeer(const boost::asio::ip::tcp::endpoint &endpoint);
+
+    /// Returns the listen endpoints of the connected peers
+    std::vector<boost::asio::ip::tcp::endpoint> getConnectedPeers();
+
+    /// Records the address of a peer found on the local network
+    void addLocalPeer(const boost::asio::ip::address &address);
+
+    /// Returns true if the peer with the given address was found on the local network. Such peers
+    /// are unchoked without taking one of the torrent's unchoke slots
+    bool isLocalPeer(const boost::asio::ip::address &address);
+
 protected:
     /// Called when a new peer has been associated with this torrent object
     void incrementPeerCount();
@@ -92,20 +173,37 @@ protected:
     /// pieces to the union of the currently available pieces and the peer's pieces
     void readPeerBitset(const boost::dynamic_bitset<> &set) { m_pieceMgr.readPeerBitset(set); }
 
-    /// Returns a bitset of the pieces that the client has
-    const boost::dynamic_bitset<> &getBitsetHave() const { return m_pieceMgr.getBitsetHave(); }
+    /// Returns the set of pieces that the client has
+    const PieceBitfield &getBitsetHave() const { return m_pieceMgr.getBitsetHave(); }
 
-    /// Returns a pointer to a torrent fragment structure that needs to be downloaded.
-    /// If the fragments associated with the current piece have already been assigned,
-    /// returns a null pointer.
-    std::shared_ptr<TorrentFragment> getFragmentToDownload() { return m_pieceMgr.getFragmentToDownload(); }
+    /// Returns a pointer to a torrent fragment structure that needs to be downloaded by the peer with the given address.
+    /// If the fragments associated with the current piece have already been assigned, returns a null pointer.
+    std::shared_ptr<TorrentFragment> getFragmentToDownload(const boost::asio::ip::address &requester) { return m_pieceMgr.getFragmentToDownload(requester); }
 
     /// If the client has the given fragment, it will return a shared pointer to a structure containing its data.
     /// Otherwise, returns a null pointer
     std::shared_ptr<TorrentFragment> getFragmentToUpload(uint32_t pieceIdx, uint32_t offset, uint32_t length) { return m_pieceMgr.getFragmentToUpload(pieceIdx, offset, length); }
 
-    /// Called by a peer once a fragment has been downloaded in its entirety
-    void onFragmentDownloaded(uint32_t pieceIdx) { m_pieceMgr.onFragmentDownloaded(pieceIdx); }
+    /// Called by a peer once a fragment has been downloaded in its entirety, with the address of the peer that sent it
+    void onFragmentDownloaded(const TorrentFragment &fragment, const boost::asio::ip::address &sender) { m_pieceMgr.onFragmentDownloaded(fragment, sender); }
+
+    /// Called by a peer when its request for a fragment of the given piece was rejected
+    void onFragmentRejected(uint32_t pieceIdx, uint32_t offset) { m_pieceMgr.onFragmentRejected(pieceIdx, offset); }
+
+    /// Returns true, filling in the request, if the block hashes of the piece being downloaded should be requested (v2)
+    bool getBlockHashRequest(HashRequest &request) { return m_pieceMgr.getBlockHashRequest(request); }
+
+    /// Called with the hashes sent in response to a hash request, returning the addresses of the peers found to have sent corrupt blocks
+    std::vector<boost::asio::ip::address> onBlockHashes(const HashRequest &request, const uint8_t *hashes) { return m_pieceMgr.onBlockHashes(request, hashes); }
+
+    /// Called when a peer rejects a hash request
+    void onBlockHashesRejected(const HashRequest &request) { m_pieceMgr.onBlockHashesRejected(request); }
+
+    /// Fills hashes with the nodes of a merkle tree described by a hash request from a peer, returning false if it can not be served
+    bool getHashes(const HashRequest &request, std::vector<merkle::Hash> &hashes) { return m_pieceMgr.getHashes(request, hashes); }
+
+    /// Returns the pieces most recently read from disk for uploading, newest first
+    std::vector<uint32_t> getRecentlyUploadedPieces() { return m_pieceMgr.getRecentlyUploadedPieces(); }
 
 private:
     /// Shared pointer to the torrent file
@@ -123,6 +221,54 @@ private:
     /// Piece selection and download manager
     PieceMgr m_pieceMgr;
 
+    /// True once the info dictionary is known and the piece manager has laid out the pieces and files
+    std::atomic_bool m_hasMetadata;
+
     /// Name of the ".torrent" file itself (used in graphical interface)
     std::string m_torrentFileName;
+
+    /// Tiers of trackers for the torrent, with their health and latency
+    TrackerList m_trackers;
+
+    /// Candidate peer endpoints, mapped to the time of the most recent connection attempt
+    std::map<boost::asio::ip::tcp::endpoint, time_t> m_peerCandidates;
+
+    /// Lock used when accessing the peer candidates
+    std::mutex m_candidateLock;
+
+    /// Listen endpoints of the connected peers
+    std::set<boost::asio::ip::tcp::endpoint> m_connectedPeers;
+
+    /// Lock used when accessing the connected peers
+    std::mutex m_connectedPeerLock;
+
+    /// Addresses of the peers found on the local network
+    std::set<boost::asio::ip::address> m_localPeers;
+
+    /// Lock used when accessing the local peers
+    std::mutex m_localPeerLock;
+
+    /// Cached statistics of the swarm (seeders, leechers, completed downloads)
+    SwarmStats m_swarmStats;
+
+    /// Lock used when accessing the swarm statistics
+    std::mutex m_statsLock;
+
+    /// Info dictionary being assembled from the pieces received from peers
+    std::string m_metadata;
+
+    /// Flags of the pieces of the info dictionary that have been received
+    std::vector<bool> m_metadataPiecesReceived;
+
+    /// Time at which each piece of the info dictionary was last requested
+    std::vector<time_t> m_metadataRequestTimes;
+
+    /// Address of the peer whose advertised size of the info dictionary was accepted
+    boost::asio::ip::address m_metadataSizeSource;
+
+    /// Addresses of the peers that advertised the size of an info dictionary which failed verification
+    std::set<boost::asio::ip::address> m_untrustedMetadataPeers;
+
+    /// Lock used when accessing the info dictionary being assembled
+    std::mutex m_metadataLock;
 };
@@ -0,0 +1,110 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <algorithm>
+#include <limits>
+#include <random>
+
+#include "TrackerList.h"
+
+TrackerList::TrackerList(const std::vector< std::vector<std::string> > &tiers) :
+    m_tiers(),
+    m_lock()
+{
+    std::random_device rd;
+    std::mt19937 gen(rd());
+
+    for (const auto &tier : tiers)
+    {
+        std::vector<TrackerEntry> entries;
+        for (const auto &url : tier)
+            entries.push_back(TrackerEntry{ url, 0, std::numeric_limits<uint32_t>::max() });
+
+        // Trackers within each tier are shuffled, as specified by BEP 12
+        std::shuffle(entries.begin(), entries.end(), gen);
+        m_tiers.push_back(std::move(entries));
+    }
+}
+
+size_t TrackerList::getNumTiers() const
+{
+    return m_tiers.size();
+}
+
+std::string TrackerList::getTracker(size_t tier, size_t attempt)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (tier >= m_tiers.size() || attempt >= m_tiers[tier].size())
+        return std::string();
+
+    return m_tiers[tier][attempt].URL;
+}
+
+void TrackerList::beginRound()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    for (auto &tier : m_tiers)
+    {
+        std::stable_sort(tier.begin(), tier.end(), [](const TrackerEntry &a, const TrackerEntry &b)
+        {
+            if (a.NumFailures != b.NumFailures)
+                return a.NumFailures < b.NumFailures;
+            return a.LatencyMs < b.LatencyMs;
+        });
+    }
+}
+
+void TrackerList::onAnnounceSuccess(size_t tier, const std::string &url, uint32_t latencyMs)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (TrackerEntry *entry = findEntry(tier, url))
+    {
+        entry->NumFailures = 0;
+        if (entry->LatencyMs == std::numeric_limits<uint32_t>::max())
+            entry->LatencyMs = latencyMs;
+        else
+            entry->LatencyMs = (entry->LatencyMs * 3 + latencyMs) / 4;
+    }
+}
+
+void TrackerList::onAnnounceFailure(size_t tier, const std::string &url)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (TrackerEntry *entry = findEntry(tier, url))
+        ++entry->NumFailures;
+}
+
+TrackerList::TrackerEntry *TrackerList::findEntry(size_t tier, const std::string &url)
+{
+    if (tier >= m_tiers.size())
+        return nullptr;
+
+    for (auto &entry : m_tiers[tier])
+    {
+        if (entry.URL == url)
+            return &entry;
+    }
+    return nullptr;
+}
@@ -0,0 +1,88 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * @class TrackerList
+ * @brief Stores the tiers of trackers associated with a torrent (BEP 12), along with
+ *        the health and response latency of each tracker. Trackers within a tier are
+ *        shuffled initially, and each announce round tries the healthiest, fastest
+ *        tracker of the tier first.
+ */
+class TrackerList
+{
+public:
+    /// Constructs the tracker list from the tiers of the torrent's announce-list
+    explicit TrackerList(const std::vector< std::vector<std::string> > &tiers);
+
+    /// Returns the number of tiers
+    size_t getNumTiers() const;
+
+    /// Returns the URL of the tracker to announce to within the given tier, after the given
+    /// number of failed attempts during the current round. Returns an empty string once
+    /// every tracker in the tier has been tried.
+    std::string getTracker(size_t tier, size_t attempt);
+
+    /// Orders the trackers of each tier for a new round of announces: trackers that have
+    /// responded come first in order of latency, followed by untried trackers, and then
+    /// by those that have failed
+    void beginRound();
+
+    /// Records a successful announce to the tracker, with the time it took to respond
+    void onAnnounceSuccess(size_t tier, const std::string &url, uint32_t latencyMs);
+
+    /// Records a failed announce to the tracker
+    void onAnnounceFailure(size_t tier, const std::string &url);
+
+private:
+    /// Health and latency information for a single tracker
+    struct TrackerEntry
+    {
+        /// Announce URL
+        std::string URL;
+
+        /// Number of consecutive failed announces
+        uint32_t NumFailures;
+
+        /// Smoothed response time in milliseconds, or UINT32_MAX if the tracker has not yet responded
+        uint32_t LatencyMs;
+    };
+
+    /// Returns a pointer to the entry with the given URL in the tier, or a null pointer if not found
+    TrackerEntry *findEntry(size_t tier, const std::string &url);
+
+private:
+    /// Tiers of trackers, in order of priority
+    std::vector< std::vector<TrackerEntry> > m_tiers;
+
+    /// Lock used when accessing the tiers
+    std::mutex m_lock;
+};
@@ -0,0 +1,259 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <algorithm>
+#include "BenDocument.h"
+#include "Decoder.h"
+
+#include "LogHelper.h"
+
+namespace bencoding
+{
+    BenNode::const_iterator::const_iterator(const BenDocument *document, std::size_t index) :
+        m_document(document),
+        m_index(index)
+    {
+    }
+
+    BenNode BenNode::const_iterator::operator*() const
+    {
+        return BenNode(m_document, m_index);
+    }
+
+    BenNode::const_iterator &BenNode::const_iterator::operator++()
+    {
+        m_index = m_document->m_tokens[m_index].Next;
+        return *this;
+    }
+
+    bool BenNode::const_iterator::operator==(const const_iterator &other) const
+    {
+        return m_document == other.m_document && m_index == other.m_index;
+    }
+
+    bool BenNode::const_iterator::operator!=(const const_iterator &other) const
+    {
+        return !(*this == other);
+    }
+
+    BenNode::BenNode() :
+        m_document(nullptr),
+        m_index(0)
+    {
+    }
+
+    BenNode::BenNode(const BenDocument *document, std::size_t index) :
+        m_document(document),
+        m_index(index)
+    {
+    }
+
+    bool BenNode::isValid() const
+    {
+        return m_document != nullptr && m_index < m_document->m_tokens.size();
+    }
+
+    BenNode::operator bool() const
+    {
+        return isValid();
+    }
+
+    bool BenNode::isInt() const
+    {
+        return isValid() && getToken().Kind == BenToken::Type::Integer;
+    }
+
+    bool BenNode::isString() const
+    {
+        return isValid() && getToken().Kind == BenToken::Type::String;
+    }
+
+    bool BenNode::isList() const
+    {
+        return isValid() && getToken().Kind == BenToken::Type::List;
+    }
+
+    bool BenNode::isDictionary() const
+    {
+        return isValid() && getToken().Kind == BenToken::Type::Dictionary;
+    }
+
+    int64_t BenNode::getInt(int64_t defaultValue) const
+    {
+        return isInt() ? getToken().Integer : defaultValue;
+    }
+
+    std::string_view BenNode::getString() const
+    {
+        return isString() ? getToken().getString(m_document->m_source) : std::string_view();
+    }
+
+    std::string_view BenNode::getEncoded() const
+    {
+        return isValid() ? getToken().getEncoded(m_document->m_source) : std::string_view();
+    }
+
+    std::size_t BenNode::size() const
+    {
+        if (isList())
+            return getToken().NumChildren;
+        if (isDictionary())
+            return getToken().NumChildren / 2;
+        return 0;
+    }
+
+    BenNode BenNode::find(std::string_view key) const
+    {
+        if (!isDictionary())
+            return BenNode();
+
+        const BenToken &dict = getToken();
+        const std::string &source = m_document->m_source;
+        const std::vector<BenToken> &tokens = m_document->m_tokens;
+
+        auto first = m_document->m_keys.begin() + dict.FirstKey;
+        auto last = first + dict.NumChildren / 2;
+        auto it = std::lower_bound(first, last, key, [&](uint32_t keyIndex, std::string_view value) {
+            return tokens[keyIndex].getString(source) < value;
+        });
+
+        if (it == last || tokens[*it].getString(source) != key)
+            return BenNode();
+
+        return BenNode(m_document, *it + 1);
+    }
+
+    std::string_view BenNode::getKey(std::size_t pos) const
+    {
+        uint32_t keyIndex = m_document->m_keys[getToken().FirstKey + pos];
+        return m_document->m_tokens[keyIndex].getString(m_document->m_source);
+    }
+
+    BenNode BenNode::getValue(std::size_t pos) const
+    {
+        return BenNode(m_document, m_document->m_keys[getToken().FirstKey + pos] + 1);
+    }
+
+    BenNode::const_iterator BenNode::begin() const
+    {
+        if (!isList())
+            return end();
+
+        return const_iterator(m_document, m_index + 1);
+    }
+
+    BenNode::const_iterator BenNode::end() const
+    {
+        if (!isValid())
+            return const_iterator(m_document, m_index);
+
+        return const_iterator(m_document, getToken().Next);
+    }
+
+    const BenToken &BenNode::getToken() const
+    {
+        return m_document->m_tokens[m_index];
+    }
+
+    BenDocument::BenDocument() :
+        m_source(),
+        m_tokens(),
+        m_keys()
+    {
+    }
+
+    bool BenDocument::parse(std::string encoded)
+    {
+        m_source = std::move(encoded);
+
+        Decoder decoder;
+        if (!decoder.tokenize(m_source, m_tokens))
+        {
+            clear();
+            return false;
+        }
+
+        m_tokens.shrink_to_fit();
+        indexKeys();
+        return true;
+    }
+
+    void BenDocument::clear()
+    {
+        std::string().swap(m_source);
+        std::vector<BenToken>().swap(m_tokens);
+        std::vector<uint32_t>().swap(m_keys);
+    }
+
+    BenNode BenDocument::getRoot() const
+    {
+        if (m_tokens.empty())
+            return BenNode();
+
+        return BenNode(this, 0);
+    }
+
+    const std::string &BenDocument::getSource() const
+    {
+        return m_source;
+    }
+
+    void BenDocument::indexKeys()
+    {
+        // Size the key table up front, so that it is allocated once
+        std::size_t numKeys = 0;
+        for (const BenToken &token : m_tokens)
+        {
+            if (token.Kind == BenToken::Type::Dictionary)
+                numKeys += token.NumChildren / 2;
+        }
+
+        m_keys.clear();
+        m_keys.reserve(numKeys);
+
+        for (std::size_t i = 0; i < m_tokens.size(); ++i)
+        {
+            BenToken &dict = m_tokens[i];
+            if (dict.Kind != BenToken::Type::Dictionary)
+                continue;
+
+            dict.FirstKey = static_cast<uint32_t>(m_keys.size());
+            for (std::size_t key = i + 1; key < dict.Next; key = m_tokens[key + 1].Next)
+                m_keys.push_back(static_cast<uint32_t>(key));
+
+            // Canonical bencoding stores keys in sorted order, in which case there is nothing left to do.
+            // A stable sort ensures the first of any duplicate keys is found by a lookup
+            auto first = m_keys.begin() + dict.FirstKey;
+            auto compareKeys = [this](uint32_t a, uint32_t b) {
+                return m_tokens[a].getString(m_source) < m_tokens[b].getString(m_source);
+            };
+            if (!std::is_sorted(first, m_keys.end(), compareKeys))
+            {
+                LOG_DEBUG("torrent_protocol.bencoding", "Dictionary at offset ", dict.Begin, " is not in canonical order");
+                std::stable_sort(first, m_keys.end(), compareKeys);
+            }
+        }
+    }
+}
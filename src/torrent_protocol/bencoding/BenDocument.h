@@ -0,0 +1,198 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "BenToken.h"
+
+namespace bencoding
+{
+    class BenDocument;
+
+    /**
+     * @class BenNode
+     * @brief Lightweight handle to a value stored in a \ref BenDocument. Accessors on a node of
+     *        the wrong type, or on an invalid node, return empty values rather than failing.
+     *        A node is only valid for the lifetime of the document it refers to.
+     */
+    class BenNode
+    {
+    public:
+        /**
+         * @class const_iterator
+         * @brief Iterates over the elements of a list node
+         */
+        class const_iterator
+        {
+        public:
+            typedef std::forward_iterator_tag iterator_category;
+            typedef BenNode value_type;
+            typedef std::ptrdiff_t difference_type;
+            typedef const BenNode *pointer;
+            typedef BenNode reference;
+
+            /// Constructs an iterator at the token with the given index
+            const_iterator(const BenDocument *document, std::size_t index);
+
+            /// Returns the element the iterator points to
+            BenNode operator*() const;
+
+            /// Advances to the next element of the list
+            const_iterator &operator++();
+
+            /// Returns true if both iterators point to the same element
+            bool operator==(const const_iterator &other) const;
+
+            /// Returns true if the iterators point to different elements
+            bool operator!=(const const_iterator &other) const;
+
+        private:
+            /// Document containing the list
+            const BenDocument *m_document;
+
+            /// Index of the current element's token
+            std::size_t m_index;
+        };
+
+    public:
+        /// Constructs an invalid node
+        BenNode();
+
+        /// Constructs a handle to the token with the given index in the document
+        BenNode(const BenDocument *document, std::size_t index);
+
+        /// Returns true if the node refers to a value in a document
+        bool isValid() const;
+
+        /// Returns true if the node refers to a value in a document
+        explicit operator bool() const;
+
+        /// Returns true if the node holds an integer
+        bool isInt() const;
+
+        /// Returns true if the node holds a string
+        bool isString() const;
+
+        /// Returns true if the node holds a list
+        bool isList() const;
+
+        /// Returns true if the node holds a dictionary
+        bool isDictionary() const;
+
+        /// Returns the value of an integer node, or defaultValue if the node is not an integer
+        int64_t getInt(int64_t defaultValue = 0) const;
+
+        /// Returns a view of the contents of a string node, or an empty view if the node is not a string
+        std::string_view getString() const;
+
+        /// Returns the bencoded representation of the node, as it appears in the source buffer
+        std::string_view getEncoded() const;
+
+        /// Returns the number of elements in a list, or the number of entries in a dictionary
+        std::size_t size() const;
+
+        /// Returns the value associated with the given key, or an invalid node if this is
+        /// not a dictionary or the key is not present. Runs in logarithmic time
+        BenNode find(std::string_view key) const;
+
+        /// Returns the key of the dictionary entry at position pos, in sorted order.
+        /// pos must be within the range [ 0, size() )
+        std::string_view getKey(std::size_t pos) const;
+
+        /// Returns the value of the dictionary entry at position pos, in sorted key order.
+        /// pos must be within the range [ 0, size() )
+        BenNode getValue(std::size_t pos) const;
+
+        /// Returns an iterator to the first element of a list node
+        const_iterator begin() const;
+
+        /// Returns an iterator just past the last element of a list node
+        const_iterator end() const;
+
+    private:
+        /// Returns the token of the node, which must be valid
+        const BenToken &getToken() const;
+
+    private:
+        /// Document containing the node
+        const BenDocument *m_document;
+
+        /// Index of the node's token in the document
+        std::size_t m_index;
+    };
+
+    /**
+     * @class BenDocument
+     * @brief Compact, read-only representation of a bencoded document. The source bytes are
+     *        kept in a single buffer, with every value stored as a \ref BenToken in one contiguous
+     *        array. Dictionary keys are indexed in sorted order so that lookups use a binary search
+     *        over string views instead of hashing a std::string.
+     */
+    class BenDocument
+    {
+        friend class BenNode;
+
+    public:
+        /// Constructs an empty document
+        BenDocument();
+
+        BenDocument(const BenDocument&) = delete;
+        BenDocument &operator=(const BenDocument&) = delete;
+
+        /// Parses the given bencoded data into the document, replacing any previous contents.
+        /// Returns true on success, false if the data is malformed
+        bool parse(std::string encoded);
+
+        /// Releases the contents of the document. Any nodes referring to it become invalid
+        void clear();
+
+        /// Returns a handle to the root value of the document, or an invalid node if it is empty
+        BenNode getRoot() const;
+
+        /// Returns the bencoded data the document was parsed from
+        const std::string &getSource() const;
+
+    private:
+        /// Builds the sorted key table for each dictionary in the document
+        void indexKeys();
+
+    private:
+        /// Bencoded data that all tokens refer into
+        std::string m_source;
+
+        /// Every value in the document, in the order that they appear in the source
+        std::vector<BenToken> m_tokens;
+
+        /// Token indices of dictionary keys. The keys of each dictionary are stored contiguously,
+        /// beginning at BenToken::FirstKey, and sorted by their contents
+        std::vector<uint32_t> m_keys;
+    };
+}
@@ -0,0 +1,86 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+namespace bencoding
+{
+    /**
+     * @brief A single bencoded value within a source buffer, as recorded by the \ref Decoder.
+     *        Tokens are stored in a flat array in document order, so the children of a list
+     *        or dictionary immediately follow their parent token. Strings are not copied; they
+     *        are referred to by their byte offsets in the source buffer.
+     */
+    struct BenToken
+    {
+        /// The data type of a token
+        enum class Type : uint8_t
+        {
+            Integer,
+            String,
+            List,
+            Dictionary
+        };
+
+        /// Data type of the value
+        Type Kind;
+
+        /// Offset of the first byte of the encoded value in the source buffer
+        uint32_t Begin;
+
+        /// Offset just past the final byte of the encoded value (including any trailing 'e')
+        uint32_t End;
+
+        /// Offset of the first byte of a string's contents (only valid for strings)
+        uint32_t DataBegin;
+
+        /// Index of the token following this value and all of its children
+        uint32_t Next;
+
+        /// Number of child tokens of a list or dictionary (a dictionary has two per entry)
+        uint32_t NumChildren;
+
+        /// Index of the first key of a dictionary in the sorted key table of a \ref BenDocument
+        uint32_t FirstKey;
+
+        /// Value of an integer (only valid for integers)
+        int64_t Integer;
+
+        /// Returns the entire encoded value as a view into the source buffer
+        std::string_view getEncoded(std::string_view source) const
+        {
+            return source.substr(Begin, End - Begin);
+        }
+
+        /// Returns the contents of a string as a view into the source buffer
+        std::string_view getString(std::string_view source) const
+        {
+            return source.substr(DataBegin, End - DataBegin);
+        }
+    };
+}
@@ -23,7 +23,7 @@ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
-#include <cstdlib>
+#include <charconv>
 #include "Decoder.h"
 
 #include "BenDictionary.h"
@@ -35,101 +35,242 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 namespace bencoding
 {
-    std::shared_ptr<BenObjectBase> Decoder::decode(const std::string &encoded, bool recursive)
+    /// Limit on the nesting of lists and dictionaries, which bounds the recursion in Decoder::build
+    const static std::size_t MaxNestingDepth = 256;
+
+    Decoder::Decoder() :
+        m_index(0)
+    {
+    }
+
+    std::shared_ptr<BenObjectBase> Decoder::decode(std::string_view encoded)
+    {
+        std::vector<BenToken> tokens;
+        if (!tokenize(encoded, tokens))
+            return std::shared_ptr<BenObjectBase>();
+
+        return build(encoded, tokens);
+    }
+
+    bool Decoder::tokenize(std::string_view encoded, std::vector<BenToken> &tokens)
     {
-        std::shared_ptr<BenObjectBase> retVal;
+        tokens.clear();
+        m_index = 0;
 
-        if (encoded.size() < 2)
-            return retVal;
+        // Token offsets are 32 bits wide
+        if (encoded.size() > UINT32_MAX)
+        {
+            LOG_ERROR("torrent_protocol.bencoding", "Input is too large to decode");
+            return false;
+        }
 
-        if (!recursive)
-            m_index = 0;
+        // Indices of the lists and dictionaries that have not yet been closed
+        std::vector<uint32_t> openTokens;
 
-        // Determine data type
-        switch (encoded.at(m_index))
+        do
         {
-            // BenInt
-            case 'i':
+            if (m_index >= encoded.size())
             {
-                ++m_index;
-                retVal = std::make_shared<BenInt>(getInt(encoded));
-                break;
+                LOG_ERROR("torrent_protocol.bencoding", "Unexpected end of input at offset ", m_index);
+                return false;
             }
-            // BenList
-            case 'l':
+
+            char c = encoded[m_index];
+
+            // End of the innermost list or dictionary
+            if (c == 'e' && !openTokens.empty())
             {
-                ++m_index;
-                retVal = std::make_shared<BenList>();
-                auto listPtr = std::static_pointer_cast<BenList>(retVal);
-                while (m_index < encoded.size() && encoded.at(m_index) != 'e')
+                BenToken &parent = tokens[openTokens.back()];
+                if (parent.Kind == BenToken::Type::Dictionary && (parent.NumChildren & 1))
                 {
-                    listPtr->push_back(decode(encoded, true));
+                    LOG_ERROR("torrent_protocol.bencoding", "Dictionary key without a value at offset ", m_index);
+                    return false;
                 }
-                ++m_index;
-                break;
+                parent.End = static_cast<uint32_t>(++m_index);
+                parent.Next = static_cast<uint32_t>(tokens.size());
+                openTokens.pop_back();
+                continue;
             }
-            // BenDictionary
-            case 'd':
+
+            // Dictionary keys must be strings
+            if (!openTokens.empty())
             {
-                ++m_index;
-                retVal = std::make_shared<BenDictionary>();
-                auto dictPtr = std::static_pointer_cast<BenDictionary>(retVal);
-                while (m_index < encoded.size() && encoded.at(m_index) != 'e')
+                BenToken &parent = tokens[openTokens.back()];
+                if (parent.Kind == BenToken::Type::Dictionary && !(parent.NumChildren & 1) && (c < '0' || c > '9'))
                 {
-                    dictPtr->insert(std::make_pair(getString(encoded), decode(encoded, true)));
+                    LOG_ERROR("torrent_protocol.bencoding", "Dictionary key is not a string at offset ", m_index);
+                    return false;
                 }
-                ++m_index;
-                break;
+                ++parent.NumChildren;
+            }
+
+            BenToken token;
+            token.Begin = static_cast<uint32_t>(m_index);
+            token.End = token.Begin;
+            token.DataBegin = token.Begin;
+            token.Next = static_cast<uint32_t>(tokens.size() + 1);
+            token.NumChildren = 0;
+            token.FirstKey = 0;
+            token.Integer = 0;
+
+            switch (c)
+            {
+                case 'i':
+                {
+                    ++m_index;
+                    token.Kind = BenToken::Type::Integer;
+                    if (!parseInt(encoded, token.Integer))
+                        return false;
+                    token.End = static_cast<uint32_t>(m_index);
+                    tokens.push_back(token);
+                    break;
+                }
+                case 'l':
+                case 'd':
+                {
+                    if (openTokens.size() >= MaxNestingDepth)
+                    {
+                        LOG_ERROR("torrent_protocol.bencoding", "Maximum nesting depth exceeded at offset ", m_index);
+                        return false;
+                    }
+                    ++m_index;
+                    token.Kind = (c == 'l') ? BenToken::Type::List : BenToken::Type::Dictionary;
+                    openTokens.push_back(static_cast<uint32_t>(tokens.size()));
+                    tokens.push_back(token);
+                    break;
+                }
+                default:
+                {
+                    uint64_t length = 0;
+                    token.Kind = BenToken::Type::String;
+                    if (!parseStringLength(encoded, length))
+                        return false;
+                    token.DataBegin = static_cast<uint32_t>(m_index);
+                    m_index += length;
+                    token.End = static_cast<uint32_t>(m_index);
+                    tokens.push_back(token);
+                    break;
+                }
+            }
+        } while (!openTokens.empty());
+
+        return true;
+    }
+
+    std::shared_ptr<BenObjectBase> Decoder::build(std::string_view encoded, const std::vector<BenToken> &tokens, std::size_t index)
+    {
+        if (index >= tokens.size())
+            return std::shared_ptr<BenObjectBase>();
+
+        const BenToken &token = tokens[index];
+        switch (token.Kind)
+        {
+            case BenToken::Type::Integer:
+                return std::make_shared<BenInt>(token.Integer);
+            case BenToken::Type::String:
+                return std::make_shared<BenString>(std::string(token.getString(encoded)));
+            case BenToken::Type::List:
+            {
+                auto listPtr = std::make_shared<BenList>();
+                for (std::size_t child = index + 1; child < token.Next; child = tokens[child].Next)
+                    listPtr->push_back(build(encoded, tokens, child));
+                return listPtr;
             }
-            // Default case is string
-            default:
+            case BenToken::Type::Dictionary:
             {
-                retVal = std::make_shared<BenString>(getString(encoded));
-                break;
+                auto dictPtr = std::make_shared<BenDictionary>();
+                for (std::size_t key = index + 1; key < token.Next; key = tokens[key + 1].Next)
+                    dictPtr->insert(std::make_pair(std::string(tokens[key].getString(encoded)), build(encoded, tokens, key + 1)));
+                return dictPtr;
             }
         }
 
-        return retVal;
+        return std::shared_ptr<BenObjectBase>();
+    }
+
+    std::size_t Decoder::findValue(std::string_view encoded, const std::vector<BenToken> &tokens,
+                                   std::size_t dictIndex, std::string_view key)
+    {
+        if (dictIndex >= tokens.size() || tokens[dictIndex].Kind != BenToken::Type::Dictionary)
+            return tokens.size();
+
+        const BenToken &dict = tokens[dictIndex];
+        for (std::size_t keyIndex = dictIndex + 1; keyIndex < dict.Next; keyIndex = tokens[keyIndex + 1].Next)
+        {
+            if (tokens[keyIndex].getString(encoded) == key)
+                return keyIndex + 1;
+        }
+
+        return tokens.size();
     }
 
     const std::size_t &Decoder::getIndex() const
     {
         return m_index;
     }
-    
-    int64_t Decoder::getInt(const std::string &encoded)
+
+    bool Decoder::parseInt(std::string_view encoded, int64_t &value)
     {
-        std::string tmp;
-        while (m_index < encoded.size() && encoded.at(m_index) != 'e')
+        std::size_t endPos = encoded.find('e', m_index);
+        if (endPos == std::string_view::npos || endPos == m_index)
         {
-            tmp.push_back(encoded.at(m_index++));
+            LOG_ERROR("torrent_protocol.bencoding", "Malformed integer at offset ", m_index);
+            return false;
         }
-        ++m_index;
 
-        // Convert to long long
-        return std::strtoll(tmp.c_str(), nullptr, 10);
+        // Reject leading zeros and negative zero, which have no canonical encoding
+        const char *first = encoded.data() + m_index;
+        const char *last = encoded.data() + endPos;
+        const char *digits = (*first == '-') ? first + 1 : first;
+        if (digits == last || (*digits == '0' && (last - digits > 1 || digits != first)))
+        {
+            LOG_ERROR("torrent_protocol.bencoding", "Non-canonical integer at offset ", m_index);
+            return false;
+        }
+
+        auto result = std::from_chars(first, last, value);
+        if (result.ec != std::errc() || result.ptr != last)
+        {
+            LOG_ERROR("torrent_protocol.bencoding", "Invalid integer at offset ", m_index);
+            return false;
+        }
+
+        m_index = endPos + 1;
+        return true;
     }
-    
-    std::string Decoder::getString(const std::string &encoded)
+
+    bool Decoder::parseStringLength(std::string_view encoded, uint64_t &length)
     {
-        std::string tmp;
-        
-        // Get length of string
-        while (m_index < encoded.size() && encoded.at(m_index) != ':')
+        std::size_t sepPos = encoded.find(':', m_index);
+        if (sepPos == std::string_view::npos || sepPos == m_index)
         {
-            tmp.push_back(encoded.at(m_index++));
+            LOG_ERROR("torrent_protocol.bencoding", "Malformed string at offset ", m_index);
+            return false;
         }
-        ++m_index;
 
-        uint64_t stringLen = std::strtoull(tmp.c_str(), nullptr, 10);
+        const char *first = encoded.data() + m_index;
+        const char *last = encoded.data() + sepPos;
+        if (*first == '0' && last - first > 1)
+        {
+            LOG_ERROR("torrent_protocol.bencoding", "Non-canonical string length at offset ", m_index);
+            return false;
+        }
+
+        auto result = std::from_chars(first, last, length);
+        if (result.ec != std::errc() || result.ptr != last)
+        {
+            LOG_ERROR("torrent_protocol.bencoding", "Invalid string length at offset ", m_index);
+            return false;
+        }
 
         // Ensure the string length is valid
-        if ((uint64_t)m_index + stringLen > encoded.size())
-            return std::string();
+        m_index = sepPos + 1;
+        if (length > encoded.size() - m_index)
+        {
+            LOG_ERROR("torrent_protocol.bencoding", "String length exceeds input at offset ", m_index);
+            return false;
+        }
 
-        tmp = encoded.substr(m_index, stringLen);
-        m_index += stringLen;
-        return tmp;
+        return true;
     }
 }
-
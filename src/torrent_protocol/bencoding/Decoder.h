@@ -28,7 +28,11 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <cstdint>
 #include <memory>
 #include <string>
+#include <string_view>
+#include <vector>
+
 #include "BenObject.h"
+#include "BenToken.h"
 
 namespace bencoding
 {
@@ -39,29 +43,47 @@ namespace bencoding
     /**
      * @class Decoder
      * @brief Parses a string in bencoding format into a BenObjectBase-derived type.
+     *
+     * Decoding happens in two stages. \ref tokenize makes a single pass over the source
+     * buffer, validating it and recording the byte offsets of every value in a flat array
+     * of \ref BenToken without copying any data. The BenObject tree is then built from those
+     * tokens, if needed.
      */
     class Decoder
     {
     public:
         /// Default constructor
-        Decoder() = default;
+        Decoder();
+
+        /// Decodes the given string, returning a shared_ptr to the appropriate data type, or
+        /// a null pointer if the input is not valid bencoded data
+        std::shared_ptr<BenObjectBase> decode(std::string_view encoded);
+
+        /// Validates the bencoded value at the beginning of the buffer, storing a token for each
+        /// value it contains. Returns true on success, false if the input is malformed
+        bool tokenize(std::string_view encoded, std::vector<BenToken> &tokens);
 
-        /// Decodes the given string, returning a shared_ptr to the appropriate data type
-        std::shared_ptr<BenObjectBase> decode(const std::string &encoded, bool recursive = false);
+        /// Builds the object tree for the token at the given index, after a call to \ref tokenize
+        std::shared_ptr<BenObjectBase> build(std::string_view encoded, const std::vector<BenToken> &tokens, std::size_t index = 0);
 
-        /// Returns the final index value from the last decode operation (used for info hash) 
+        /// Returns the index of the token holding the value of the given key in the dictionary
+        /// token at index dictIndex, or tokens.size() if the key is not present
+        static std::size_t findValue(std::string_view encoded, const std::vector<BenToken> &tokens,
+                                     std::size_t dictIndex, std::string_view key);
+
+        /// Returns the final index value from the last decode operation (one past the end of the root value)
         const std::size_t &getIndex() const;
 
     private:
-        /// Returns the integer associated with the bencoded string
-        int64_t getInt(const std::string &encoded);
+        /// Parses the integer beginning at m_index, which must point just past the 'i' prefix
+        bool parseInt(std::string_view encoded, int64_t &value);
 
-        /// Returns the bencoded string in string format
-        std::string getString(const std::string &encoded);
+        /// Parses the length prefix of the string beginning at m_index, leaving m_index at the
+        /// first byte of the string's contents
+        bool parseStringLength(std::string_view encoded, uint64_t &length);
 
     private:
         /// Current index in the string being decoded
         std::size_t m_index;
     };
 }
-
@@ -23,6 +23,8 @@ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include <algorithm>
+#include <charconv>
 #include "Encoder.h"
 
 #include "BenDictionary.h"
@@ -32,6 +34,22 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 namespace bencoding
 {
+    Encoder::Encoder() :
+        m_data(),
+        m_stringSink(m_data),
+        m_sink(m_stringSink),
+        m_sortedEntries()
+    {
+    }
+
+    Encoder::Encoder(OutputSink &sink) :
+        m_data(),
+        m_stringSink(m_data),
+        m_sink(sink),
+        m_sortedEntries()
+    {
+    }
+
     void Encoder::clear()
     {
         m_data.clear();
@@ -44,33 +62,54 @@ namespace bencoding
 
     void Encoder::visit(BenDictionary &benObject)
     {
-        BenString key;
-        m_data.push_back('d');
+        // Keys must be written in sorted order, which the underlying hash map does not provide
+        const std::size_t first = m_sortedEntries.size();
         for (auto it = benObject.begin(); it != benObject.end(); ++it)
+            m_sortedEntries.push_back(&(*it));
+
+        std::sort(m_sortedEntries.begin() + first, m_sortedEntries.end(),
+                  [](const auto *a, const auto *b) { return a->first < b->first; });
+
+        m_sink.put('d');
+        const std::size_t last = m_sortedEntries.size();
+        for (std::size_t i = first; i < last; ++i)
         {
-            key.setValue(it->first);
-            visit(key);
-            it->second->accept(*this);
+            writeString(m_sortedEntries[i]->first);
+            m_sortedEntries[i]->second->accept(*this);
         }
-        m_data.push_back('e');
+        m_sink.put('e');
+
+        m_sortedEntries.resize(first);
     }
 
     void Encoder::visit(BenInt &benObject)
     {
-        m_data += 'i' + std::to_string(benObject.getValue()) + 'e';
+        char buffer[24];
+        buffer[0] = 'i';
+        char *end = std::to_chars(buffer + 1, buffer + sizeof(buffer) - 1, benObject.getValue()).ptr;
+        *end++ = 'e';
+        m_sink.write(buffer, end - buffer);
     }
 
     void Encoder::visit(BenList &benObject)
     {
-        m_data.push_back('l');
+        m_sink.put('l');
         for (auto it = benObject.begin(); it != benObject.end(); ++it)
             (*it)->accept(*this);
-        m_data.push_back('e');
+        m_sink.put('e');
     }
 
     void Encoder::visit(BenString &benObject)
     {
-        const std::string strVal = benObject.getValue();
-        m_data += std::to_string(strVal.size()) + ':' + strVal;
+        writeString(benObject.getValue());
+    }
+
+    void Encoder::writeString(const std::string &value)
+    {
+        char buffer[24];
+        char *end = std::to_chars(buffer, buffer + sizeof(buffer) - 1, value.size()).ptr;
+        *end++ = ':';
+        m_sink.write(buffer, end - buffer);
+        m_sink.write(value.data(), value.size());
     }
 }
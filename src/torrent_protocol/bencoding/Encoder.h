@@ -25,26 +25,40 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #pragma once
 
+#include <memory>
 #include <string>
+#include <utility>
+#include <vector>
+
+#include "BenObject.h"
 #include "BenObjectVisitor.h"
+#include "OutputSink.h"
 
 namespace bencoding
 {
     /**
      * @class Encoder
      * @brief Implements the BenObjectVisitor, encoding any BenObject-derived
-     *        type into its appropriate format
+     *        type into its appropriate format. Data is written to an \ref OutputSink
+     *        as it is encoded, with dictionary keys emitted in sorted (canonical) order.
      */
     class Encoder : public BenObjectVisitor
     {
     public:
-        /// Default constructor
-        Encoder() = default;
+        /// Constructs an encoder that stores the encoded data in a string, accessed through \ref getData
+        Encoder();
+
+        /// Constructs an encoder that writes the encoded data to the given sink
+        explicit Encoder(OutputSink &sink);
+
+        Encoder(const Encoder&) = delete;
+        Encoder &operator=(const Encoder&) = delete;
 
         /// Clears any previously encoded data from the buffer
         void clear();
 
-        /// Returns the data that has been encoded in string format
+        /// Returns the data that has been encoded in string format. Only used when no sink was
+        /// given to the constructor
         const std::string &getData() const;
 
     public:
@@ -61,7 +75,21 @@ namespace bencoding
         virtual void visit(BenString &benObject);
 
     private:
-        /// Encoded data in string form
+        /// Writes a bencoded string with the given contents
+        void writeString(const std::string &value);
+
+    private:
+        /// Encoded data in string form, when no external sink is used
         std::string m_data;
+
+        /// Sink writing to m_data
+        StringSink m_stringSink;
+
+        /// Destination of the encoded data
+        OutputSink &m_sink;
+
+        /// Entries of the dictionaries being encoded, sorted by key. Shared by all nested
+        /// dictionaries to avoid allocating a new array for each one
+        std::vector<const std::pair<const std::string, std::shared_ptr<BenObjectBase>>*> m_sortedEntries;
     };
 }
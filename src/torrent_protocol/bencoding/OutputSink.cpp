@@ -0,0 +1,113 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <cstring>
+#include "OutputSink.h"
+
+namespace bencoding
+{
+    /// Size of the buffer used by the file sink
+    const static std::size_t FileSinkBufferSize = 64 * 1024;
+
+    void OutputSink::put(char c)
+    {
+        write(&c, 1);
+    }
+
+    bool OutputSink::flush()
+    {
+        return true;
+    }
+
+    StringSink::StringSink(std::string &output) :
+        m_output(output)
+    {
+    }
+
+    void StringSink::write(const char *data, std::size_t len)
+    {
+        m_output.append(data, len);
+    }
+
+    void StringSink::put(char c)
+    {
+        m_output.push_back(c);
+    }
+
+    FileSink::FileSink(const std::string &path) :
+        m_file(path, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc),
+        m_buffer(FileSinkBufferSize),
+        m_bufferLen(0)
+    {
+    }
+
+    FileSink::~FileSink()
+    {
+        flush();
+    }
+
+    bool FileSink::good() const
+    {
+        return m_file.is_open() && m_file.good();
+    }
+
+    void FileSink::write(const char *data, std::size_t len)
+    {
+        if (m_bufferLen + len > m_buffer.size())
+        {
+            flush();
+
+            // Large writes bypass the buffer
+            if (len >= m_buffer.size())
+            {
+                m_file.write(data, len);
+                return;
+            }
+        }
+
+        memcpy(&m_buffer[m_bufferLen], data, len);
+        m_bufferLen += len;
+    }
+
+    void FileSink::put(char c)
+    {
+        if (m_bufferLen == m_buffer.size())
+            flush();
+
+        m_buffer[m_bufferLen++] = c;
+    }
+
+    bool FileSink::flush()
+    {
+        if (m_bufferLen > 0)
+        {
+            m_file.write(m_buffer.data(), m_bufferLen);
+            m_bufferLen = 0;
+        }
+
+        m_file.flush();
+        return good();
+    }
+}
@@ -0,0 +1,111 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace bencoding
+{
+    /**
+     * @class OutputSink
+     * @brief Destination for the bytes produced by the \ref Encoder
+     */
+    class OutputSink
+    {
+    public:
+        /// Virtual destructor
+        virtual ~OutputSink() = default;
+
+        /// Writes len bytes from the given buffer to the sink
+        virtual void write(const char *data, std::size_t len) = 0;
+
+        /// Writes a single byte to the sink
+        virtual void put(char c);
+
+        /// Writes any buffered data to the underlying destination. Returns true on success
+        virtual bool flush();
+    };
+
+    /**
+     * @class StringSink
+     * @brief Appends encoded data to a string
+     */
+    class StringSink : public OutputSink
+    {
+    public:
+        /// Constructs the sink, which will append to the given string
+        explicit StringSink(std::string &output);
+
+        /// Appends len bytes from the given buffer to the string
+        virtual void write(const char *data, std::size_t len) override;
+
+        /// Appends a single byte to the string
+        virtual void put(char c) override;
+
+    private:
+        /// String that data is appended to
+        std::string &m_output;
+    };
+
+    /**
+     * @class FileSink
+     * @brief Writes encoded data to a file through a fixed size buffer
+     */
+    class FileSink : public OutputSink
+    {
+    public:
+        /// Opens the file with the given path for writing, truncating any existing contents
+        explicit FileSink(const std::string &path);
+
+        /// Flushes any buffered data before closing the file
+        virtual ~FileSink();
+
+        /// Returns true if the file is open and no write has failed
+        bool good() const;
+
+        /// Writes len bytes from the given buffer to the file
+        virtual void write(const char *data, std::size_t len) override;
+
+        /// Writes a single byte to the file
+        virtual void put(char c) override;
+
+        /// Writes the buffered data to the file. Returns true on success
+        virtual bool flush() override;
+
+    private:
+        /// Output file
+        std::ofstream m_file;
+
+        /// Data that has not yet been written to the file
+        std::vector<char> m_buffer;
+
+        /// Number of bytes in use at the front of m_buffer
+        std::size_t m_bufferLen;
+    };
+}
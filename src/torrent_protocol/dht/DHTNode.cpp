@@ -0,0 +1,758 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include "BenDictionary.h"
+#include "BenDocument.h"
+#include "BenInt.h"
+#include "BenList.h"
+#include "BenString.h"
+#include "DHTNode.h"
+#include "Encoder.h"
+#include "LogHelper.h"
+#include "OutputSink.h"
+#include "SHA1Hash.h"
+
+using namespace bencoding;
+
+namespace dht
+{
+    /// Milliseconds between each call to onTick
+    const static long TickIntervalMs = 1000;
+
+    /// Milliseconds after which an unanswered query has failed
+    const static long QueryTimeoutMs = 3000;
+
+    /// Seconds between each rotation of the token secret. Tokens stay valid for two periods
+    const static time_t TokenRotationSeconds = 300;
+
+    /// Seconds after which a bucket that has not changed is refreshed with a lookup
+    const static time_t BucketRefreshSeconds = 900;
+
+    /// Seconds between each check for buckets to refresh
+    const static time_t RefreshCheckSeconds = 60;
+
+    /// Seconds after which an announced peer is forgotten unless announced again
+    const static time_t PeerExpirySeconds = 1800;
+
+    /// Maximum number of torrents for which peers are stored
+    const static std::size_t MaxStoredTorrents = 2000;
+
+    /// Maximum number of peers stored per torrent
+    const static std::size_t MaxPeersPerTorrent = 100;
+
+    /// Maximum number of peers returned in a get_peers response
+    const static std::size_t MaxPeersPerResponse = 50;
+
+    /// Number of nodes a lookup is seeded with from the routing table
+    const static std::size_t LookupSeedSize = 16;
+
+    /// Number of bytes of a node in the compact node format
+    const static std::size_t CompactNodeSize = NodeID::Size + 6;
+
+    /// Version of the saved state format
+    const static int64_t StateFormatVersion = 1;
+
+    /// Returns a random string of the given length
+    static std::string getRandomString(std::size_t length)
+    {
+        static std::random_device rd;
+        std::uniform_int_distribution<int> byteDist(0, 255);
+
+        std::string value(length, '\0');
+        for (auto &c : value)
+            c = static_cast<char>(byteDist(rd));
+        return value;
+    }
+
+    DHTNode::DHTNode(boost::asio::io_service &ioService) :
+        network::Socket(ioService, network::Socket::Mode::UDP),
+        m_ioService(ioService),
+        m_tickTimer(ioService),
+        m_routingTable(NodeID::random()),
+        m_transactions(),
+        m_nextTransactionID(static_cast<uint16_t>(std::random_device{}())),
+        m_lookups(),
+        m_bootstrapNodes(),
+        m_savedNodes(),
+        m_tokenSecrets { getRandomString(8), getRandomString(8) },
+        m_lastSecretRotation(time(nullptr)),
+        m_lastRefresh(time(nullptr)),
+        m_peerStore()
+    {
+    }
+
+    bool DHTNode::start(uint16_t port)
+    {
+        boost::system::error_code ec;
+        m_udpSocket.open(boost::asio::ip::udp::v4(), ec);
+        if (!ec)
+            m_udpSocket.bind(boost::asio::ip::udp::endpoint(boost::asio::ip::udp::v4(), port), ec);
+        if (ec)
+        {
+            LOG_ERROR("torrent_protocol.dht", "Unable to bind DHT node to port ", port, ", message: ", ec.message());
+            return false;
+        }
+
+        m_isConnected.store(true);
+        read();
+
+        m_tickTimer.expires_from_now(boost::posix_time::milliseconds(TickIntervalMs));
+        m_tickTimer.async_wait(std::bind(&DHTNode::onTick, getSelf(), std::placeholders::_1));
+
+        // Join the network by looking up the node's own identifier
+        startLookup(std::make_shared<Lookup>(Lookup::Type::FindNode, m_routingTable.getOwnID()));
+        return true;
+    }
+
+    void DHTNode::stop()
+    {
+        boost::system::error_code ec;
+        m_tickTimer.cancel(ec);
+        close();
+    }
+
+    bool DHTNode::loadState(const std::string &path)
+    {
+        std::ifstream file(path, std::ifstream::in | std::ifstream::binary);
+        if (!file.is_open())
+            return false;
+
+        std::string encodedData((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+        BenDocument document;
+        BenNode root;
+        if (document.parse(std::move(encodedData)))
+            root = document.getRoot();
+
+        std::string_view id = root.find("id").getString();
+        if (!root.isDictionary() || root.find("version").getInt() != StateFormatVersion || id.size() != NodeID::Size)
+        {
+            LOG_WARNING("torrent_protocol.dht", "Ignoring invalid DHT state ", path);
+            return false;
+        }
+
+        m_routingTable.reset(NodeID(reinterpret_cast<const uint8_t*>(id.data())));
+        m_savedNodes = decodeNodes(root.find("nodes").getString());
+        LOG_INFO("torrent_protocol.dht", "Loaded ", m_savedNodes.size(), " DHT nodes from ", path);
+        return true;
+    }
+
+    bool DHTNode::saveState(const std::string &path) const
+    {
+        // Nodes that were not reached this session are kept for the next one
+        std::vector<NodeEntry> nodes = m_routingTable.getNodes();
+        if (nodes.empty())
+            nodes = m_savedNodes;
+
+        BenDictionary root;
+        root["id"] = std::make_shared<BenString>(m_routingTable.getOwnID().toString());
+        root["nodes"] = std::make_shared<BenString>(encodeNodes(nodes));
+        root["version"] = std::make_shared<BenInt>(StateFormatVersion);
+
+        FileSink sink(path);
+        if (!sink.good())
+        {
+            LOG_ERROR("torrent_protocol.dht", "Unable to write DHT state ", path);
+            return false;
+        }
+
+        Encoder enc(sink);
+        root.accept(enc);
+        return sink.flush();
+    }
+
+    void DHTNode::addBootstrapNode(const boost::asio::ip::udp::endpoint &endpoint)
+    {
+        m_bootstrapNodes.push_back(endpoint);
+    }
+
+    void DHTNode::ping(const boost::asio::ip::udp::endpoint &endpoint)
+    {
+        m_ioService.post([self = getSelf(), endpoint]() {
+            std::shared_ptr<BenDictionary> args = std::make_shared<BenDictionary>();
+            self->sendQuery("ping", args, Transaction { QueryType::Ping, endpoint, NodeID(), false, std::chrono::steady_clock::now(), nullptr });
+        });
+    }
+
+    void DHTNode::getPeers(const uint8_t *infoHash, PeerHandler handler)
+    {
+        announce(infoHash, 0, handler);
+    }
+
+    void DHTNode::announce(const uint8_t *infoHash, uint16_t port, PeerHandler handler)
+    {
+        std::shared_ptr<Lookup> lookup = std::make_shared<Lookup>(Lookup::Type::GetPeers, NodeID(infoHash));
+        lookup->setPeerHandler(handler);
+        lookup->setAnnouncePort(port);
+
+        m_ioService.post([self = getSelf(), lookup]() {
+            self->startLookup(lookup);
+        });
+    }
+
+    const NodeID &DHTNode::getNodeID() const
+    {
+        return m_routingTable.getOwnID();
+    }
+
+    std::size_t DHTNode::getNumNodes() const
+    {
+        return m_routingTable.getNumNodes();
+    }
+
+    uint16_t DHTNode::getPort() const
+    {
+        boost::system::error_code ec;
+        auto endpoint = m_udpSocket.local_endpoint(ec);
+        return ec ? 0 : endpoint.port();
+    }
+
+    void DHTNode::onRead()
+    {
+        // Each read holds exactly one datagram
+        std::size_t length = m_bufferRead.getSizeUnread();
+        if (length > 0)
+        {
+            handleMessage(std::string(m_bufferRead.getReadPointer(), length), getUDPSender());
+            m_bufferRead.advanceReadPosition(length);
+        }
+
+        read();
+    }
+
+    std::shared_ptr<DHTNode> DHTNode::getSelf()
+    {
+        return std::static_pointer_cast<DHTNode>(shared_from_this());
+    }
+
+    void DHTNode::onTick(const boost::system::error_code &ec)
+    {
+        if (ec || isClosing())
+            return;
+
+        // Expire unanswered queries
+        auto now = std::chrono::steady_clock::now();
+        std::vector<Transaction> expired;
+        for (auto it = m_transactions.begin(); it != m_transactions.end();)
+        {
+            if (now - it->second.SentTime < std::chrono::milliseconds(QueryTimeoutMs))
+            {
+                ++it;
+                continue;
+            }
+
+            expired.push_back(std::move(it->second));
+            it = m_transactions.erase(it);
+        }
+        for (const auto &transaction : expired)
+            onQueryFailed(transaction, true);
+
+        time_t currentTime = time(nullptr);
+        if (currentTime - m_lastSecretRotation >= TokenRotationSeconds)
+        {
+            m_tokenSecrets[1] = m_tokenSecrets[0];
+            m_tokenSecrets[0] = getRandomString(8);
+            m_lastSecretRotation = currentTime;
+        }
+
+        if (currentTime - m_lastRefresh >= RefreshCheckSeconds)
+        {
+            m_lastRefresh = currentTime;
+            expireStoredPeers(currentTime);
+
+            // Rejoin through the bootstrap nodes if every node was lost, otherwise refresh stale buckets
+            if (m_routingTable.getNumNodes() == 0)
+                startLookup(std::make_shared<Lookup>(Lookup::Type::FindNode, m_routingTable.getOwnID()));
+            else
+            {
+                for (const NodeID &target : m_routingTable.getRefreshTargets(currentTime - BucketRefreshSeconds, currentTime))
+                    startLookup(std::make_shared<Lookup>(Lookup::Type::FindNode, target));
+            }
+        }
+
+        m_tickTimer.expires_from_now(boost::posix_time::milliseconds(TickIntervalMs));
+        m_tickTimer.async_wait(std::bind(&DHTNode::onTick, getSelf(), std::placeholders::_1));
+    }
+
+    void DHTNode::startLookup(std::shared_ptr<Lookup> lookup)
+    {
+        if (isClosing())
+            return;
+
+        for (const auto &node : m_routingTable.findClosest(lookup->getTarget(), LookupSeedSize))
+            lookup->addCandidate(node.ID, node.Endpoint);
+
+        if (m_routingTable.getNumNodes() < RoutingTable::BucketSize)
+        {
+            for (const auto &node : m_savedNodes)
+                lookup->addCandidate(node.ID, node.Endpoint);
+
+            // Bootstrap nodes are queried for the target itself, their identifiers being unknown
+            const char *method = (lookup->getType() == Lookup::Type::GetPeers) ? "get_peers" : "find_node";
+            const char *targetKey = (lookup->getType() == Lookup::Type::GetPeers) ? "info_hash" : "target";
+            QueryType type = (lookup->getType() == Lookup::Type::GetPeers) ? QueryType::GetPeers : QueryType::FindNode;
+            for (const auto &endpoint : m_bootstrapNodes)
+            {
+                std::shared_ptr<BenDictionary> args = std::make_shared<BenDictionary>();
+                (*args)[targetKey] = std::make_shared<BenString>(lookup->getTarget().toString());
+                lookup->beginAnonymousQuery();
+                sendQuery(method, args, Transaction { type, endpoint, NodeID(), false, std::chrono::steady_clock::now(), lookup });
+            }
+        }
+
+        // Peers announced to this node are found without a query
+        if (lookup->getType() == Lookup::Type::GetPeers)
+            lookup->onPeersFound(getStoredPeers(lookup->getTarget()));
+
+        m_lookups.push_back(lookup);
+        advanceLookup(lookup);
+    }
+
+    void DHTNode::advanceLookup(const std::shared_ptr<Lookup> &lookup)
+    {
+        if (std::find(m_lookups.begin(), m_lookups.end(), lookup) == m_lookups.end())
+            return;
+
+        Lookup::Candidate candidate;
+        while (lookup->getNextQuery(candidate))
+        {
+            std::shared_ptr<BenDictionary> args = std::make_shared<BenDictionary>();
+            Transaction transaction { QueryType::FindNode, candidate.Endpoint, candidate.ID, true, std::chrono::steady_clock::now(), lookup };
+            if (lookup->getType() == Lookup::Type::GetPeers)
+            {
+                transaction.Type = QueryType::GetPeers;
+                (*args)["info_hash"] = std::make_shared<BenString>(lookup->getTarget().toString());
+                sendQuery("get_peers", args, std::move(transaction));
+            }
+            else
+            {
+                (*args)["target"] = std::make_shared<BenString>(lookup->getTarget().toString());
+                sendQuery("find_node", args, std::move(transaction));
+            }
+        }
+
+        if (lookup->isFinished())
+            finishLookup(lookup);
+    }
+
+    void DHTNode::finishLookup(const std::shared_ptr<Lookup> &lookup)
+    {
+        m_lookups.erase(std::remove(m_lookups.begin(), m_lookups.end(), lookup), m_lookups.end());
+
+        uint16_t port = lookup->getAnnouncePort();
+        if (lookup->getType() != Lookup::Type::GetPeers || port == 0)
+            return;
+
+        std::size_t numAnnounced = 0;
+        for (const auto &candidate : lookup->getClosestResponded(RoutingTable::BucketSize))
+        {
+            if (candidate.Token.empty())
+                continue;
+
+            std::shared_ptr<BenDictionary> args = std::make_shared<BenDictionary>();
+            (*args)["implied_port"] = std::make_shared<BenInt>(0);
+            (*args)["info_hash"] = std::make_shared<BenString>(lookup->getTarget().toString());
+            (*args)["port"] = std::make_shared<BenInt>(static_cast<int64_t>(port));
+            (*args)["token"] = std::make_shared<BenString>(candidate.Token);
+            sendQuery("announce_peer", args, Transaction { QueryType::AnnouncePeer, candidate.Endpoint, candidate.ID, true,
+                                                           std::chrono::steady_clock::now(), nullptr });
+            ++numAnnounced;
+        }
+
+        LOG_DEBUG("torrent_protocol.dht", "Announced to ", numAnnounced, " DHT nodes");
+    }
+
+    void DHTNode::handleMessage(std::string data, const boost::asio::ip::udp::endpoint &sender)
+    {
+        BenDocument document;
+        if (!document.parse(std::move(data)) || !document.getRoot().isDictionary())
+            return;
+
+        BenNode message = document.getRoot();
+        std::string_view type = message.find("y").getString();
+        if (type == "q")
+            handleQuery(message, sender);
+        else if (type == "r")
+            handleResponse(message, sender, false);
+        else if (type == "e")
+            handleResponse(message, sender, true);
+    }
+
+    void DHTNode::handleQuery(const BenNode &message, const boost::asio::ip::udp::endpoint &sender)
+    {
+        std::string_view transactionID = message.find("t").getString();
+        std::string_view method = message.find("q").getString();
+        BenNode args = message.find("a");
+        std::string_view senderID = args.find("id").getString();
+        if (senderID.size() != NodeID::Size)
+        {
+            sendError(sender, transactionID, 203, "Protocol Error");
+            return;
+        }
+
+        time_t now = time(nullptr);
+        m_routingTable.onNodeSeen(NodeID(reinterpret_cast<const uint8_t*>(senderID.data())), sender, now);
+
+        std::shared_ptr<BenDictionary> values = std::make_shared<BenDictionary>();
+        if (method == "ping")
+        {
+            sendResponse(sender, transactionID, values);
+        }
+        else if (method == "find_node")
+        {
+            std::string_view target = args.find("target").getString();
+            if (target.size() != NodeID::Size)
+            {
+                sendError(sender, transactionID, 203, "Protocol Error");
+                return;
+            }
+
+            auto nodes = m_routingTable.findClosest(NodeID(reinterpret_cast<const uint8_t*>(target.data())), RoutingTable::BucketSize);
+            (*values)["nodes"] = std::make_shared<BenString>(encodeNodes(nodes));
+            sendResponse(sender, transactionID, values);
+        }
+        else if (method == "get_peers")
+        {
+            std::string_view infoHash = args.find("info_hash").getString();
+            if (infoHash.size() != NodeID::Size)
+            {
+                sendError(sender, transactionID, 203, "Protocol Error");
+                return;
+            }
+
+            NodeID target(reinterpret_cast<const uint8_t*>(infoHash.data()));
+            (*values)["token"] = std::make_shared<BenString>(getToken(sender.address(), false));
+
+            auto peers = getStoredPeers(target);
+            if (!peers.empty())
+            {
+                std::shared_ptr<BenList> peerList = std::make_shared<BenList>();
+                for (const auto &peer : peers)
+                {
+                    auto addressBytes = peer.address().to_v4().to_bytes();
+                    std::string compactPeer(reinterpret_cast<const char*>(addressBytes.data()), addressBytes.size());
+                    compactPeer.push_back(static_cast<char>(peer.port() >> 8));
+                    compactPeer.push_back(static_cast<char>(peer.port() & 0xff));
+                    peerList->push_back(std::make_shared<BenString>(compactPeer));
+                }
+                (*values)["values"] = peerList;
+            }
+            else
+                (*values)["nodes"] = std::make_shared<BenString>(encodeNodes(m_routingTable.findClosest(target, RoutingTable::BucketSize)));
+
+            sendResponse(sender, transactionID, values);
+        }
+        else if (method == "announce_peer")
+        {
+            std::string_view infoHash = args.find("info_hash").getString();
+            std::string_view token = args.find("token").getString();
+            int64_t port = args.find("port").getInt(0);
+            if (args.find("implied_port").getInt(0) != 0)
+                port = sender.port();
+
+            if (infoHash.size() != NodeID::Size || port <= 0 || port > 65535)
+            {
+                sendError(sender, transactionID, 203, "Protocol Error");
+                return;
+            }
+            if (token != getToken(sender.address(), false) && token != getToken(sender.address(), true))
+            {
+                sendError(sender, transactionID, 203, "Bad Token");
+                return;
+            }
+
+            storePeer(NodeID(reinterpret_cast<const uint8_t*>(infoHash.data())),
+                      boost::asio::ip::tcp::endpoint(sender.address(), static_cast<uint16_t>(port)), now);
+            sendResponse(sender, transactionID, values);
+        }
+        else
+        {
+            sendError(sender, transactionID, 204, "Method Unknown");
+        }
+    }
+
+    void DHTNode::handleResponse(const BenNode &message, const boost::asio::ip::udp::endpoint &sender, bool isError)
+    {
+        std::string_view transactionID = message.find("t").getString();
+        if (transactionID.size() != 2)
+            return;
+
+        uint16_t id = static_cast<uint16_t>((uint8_t(transactionID[0]) << 8) | uint8_t(transactionID[1]));
+        auto it = m_transactions.find(id);
+        if (it == m_transactions.end() || it->second.Endpoint != sender)
+            return;
+
+        Transaction transaction = std::move(it->second);
+        m_transactions.erase(it);
+
+        if (isError)
+        {
+            onQueryFailed(transaction, false);
+            return;
+        }
+
+        BenNode values = message.find("r");
+        std::string_view responderID = values.find("id").getString();
+        if (responderID.size() != NodeID::Size)
+        {
+            onQueryFailed(transaction, false);
+            return;
+        }
+
+        m_routingTable.onNodeSeen(NodeID(reinterpret_cast<const uint8_t*>(responderID.data())), sender, time(nullptr));
+
+        const std::shared_ptr<Lookup> &lookup = transaction.Search;
+        if (!lookup)
+            return;
+
+        for (const auto &node : decodeNodes(values.find("nodes").getString()))
+            lookup->addCandidate(node.ID, node.Endpoint);
+
+        std::string token;
+        if (transaction.Type == QueryType::GetPeers)
+        {
+            token = std::string(values.find("token").getString());
+
+            std::vector<boost::asio::ip::tcp::endpoint> peers;
+            for (BenNode value : values.find("values"))
+            {
+                std::string_view compactPeer = value.getString();
+                if (compactPeer.size() != 6)
+                    continue;
+
+                const uint8_t *bytes = reinterpret_cast<const uint8_t*>(compactPeer.data());
+                boost::asio::ip::address_v4::bytes_type addressBytes;
+                memcpy(addressBytes.data(), bytes, addressBytes.size());
+                uint16_t port = static_cast<uint16_t>((uint16_t(bytes[4]) << 8) | bytes[5]);
+                if (port != 0)
+                    peers.emplace_back(boost::asio::ip::address_v4(addressBytes), port);
+            }
+            lookup->onPeersFound(peers);
+        }
+
+        if (transaction.KnownID)
+            lookup->onResponse(transaction.ID, token);
+        else
+            lookup->endAnonymousQuery();
+
+        advanceLookup(lookup);
+    }
+
+    void DHTNode::onQueryFailed(const Transaction &transaction, bool timedOut)
+    {
+        if (timedOut && transaction.KnownID)
+            m_routingTable.onNodeFailed(transaction.ID);
+
+        const std::shared_ptr<Lookup> &lookup = transaction.Search;
+        if (!lookup)
+            return;
+
+        if (transaction.KnownID)
+            lookup->onFailure(transaction.ID);
+        else
+            lookup->endAnonymousQuery();
+
+        advanceLookup(lookup);
+    }
+
+    void DHTNode::sendQuery(const char *method, std::shared_ptr<BenDictionary> args, Transaction transaction)
+    {
+        // Skip transaction ids that are still awaiting a response
+        uint16_t id = m_nextTransactionID++;
+        while (m_transactions.find(id) != m_transactions.end())
+            id = m_nextTransactionID++;
+
+        std::string transactionID;
+        transactionID.push_back(static_cast<char>(id >> 8));
+        transactionID.push_back(static_cast<char>(id & 0xff));
+
+        (*args)["id"] = std::make_shared<BenString>(m_routingTable.getOwnID().toString());
+
+        BenDictionary message;
+        message["a"] = args;
+        message["q"] = std::make_shared<BenString>(method);
+        message["t"] = std::make_shared<BenString>(transactionID);
+        message["y"] = std::make_shared<BenString>("q");
+
+        boost::asio::ip::udp::endpoint endpoint = transaction.Endpoint;
+        m_transactions[id] = std::move(transaction);
+        sendMessage(endpoint, message);
+    }
+
+    void DHTNode::sendResponse(const boost::asio::ip::udp::endpoint &endpoint, std::string_view transactionID,
+                               std::shared_ptr<BenDictionary> values)
+    {
+        (*values)["id"] = std::make_shared<BenString>(m_routingTable.getOwnID().toString());
+
+        BenDictionary message;
+        message["r"] = values;
+        message["t"] = std::make_shared<BenString>(std::string(transactionID));
+        message["y"] = std::make_shared<BenString>("r");
+        sendMessage(endpoint, message);
+    }
+
+    void DHTNode::sendError(const boost::asio::ip::udp::endpoint &endpoint, std::string_view transactionID,
+                            int64_t code, const std::string &message)
+    {
+        std::shared_ptr<BenList> error = std::make_shared<BenList>();
+        error->push_back(std::make_shared<BenInt>(code));
+        error->push_back(std::make_shared<BenString>(message));
+
+        BenDictionary errorMessage;
+        errorMessage["e"] = error;
+        errorMessage["t"] = std::make_shared<BenString>(std::string(transactionID));
+        errorMessage["y"] = std::make_shared<BenString>("e");
+        sendMessage(endpoint, errorMessage);
+    }
+
+    void DHTNode::sendMessage(const boost::asio::ip::udp::endpoint &endpoint, BenDictionary &message)
+    {
+        if (isClosing())
+            return;
+
+        Encoder encoder;
+        message.accept(encoder);
+
+        const std::string &data = encoder.getData();
+        network::MutableBuffer mb(data.size());
+        mb.write(data.data(), data.size());
+        sendTo(std::move(mb), endpoint);
+    }
+
+    std::string DHTNode::getToken(const boost::asio::ip::address &address, bool previousSecret) const
+    {
+        const std::string &secret = m_tokenSecrets[previousSecret ? 1 : 0];
+        auto addressBytes = address.to_v4().to_bytes();
+
+        SHA1Hash hash;
+        hash.update(addressBytes.data(), addressBytes.size());
+        hash.update(reinterpret_cast<const uint8_t*>(secret.data()), secret.size());
+        hash.finalize();
+
+        uint8_t *digest = hash.getDigest();
+        if (digest == nullptr)
+            return std::string();
+        return std::string(reinterpret_cast<const char*>(digest), 8);
+    }
+
+    std::string DHTNode::encodeNodes(const std::vector<NodeEntry> &nodes)
+    {
+        std::string compactNodes;
+        compactNodes.reserve(nodes.size() * CompactNodeSize);
+        for (const auto &node : nodes)
+        {
+            if (!node.Endpoint.address().is_v4())
+                continue;
+
+            auto addressBytes = node.Endpoint.address().to_v4().to_bytes();
+            compactNodes.append(reinterpret_cast<const char*>(node.ID.getData()), NodeID::Size);
+            compactNodes.append(reinterpret_cast<const char*>(addressBytes.data()), addressBytes.size());
+            compactNodes.push_back(static_cast<char>(node.Endpoint.port() >> 8));
+            compactNodes.push_back(static_cast<char>(node.Endpoint.port() & 0xff));
+        }
+        return compactNodes;
+    }
+
+    std::vector<NodeEntry> DHTNode::decodeNodes(std::string_view compactNodes)
+    {
+        std::vector<NodeEntry> nodes;
+        for (std::size_t pos = 0; pos + CompactNodeSize <= compactNodes.size(); pos += CompactNodeSize)
+        {
+            const uint8_t *entry = reinterpret_cast<const uint8_t*>(compactNodes.data() + pos);
+            boost::asio::ip::address_v4::bytes_type addressBytes;
+            memcpy(addressBytes.data(), entry + NodeID::Size, addressBytes.size());
+            uint16_t port = static_cast<uint16_t>((uint16_t(entry[CompactNodeSize - 2]) << 8) | entry[CompactNodeSize - 1]);
+            if (port == 0)
+                continue;
+
+            nodes.push_back(NodeEntry { NodeID(entry), boost::asio::ip::udp::endpoint(boost::asio::ip::address_v4(addressBytes), port), 0, 0 });
+        }
+        return nodes;
+    }
+
+    void DHTNode::storePeer(const NodeID &infoHash, const boost::asio::ip::tcp::endpoint &peer, time_t now)
+    {
+        auto it = m_peerStore.find(infoHash);
+        if (it == m_peerStore.end())
+        {
+            if (m_peerStore.size() >= MaxStoredTorrents)
+                return;
+            it = m_peerStore.emplace(infoHash, std::map<boost::asio::ip::tcp::endpoint, time_t>()).first;
+        }
+
+        auto &peers = it->second;
+        if (peers.size() >= MaxPeersPerTorrent && peers.find(peer) == peers.end())
+        {
+            // Make room by forgetting the peer that announced least recently
+            auto oldest = std::min_element(peers.begin(), peers.end(), [](const std::pair<const boost::asio::ip::tcp::endpoint, time_t> &a,
+                                                                          const std::pair<const boost::asio::ip::tcp::endpoint, time_t> &b) {
+                return a.second < b.second;
+            });
+            peers.erase(oldest);
+        }
+        peers[peer] = now;
+    }
+
+    std::vector<boost::asio::ip::tcp::endpoint> DHTNode::getStoredPeers(const NodeID &infoHash) const
+    {
+        std::vector<boost::asio::ip::tcp::endpoint> peers;
+        auto it = m_peerStore.find(infoHash);
+        if (it == m_peerStore.end())
+            return peers;
+
+        for (const auto &peer : it->second)
+        {
+            if (peers.size() == MaxPeersPerResponse)
+                break;
+            peers.push_back(peer.first);
+        }
+        return peers;
+    }
+
+    void DHTNode::expireStoredPeers(time_t now)
+    {
+        for (auto it = m_peerStore.begin(); it != m_peerStore.end();)
+        {
+            auto &peers = it->second;
+            for (auto peer = peers.begin(); peer != peers.end();)
+            {
+                if (now - peer->second >= PeerExpirySeconds)
+                    peer = peers.erase(peer);
+                else
+                    ++peer;
+            }
+
+            if (peers.empty())
+                it = m_peerStore.erase(it);
+            else
+                ++it;
+        }
+    }
+}
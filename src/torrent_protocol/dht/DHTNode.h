@@ -0,0 +1,242 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <boost/asio.hpp>
+
+#include "Lookup.h"
+#include "NodeID.h"
+#include "RoutingTable.h"
+#include "Socket.h"
+
+namespace bencoding
+{
+    class BenDictionary;
+    class BenNode;
+}
+
+namespace dht
+{
+    /**
+     * @class DHTNode
+     * @brief Node of the mainline DHT (BEP 5). Exchanges KRPC messages with other nodes over a
+     *        single bound UDP socket, answers their queries, and finds peers for a torrent through
+     *        iterative get_peers lookups, announcing itself to the closest nodes if requested.
+     *        Every method that is not called on the thread running the io_service is posted to it.
+     */
+    class DHTNode : public network::Socket
+    {
+    public:
+        /// Handler called with each batch of new peers found for a torrent
+        typedef Lookup::PeerHandler PeerHandler;
+
+    public:
+        /// Constructs a DHT node with a random identifier, given the io_service to run on
+        explicit DHTNode(boost::asio::io_service &ioService);
+
+        /// Binds the node to the given UDP port and joins the network through the nodes of the saved
+        /// state and the bootstrap nodes. A port of 0 binds to any free port. Returns false on failure.
+        /// The node reports itself as connected once bound
+        bool start(uint16_t port);
+
+        /// Stops the node, closing its socket
+        void stop();
+
+        /// Loads the identifier and nodes saved by a previous session, so that the node can rejoin the
+        /// network without the bootstrap nodes. Must be called before \ref start
+        bool loadState(const std::string &path);
+
+        /// Saves the identifier of the node and the contents of its routing table
+        bool saveState(const std::string &path) const;
+
+        /// Adds a well-known node used to join the network when no other node is known. Must be called
+        /// before \ref start
+        void addBootstrapNode(const boost::asio::ip::udp::endpoint &endpoint);
+
+        /// Pings the node at the given endpoint, adding it to the routing table if it responds
+        void ping(const boost::asio::ip::udp::endpoint &endpoint);
+
+        /// Searches for peers of the torrent with the given info hash
+        void getPeers(const uint8_t *infoHash, PeerHandler handler);
+
+        /// Searches for peers of the torrent with the given info hash, then announces that the client
+        /// accepts connections for it on the given port
+        void announce(const uint8_t *infoHash, uint16_t port, PeerHandler handler);
+
+        /// Returns the identifier of the node
+        const NodeID &getNodeID() const;
+
+        /// Returns the number of nodes in the routing table
+        std::size_t getNumNodes() const;
+
+        /// Returns the local UDP port the node is bound to, or 0 if not started
+        uint16_t getPort() const;
+
+    protected:
+        /// Handles a received datagram
+        void onRead() override;
+
+    private:
+        /// Kind of query sent to another node
+        enum class QueryType
+        {
+            Ping,
+            FindNode,
+            GetPeers,
+            AnnouncePeer
+        };
+
+        /// A query awaiting its response
+        struct Transaction
+        {
+            /// Kind of query
+            QueryType Type;
+
+            /// Endpoint the query was sent to
+            boost::asio::ip::udp::endpoint Endpoint;
+
+            /// Identifier of the queried node, if known
+            NodeID ID;
+
+            /// True if the identifier of the queried node is known
+            bool KnownID;
+
+            /// Time at which the query was sent
+            std::chrono::steady_clock::time_point SentTime;
+
+            /// Lookup the query belongs to, if any
+            std::shared_ptr<Lookup> Search;
+        };
+
+    private:
+        /// Returns a shared pointer to this node
+        std::shared_ptr<DHTNode> getSelf();
+
+        /// Performs periodic work: expiring queries, rotating token secrets, refreshing buckets
+        /// and expiring stored peers
+        void onTick(const boost::system::error_code &ec);
+
+        /// Seeds a lookup with the closest known nodes, and starts it
+        void startLookup(std::shared_ptr<Lookup> lookup);
+
+        /// Sends the next queries of a lookup, finishing it if done
+        void advanceLookup(const std::shared_ptr<Lookup> &lookup);
+
+        /// Announces the client to the closest nodes of a finished lookup if requested, and removes the lookup
+        void finishLookup(const std::shared_ptr<Lookup> &lookup);
+
+        /// Dispatches a KRPC message received from the given endpoint
+        void handleMessage(std::string data, const boost::asio::ip::udp::endpoint &sender);
+
+        /// Answers a query
+        void handleQuery(const bencoding::BenNode &message, const boost::asio::ip::udp::endpoint &sender);
+
+        /// Handles a response or error message to one of the node's queries
+        void handleResponse(const bencoding::BenNode &message, const boost::asio::ip::udp::endpoint &sender, bool isError);
+
+        /// Handles a query that timed out or was answered with an error
+        void onQueryFailed(const Transaction &transaction, bool timedOut);
+
+        /// Sends a query with the given arguments, recording the transaction
+        void sendQuery(const char *method, std::shared_ptr<bencoding::BenDictionary> args, Transaction transaction);
+
+        /// Sends a response with the given values, to which the node's identifier is added
+        void sendResponse(const boost::asio::ip::udp::endpoint &endpoint, std::string_view transactionID,
+                          std::shared_ptr<bencoding::BenDictionary> values);
+
+        /// Sends an error message
+        void sendError(const boost::asio::ip::udp::endpoint &endpoint, std::string_view transactionID,
+                       int64_t code, const std::string &message);
+
+        /// Encodes a message and sends it to the given endpoint
+        void sendMessage(const boost::asio::ip::udp::endpoint &endpoint, bencoding::BenDictionary &message);
+
+        /// Returns the announce token of the given address, generated from the current or previous secret
+        std::string getToken(const boost::asio::ip::address &address, bool previousSecret) const;
+
+        /// Encodes nodes into the compact node format, 26 bytes per IPv4 node
+        static std::string encodeNodes(const std::vector<NodeEntry> &nodes);
+
+        /// Decodes nodes in the compact node format
+        static std::vector<NodeEntry> decodeNodes(std::string_view compactNodes);
+
+        /// Stores a peer announced for the given info hash
+        void storePeer(const NodeID &infoHash, const boost::asio::ip::tcp::endpoint &peer, time_t now);
+
+        /// Returns up to MaxPeersPerResponse peers stored for the given info hash
+        std::vector<boost::asio::ip::tcp::endpoint> getStoredPeers(const NodeID &infoHash) const;
+
+        /// Removes stored peers that have not been announced recently
+        void expireStoredPeers(time_t now);
+
+    private:
+        /// I/O service the node runs on
+        boost::asio::io_service &m_ioService;
+
+        /// Timer driving \ref onTick
+        boost::asio::deadline_timer m_tickTimer;
+
+        /// Routing table
+        RoutingTable m_routingTable;
+
+        /// Queries awaiting responses, by transaction id
+        std::unordered_map<uint16_t, Transaction> m_transactions;
+
+        /// Transaction id of the next query
+        uint16_t m_nextTransactionID;
+
+        /// Lookups in progress
+        std::vector< std::shared_ptr<Lookup> > m_lookups;
+
+        /// Well-known nodes used to join the network
+        std::vector<boost::asio::ip::udp::endpoint> m_bootstrapNodes;
+
+        /// Nodes loaded from the saved state, used to seed lookups until the routing table fills up
+        std::vector<NodeEntry> m_savedNodes;
+
+        /// Current and previous secrets that announce tokens are generated from
+        std::array<std::string, 2> m_tokenSecrets;
+
+        /// Time at which the token secret was last rotated
+        time_t m_lastSecretRotation;
+
+        /// Time at which the routing table was last refreshed
+        time_t m_lastRefresh;
+
+        /// Peers announced to this node, with the time of their last announce, by info hash
+        std::map< NodeID, std::map<boost::asio::ip::tcp::endpoint, time_t> > m_peerStore;
+    };
+}
@@ -0,0 +1,195 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <algorithm>
+#include "Lookup.h"
+#include "RoutingTable.h"
+
+namespace dht
+{
+    Lookup::Lookup(Type type, const NodeID &target) :
+        m_type(type),
+        m_target(target),
+        m_candidates(),
+        m_numInFlight(0),
+        m_numAnonymous(0),
+        m_peers(),
+        m_peerHandler(),
+        m_announcePort(0)
+    {
+    }
+
+    Lookup::Type Lookup::getType() const
+    {
+        return m_type;
+    }
+
+    const NodeID &Lookup::getTarget() const
+    {
+        return m_target;
+    }
+
+    void Lookup::setPeerHandler(PeerHandler handler)
+    {
+        m_peerHandler = handler;
+    }
+
+    void Lookup::setAnnouncePort(uint16_t port)
+    {
+        m_announcePort = port;
+    }
+
+    uint16_t Lookup::getAnnouncePort() const
+    {
+        return m_announcePort;
+    }
+
+    void Lookup::addCandidate(const NodeID &id, const boost::asio::ip::udp::endpoint &endpoint)
+    {
+        if (endpoint.port() == 0 || findCandidate(id) != nullptr)
+            return;
+
+        auto pos = std::lower_bound(m_candidates.begin(), m_candidates.end(), id, [this](const Candidate &candidate, const NodeID &other) {
+            return NodeID::isCloser(m_target, candidate.ID, other);
+        });
+        if (pos == m_candidates.end() && m_candidates.size() >= MaxCandidates)
+            return;
+
+        m_candidates.insert(pos, Candidate { id, endpoint, CandidateState::Pending, std::string() });
+
+        // Drop the farthest candidate, unless a query to it is still in flight
+        if (m_candidates.size() > MaxCandidates && m_candidates.back().State != CandidateState::Queried)
+            m_candidates.pop_back();
+    }
+
+    bool Lookup::getNextQuery(Candidate &candidate)
+    {
+        if (m_numInFlight >= Alpha || isFinished())
+            return false;
+
+        for (auto &next : m_candidates)
+        {
+            if (next.State != CandidateState::Pending)
+                continue;
+
+            next.State = CandidateState::Queried;
+            ++m_numInFlight;
+            candidate = next;
+            return true;
+        }
+        return false;
+    }
+
+    void Lookup::onResponse(const NodeID &id, const std::string &token)
+    {
+        Candidate *candidate = findCandidate(id);
+        if (candidate == nullptr || candidate->State != CandidateState::Queried)
+            return;
+
+        candidate->State = CandidateState::Responded;
+        candidate->Token = token;
+        --m_numInFlight;
+    }
+
+    void Lookup::onFailure(const NodeID &id)
+    {
+        Candidate *candidate = findCandidate(id);
+        if (candidate == nullptr || candidate->State != CandidateState::Queried)
+            return;
+
+        candidate->State = CandidateState::Failed;
+        --m_numInFlight;
+    }
+
+    void Lookup::beginAnonymousQuery()
+    {
+        ++m_numAnonymous;
+    }
+
+    void Lookup::endAnonymousQuery()
+    {
+        if (m_numAnonymous > 0)
+            --m_numAnonymous;
+    }
+
+    void Lookup::onPeersFound(const std::vector<boost::asio::ip::tcp::endpoint> &peers)
+    {
+        std::vector<boost::asio::ip::tcp::endpoint> newPeers;
+        for (const auto &peer : peers)
+        {
+            if (m_peers.insert(peer).second)
+                newPeers.push_back(peer);
+        }
+
+        if (!newPeers.empty() && m_peerHandler)
+            m_peerHandler(newPeers);
+    }
+
+    bool Lookup::isFinished() const
+    {
+        // Finished once the closest BucketSize candidates that did not fail have all responded
+        std::size_t numResponded = 0;
+        for (const auto &candidate : m_candidates)
+        {
+            if (candidate.State == CandidateState::Failed)
+                continue;
+            if (candidate.State != CandidateState::Responded)
+                return false;
+            if (++numResponded == RoutingTable::BucketSize)
+                return true;
+        }
+
+        // Too few candidates so far, but queries to bootstrap nodes may still return more
+        return m_numAnonymous == 0;
+    }
+
+    std::vector<Lookup::Candidate> Lookup::getClosestResponded(std::size_t count) const
+    {
+        std::vector<Candidate> closest;
+        for (const auto &candidate : m_candidates)
+        {
+            if (closest.size() == count)
+                break;
+            if (candidate.State == CandidateState::Responded)
+                closest.push_back(candidate);
+        }
+        return closest;
+    }
+
+    std::size_t Lookup::getNumInFlight() const
+    {
+        return m_numInFlight;
+    }
+
+    Lookup::Candidate *Lookup::findCandidate(const NodeID &id)
+    {
+        for (auto &candidate : m_candidates)
+        {
+            if (candidate.ID == id)
+                return &candidate;
+        }
+        return nullptr;
+    }
+}
@@ -0,0 +1,173 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <set>
+#include <string>
+#include <vector>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/ip/udp.hpp>
+
+#include "NodeID.h"
+
+namespace dht
+{
+    /**
+     * @class Lookup
+     * @brief State of an iterative lookup for the nodes closest to a target identifier. Candidates are
+     *        queried closest first, with up to Alpha queries in flight, until the BucketSize closest
+     *        candidates that could be reached have all responded. A get_peers lookup also collects the
+     *        peers and announce tokens returned along the way.
+     */
+    class Lookup
+    {
+    public:
+        /// Handler called with each batch of new peers found by a get_peers lookup
+        typedef std::function<void(const std::vector<boost::asio::ip::tcp::endpoint>&)> PeerHandler;
+
+        /// Kind of query sent to the candidates
+        enum class Type
+        {
+            FindNode,
+            GetPeers
+        };
+
+        /// Progress of a candidate
+        enum class CandidateState
+        {
+            Pending,
+            Queried,
+            Responded,
+            Failed
+        };
+
+        /// A node that may be queried by the lookup
+        struct Candidate
+        {
+            /// Identifier of the node
+            NodeID ID;
+
+            /// Endpoint of the node
+            boost::asio::ip::udp::endpoint Endpoint;
+
+            /// Progress of the query sent to the node
+            CandidateState State;
+
+            /// Announce token returned by the node, for get_peers lookups
+            std::string Token;
+        };
+
+    public:
+        /// Number of queries a lookup keeps in flight at a time
+        static const std::size_t Alpha = 3;
+
+        /// Maximum number of candidates kept, the farthest being dropped first
+        static const std::size_t MaxCandidates = 64;
+
+    public:
+        /// Constructs a lookup of the given type for the target
+        Lookup(Type type, const NodeID &target);
+
+        /// Returns the type of lookup
+        Type getType() const;
+
+        /// Returns the target of the lookup
+        const NodeID &getTarget() const;
+
+        /// Sets the handler called as peers are found
+        void setPeerHandler(PeerHandler handler);
+
+        /// Sets the port to announce to the closest nodes once the lookup finishes, 0 meaning no announce
+        void setAnnouncePort(uint16_t port);
+
+        /// Returns the port to announce once the lookup finishes, or 0
+        uint16_t getAnnouncePort() const;
+
+        /// Adds a node to query, unless it is already known or farther than every kept candidate
+        void addCandidate(const NodeID &id, const boost::asio::ip::udp::endpoint &endpoint);
+
+        /// Selects the closest pending candidate to query, if fewer than Alpha queries are in flight
+        /// and the lookup is not finished. Returns false if no query should be sent now
+        bool getNextQuery(Candidate &candidate);
+
+        /// Records the response of a candidate, with its announce token if any
+        void onResponse(const NodeID &id, const std::string &token);
+
+        /// Records the failure of a candidate to respond
+        void onFailure(const NodeID &id);
+
+        /// Called when a query is sent to a node whose identifier is not known yet, such as a bootstrap
+        /// node. The lookup does not finish while such queries are in flight
+        void beginAnonymousQuery();
+
+        /// Called when a query to a node whose identifier was not known has completed or failed
+        void endAnonymousQuery();
+
+        /// Passes the peers returned by a node to the peer handler, skipping those already found
+        void onPeersFound(const std::vector<boost::asio::ip::tcp::endpoint> &peers);
+
+        /// Returns true once the closest reachable candidates have all responded, or none are left to query
+        bool isFinished() const;
+
+        /// Returns up to count of the closest candidates that responded
+        std::vector<Candidate> getClosestResponded(std::size_t count) const;
+
+        /// Returns the number of queries in flight
+        std::size_t getNumInFlight() const;
+
+    private:
+        /// Returns the candidate with the given identifier, or a null pointer
+        Candidate *findCandidate(const NodeID &id);
+
+    private:
+        /// Kind of query sent to the candidates
+        Type m_type;
+
+        /// Target identifier
+        NodeID m_target;
+
+        /// Candidates, ordered by distance to the target
+        std::vector<Candidate> m_candidates;
+
+        /// Number of candidates in the Queried state
+        std::size_t m_numInFlight;
+
+        /// Number of queries in flight to nodes whose identifier is not known
+        std::size_t m_numAnonymous;
+
+        /// Peers found so far
+        std::set<boost::asio::ip::tcp::endpoint> m_peers;
+
+        /// Handler of newly found peers
+        PeerHandler m_peerHandler;
+
+        /// Port to announce once finished
+        uint16_t m_announcePort;
+    };
+}
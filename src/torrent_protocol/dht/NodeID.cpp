@@ -0,0 +1,123 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <cstring>
+#include <random>
+#include "NodeID.h"
+
+namespace dht
+{
+    NodeID::NodeID() :
+        m_data()
+    {
+        m_data.fill(0);
+    }
+
+    NodeID::NodeID(const uint8_t *data) :
+        m_data()
+    {
+        memcpy(m_data.data(), data, Size);
+    }
+
+    NodeID NodeID::random()
+    {
+        static std::random_device rd;
+        std::uniform_int_distribution<int> byteDist(0, 255);
+
+        NodeID id;
+        for (auto &byte : id.m_data)
+            byte = static_cast<uint8_t>(byteDist(rd));
+        return id;
+    }
+
+    const uint8_t *NodeID::getData() const
+    {
+        return m_data.data();
+    }
+
+    std::string NodeID::toString() const
+    {
+        return std::string(reinterpret_cast<const char*>(m_data.data()), Size);
+    }
+
+    std::size_t NodeID::getCommonPrefixLength(const NodeID &other) const
+    {
+        for (std::size_t i = 0; i < Size; ++i)
+        {
+            uint8_t diff = m_data[i] ^ other.m_data[i];
+            if (diff == 0)
+                continue;
+
+            std::size_t numBits = i * 8;
+            while ((diff & 0x80) == 0)
+            {
+                diff <<= 1;
+                ++numBits;
+            }
+            return numBits;
+        }
+        return NumBits;
+    }
+
+    bool NodeID::getBit(std::size_t pos) const
+    {
+        return (m_data[pos / 8] & (0x80 >> (pos % 8))) != 0;
+    }
+
+    void NodeID::setBit(std::size_t pos, bool value)
+    {
+        if (value)
+            m_data[pos / 8] |= (0x80 >> (pos % 8));
+        else
+            m_data[pos / 8] &= ~(0x80 >> (pos % 8));
+    }
+
+    bool NodeID::isCloser(const NodeID &target, const NodeID &a, const NodeID &b)
+    {
+        for (std::size_t i = 0; i < Size; ++i)
+        {
+            uint8_t distA = a.m_data[i] ^ target.m_data[i];
+            uint8_t distB = b.m_data[i] ^ target.m_data[i];
+            if (distA != distB)
+                return distA < distB;
+        }
+        return false;
+    }
+
+    bool NodeID::operator==(const NodeID &other) const
+    {
+        return m_data == other.m_data;
+    }
+
+    bool NodeID::operator!=(const NodeID &other) const
+    {
+        return m_data != other.m_data;
+    }
+
+    bool NodeID::operator<(const NodeID &other) const
+    {
+        return m_data < other.m_data;
+    }
+}
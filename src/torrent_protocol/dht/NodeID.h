@@ -0,0 +1,89 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace dht
+{
+    /**
+     * @class NodeID
+     * @brief 160-bit identifier of a DHT node or info hash, compared by the XOR metric
+     */
+    class NodeID
+    {
+    public:
+        /// Number of bytes in an identifier
+        static const std::size_t Size = 20;
+
+        /// Number of bits in an identifier
+        static const std::size_t NumBits = Size * 8;
+
+    public:
+        /// Constructs an identifier with every bit cleared
+        NodeID();
+
+        /// Constructs an identifier from Size bytes of data
+        explicit NodeID(const uint8_t *data);
+
+        /// Returns a random identifier
+        static NodeID random();
+
+        /// Returns a pointer to the Size bytes of the identifier
+        const uint8_t *getData() const;
+
+        /// Returns the identifier as a string of Size bytes
+        std::string toString() const;
+
+        /// Returns the number of leading bits shared with another identifier
+        std::size_t getCommonPrefixLength(const NodeID &other) const;
+
+        /// Returns the value of the bit at the given position, counting from the most significant bit
+        bool getBit(std::size_t pos) const;
+
+        /// Sets the value of the bit at the given position, counting from the most significant bit
+        void setBit(std::size_t pos, bool value);
+
+        /// Returns true if a is closer to target than b by the XOR metric
+        static bool isCloser(const NodeID &target, const NodeID &a, const NodeID &b);
+
+        /// Equality operator
+        bool operator==(const NodeID &other) const;
+
+        /// Inequality operator
+        bool operator!=(const NodeID &other) const;
+
+        /// Lexicographic ordering, allowing identifiers to be used as keys of ordered containers
+        bool operator<(const NodeID &other) const;
+
+    private:
+        /// Bytes of the identifier, most significant first
+        std::array<uint8_t, Size> m_data;
+    };
+}
@@ -0,0 +1,174 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <algorithm>
+#include <random>
+#include "RoutingTable.h"
+
+namespace dht
+{
+    RoutingTable::RoutingTable(const NodeID &ownID) :
+        m_ownID(ownID),
+        m_buckets(NodeID::NumBits),
+        m_numNodes(0)
+    {
+    }
+
+    void RoutingTable::reset(const NodeID &ownID)
+    {
+        m_ownID = ownID;
+        m_buckets.clear();
+        m_buckets.resize(NodeID::NumBits);
+        m_numNodes = 0;
+    }
+
+    const NodeID &RoutingTable::getOwnID() const
+    {
+        return m_ownID;
+    }
+
+    bool RoutingTable::onNodeSeen(const NodeID &id, const boost::asio::ip::udp::endpoint &endpoint, time_t now)
+    {
+        if (id == m_ownID || endpoint.port() == 0)
+            return false;
+
+        Bucket &bucket = m_buckets[getBucketIndex(id)];
+        for (auto &node : bucket.Nodes)
+        {
+            if (node.ID != id)
+                continue;
+
+            node.Endpoint = endpoint;
+            node.LastSeen = now;
+            node.NumFailures = 0;
+            bucket.LastChanged = now;
+            return true;
+        }
+
+        NodeEntry entry { id, endpoint, now, 0 };
+        if (bucket.Nodes.size() < BucketSize)
+        {
+            bucket.Nodes.push_back(entry);
+            bucket.LastChanged = now;
+            ++m_numNodes;
+            return true;
+        }
+
+        // Replace the node that failed the most, if it is bad
+        auto worst = std::max_element(bucket.Nodes.begin(), bucket.Nodes.end(), [](const NodeEntry &a, const NodeEntry &b) {
+            return a.NumFailures < b.NumFailures;
+        });
+        if (worst->NumFailures < MaxNodeFailures)
+            return false;
+
+        *worst = entry;
+        bucket.LastChanged = now;
+        return true;
+    }
+
+    void RoutingTable::onNodeFailed(const NodeID &id)
+    {
+        Bucket &bucket = m_buckets[getBucketIndex(id)];
+        for (auto &node : bucket.Nodes)
+        {
+            if (node.ID == id)
+            {
+                ++node.NumFailures;
+                return;
+            }
+        }
+    }
+
+    std::vector<NodeEntry> RoutingTable::findClosest(const NodeID &target, std::size_t count) const
+    {
+        // Nodes in the target's bucket are closest to it, followed by those in every deeper bucket (which all
+        // lie in the same distance range), and then those in each shallower bucket, in decreasing depth
+        std::vector<NodeEntry> candidates;
+        auto addBucket = [&](std::size_t index) {
+            for (const auto &node : m_buckets[index].Nodes)
+            {
+                if (node.NumFailures < MaxNodeFailures)
+                    candidates.push_back(node);
+            }
+        };
+
+        std::size_t targetIndex = getBucketIndex(target);
+        addBucket(targetIndex);
+        for (std::size_t i = targetIndex + 1; i < m_buckets.size(); ++i)
+            addBucket(i);
+        for (std::size_t i = targetIndex; i > 0 && candidates.size() < count; --i)
+            addBucket(i - 1);
+
+        std::sort(candidates.begin(), candidates.end(), [&target](const NodeEntry &a, const NodeEntry &b) {
+            return NodeID::isCloser(target, a.ID, b.ID);
+        });
+        if (candidates.size() > count)
+            candidates.resize(count);
+        return candidates;
+    }
+
+    std::vector<NodeEntry> RoutingTable::getNodes() const
+    {
+        std::vector<NodeEntry> nodes;
+        nodes.reserve(m_numNodes);
+        for (const auto &bucket : m_buckets)
+            nodes.insert(nodes.end(), bucket.Nodes.begin(), bucket.Nodes.end());
+        return nodes;
+    }
+
+    std::size_t RoutingTable::getNumNodes() const
+    {
+        return m_numNodes;
+    }
+
+    std::vector<NodeID> RoutingTable::getRefreshTargets(time_t staleBefore, time_t now)
+    {
+        static std::mt19937 gen(std::random_device{}());
+        std::bernoulli_distribution bitDist;
+
+        std::vector<NodeID> targets;
+        for (std::size_t i = 0; i < m_buckets.size(); ++i)
+        {
+            Bucket &bucket = m_buckets[i];
+            if (bucket.Nodes.empty() || bucket.LastChanged >= staleBefore)
+                continue;
+
+            // Shares exactly i bits with the local identifier, random beyond
+            NodeID target = m_ownID;
+            target.setBit(i, !m_ownID.getBit(i));
+            for (std::size_t bit = i + 1; bit < NodeID::NumBits; ++bit)
+                target.setBit(bit, bitDist(gen));
+
+            targets.push_back(target);
+            bucket.LastChanged = now;
+        }
+        return targets;
+    }
+
+    std::size_t RoutingTable::getBucketIndex(const NodeID &id) const
+    {
+        return std::min(m_ownID.getCommonPrefixLength(id), NodeID::NumBits - 1);
+    }
+}
@@ -0,0 +1,123 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <vector>
+#include <boost/asio/ip/udp.hpp>
+
+#include "NodeID.h"
+
+namespace dht
+{
+    /// A node known to the routing table
+    struct NodeEntry
+    {
+        /// Identifier of the node
+        NodeID ID;
+
+        /// Endpoint the node is reachable at
+        boost::asio::ip::udp::endpoint Endpoint;
+
+        /// Time at which the node last responded or sent a query
+        time_t LastSeen;
+
+        /// Number of consecutive queries the node failed to respond to
+        uint32_t NumFailures;
+    };
+
+    /**
+     * @class RoutingTable
+     * @brief Kademlia routing table of a DHT node. Nodes are kept in one bucket per length of the
+     *        prefix they share with the local node's identifier, each holding up to BucketSize good
+     *        nodes. Nodes that fail to respond several times in a row are replaced by new ones.
+     */
+    class RoutingTable
+    {
+    public:
+        /// Maximum number of nodes in a bucket, the K of Kademlia
+        static const std::size_t BucketSize = 8;
+
+        /// Number of consecutive failures after which a node is considered bad
+        static const uint32_t MaxNodeFailures = 2;
+
+    public:
+        /// Constructs an empty routing table around the given local identifier
+        explicit RoutingTable(const NodeID &ownID);
+
+        /// Removes every node, and changes the local identifier
+        void reset(const NodeID &ownID);
+
+        /// Returns the identifier of the local node
+        const NodeID &getOwnID() const;
+
+        /// Called when a node has responded to a query or sent one. Adds the node to its bucket if
+        /// there is room or a bad node to replace. Returns true if the node is in the table
+        bool onNodeSeen(const NodeID &id, const boost::asio::ip::udp::endpoint &endpoint, time_t now);
+
+        /// Called when a node has failed to respond to a query
+        void onNodeFailed(const NodeID &id);
+
+        /// Returns up to count good nodes closest to the target, ordered by distance
+        std::vector<NodeEntry> findClosest(const NodeID &target, std::size_t count) const;
+
+        /// Returns every node in the table
+        std::vector<NodeEntry> getNodes() const;
+
+        /// Returns the number of nodes in the table
+        std::size_t getNumNodes() const;
+
+        /// Returns a random identifier within each non-empty bucket that has not changed since the given time,
+        /// marking those buckets as refreshed
+        std::vector<NodeID> getRefreshTargets(time_t staleBefore, time_t now);
+
+    private:
+        /// Returns the index of the bucket that the given identifier belongs to
+        std::size_t getBucketIndex(const NodeID &id) const;
+
+    private:
+        /// Nodes sharing the same prefix length with the local identifier
+        struct Bucket
+        {
+            /// Nodes of the bucket
+            std::vector<NodeEntry> Nodes;
+
+            /// Time at which a node of the bucket was last added or seen
+            time_t LastChanged;
+        };
+
+        /// Identifier of the local node
+        NodeID m_ownID;
+
+        /// Buckets, indexed by the length of the prefix their nodes share with the local identifier
+        std::vector<Bucket> m_buckets;
+
+        /// Number of nodes across all buckets
+        std::size_t m_numNodes;
+    };
+}
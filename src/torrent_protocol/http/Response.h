@@ -25,6 +25,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #pragma once
 
+#include <cstdlib>
 #include <string>
 
 #include "LogHelper.h"
@@ -48,6 +49,24 @@ namespace http
         /// The payload
         std::string Payload;
 
+        /// Returns true if the given data contains the entire response header and payload, false if else.
+        /// A payload with neither a Content-Length nor chunked encoding ends when the server closes the connection
+        static bool isComplete(const std::string &data)
+        {
+            std::size_t headerEndPos = data.find("\r\n\r\n");
+            if (headerEndPos == std::string::npos)
+                return false;
+
+            std::size_t lengthPos = data.find("Content-Length:");
+            if (lengthPos != std::string::npos && lengthPos < headerEndPos)
+            {
+                std::size_t contentLength = std::strtoull(data.c_str() + lengthPos + 15, nullptr, 10);
+                return data.size() >= headerEndPos + 4 + contentLength;
+            }
+
+            return isChunked(data, headerEndPos) && decodeChunks(data, headerEndPos + 4, nullptr);
+        }
+
         /// Constructs a respose given the raw string sent by the server
         Response(const std::string &data)
         {
@@ -77,8 +96,44 @@ namespace http
             std::size_t headerEndPos = data.find("\r\n\r\n");
             if (headerEndPos != std::string::npos && headerEndPos + 4 < data.size())
             {
-                Payload = data.substr(headerEndPos + 4);
+                if (isChunked(data, headerEndPos))
+                    decodeChunks(data, headerEndPos + 4, &Payload);
+                else
+                    Payload = data.substr(headerEndPos + 4);
+            }
+        }
+
+    private:
+        /// Returns true if the header, which ends at the given position, specifies a chunked payload
+        static bool isChunked(const std::string &data, std::size_t headerEndPos)
+        {
+            std::size_t encodingPos = data.find("Transfer-Encoding: chunked");
+            return encodingPos != std::string::npos && encodingPos < headerEndPos;
+        }
+
+        /// Reads the chunks of a payload starting at the given position, appending their data to the payload
+        /// if one is given. Returns true if the final chunk, of length zero, has been received
+        static bool decodeChunks(const std::string &data, std::size_t pos, std::string *payload)
+        {
+            while (pos < data.size())
+            {
+                // Each chunk is <length in hex>[;extensions]\r\n<data>\r\n
+                std::size_t lineEndPos = data.find("\r\n", pos);
+                if (lineEndPos == std::string::npos)
+                    return false;
+
+                std::size_t chunkLength = std::strtoull(data.c_str() + pos, nullptr, 16);
+                if (chunkLength == 0)
+                    return data.find("\r\n", lineEndPos + 2) != std::string::npos;
+
+                if (data.size() < lineEndPos + 2 + chunkLength + 2)
+                    return false;
+
+                if (payload != nullptr)
+                    payload->append(data, lineEndPos + 2, chunkLength);
+                pos = lineEndPos + 2 + chunkLength + 2;
             }
+            return false;
         }
     };
 }
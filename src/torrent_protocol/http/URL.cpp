@@ -37,6 +37,8 @@ namespace http
         if (addrPosBegin != std::string::npos
                 && url.size() > addrPosBegin + 3)
         {
+            m_scheme = url.substr(0, addrPosBegin);
+
             auto addrPosEnd = url.find_first_of('/', addrPosBegin + 3);
 
             // If '/' was found in the original string, modify addrPosEnd to represent the length of the host substring
@@ -63,11 +65,32 @@ namespace http
         }
     }
 
+    const std::string &URL::getScheme() const
+    {
+        return m_scheme;
+    }
+
     const std::string &URL::getHost() const
     {
         return m_host;
     }
 
+    std::string URL::getHostName() const
+    {
+        auto delimPos = m_host.find_last_of(':');
+        if (delimPos != std::string::npos)
+            return m_host.substr(0, delimPos);
+        return m_host;
+    }
+
+    std::string URL::getPort() const
+    {
+        auto delimPos = m_host.find_last_of(':');
+        if (delimPos != std::string::npos)
+            return m_host.substr(delimPos + 1);
+        return (m_scheme == "https") ? "443" : "80";
+    }
+
     const std::string &URL::getPageName() const
     {
         return m_pageName;
@@ -102,6 +125,36 @@ namespace http
         m_pageName = name;
     }
 
+    bool URL::convertToScrape()
+    {
+        // The text following the final '/' of the path must begin with "announce"
+        auto namePos = m_pageName.find_last_of('/');
+        namePos = (namePos == std::string::npos) ? 0 : namePos + 1;
+        if (m_pageName.compare(namePos, 8, "announce") != 0)
+            return false;
+
+        m_pageName.replace(namePos, 8, "scrape");
+        return true;
+    }
+
+    void URL::addParameter(std::string key, std::string value)
+    {
+        m_parameters.emplace_back(std::move(key), std::move(value));
+    }
+
+    void URL::setParameterString(std::string key, std::string value)
+    {
+        for (auto &param : m_parameters)
+        {
+            if (param.first == key)
+            {
+                param.second = std::move(value);
+                return;
+            }
+        }
+        m_parameters.emplace_back(std::move(key), std::move(value));
+    }
+
     std::string URL::getEncodedFor(const std::string &str) const
     {
         std::ostringstream oss;
@@ -143,7 +196,7 @@ namespace http
             std::string requestPair = paramString.substr(last, paramDelim - last);
             auto keyValDelim = requestPair.find_first_of('=');
             if (keyValDelim != std::string::npos)
-                m_parameters.insert(std::make_pair(requestPair.substr(0, keyValDelim), requestPair.substr(keyValDelim + 1)));
+                m_parameters.emplace_back(requestPair.substr(0, keyValDelim), requestPair.substr(keyValDelim + 1));
 
             // Check if more parameters to extract or if loop should stop
             if (paramDelim != std::string::npos)
@@ -26,7 +26,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #pragma once
 
 #include <string>
-#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "StringHelper.h"
 
@@ -42,9 +43,18 @@ namespace http
         /// Constructs a URL given a string of proper format
         explicit URL(const std::string &url);
 
+        /// Returns the scheme of the URL, ex: "http" or "udp"
+        const std::string &getScheme() const;
+
         /// Returns the host associated with the URL
         const std::string &getHost() const;
 
+        /// Returns the host name of the URL, without any port number
+        std::string getHostName() const;
+
+        /// Returns the port number of the URL as a string, or the default port of its scheme if none was given
+        std::string getPort() const;
+
         /// Returns the page name associated with the URL
         const std::string &getPageName() const;
 
@@ -54,21 +64,33 @@ namespace http
         /// Sets the page name to the given value
         void setPageName(std::string name);
 
+        /// Converts an announce URL into the URL of the tracker's scrape convention, by replacing the
+        /// "announce" text of the final path component with "scrape". Returns false if the tracker
+        /// does not support scraping.
+        bool convertToScrape();
+
         /// Associates the key parameter to the given value
         template <typename T>
         void setParameter(std::string key, T value)
         {
-            m_parameters[key] = StringHelper::toString(value);
+            setParameterString(std::move(key), StringHelper::toString(value));
         }
 
         /// Associates the key parameter to the given value
         template <typename T>
         void setParameter(std::string key, T value, size_t len)
         {
-            m_parameters[key] = StringHelper::toString(value).substr(0, len);
+            setParameterString(std::move(key), StringHelper::toString(value).substr(0, len));
         }
 
+        /// Adds another value for the key parameter without replacing any previous values (ex: a scrape
+        /// request with several info_hash parameters)
+        void addParameter(std::string key, std::string value);
+
     private:
+        /// Associates the key parameter to the given string, replacing the first value already associated with the key
+        void setParameterString(std::string key, std::string value);
+
         /// Converts the string, wherever applicable, into percent encoded URI format
         std::string getEncodedFor(const std::string &str) const;
 
@@ -76,13 +98,16 @@ namespace http
         void extractParameters(std::string paramString);
 
     private:
+        /// Scheme of the URL. Ex: http
+        std::string m_scheme;
+
         /// Host location. Ex: www.sitename.com
         std::string m_host;
 
         /// Page name. Appears after host, before request parameters
         std::string m_pageName;
 
-        /// Map of request parameters, which can be formatted as "/?key1=value1&keyN=valueN" when sending a request
-        std::unordered_map<std::string, std::string> m_parameters;
+        /// Request parameters in order of insertion, which can be formatted as "/?key1=value1&keyN=valueN" when sending a request
+        std::vector< std::pair<std::string, std::string> > m_parameters;
     };
 }
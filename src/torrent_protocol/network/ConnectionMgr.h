@@ -52,6 +52,8 @@ namespace network
         ConnectionMgr(boost::asio::io_service &ioService) :
             m_ioService(ioService),
             m_connectionTimer(ioService),
+            m_haveTimer(ioService),
+            m_utpSocketMgr(nullptr),
             m_connections()
         {
         }
@@ -61,9 +63,18 @@ namespace network
         {
             m_connectionTimer.expires_from_now(boost::posix_time::seconds(5));
             m_connectionTimer.async_wait(std::bind(&ConnectionMgr<SocketType>::checkForStaleConns, this, std::placeholders::_1));
+
+            m_haveTimer.expires_from_now(boost::posix_time::milliseconds(HaveInterval));
+            m_haveTimer.async_wait(std::bind(&ConnectionMgr<SocketType>::flushPieceHaves, this, std::placeholders::_1));
         }
 
     public:
+        /// Sets the uTP socket manager. Once set, outgoing peer connections are attempted over uTP first
+        void setUTPSocketMgr(std::shared_ptr<UTPSocketMgr> utpSocketMgr)
+        {
+            m_utpSocketMgr = utpSocketMgr;
+        }
+
         /// Adds a connection to the list of active connections
         void addConnection(std::shared_ptr<SocketType> connection)
         {
@@ -71,12 +82,11 @@ namespace network
             m_connections.push_back(connection);
         }
 
-        /// Attempts to add a new SocketType (Peer) which will connect to a remote endpoint given the IP address and port
-        /// Also passes the torrent state to the socket for peer handshake
-        void attemptConnection(uint32_t ipAddress, uint16_t port, std::shared_ptr<TorrentState> &torrentState)
+        /// Attempts to add a new SocketType (Peer) which will connect to a remote endpoint given the IP address
+        /// (either IPv4 or IPv6) and port. Also passes the torrent state to the socket for peer handshake
+        void attemptConnection(const boost::asio::ip::address &ipAddress, uint16_t port, std::shared_ptr<TorrentState> &torrentState)
         {
-            boost::asio::ip::address_v4 ip(ipAddress);
-            boost::asio::ip::tcp::endpoint connEndpoint(ip, port);
+            boost::asio::ip::tcp::endpoint connEndpoint(Socket::normalizeAddress(ipAddress), port);
 
             // When this method is specifically called, we should check if there is already
             // a connection with the same endpoint
@@ -86,10 +96,14 @@ namespace network
                     return;
 
             // Made it this far, add new connection
-            LOG_INFO("torrent_protocol.network", "Attempting connection with endpoint ", ip.to_string(), ":", port);
+            LOG_INFO("torrent_protocol.network", "Attempting connection with endpoint ", connEndpoint.address().to_string(), ":", port);
             std::shared_ptr<SocketType> conn = std::make_shared<SocketType>(m_ioService, Socket::Mode::TCP);
             conn->setTorrentState(torrentState);
-            conn->connect(connEndpoint);
+            if (m_utpSocketMgr)
+                conn->connect(m_utpSocketMgr, connEndpoint);
+            else
+                conn->connect(connEndpoint);
+            m_connections.push_back(conn);
         }
 
         /// Attempts to create a new SocketType which will connect to the givne TCP endpoint
@@ -112,6 +126,7 @@ namespace network
     private:
         /// Iterates through the container of pointers to Sockets, checking
         /// if any connections have gone stale, and if so, removing them.
+        /// The remaining connections are given a chance to run periodic work.
         void checkForStaleConns(const boost::system::error_code &ec)
         {
             if (ec)
@@ -120,31 +135,69 @@ namespace network
                 return;
             }
 
-            std::lock_guard<std::mutex> lock(m_connectionLock);
-            m_connections.erase(std::remove_if(m_connections.begin(), m_connections.end(), [this](std::shared_ptr<SocketType> connection)
+            // The connections are ticked outside of the lock, as a tick may close a connection or attempt new ones
+            std::vector< std::shared_ptr<SocketType> > connections;
             {
-                if (connection.get() && connection->isClosing())
-                    return true;
-                connection->sendPieceHave();
-                return false;
-            }), m_connections.end());
+                std::lock_guard<std::mutex> lock(m_connectionLock);
+                m_connections.erase(std::remove_if(m_connections.begin(), m_connections.end(), [](std::shared_ptr<SocketType> connection)
+                {
+                    return !connection.get() || connection->isClosing();
+                }), m_connections.end());
+                connections = m_connections;
+            }
+
+            for (auto &connection : connections)
+                connection->onTick();
 
             // Reset timer
             m_connectionTimer.expires_from_now(boost::posix_time::seconds(5));
             m_connectionTimer.async_wait(std::bind(&ConnectionMgr<SocketType>::checkForStaleConns, this, std::placeholders::_1));
         }
 
+        /// Lets each connection announce the pieces completed since the previous tick. Connections
+        /// with nothing new return immediately, so the tick can run far more often than the stale check
+        void flushPieceHaves(const boost::system::error_code &ec)
+        {
+            if (ec)
+            {
+                LOG_ERROR("torrent_protocol.network", "Error in ConnectionMgr::flushPieceHaves. Message: ", ec.message());
+                return;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(m_connectionLock);
+                for (auto &connection : m_connections)
+                {
+                    if (connection.get() && !connection->isClosing())
+                        connection->sendPieceHave();
+                }
+            }
+
+            // Reset timer
+            m_haveTimer.expires_from_now(boost::posix_time::milliseconds(HaveInterval));
+            m_haveTimer.async_wait(std::bind(&ConnectionMgr<SocketType>::flushPieceHaves, this, std::placeholders::_1));
+        }
+
     private:
+        /// Milliseconds between each batch of have messages
+        static constexpr long HaveInterval = 250;
+
         /// IO Service reference
         boost::asio::io_service &m_ioService;
 
         /// Timer used to check for stale connections
         boost::asio::deadline_timer m_connectionTimer;
 
+        /// Timer used to send batches of have messages
+        boost::asio::deadline_timer m_haveTimer;
+
+        /// Socket manager of uTP connections, null if uTP is disabled
+        std::shared_ptr<UTPSocketMgr> m_utpSocketMgr;
+
         /// Container for active connections
         std::vector< std::shared_ptr<SocketType> > m_connections;
 
         /// Lock for access to connection container
-        std::mutex m_connectionLock;
+        mutable std::mutex m_connectionLock;
     };
 }
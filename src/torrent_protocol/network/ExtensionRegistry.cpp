@@ -0,0 +1,69 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "ExtensionRegistry.h"
+#include "PeerExtension.h"
+#include "LogHelper.h"
+
+namespace network
+{
+    uint8_t ExtensionRegistry::registerExtension(const std::string &name, Factory factory)
+    {
+        std::vector<Entry> &entries = getEntries();
+
+        // Message id 0 is reserved for the extended handshake
+        if (entries.size() >= 255)
+        {
+            LOG_ERROR("torrent_protocol.network", "Unable to register extension ", name, ", no message ids left");
+            return 0;
+        }
+
+        for (const Entry &entry : entries)
+        {
+            if (entry.Name == name)
+            {
+                LOG_ERROR("torrent_protocol.network", "Extension ", name, " is already registered");
+                return 0;
+            }
+        }
+
+        entries.push_back(Entry{ name, std::move(factory) });
+        return static_cast<uint8_t>(entries.size());
+    }
+
+    std::vector< std::unique_ptr<PeerExtension> > ExtensionRegistry::createExtensions(Peer &peer)
+    {
+        std::vector< std::unique_ptr<PeerExtension> > extensions;
+        for (const Entry &entry : getEntries())
+            extensions.push_back(entry.Create(peer));
+        return extensions;
+    }
+
+    std::vector<ExtensionRegistry::Entry> &ExtensionRegistry::getEntries()
+    {
+        static std::vector<Entry> entries;
+        return entries;
+    }
+}
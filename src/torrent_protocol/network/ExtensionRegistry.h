@@ -0,0 +1,74 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace network
+{
+    class Peer;
+    class PeerExtension;
+
+    /**
+     * @class ExtensionRegistry
+     * @brief Keeps track of the extensions available over the extension protocol (BEP 10). Each registered
+     *        extension claims the next local message id, which is what the client advertises in its extended
+     *        handshake and what incoming extended messages are dispatched on.
+     */
+    class ExtensionRegistry
+    {
+    public:
+        /// Function creating an extension instance for a peer connection
+        typedef std::function<std::unique_ptr<PeerExtension>(Peer&)> Factory;
+
+    public:
+        /// Registers an extension with the given name, returning its local message id, or 0 if no more
+        /// ids are available or the name is taken. Must be called before any peer connections are made
+        static uint8_t registerExtension(const std::string &name, Factory factory);
+
+        /// Creates one instance of every registered extension for the given peer. The extension with
+        /// local message id N is found at index N - 1
+        static std::vector< std::unique_ptr<PeerExtension> > createExtensions(Peer &peer);
+
+    private:
+        /// A registered extension
+        struct Entry
+        {
+            /// Name of the extension
+            std::string Name;
+
+            /// Creates instances of the extension
+            Factory Create;
+        };
+
+        /// Returns the container of registered extensions
+        static std::vector<Entry> &getEntries();
+    };
+}
@@ -0,0 +1,157 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <algorithm>
+#include "LedbatController.h"
+
+namespace network
+{
+    /// Number of minutes of delay samples the base delay is the minimum of
+    const static std::size_t BaseDelayHistoryMinutes = 2;
+
+    /// Retransmission timeout used until a round trip time is measured
+    const static uint32_t InitialTimeoutMillis = 1000;
+
+    /// Lower bound of the retransmission timeout
+    const static uint32_t MinTimeoutMillis = 500;
+
+    /// Upper bound of the retransmission timeout
+    const static uint32_t MaxTimeoutMillis = 60000;
+
+    /// Window of a new connection, in packets
+    const static uint32_t InitialWindowPackets = 2;
+
+    LedbatController::LedbatController(uint32_t packetSize) :
+        m_packetSize(packetSize),
+        m_window(packetSize * InitialWindowPackets),
+        m_slowStart(true),
+        m_slowStartThreshold(MaxWindow),
+        m_baseDelays(),
+        m_baseDelayMinute(Clock::now()),
+        m_rtt(0),
+        m_rttVar(0),
+        m_hasRTT(false),
+        m_timeout(InitialTimeoutMillis),
+        m_lastLoss()
+    {
+    }
+
+    void LedbatController::onAck(uint32_t bytesAcked, uint32_t delayMicros, Clock::time_point now)
+    {
+        if (bytesAcked == 0)
+            return;
+
+        // The delay includes the offset between both clocks, which the base delay cancels out
+        uint32_t baseDelay = updateBaseDelay(delayMicros, now);
+        uint32_t queuingDelay = std::min<uint32_t>(delayMicros - baseDelay, TargetDelayMicros * 10);
+
+        if (m_slowStart && queuingDelay < TargetDelayMicros * 3 / 4 && m_window < m_slowStartThreshold)
+            m_window += bytesAcked;
+        else
+        {
+            m_slowStart = false;
+
+            double offTarget = (double(TargetDelayMicros) - double(queuingDelay)) / double(TargetDelayMicros);
+            double windowFactor = double(bytesAcked) / std::max(m_window, double(bytesAcked));
+            m_window += MaxWindowIncreasePerRTT * offTarget * windowFactor;
+        }
+
+        m_window = std::min(std::max(m_window, double(m_packetSize)), double(MaxWindow));
+    }
+
+    void LedbatController::onRTTSample(uint32_t rttMillis)
+    {
+        // Smoothed as for TCP (RFC 6298)
+        if (!m_hasRTT)
+        {
+            m_rtt = rttMillis;
+            m_rttVar = rttMillis / 2;
+            m_hasRTT = true;
+        }
+        else
+        {
+            uint32_t deviation = (rttMillis > m_rtt) ? rttMillis - m_rtt : m_rtt - rttMillis;
+            m_rttVar += (int32_t(deviation) - int32_t(m_rttVar)) / 4;
+            m_rtt += (int32_t(rttMillis) - int32_t(m_rtt)) / 8;
+        }
+
+        m_timeout = std::min(std::max(m_rtt + 4 * m_rttVar, MinTimeoutMillis), MaxTimeoutMillis);
+    }
+
+    void LedbatController::onLoss(Clock::time_point now)
+    {
+        m_slowStart = false;
+        if (now - m_lastLoss < std::chrono::milliseconds(std::max<uint32_t>(m_rtt, 1)))
+            return;
+
+        m_lastLoss = now;
+        m_window = std::max(m_window / 2, double(m_packetSize));
+    }
+
+    void LedbatController::onTimeout()
+    {
+        m_slowStart = true;
+        m_slowStartThreshold = std::max(m_window / 2, double(m_packetSize));
+        m_window = m_packetSize;
+        m_timeout = std::min(m_timeout * 2, MaxTimeoutMillis);
+    }
+
+    uint32_t LedbatController::getWindow() const
+    {
+        return static_cast<uint32_t>(m_window);
+    }
+
+    uint32_t LedbatController::getTimeoutMillis() const
+    {
+        return m_timeout;
+    }
+
+    uint32_t LedbatController::getRTTMillis() const
+    {
+        return m_rtt;
+    }
+
+    uint32_t LedbatController::updateBaseDelay(uint32_t delayMicros, Clock::time_point now)
+    {
+        if (m_baseDelays.empty() || now - m_baseDelayMinute >= std::chrono::minutes(1))
+        {
+            m_baseDelays.push_back(delayMicros);
+            m_baseDelayMinute = now;
+            if (m_baseDelays.size() > BaseDelayHistoryMinutes)
+                m_baseDelays.pop_front();
+        }
+        else if (int32_t(delayMicros - m_baseDelays.back()) < 0)
+            m_baseDelays.back() = delayMicros;
+
+        // Delays are compared as differences, as they wrap along with the 32-bit timestamps
+        uint32_t baseDelay = m_baseDelays.front();
+        for (uint32_t delay : m_baseDelays)
+        {
+            if (int32_t(delay - baseDelay) < 0)
+                baseDelay = delay;
+        }
+        return baseDelay;
+    }
+}
@@ -0,0 +1,121 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+
+namespace network
+{
+    /**
+     * @class LedbatController
+     * @brief Delay-based congestion control of a uTP connection (LEDBAT, RFC 6817). The window grows
+     *        while the one-way queuing delay measured by the remote side stays below TargetDelayMicros,
+     *        and shrinks as it exceeds it, so that uTP connections give way to other traffic sharing
+     *        the link. Also tracks the round trip time and retransmission timeout.
+     */
+    class LedbatController
+    {
+    public:
+        /// Clock used for all time points
+        typedef std::chrono::steady_clock Clock;
+
+        /// Queuing delay the controller aims for
+        static const uint32_t TargetDelayMicros = 100000;
+
+        /// Maximum growth of the window over one round trip, in bytes
+        static const uint32_t MaxWindowIncreasePerRTT = 3000;
+
+        /// Upper bound of the window, in bytes
+        static const uint32_t MaxWindow = 1 << 20;
+
+    public:
+        /// Constructs a controller for packets of the given payload size
+        explicit LedbatController(uint32_t packetSize);
+
+        /// Called when bytesAcked bytes have been acknowledged by a packet that carried the one-way
+        /// delay measured by the remote side
+        void onAck(uint32_t bytesAcked, uint32_t delayMicros, Clock::time_point now);
+
+        /// Called with the round trip time of a packet that was sent only once
+        void onRTTSample(uint32_t rttMillis);
+
+        /// Called when a packet was lost, halving the window at most once per round trip
+        void onLoss(Clock::time_point now);
+
+        /// Called when the oldest unacknowledged packet timed out, collapsing the window to one packet
+        /// and slowly starting again up to half of the previous window
+        void onTimeout();
+
+        /// Returns the number of bytes that may be in flight
+        uint32_t getWindow() const;
+
+        /// Returns the current retransmission timeout in milliseconds
+        uint32_t getTimeoutMillis() const;
+
+        /// Returns the smoothed round trip time in milliseconds
+        uint32_t getRTTMillis() const;
+
+    private:
+        /// Adds a delay sample to the base delay history, returning the current base delay
+        uint32_t updateBaseDelay(uint32_t delayMicros, Clock::time_point now);
+
+    private:
+        /// Payload size of a full packet
+        uint32_t m_packetSize;
+
+        /// Congestion window in bytes
+        double m_window;
+
+        /// True until the queuing delay nears the target, a packet is lost, or the window reaches m_slowStartThreshold
+        bool m_slowStart;
+
+        /// Window at which a slow start that follows a timeout ends, in bytes
+        double m_slowStartThreshold;
+
+        /// Minimum delay sample of each of the last few minutes, the latest last
+        std::deque<uint32_t> m_baseDelays;
+
+        /// Start of the minute covered by the last entry of m_baseDelays
+        Clock::time_point m_baseDelayMinute;
+
+        /// Smoothed round trip time in milliseconds
+        uint32_t m_rtt;
+
+        /// Round trip time variance in milliseconds
+        uint32_t m_rttVar;
+
+        /// True once the first round trip time sample was taken
+        bool m_hasRTT;
+
+        /// Retransmission timeout in milliseconds
+        uint32_t m_timeout;
+
+        /// Time of the last loss that shrank the window
+        Clock::time_point m_lastLoss;
+    };
+}
@@ -40,14 +40,47 @@ namespace network
     {
         m_connectionMgr = connectionMgr;
 
-        boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::tcp::v4(), port);
-        m_acceptor.open(endpoint.protocol());
-        m_acceptor.bind(endpoint);
+        // Listen on a dual-stack IPv6 socket, which accepts both IPv4 and IPv6 peers. Fall back to
+        // IPv4 only if the host does not support IPv6
+        boost::system::error_code ec;
+        boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::tcp::v6(), port);
+        m_acceptor.open(endpoint.protocol(), ec);
+        if (!ec)
+            m_acceptor.set_option(boost::asio::ip::v6_only(false), ec);
+        if (!ec)
+            m_acceptor.bind(endpoint, ec);
+
+        if (ec)
+        {
+            LOG_WARNING("torrent_protocol.network", "Unable to listen for IPv6 peers, message: ", ec.message());
+            if (m_acceptor.is_open())
+                m_acceptor.close(ec);
+
+            endpoint = boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), port);
+            m_acceptor.open(endpoint.protocol());
+            m_acceptor.bind(endpoint);
+        }
         m_acceptor.listen(maxConnections);
 
         accept();
     }
 
+    void Listener::acceptUTP(std::shared_ptr<UTPSocketMgr> utpSocketMgr)
+    {
+        utpSocketMgr->setAcceptHandler([this](std::shared_ptr<UTPStream> stream)
+        {
+            auto conn = std::make_shared<Peer>(stream);
+
+            // Call read as peer is expected to immediately send their handshake
+            conn->startHandshakeTimeout();
+            conn->read();
+
+            this->m_connectionMgr->addConnection(conn);
+
+            LOG_INFO("torrent_protocol.network", "Accepted new peer over uTP");
+        });
+    }
+
     void Listener::accept()
     {
         m_acceptor.async_accept(m_socket, [this](const boost::system::error_code &ec)
@@ -58,6 +91,7 @@ namespace network
                 auto conn = std::make_shared<Peer>(std::move(this->m_socket));
 
                 // Call read as peer is expected to immediately send their handshake
+                conn->startHandshakeTimeout();
                 conn->read();
 
                 // Add to connection mgr
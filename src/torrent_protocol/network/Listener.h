@@ -30,6 +30,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "ConnectionMgr.h"
 #include "Peer.h"
 #include "Socket.h"
+#include "UTPSocketMgr.h"
 
 namespace network
 {
@@ -52,6 +53,9 @@ namespace network
          */
         void start(uint16_t port, int maxConnections, std::shared_ptr< ConnectionMgr<Peer> > connectionMgr);
 
+        /// Accepts incoming uTP connections from the given socket manager as well. Must be called after \ref start
+        void acceptUTP(std::shared_ptr<UTPSocketMgr> utpSocketMgr);
+
     private:
         /// Accepts the next connection
         void accept();
@@ -0,0 +1,231 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <random>
+#include "LocalServiceDiscovery.h"
+#include "LogHelper.h"
+
+namespace network
+{
+    const char *LocalServiceDiscovery::MulticastAddress = "239.192.152.143";
+
+    /// Seconds between two announcements of the same torrent
+    const static time_t AnnounceIntervalSeconds = 300;
+
+    /// Minimum number of seconds between two messages
+    const static time_t MinMessageIntervalSeconds = 60;
+
+    /// Maximum number of info hashes in one message, keeping it within a single datagram
+    const static std::size_t MaxHashesPerMessage = 20;
+
+    /// Number of characters in a hex-encoded info hash
+    const static std::size_t InfoHashHexLength = 40;
+
+    LocalServiceDiscovery::LocalServiceDiscovery(boost::asio::io_service &ioService) :
+        Socket(ioService, Socket::Mode::UDP),
+        m_ioService(ioService),
+        m_tickTimer(ioService),
+        m_listenPort(0),
+        m_cookie(),
+        m_pendingHashes(),
+        m_lastAnnounced(),
+        m_lastMessageTime(0),
+        m_peerHandler()
+    {
+        std::random_device rd;
+        m_cookie = std::to_string(rd()) + std::to_string(rd());
+    }
+
+    bool LocalServiceDiscovery::start(uint16_t listenPort)
+    {
+        namespace ip = boost::asio::ip;
+
+        // Other clients on the same machine listen to the same group, so the port must be shared
+        boost::system::error_code ec;
+        m_udpSocket.open(ip::udp::v4(), ec);
+        if (!ec)
+            m_udpSocket.set_option(ip::udp::socket::reuse_address(true), ec);
+        if (!ec)
+            m_udpSocket.bind(ip::udp::endpoint(ip::address_v4::any(), MulticastPort), ec);
+        if (!ec)
+            m_udpSocket.set_option(ip::multicast::join_group(ip::address_v4::from_string(MulticastAddress)), ec);
+        if (!ec)
+            m_udpSocket.set_option(ip::multicast::hops(1), ec);
+        if (!ec)
+            m_udpSocket.set_option(ip::multicast::enable_loopback(true), ec);
+        if (ec)
+        {
+            LOG_ERROR("torrent_protocol.network", "Unable to start local service discovery, message: ", ec.message());
+            close();
+            return false;
+        }
+
+        m_listenPort = listenPort;
+        m_isConnected.store(true);
+        read();
+
+        m_tickTimer.expires_from_now(boost::posix_time::seconds(1));
+        m_tickTimer.async_wait(std::bind(&LocalServiceDiscovery::onTick, getSelf(), std::placeholders::_1));
+        return true;
+    }
+
+    void LocalServiceDiscovery::setPeerHandler(PeerHandler handler)
+    {
+        m_peerHandler = handler;
+    }
+
+    void LocalServiceDiscovery::announce(const uint8_t *infoHash)
+    {
+        static const char *hexDigits = "0123456789ABCDEF";
+        std::string hexHash;
+        for (int i = 0; i < 20; ++i)
+        {
+            hexHash.push_back(hexDigits[infoHash[i] >> 4]);
+            hexHash.push_back(hexDigits[infoHash[i] & 0x0f]);
+        }
+
+        m_ioService.post([self = getSelf(), hexHash]() {
+            auto it = self->m_lastAnnounced.find(hexHash);
+            if (it != self->m_lastAnnounced.end() && time(nullptr) - it->second < AnnounceIntervalSeconds)
+                return;
+
+            self->m_pendingHashes.insert(hexHash);
+        });
+    }
+
+    void LocalServiceDiscovery::onRead()
+    {
+        // Each read holds exactly one datagram
+        std::size_t length = m_bufferRead.getSizeUnread();
+        if (length > 0)
+        {
+            handleAnnouncement(std::string(m_bufferRead.getReadPointer(), length), getUDPSender().address());
+            m_bufferRead.advanceReadPosition(length);
+        }
+
+        read();
+    }
+
+    std::shared_ptr<LocalServiceDiscovery> LocalServiceDiscovery::getSelf()
+    {
+        return std::static_pointer_cast<LocalServiceDiscovery>(shared_from_this());
+    }
+
+    void LocalServiceDiscovery::onTick(const boost::system::error_code &ec)
+    {
+        if (ec || isClosing())
+            return;
+
+        time_t now = time(nullptr);
+        if (!m_pendingHashes.empty() && now - m_lastMessageTime >= MinMessageIntervalSeconds)
+        {
+            std::string message = "BT-SEARCH * HTTP/1.1\r\n";
+            message += "Host: " + std::string(MulticastAddress) + ":" + std::to_string(MulticastPort) + "\r\n";
+            message += "Port: " + std::to_string(m_listenPort) + "\r\n";
+
+            std::size_t numHashes = 0;
+            for (auto it = m_pendingHashes.begin(); it != m_pendingHashes.end() && numHashes < MaxHashesPerMessage; ++numHashes)
+            {
+                message += "Infohash: " + *it + "\r\n";
+                m_lastAnnounced[*it] = now;
+                it = m_pendingHashes.erase(it);
+            }
+
+            message += "cookie: " + m_cookie + "\r\n\r\n\r\n";
+
+            MutableBuffer mb(message.size());
+            mb.write(message.data(), message.size());
+            sendTo(std::move(mb), boost::asio::ip::udp::endpoint(boost::asio::ip::address_v4::from_string(MulticastAddress), MulticastPort));
+            m_lastMessageTime = now;
+        }
+
+        m_tickTimer.expires_from_now(boost::posix_time::seconds(1));
+        m_tickTimer.async_wait(std::bind(&LocalServiceDiscovery::onTick, getSelf(), std::placeholders::_1));
+    }
+
+    void LocalServiceDiscovery::handleAnnouncement(const std::string &message, const boost::asio::ip::address &sender)
+    {
+        if (message.compare(0, 10, "BT-SEARCH ") != 0)
+            return;
+
+        uint16_t port = 0;
+        std::string cookie;
+        std::vector<std::string> infoHashes;
+
+        std::size_t lineStart = message.find("\r\n");
+        while (lineStart != std::string::npos)
+        {
+            lineStart += 2;
+            std::size_t lineEnd = message.find("\r\n", lineStart);
+            if (lineEnd == std::string::npos || lineEnd == lineStart)
+                break;
+
+            std::size_t separator = message.find(':', lineStart);
+            if (separator != std::string::npos && separator < lineEnd)
+            {
+                // Header names are case-insensitive
+                std::string name = message.substr(lineStart, separator - lineStart);
+                std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+
+                std::size_t valueStart = message.find_first_not_of(' ', separator + 1);
+                std::string value = (valueStart < lineEnd) ? message.substr(valueStart, lineEnd - valueStart) : std::string();
+
+                if (name == "port")
+                {
+                    long portValue = std::strtol(value.c_str(), nullptr, 10);
+                    port = (portValue > 0 && portValue <= 65535) ? static_cast<uint16_t>(portValue) : 0;
+                }
+                else if (name == "infohash" && value.size() == InfoHashHexLength)
+                    infoHashes.push_back(value);
+                else if (name == "cookie")
+                    cookie = value;
+            }
+
+            lineStart = lineEnd;
+        }
+
+        // The client's own announcements are looped back to it
+        if (port == 0 || cookie == m_cookie || !m_peerHandler)
+            return;
+
+        boost::asio::ip::tcp::endpoint endpoint(Socket::normalizeAddress(sender), port);
+        for (const std::string &hexHash : infoHashes)
+        {
+            std::string infoHash;
+            for (std::size_t i = 0; i < InfoHashHexLength; i += 2)
+            {
+                if (!std::isxdigit(static_cast<unsigned char>(hexHash[i])) || !std::isxdigit(static_cast<unsigned char>(hexHash[i + 1])))
+                    break;
+                infoHash.push_back(static_cast<char>(std::stoi(hexHash.substr(i, 2), nullptr, 16)));
+            }
+
+            if (infoHash.size() == InfoHashHexLength / 2)
+                m_peerHandler(infoHash, endpoint);
+        }
+    }
+}
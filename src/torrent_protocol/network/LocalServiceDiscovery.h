@@ -0,0 +1,114 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+
+#include "Socket.h"
+
+namespace network
+{
+    /**
+     * @class LocalServiceDiscovery
+     * @brief Finds peers on the local network through multicast announcements (BEP 14). Info hashes
+     *        to announce are batched into as few messages as possible, each torrent being announced
+     *        at most once every AnnounceIntervalSeconds, and no message sent sooner than
+     *        MinMessageIntervalSeconds after the previous one.
+     */
+    class LocalServiceDiscovery : public Socket
+    {
+    public:
+        /// Handler called with the raw info hash and endpoint of each peer announced on the local network
+        typedef std::function<void(const std::string&, const boost::asio::ip::tcp::endpoint&)> PeerHandler;
+
+        /// Multicast group of the announcements
+        static const char *MulticastAddress;
+
+        /// UDP port of the announcements
+        static const uint16_t MulticastPort = 6771;
+
+    public:
+        /// Constructs the service, given the io_service to run on
+        explicit LocalServiceDiscovery(boost::asio::io_service &ioService);
+
+        /// Joins the multicast group and begins listening for announcements, advertising the given
+        /// port for incoming peer connections. Returns false on failure
+        bool start(uint16_t listenPort);
+
+        /// Sets the handler called for each peer announced on the local network
+        void setPeerHandler(PeerHandler handler);
+
+        /// Queues an announcement of the torrent with the given info hash. Torrents announced within
+        /// the last AnnounceIntervalSeconds are skipped
+        void announce(const uint8_t *infoHash);
+
+    protected:
+        /// Handles a received announcement
+        void onRead() override;
+
+    private:
+        /// Returns a shared pointer to this object
+        std::shared_ptr<LocalServiceDiscovery> getSelf();
+
+        /// Sends the queued announcements if the previous message was sent long enough ago
+        void onTick(const boost::system::error_code &ec);
+
+        /// Parses an announcement, passing each announced torrent to the peer handler
+        void handleAnnouncement(const std::string &message, const boost::asio::ip::address &sender);
+
+    private:
+        /// I/O service the object runs on
+        boost::asio::io_service &m_ioService;
+
+        /// Timer driving \ref onTick
+        boost::asio::deadline_timer m_tickTimer;
+
+        /// Port advertised for incoming peer connections
+        uint16_t m_listenPort;
+
+        /// Random value identifying the client's own announcements, which are looped back
+        std::string m_cookie;
+
+        /// Hex-encoded info hashes waiting to be announced
+        std::set<std::string> m_pendingHashes;
+
+        /// Time each info hash was last announced
+        std::map<std::string, time_t> m_lastAnnounced;
+
+        /// Time at which the last message was sent
+        time_t m_lastMessageTime;
+
+        /// Handler of announced peers
+        PeerHandler m_peerHandler;
+    };
+}
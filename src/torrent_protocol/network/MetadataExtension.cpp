@@ -0,0 +1,229 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include "LogHelper.h"
+#include "MetadataExtension.h"
+#include "Peer.h"
+#include "TorrentFile.h"
+#include "TorrentState.h"
+#include "BenDictionary.h"
+#include "BenDocument.h"
+#include "BenInt.h"
+#include "Encoder.h"
+
+namespace network
+{
+    /// Message type requesting a piece of the info dictionary
+    const static int64_t MetadataRequest = 0;
+
+    /// Message type carrying a piece of the info dictionary
+    const static int64_t MetadataData = 1;
+
+    /// Message type refusing a request
+    const static int64_t MetadataReject = 2;
+
+    /// Number of pieces of the info dictionary requested from a single peer at a time
+    const static std::size_t MaxOutstandingMetadataRequests = 2;
+
+    /// Number of seconds after which a request without a response is given up on
+    const static time_t MetadataResponseTimeoutSeconds = 20;
+
+    MetadataExtension::MetadataExtension(Peer &peer) :
+        PeerExtension(peer),
+        m_peerMetadataSize(0),
+        m_requests()
+    {
+    }
+
+    const char *MetadataExtension::getName() const
+    {
+        return "ut_metadata";
+    }
+
+    void MetadataExtension::addHandshakeData(bencoding::BenDictionary &handshake)
+    {
+        std::shared_ptr<TorrentState> torrentState = m_peer.getTorrentState();
+        if (torrentState.get() == nullptr || !torrentState->hasMetadata())
+            return;
+
+        const std::string &infoDictionary = torrentState->getTorrentFile()->getInfoDictionaryData();
+        handshake["metadata_size"] = std::make_shared<bencoding::BenInt>(static_cast<int64_t>(infoDictionary.size()));
+    }
+
+    void MetadataExtension::onHandshake(const bencoding::BenNode &handshake)
+    {
+        std::shared_ptr<TorrentState> torrentState = m_peer.getTorrentState();
+        int64_t metadataSize = handshake.find("metadata_size").getInt(0);
+        if (!isSupportedByPeer() || torrentState.get() == nullptr || metadataSize <= 0 || torrentState->hasMetadata())
+            return;
+
+        if (metadataSize > UINT32_MAX)
+            return;
+
+        // The size is kept even if it is not accepted, as the size accepted from another peer may prove wrong
+        m_peerMetadataSize = static_cast<uint32_t>(metadataSize);
+        if (!torrentState->setMetadataSize(m_peerMetadataSize, m_peer.getTCPEndpoint().address()))
+        {
+            LOG_DEBUG("torrent_protocol.network", "Peer advertised a metadata size of ", metadataSize, ", which is not accepted");
+            return;
+        }
+
+        requestPieces();
+    }
+
+    void MetadataExtension::onMessage(const char *data, std::size_t length)
+    {
+        std::shared_ptr<TorrentState> torrentState = m_peer.getTorrentState();
+        if (torrentState.get() == nullptr)
+            return;
+
+        // The dictionary of a data message is followed by the piece itself, which the parser ignores
+        bencoding::BenDocument message;
+        if (!message.parse(std::string(data, length)) || !message.getRoot().isDictionary())
+        {
+            LOG_WARNING("torrent_protocol.network", "Peer sent an invalid metadata message");
+            return;
+        }
+
+        bencoding::BenNode root = message.getRoot();
+        int64_t type = root.find("msg_type").getInt(-1);
+        int64_t pieceIdx = root.find("piece").getInt(-1);
+        if (pieceIdx < 0 || pieceIdx > UINT32_MAX)
+            return;
+
+        switch (type)
+        {
+            case MetadataRequest:
+                sendPiece(static_cast<uint32_t>(pieceIdx));
+                break;
+            case MetadataData:
+            {
+                // Unsolicited pieces are dropped, so that a peer cannot fill in the dictionary on its own
+                if (m_requests.erase(static_cast<uint32_t>(pieceIdx)) == 0)
+                    break;
+
+                const std::size_t dictLength = root.getEncoded().size();
+                torrentState->onMetadataPiece(static_cast<uint32_t>(pieceIdx), (const uint8_t*)data + dictLength, length - dictLength);
+                requestPieces();
+                break;
+            }
+            case MetadataReject:
+                if (m_requests.erase(static_cast<uint32_t>(pieceIdx)) != 0)
+                    torrentState->onMetadataPieceRejected(static_cast<uint32_t>(pieceIdx));
+
+                // A peer that rejects a request does not have the metadata, or won't share it
+                m_peerMetadataSize = 0;
+                break;
+            default:
+                LOG_DEBUG("torrent_protocol.network", "Metadata message of unknown type ", type, " received by peer. Ignoring.");
+                break;
+        }
+    }
+
+    void MetadataExtension::onTick()
+    {
+        time_t now = time(nullptr);
+        for (auto it = m_requests.begin(); it != m_requests.end();)
+        {
+            if (now - it->second >= MetadataResponseTimeoutSeconds)
+                it = m_requests.erase(it);
+            else
+                ++it;
+        }
+
+        requestPieces();
+    }
+
+    void MetadataExtension::requestPieces()
+    {
+        std::shared_ptr<TorrentState> torrentState = m_peer.getTorrentState();
+        if (m_peerMetadataSize == 0 || !isSupportedByPeer() || torrentState.get() == nullptr)
+            return;
+
+        if (torrentState->hasMetadata())
+        {
+            m_requests.clear();
+            return;
+        }
+
+        // The size is offered again, as it is forgotten when the dictionary fails verification
+        if (!torrentState->setMetadataSize(m_peerMetadataSize, m_peer.getTCPEndpoint().address()))
+            return;
+
+        time_t now = time(nullptr);
+        uint32_t pieceIdx;
+        while (m_requests.size() < MaxOutstandingMetadataRequests && torrentState->getMetadataPieceToRequest(pieceIdx))
+        {
+            m_requests[pieceIdx] = now;
+            sendMetadataMessage(MetadataRequest, pieceIdx);
+        }
+    }
+
+    void MetadataExtension::sendPiece(uint32_t pieceIdx)
+    {
+        std::shared_ptr<TorrentState> torrentState = m_peer.getTorrentState();
+        if (!torrentState->hasMetadata())
+        {
+            sendMetadataMessage(MetadataReject, pieceIdx);
+            return;
+        }
+
+        const std::string &infoDictionary = torrentState->getTorrentFile()->getInfoDictionaryData();
+        const std::size_t offset = std::size_t(pieceIdx) * TorrentState::MetadataPieceLength;
+        if (offset >= infoDictionary.size())
+        {
+            sendMetadataMessage(MetadataReject, pieceIdx);
+            return;
+        }
+
+        const std::size_t length = std::min<std::size_t>(TorrentState::MetadataPieceLength, infoDictionary.size() - offset);
+        sendMetadataMessage(MetadataData, pieceIdx, infoDictionary.data() + offset, length);
+    }
+
+    void MetadataExtension::sendMetadataMessage(int64_t type, uint32_t pieceIdx, const char *data, std::size_t length)
+    {
+        using namespace bencoding;
+
+        std::shared_ptr<TorrentState> torrentState = m_peer.getTorrentState();
+
+        BenDictionary message;
+        message["msg_type"] = std::make_shared<BenInt>(type);
+        message["piece"] = std::make_shared<BenInt>(static_cast<int64_t>(pieceIdx));
+        if (type == MetadataData)
+            message["total_size"] = std::make_shared<BenInt>(static_cast<int64_t>(torrentState->getTorrentFile()->getInfoDictionaryData().size()));
+
+        Encoder encoder;
+        message.accept(encoder);
+
+        std::string payload = encoder.getData();
+        if (data != nullptr)
+            payload.append(data, length);
+
+        sendMessage(payload.data(), payload.size());
+    }
+}
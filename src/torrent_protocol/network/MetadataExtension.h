@@ -0,0 +1,80 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <ctime>
+#include <map>
+
+#include "PeerExtension.h"
+
+namespace network
+{
+    /**
+     * @class MetadataExtension
+     * @brief Implements the metadata exchange (ut_metadata, BEP 9). The info dictionary is served to
+     *        peers in 16 KiB pieces, and torrents added from a magnet link fetch it the same way,
+     *        with each connection requesting different pieces so that they arrive in parallel.
+     */
+    class MetadataExtension : public PeerExtension
+    {
+    public:
+        /// Constructs the extension for the given peer connection
+        explicit MetadataExtension(Peer &peer);
+
+        /// Returns "ut_metadata"
+        const char *getName() const override;
+
+        /// Advertises the size of the info dictionary, if the client has it
+        void addHandshakeData(bencoding::BenDictionary &handshake) override;
+
+        /// Reads the size of the info dictionary advertised by the peer, and begins fetching it if needed
+        void onHandshake(const bencoding::BenNode &handshake) override;
+
+        /// Handles a request, data or reject message
+        void onMessage(const char *data, std::size_t length) override;
+
+        /// Requests pieces of the info dictionary again after a timeout
+        void onTick() override;
+
+    private:
+        /// Requests pieces of the info dictionary from the peer, up to the limit of outstanding requests
+        void requestPieces();
+
+        /// Sends the piece of the info dictionary with the given index, or a reject message if the
+        /// client does not have it
+        void sendPiece(uint32_t pieceIdx);
+
+        /// Sends a message of the given type about the piece with the given index, followed by the given data
+        void sendMetadataMessage(int64_t type, uint32_t pieceIdx, const char *data = nullptr, std::size_t length = 0);
+
+    private:
+        /// Size of the info dictionary advertised by the peer, or 0 if it has not advertised one
+        uint32_t m_peerMetadataSize;
+
+        /// Pieces of the info dictionary requested from the peer, mapped to the time of the request
+        std::map<uint32_t, time_t> m_requests;
+    };
+}
@@ -31,80 +31,289 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "TorrentState.h"
 #include "TorrentFile.h"
 #include "TorrentFragment.h"
+#include "SHA1Hash.h"
+#include "BenDictionary.h"
+#include "BenDocument.h"
+#include "BenInt.h"
+#include "BenString.h"
+#include "Encoder.h"
+#include "ExtensionRegistry.h"
+#include "PeerExtension.h"
+
+/// Bit of the last reserved handshake byte signalling a DHT node (BEP 5)
+const static uint64_t DHTBit = 0x01;
+
+/// Bit of the last reserved handshake byte signalling support for the fast extension (BEP 6)
+const static uint64_t FastExtensionBit = 0x04;
+
+/// Bit of the last reserved handshake byte signalling support for the hash messages of BitTorrent v2 (BEP 52)
+const static uint64_t V2Bit = 0x10;
+
+/// Bit of the sixth reserved handshake byte signalling support for the extension protocol (BEP 10)
+const static uint64_t ExtensionProtocolBit = 0x100000;
+
+/// Number of outstanding requests assumed for peers that don't advertise one
+const static uint32_t DefaultRequestQueueSize = 250;
+
+/// Upper bound on the request queue size accepted from a peer
+const static uint32_t MaxRequestQueueSize = 4096;
+
+/// Client name sent in the extended handshake
+const static char *ExtendedClientName = "BitTorrentProject";
+
+/// Number of pieces in the allowed fast set given to each peer
+const static uint32_t AllowedFastSetSize = 10;
+
+/// Upper bound on the piece indices remembered from a peer while the metadata is pending
+const static uint32_t MaxPiecesAwaitingMetadata = 1 << 20;
+
+/// Length of the payload shared by the hash request, hashes and hash reject messages (BEP 52)
+const static uint32_t HashRequestFieldsLength = SHA256_DIGEST_LENGTH + 4 * 4;
+
+/// Largest fragment a peer may request
+const static uint32_t MaxRequestLength = 128 * 1024;
+
+/// Size of the send queue, in bytes, above which no more of the peer's requests are read from disk
+const static std::size_t SendQueueHighWatermark = 512 * 1024;
+
+/// Size the send queue must drain to, in bytes, before the peer's requests are served again
+const static std::size_t SendQueueLowWatermark = 128 * 1024;
+
+/// Seconds a connection may take to receive the peer's handshake
+const static uint32_t HandshakeTimeout = 20;
+
+/// Seconds without sending anything to the peer after which a keep-alive is sent
+const static uint32_t KeepAliveInterval = 90;
+
+/// Seconds without a message from the peer after which the connection is closed. Peers send
+/// keep-alives every two minutes at the most
+const static uint32_t IdleTimeout = 180;
+
+/// Seconds a requested fragment may take to arrive before it is requested from other peers
+const static uint32_t RequestTimeout = 60;
+
+/// Seconds after a request timed out during which no more fragments are requested from the peer
+const static uint32_t SnubbedRequestDelay = 60;
 
 namespace network
 {
     Peer::Peer(boost::asio::io_service &ioService, Mode mode) :
         Socket(ioService, mode),
+        m_timeLastMessage(time(nullptr)),
+        m_timeLastSend(time(nullptr)),
         m_chokedBy(true),
         m_amChoking(true),
+        m_holdsUnchokeSlot(false),
         m_peerInterested(false),
         m_amInterested(false),
         m_recvdHandshake(false),
         m_sentHandshake(false),
         m_piecesHave(),
+        m_haveVersion(0),
+        m_bitfieldAllowed(false),
+        m_supportsFast(false),
+        m_allowedFastSet(),
+        m_allowedFastByPeer(),
+        m_supportsExtensions(false),
+        m_supportsDHT(false),
+        m_supportsV2(false),
+        m_extensions(ExtensionRegistry::createExtensions(*this)),
+        m_peerRequestQueue(DefaultRequestQueueSize),
+        m_uploadQueue(),
+        m_uploadQueueSize(eTorrentMgr.getRequestQueueSize()),
+        m_isUploadScheduled(false),
+        m_isUploadStalled(false),
+        m_isIncoming(false),
+        m_listenEndpoint(),
         m_torrentState(),
+        m_awaitingMetadata(false),
+        m_peerHasAll(false),
         m_fragmentDownload(nullptr),
-        m_fragBytesDownloaded(0)
+        m_fragBytesDownloaded(0),
+        m_timeSnubbed(0),
+        m_connectionTimer(TimerWheel::InvalidTimer),
+        m_requestTimer(TimerWheel::InvalidTimer)
     {
     }
 
     Peer::Peer(boost::asio::ip::tcp::socket &&socket) :
         Socket(std::move(socket)),
+        m_timeLastMessage(time(nullptr)),
+        m_timeLastSend(time(nullptr)),
+        m_chokedBy(true),
+        m_amChoking(true),
+        m_holdsUnchokeSlot(false),
+        m_peerInterested(false),
+        m_amInterested(false),
+        m_recvdHandshake(false),
+        m_sentHandshake(false),
+        m_piecesHave(),
+        m_haveVersion(0),
+        m_bitfieldAllowed(false),
+        m_supportsFast(false),
+        m_allowedFastSet(),
+        m_allowedFastByPeer(),
+        m_supportsExtensions(false),
+        m_supportsDHT(false),
+        m_supportsV2(false),
+        m_extensions(ExtensionRegistry::createExtensions(*this)),
+        m_peerRequestQueue(DefaultRequestQueueSize),
+        m_uploadQueue(),
+        m_uploadQueueSize(eTorrentMgr.getRequestQueueSize()),
+        m_isUploadScheduled(false),
+        m_isUploadStalled(false),
+        m_isIncoming(true),
+        m_listenEndpoint(),
+        m_torrentState(),
+        m_awaitingMetadata(false),
+        m_peerHasAll(false),
+        m_fragmentDownload(nullptr),
+        m_fragBytesDownloaded(0),
+        m_timeSnubbed(0),
+        m_connectionTimer(TimerWheel::InvalidTimer),
+        m_requestTimer(TimerWheel::InvalidTimer)
+    {
+    }
+
+    Peer::Peer(std::shared_ptr<UTPStream> stream) :
+        Socket(stream),
+        m_timeLastMessage(time(nullptr)),
+        m_timeLastSend(time(nullptr)),
         m_chokedBy(true),
         m_amChoking(true),
+        m_holdsUnchokeSlot(false),
         m_peerInterested(false),
         m_amInterested(false),
         m_recvdHandshake(false),
         m_sentHandshake(false),
         m_piecesHave(),
+        m_haveVersion(0),
+        m_bitfieldAllowed(false),
+        m_supportsFast(false),
+        m_allowedFastSet(),
+        m_allowedFastByPeer(),
+        m_supportsExtensions(false),
+        m_supportsDHT(false),
+        m_supportsV2(false),
+        m_extensions(ExtensionRegistry::createExtensions(*this)),
+        m_peerRequestQueue(DefaultRequestQueueSize),
+        m_uploadQueue(),
+        m_uploadQueueSize(eTorrentMgr.getRequestQueueSize()),
+        m_isUploadScheduled(false),
+        m_isUploadStalled(false),
+        m_isIncoming(true),
+        m_listenEndpoint(),
         m_torrentState(),
+        m_awaitingMetadata(false),
+        m_peerHasAll(false),
         m_fragmentDownload(nullptr),
-        m_fragBytesDownloaded(0)
+        m_fragBytesDownloaded(0),
+        m_timeSnubbed(0),
+        m_connectionTimer(TimerWheel::InvalidTimer),
+        m_requestTimer(TimerWheel::InvalidTimer)
     {
     }
 
     Peer::~Peer()
     {
+        // The wheel is gone if the peer outlives the torrent manager's members at shutdown
+        if (auto timerWheel = eTorrentMgr.getTimerWheel())
+        {
+            timerWheel->cancel(m_connectionTimer);
+            timerWheel->cancel(m_requestTimer);
+        }
+
         if (m_torrentState.get())
         {
-            if (!m_amChoking)
+            if (m_holdsUnchokeSlot)
                 m_torrentState->onPeerChoked();
             m_torrentState->decrementPeerCount();
+
+            if (m_listenEndpoint.port() != 0)
+                m_torrentState->removeConnectedPeer(m_listenEndpoint);
         }
     }
 
     void Peer::setTorrentState(std::shared_ptr<TorrentState> state)
     {
         m_torrentState = state;
+        m_awaitingMetadata = !m_torrentState->hasMetadata();
         m_piecesHave.resize(m_torrentState->getTorrentFile()->getNumPieces());
+        m_allowedFastByPeer.resize(m_piecesHave.size());
     }
 
     void Peer::tryToRequestPiece()
     {
-        if (m_chokedBy)
+        if (m_awaitingMetadata)
             return;
 
-        // Check if peer has the current piece to be downloaded
+        // Hashes may be requested while choked
+        tryToRequestHashes();
+
+        // One fragment is requested at a time, and a peer that let a request time out is left alone for a
+        // while, so that other peers download the fragments in its place
+        if (m_fragmentDownload.get() || (m_timeSnubbed != 0 && time(nullptr) - m_timeSnubbed < SnubbedRequestDelay))
+            return;
+
+        // While choked, only pieces in the peer's allowed fast set may be requested
         auto currentPiece = m_torrentState->getCurrentPieceNum();
+        if (m_chokedBy && (currentPiece >= m_allowedFastByPeer.size() || !m_allowedFastByPeer[currentPiece]))
+            return;
+
+        // Check if peer has the current piece to be downloaded
         if (currentPiece < m_piecesHave.size() && m_piecesHave[currentPiece])
         {
-            m_fragmentDownload = m_torrentState->getFragmentToDownload();
+            m_fragmentDownload = m_torrentState->getFragmentToDownload(getTCPEndpoint().address());
             if (m_fragmentDownload != nullptr)
             {
                 m_fragBytesDownloaded = 0;
                 sendRequest(m_fragmentDownload->PieceIdx, m_fragmentDownload->Offset, m_fragmentDownload->Length);
+                armRequestTimer();
             }
         }
     }
 
     void Peer::sendPieceHave()
     {
-        const auto &pieces = m_torrentState->getBitsetHave();
-        if (pieces.any())
+        if (!m_sentHandshake || !m_recvdHandshake || m_isClosing)
+            return;
+
+        const PieceBitfield &bitfield = m_torrentState->getBitsetHave();
+        const uint64_t version = bitfield.count();
+        if (version == m_haveVersion)
+            return;
+
+        // Collect the pieces completed since the peer was last told, except for those it already has
+        std::vector<uint32_t> pieces;
+        for (uint64_t v = m_haveVersion; v < version; ++v)
+        {
+            uint32_t pieceIdx = bitfield.getPieceSetAt(v);
+            if (pieceIdx < m_piecesHave.size() && !m_piecesHave[pieceIdx])
+                pieces.push_back(pieceIdx);
+        }
+        m_haveVersion = version;
+
+        if (pieces.empty())
+            return;
+
+        // A bitfield is only valid as the first message after the handshakes, but until then it
+        // replaces the have messages whenever it is smaller
+        if (m_bitfieldAllowed && 9 * pieces.size() > 5 + bitfield.getNumBytes())
+        {
+            sendBitfield();
+            return;
+        }
+
+        MutableBuffer mb(9 * pieces.size());
+        for (uint32_t pieceIdx : pieces)
         {
-            sendHave(pieces.find_first());
+            mb << uint32_t(5); // Length
+            mb << uint8_t(4);  // Message ID
+            mb << pieceIdx;
         }
+
+        m_bitfieldAllowed = false;
+        send(std::move(mb));
     }
 
     void Peer::onConnect()
@@ -113,6 +322,7 @@ namespace network
             return;
 
         // Send handshake and read from peer
+        startHandshakeTimeout();
         sendHandshake();
         read();
     }
@@ -124,14 +334,21 @@ namespace network
 
         // Handle handshake before any other messages
         if (!m_recvdHandshake)
-        {
             readHandshake();
-            return;
-        }
 
+        // Handle every complete message that has arrived, as a peer may pipeline many of them in one write
+        while (m_recvdHandshake && !m_isClosing && readMessage())
+            ;
+
+        // Continue to read data from peer
+        read();
+    }
+
+    bool Peer::readMessage()
+    {
         // Ensure there was enough data transmitted
         if (m_bufferRead.getSizeUnread() < 4)
-            return;
+            return false;
 
         // Data format: "<length prefix (32-bit)><message ID (8-bit)><payload>."
         uint32_t length;
@@ -139,20 +356,37 @@ namespace network
 
         // Before reading message ID, check if keep-alive was sent (len == 0)
         if (length == 0)
-            return;
+            return true;
 
         // Check if length is equal to amount of data received
         //LOG_DEBUG("torrent_protocol.network", "Length specified = ", length, ", amount received = ", m_bufferRead.getSizeUnread());
         if (m_bufferRead.getSizeUnread() < length)
         {
-            // Reverse position by the size of length variable (4 byte), read more data, exit
+            // Reverse position by the size of length variable (4 byte), wait for more data
             m_bufferRead.reverseReadPosition(4);
-            read();
-            return;
+            return false;
         }
 
         uint8_t messageID;
         m_bufferRead >> messageID;
+        const std::size_t sizeUnreadAfterMessage = m_bufferRead.getSizeUnread() - (length - 1);
+
+        // The handlers read their fixed fields without checking the length prefix, so a message of the
+        // wrong size would leave the stream out of step
+        if (!isValidMessageLength(messageID, length))
+        {
+            LOG_WARNING("torrent_protocol.network", "Peer sent message ", (uint32_t)messageID, " with invalid length ", length, ", closing connection");
+            close();
+            return false;
+        }
+
+        // Fast extension messages are a protocol violation unless the extension was negotiated
+        if (messageID >= 13 && messageID <= 17 && !m_supportsFast)
+        {
+            LOG_WARNING("torrent_protocol.network", "Peer sent fast extension message ", (uint32_t)messageID, " without negotiating it, closing connection");
+            close();
+            return false;
+        }
 
         // Handle message
         switch (messageID)
@@ -161,6 +395,10 @@ namespace network
             case 0:
                 LOG_DEBUG("torrent_protocol.network", "Choke message received by peer");
                 m_chokedBy = true;
+
+                // Peers without the fast extension discard the requests of the peers they choke, instead of rejecting them
+                if (!m_supportsFast)
+                    abandonFragmentDownload();
                 break;
             // Unchoke [no payload]
             case 1:
@@ -171,8 +409,27 @@ namespace network
             case 2:
                 LOG_DEBUG("torrent_protocol.network", "Interested message received by peer");
                 m_peerInterested = true;
-                if (m_torrentState->canUnchokePeer())
-                    sendUnchoke();
+                if (m_amChoking)
+                {
+                    // Peers on the local network don't compete with internet peers for the unchoke slots
+                    if (m_torrentState->isLocalPeer(getTCPEndpoint().address()))
+                        sendUnchoke();
+                    else if (m_torrentState->canUnchokePeer())
+                    {
+                        m_holdsUnchokeSlot = true;
+                        sendUnchoke();
+                    }
+                }
+
+                // Steer the peer towards pieces that were just read from disk, and are likely still cached
+                if (m_supportsFast)
+                {
+                    for (uint32_t pieceIdx : m_torrentState->getRecentlyUploadedPieces())
+                    {
+                        if (pieceIdx < m_piecesHave.size() && !m_piecesHave[pieceIdx])
+                            sendSuggestPiece(pieceIdx);
+                    }
+                }
                 break;
             // Not interested [no payload]
             case 3:
@@ -181,7 +438,9 @@ namespace network
                 if (!m_amChoking)
                 {
                     sendChoke();
-                    m_torrentState->onPeerChoked();
+                    if (m_holdsUnchokeSlot)
+                        m_torrentState->onPeerChoked();
+                    m_holdsUnchokeSlot = false;
                 }
                 break;
             // Have: <len=0005><id=4><piece index>
@@ -189,6 +448,17 @@ namespace network
                 LOG_DEBUG("torrent_protocol.network", "Have message received by peer");
                 uint32_t pieceIdx;
                 m_bufferRead >> pieceIdx;
+
+                // Without the metadata, the piece is remembered until its index can be checked
+                if (m_awaitingMetadata && pieceIdx >= m_piecesHave.size() && pieceIdx < MaxPiecesAwaitingMetadata)
+                    m_piecesHave.resize(pieceIdx + 1);
+                if (pieceIdx >= m_piecesHave.size())
+                    break;
+                if (m_awaitingMetadata)
+                {
+                    m_piecesHave[pieceIdx] = true;
+                    break;
+                }
                 m_piecesHave[pieceIdx] = true;
                 m_torrentState->markPieceAvailable(pieceIdx);
                 tryToRequestPiece();
@@ -211,18 +481,94 @@ namespace network
             // Cancel: <len=0013><id=8><index><begin><length>
             case 8:
                 LOG_DEBUG("torrent_protocol.network", "Cancel message received by peer");
+                readCancel();
                 break;
             // Port: <len=0003><id=9><listen-port>
             case 9:
-                LOG_DEBUG("torrent_protocol.network", "Port message received by peer. Ignoring.");
+                LOG_DEBUG("torrent_protocol.network", "Port message received by peer");
+                readPort();
+                break;
+            // Suggest Piece: <len=0005><id=13><piece index>
+            case 13:
+                LOG_DEBUG("torrent_protocol.network", "Suggest piece message received by peer. Ignoring.");
                 m_bufferRead.advanceReadPosition(length - 1);
                 break;
+            // Have All: <len=0001><id=14>
+            case 14:
+                LOG_DEBUG("torrent_protocol.network", "Have all message received by peer");
+                readHaveAll();
+                break;
+            // Have None: <len=0001><id=15>
+            case 15:
+                LOG_DEBUG("torrent_protocol.network", "Have none message received by peer");
+                readHaveNone();
+                break;
+            // Reject Request: <len=0013><id=16><index><begin><length>
+            case 16:
+                LOG_DEBUG("torrent_protocol.network", "Reject request message received by peer");
+                readRejectRequest();
+                break;
+            // Allowed Fast: <len=0005><id=17><piece index>
+            case 17:
+                LOG_DEBUG("torrent_protocol.network", "Allowed fast message received by peer");
+                readAllowedFast();
+                break;
+            // Extended: <len=0002+X><id=20><extended id><payload>
+            case 20:
+                readExtended(length - 1);
+                break;
+            // Hash Request: <len=0049><id=21><pieces root><base layer><index><length><proof layers>
+            case 21:
+                LOG_DEBUG("torrent_protocol.network", "Hash request message received by peer");
+                readHashRequest(length - 1);
+                break;
+            // Hashes: <len=0049+X><id=22><pieces root><base layer><index><length><proof layers><hashes>
+            case 22:
+                LOG_DEBUG("torrent_protocol.network", "Hashes message received by peer");
+                readHashes(length - 1);
+                break;
+            // Hash Reject: <len=0049><id=23><pieces root><base layer><index><length><proof layers>
+            case 23:
+                LOG_DEBUG("torrent_protocol.network", "Hash reject message received by peer");
+                readHashReject(length - 1);
+                break;
             default:
                 LOG_DEBUG("torrent_protocol.network", "Unknown message of id ", (uint32_t)messageID, " received by peer. Ignoring.");
                 break;
         }
 
-        read();
+        // Skip any part of the payload the handler left unread, so the next message starts where it should
+        if (m_isClosing)
+            return false;
+        if (m_bufferRead.getSizeUnread() > sizeUnreadAfterMessage)
+            m_bufferRead.advanceReadPosition(m_bufferRead.getSizeUnread() - sizeUnreadAfterMessage);
+
+        return true;
+    }
+
+    bool Peer::isValidMessageLength(uint8_t messageID, uint32_t length)
+    {
+        switch (messageID)
+        {
+            // Choke, unchoke, interested, not interested, have all, have none
+            case 0: case 1: case 2: case 3: case 14: case 15:
+                return length == 1;
+            // Have, suggest piece, allowed fast
+            case 4: case 13: case 17:
+                return length == 5;
+            // Request, cancel, reject request
+            case 6: case 8: case 16:
+                return length == 13;
+            // Piece
+            case 7:
+                return length >= 9;
+            // Port
+            case 9:
+                return length == 3;
+            // The remaining messages check their own lengths
+            default:
+                return true;
+        }
     }
 
     void Peer::readHandshake()
@@ -235,8 +581,18 @@ namespace network
         uint8_t pstrlen;
         m_bufferRead >> pstrlen;
         if (m_bufferRead.getSizeUnread() < 48 + pstrlen)
+        {
+            m_bufferRead.reverseReadPosition(1);
             return;
-        m_bufferRead.advanceReadPosition(pstrlen + 8);
+        }
+        m_bufferRead.advanceReadPosition(pstrlen);
+
+        uint64_t reserved;
+        m_bufferRead >> reserved;
+        m_supportsFast = (reserved & FastExtensionBit) != 0;
+        m_supportsExtensions = (reserved & ExtensionProtocolBit) != 0;
+        m_supportsDHT = (reserved & DHTBit) != 0;
+        const bool peerSupportsV2 = (reserved & V2Bit) != 0;
 
         uint8_t infoHash[20];
         memcpy(infoHash, m_bufferRead.getReadPointer(), 20);
@@ -250,9 +606,20 @@ namespace network
         else if (!m_torrentState.get())
         {
             // If not already set, get the TorrentState pointer
-            m_torrentState = eTorrentMgr.getTorrentState(infoHash);
+            setTorrentState(eTorrentMgr.getTorrentState(infoHash));
         }
 
+        // Peers banned for sending corrupt data are not let back in
+        if (m_torrentState->isPeerBanned(getTCPEndpoint().address()))
+        {
+            LOG_DEBUG("torrent_protocol.network", "Dropping connection from banned peer ", getTCPEndpoint().address().to_string());
+            close();
+            return;
+        }
+
+        // The hash messages are only of use for torrents with v2 metadata
+        m_supportsV2 = peerSupportsV2 && m_torrentState->getTorrentFile()->hasV2Hashes();
+
         // Advance past info hash, read peer ID (sent to TorrentState to associate peer id's with the pieces they have)
         m_bufferRead.advanceReadPosition(20);
         memcpy(m_peerID, m_bufferRead.getReadPointer(), 20);
@@ -260,13 +627,11 @@ namespace network
 
         // Set received handshake to true, send our handshake if it has not yet been sent, otherwise send bitfield
         m_recvdHandshake = true;
+        armConnectionTimer(KeepAliveInterval);
         if (!m_sentHandshake)
             sendHandshake();
         else
-            sendBitfield();
-
-        // Continue to read data from peer
-        read();
+            onHandshakeComplete();
     }
 
     void Peer::readUnchoked()
@@ -277,27 +642,144 @@ namespace network
 
     void Peer::readBitfield(uint32_t length)
     {
-        // Bounds check already performed on raw buffer
-        char *rawBuffer = m_bufferRead.getReadPointer();
+        // Without the metadata, the bitfield is taken at its word and checked against the torrent later
+        if (m_awaitingMetadata && length <= MaxPiecesAwaitingMetadata / 8)
+            m_piecesHave.resize(length * 8);
 
-        // Populate the peer's bitset with data that was just received
-        auto fieldSize = m_piecesHave.size();
-        for (uint32_t i = 0; i < 8 * length; i += 8)
-        {
-            m_piecesHave[i]     = (*rawBuffer & char(0x80));
-            m_piecesHave[i + 1] = (*rawBuffer & char(0x40));
-            m_piecesHave[i + 2] = (*rawBuffer & char(0x20));
-            m_piecesHave[i + 3] = (*rawBuffer & char(0x10));
-            m_piecesHave[i + 4] = (*rawBuffer & char(0x08));
-            m_piecesHave[i + 5] = (*rawBuffer & char(0x04));
-            m_piecesHave[i + 6] = (*rawBuffer & char(0x02));
-            m_piecesHave[i + 7] = (*rawBuffer & char(0x01));
-            ++rawBuffer;
-        }
+        // Bounds check already performed on raw buffer. Populate the peer's bitset with data that was just received
+        const uint8_t *rawBuffer = (const uint8_t*)m_bufferRead.getReadPointer();
+        bool isValid = PieceBitfield::decode(rawBuffer, length, m_piecesHave);
 
         // Advance position in read buffer
         m_bufferRead.advanceReadPosition(length);
 
+        // Drop peers whose bitfield does not match the torrent
+        if (!isValid)
+        {
+            LOG_WARNING("torrent_protocol.network", "Peer sent a malformed bitfield of ", length, " bytes, closing connection");
+            close();
+            return;
+        }
+
+        if (!m_awaitingMetadata)
+            onPeerPiecesKnown();
+    }
+
+    void Peer::readHaveAll()
+    {
+        if (m_awaitingMetadata)
+        {
+            m_peerHasAll = true;
+            return;
+        }
+
+        m_piecesHave.set();
+        onPeerPiecesKnown();
+    }
+
+    void Peer::readHaveNone()
+    {
+        m_peerHasAll = false;
+        m_piecesHave.reset();
+    }
+
+    void Peer::readRejectRequest()
+    {
+        uint32_t pieceIdx, offset, length;
+        m_bufferRead >> pieceIdx;
+        m_bufferRead >> offset;
+        m_bufferRead >> length;
+
+        // Give the fragment back so it can be requested again, rather than waiting on a response that won't arrive
+        if (m_fragmentDownload.get() && m_fragmentDownload->PieceIdx == pieceIdx && m_fragmentDownload->Offset == offset)
+            abandonFragmentDownload();
+    }
+
+    void Peer::readAllowedFast()
+    {
+        uint32_t pieceIdx;
+        m_bufferRead >> pieceIdx;
+        if (pieceIdx >= m_allowedFastByPeer.size())
+            return;
+
+        m_allowedFastByPeer[pieceIdx] = true;
+        if (m_chokedBy && !m_fragmentDownload.get())
+            tryToRequestPiece();
+    }
+
+    void Peer::readExtended(uint32_t length)
+    {
+        if (length < 1 || !m_supportsExtensions)
+        {
+            m_bufferRead.advanceReadPosition(length);
+            return;
+        }
+
+        uint8_t extendedID;
+        m_bufferRead >> extendedID;
+
+        const char *payload = m_bufferRead.getReadPointer();
+        const size_t payloadLength = length - 1;
+
+        // Extensions are indexed by the local message id, so only the handshake needs to be decoded here
+        if (extendedID == 0)
+            readExtendedHandshake(payload, payloadLength);
+        else if (extendedID <= m_extensions.size())
+            m_extensions[extendedID - 1]->onMessage(payload, payloadLength);
+        else
+            LOG_DEBUG("torrent_protocol.network", "Extended message of unregistered id ", (uint32_t)extendedID, " received by peer. Ignoring.");
+
+        m_bufferRead.advanceReadPosition(payloadLength);
+
+        // The message may have completed the torrent's metadata
+        if (m_awaitingMetadata && m_torrentState->hasMetadata())
+            onMetadataReceived();
+    }
+
+    void Peer::readExtendedHandshake(const char *data, size_t length)
+    {
+        bencoding::BenDocument handshake;
+        if (!handshake.parse(std::string(data, length)) || !handshake.getRoot().isDictionary())
+        {
+            LOG_WARNING("torrent_protocol.network", "Peer sent an invalid extended handshake");
+            return;
+        }
+
+        bencoding::BenNode root = handshake.getRoot();
+
+        // Map each extension to the message id the peer uses for it, where an id of 0 disables the extension
+        bencoding::BenNode messageIDs = root.find("m");
+        for (auto &extension : m_extensions)
+        {
+            int64_t remoteID = messageIDs.find(extension->getName()).getInt(0);
+            extension->setRemoteID((remoteID > 0 && remoteID <= 255) ? static_cast<uint8_t>(remoteID) : 0);
+        }
+
+        // Incoming connections come from an ephemeral port, the listen port is only known if the peer sends it
+        int64_t listenPort = root.find("p").getInt(0);
+        if (m_isIncoming && m_listenEndpoint.port() == 0 && listenPort > 0 && listenPort <= 65535)
+            setListenEndpoint(boost::asio::ip::tcp::endpoint(getTCPEndpoint().address(), static_cast<uint16_t>(listenPort)));
+
+        int64_t requestQueue = root.find("reqq").getInt(0);
+        if (requestQueue > 0)
+            m_peerRequestQueue = static_cast<uint32_t>(std::min<int64_t>(requestQueue, MaxRequestQueueSize));
+
+        for (auto &extension : m_extensions)
+            extension->onHandshake(root);
+    }
+
+    void Peer::readPort()
+    {
+        uint16_t port;
+        m_bufferRead >> port;
+
+        // Give the peer's DHT node a chance to join the routing table
+        if (port != 0)
+            eTorrentMgr.addDHTNode(boost::asio::ip::udp::endpoint(getTCPEndpoint().address(), port));
+    }
+
+    void Peer::onPeerPiecesKnown()
+    {
         // Inform TorrentState of the pieces this peer has
         m_torrentState->readPeerBitset(m_piecesHave);
 
@@ -307,6 +789,24 @@ namespace network
             sendInterested();
     }
 
+    void Peer::onMetadataReceived()
+    {
+        m_awaitingMetadata = false;
+
+        // Pieces announced beyond the end of the torrent are dropped along with the spare bits
+        const uint32_t numPieces = static_cast<uint32_t>(m_torrentState->getTorrentFile()->getNumPieces());
+        m_piecesHave.resize(numPieces);
+        m_allowedFastByPeer.resize(numPieces);
+        if (m_peerHasAll)
+            m_piecesHave.set();
+
+        if (!m_piecesHave.any())
+            return;
+
+        onPeerPiecesKnown();
+        tryToRequestPiece();
+    }
+
     void Peer::readPiece(uint32_t blockSize)
     {
         LOG_DEBUG("torrent_protocol.network", "Reading piece of block size ", blockSize, " from peer");
@@ -320,10 +820,14 @@ namespace network
             return;
         }
 
-        if (pieceIdx != m_fragmentDownload->PieceIdx)
-            LOG_WARNING("torrent_protocol.network", "Received fragment of piece ", pieceIdx, ", but requested data for piece ", m_fragmentDownload->PieceIdx);
-        if (offset != m_fragmentDownload->Offset)
-            LOG_WARNING("torrent_protocol.network", "Received offset of ", offset, " for piece ", pieceIdx, " but requested offset of ", m_fragmentDownload->Offset);
+        // The fragment of a request that timed out may still arrive, after it was cancelled and another was requested
+        if (pieceIdx != m_fragmentDownload->PieceIdx || offset != m_fragmentDownload->Offset)
+        {
+            LOG_WARNING("torrent_protocol.network", "Received fragment of piece ", pieceIdx, ", offset ", offset, ", but requested data for piece ",
+                        m_fragmentDownload->PieceIdx, ", offset ", m_fragmentDownload->Offset, ". Discarding");
+            m_bufferRead.advanceReadPosition(blockSize);
+            return;
+        }
         if (blockSize > m_fragmentDownload->Length)
             LOG_WARNING("torrent_protocol.network", "Received fragment of size ", blockSize, ", however requested length of ", m_fragmentDownload->Length, " instead");
 
@@ -332,13 +836,19 @@ namespace network
         //memcpy(&(m_fragmentDownload->Data[m_fragBytesDownloaded]), m_bufferRead.getReadPointer(), blockSize);
         m_bufferRead.advanceReadPosition(blockSize);
         m_fragBytesDownloaded += blockSize;
+        m_timeSnubbed = 0;
 
-        // Inform torrent state if fully downloaded
+        // Inform torrent state if fully downloaded, otherwise give the rest of the fragment another timeout
         if (m_fragBytesDownloaded >= m_fragmentDownload->Length)
         {
-            m_torrentState->onFragmentDownloaded(m_fragmentDownload->PieceIdx);
+            eTorrentMgr.getTimerWheel()->cancel(m_requestTimer);
+            m_requestTimer = TimerWheel::InvalidTimer;
+            m_torrentState->onFragmentDownloaded(*m_fragmentDownload, getTCPEndpoint().address());
+            m_fragmentDownload.reset();
             tryToRequestPiece();
         }
+        else
+            armRequestTimer();
     }
 
     void Peer::readRequest()
@@ -348,9 +858,119 @@ namespace network
         m_bufferRead >> offset;
         m_bufferRead >> length;
 
-        // Make sure we have this piece and are not currently choking the peer
-        if (m_torrentState->havePiece(pieceIdx) && !m_amChoking)
-            sendPiece(pieceIdx, offset, length);
+        // Make sure we have this piece and are not currently choking the peer, unless the piece is in its allowed fast set
+        bool isAllowed = !m_amChoking
+                || std::find(m_allowedFastSet.begin(), m_allowedFastSet.end(), pieceIdx) != m_allowedFastSet.end();
+        if (!m_torrentState->havePiece(pieceIdx) || !isAllowed || length == 0 || length > MaxRequestLength)
+        {
+            if (m_supportsFast)
+                sendRejectRequest(pieceIdx, offset, length);
+            return;
+        }
+
+        // Requests past the advertised queue size are not kept
+        if (m_uploadQueue.size() >= m_uploadQueueSize)
+        {
+            LOG_DEBUG("torrent_protocol.network", "Request queue of peer ", getTCPEndpoint().address().to_string(), " is full, dropping request");
+            if (m_supportsFast)
+                sendRejectRequest(pieceIdx, offset, length);
+            return;
+        }
+
+        m_uploadQueue.push_back(PeerRequest{ pieceIdx, offset, length });
+        scheduleUploads();
+    }
+
+    void Peer::readCancel()
+    {
+        uint32_t pieceIdx, offset, length;
+        m_bufferRead >> pieceIdx;
+        m_bufferRead >> offset;
+        m_bufferRead >> length;
+
+        auto it = std::find_if(m_uploadQueue.begin(), m_uploadQueue.end(), [&](const PeerRequest &request)
+        {
+            return request.PieceIdx == pieceIdx && request.Offset == offset && request.Length == length;
+        });
+        if (it == m_uploadQueue.end())
+            return;
+
+        // With the fast extension, every request is answered, a cancelled one with a reject
+        m_uploadQueue.erase(it);
+        if (m_supportsFast)
+            sendRejectRequest(pieceIdx, offset, length);
+    }
+
+    void Peer::readHashRequestFields(HashRequest &request, uint32_t &proofLayers)
+    {
+        memcpy(request.PiecesRoot.data(), m_bufferRead.getReadPointer(), SHA256_DIGEST_LENGTH);
+        m_bufferRead.advanceReadPosition(SHA256_DIGEST_LENGTH);
+        m_bufferRead >> request.BaseLayer;
+        m_bufferRead >> request.Index;
+        m_bufferRead >> request.Length;
+        m_bufferRead >> proofLayers;
+    }
+
+    void Peer::readHashRequest(uint32_t length)
+    {
+        if (length != HashRequestFieldsLength || !m_supportsV2)
+        {
+            m_bufferRead.advanceReadPosition(length);
+            return;
+        }
+
+        HashRequest request;
+        uint32_t proofLayers;
+        readHashRequestFields(request, proofLayers);
+
+        // Proof hashes are not kept by the client, so only requests without them can be served
+        std::vector<merkle::Hash> hashes;
+        if (proofLayers == 0 && m_torrentState->getHashes(request, hashes))
+            sendHashes(request, hashes);
+        else
+            sendHashReject(request, proofLayers);
+    }
+
+    void Peer::readHashes(uint32_t length)
+    {
+        if (length < HashRequestFieldsLength || !m_supportsV2)
+        {
+            m_bufferRead.advanceReadPosition(length);
+            return;
+        }
+
+        HashRequest request;
+        uint32_t proofLayers;
+        readHashRequestFields(request, proofLayers);
+
+        // The client only asks for the hashes themselves, without proof layers
+        const uint32_t hashesLength = length - HashRequestFieldsLength;
+        if (proofLayers != 0 || hashesLength != uint64_t(request.Length) * SHA256_DIGEST_LENGTH)
+        {
+            m_bufferRead.advanceReadPosition(hashesLength);
+            return;
+        }
+
+        std::vector<boost::asio::ip::address> corruptSenders = m_torrentState->onBlockHashes(request, (const uint8_t*)m_bufferRead.getReadPointer());
+        m_bufferRead.advanceReadPosition(hashesLength);
+
+        // The corrupt blocks can now be downloaded again
+        if (!corruptSenders.empty())
+            tryToRequestPiece();
+    }
+
+    void Peer::readHashReject(uint32_t length)
+    {
+        if (length != HashRequestFieldsLength || !m_supportsV2)
+        {
+            m_bufferRead.advanceReadPosition(length);
+            return;
+        }
+
+        HashRequest request;
+        uint32_t proofLayers;
+        readHashRequestFields(request, proofLayers);
+        m_torrentState->onBlockHashesRejected(request);
     }
 
     void Peer::sendHandshake()
@@ -363,7 +983,11 @@ namespace network
 
         uint8_t pstrlen = 19;
         char pstr[20] = "BitTorrent protocol";
-        uint64_t reserved = 0;
+        uint64_t reserved = FastExtensionBit | ExtensionProtocolBit;
+        if (eTorrentMgr.getDHTPort() != 0)
+            reserved |= DHTBit;
+        if (m_torrentState->getTorrentFile()->hasV2Hashes())
+            reserved |= V2Bit;
 
         MutableBuffer mb(1 + pstrlen + 8 + 20 + 20);
         mb << pstrlen;
@@ -378,40 +1002,74 @@ namespace network
 
         // Check if should send bitfield
         if (m_recvdHandshake)
+            onHandshakeComplete();
+    }
+
+    void Peer::onHandshakeComplete()
+    {
+        const PieceBitfield &bitfield = m_torrentState->getBitsetHave();
+        if (!m_supportsFast)
             sendBitfield();
+        else if (m_awaitingMetadata)
+        {
+            // Nothing can have been downloaded before the metadata, and the allowed fast set
+            // depends on the number of pieces
+            sendHaveNone();
+        }
+        else
+        {
+            // Peers supporting the fast extension must be sent exactly one of bitfield, have all or have none,
+            // and the latter two spare a seed from sending its entire bitfield
+            if (bitfield.all())
+                sendHaveAll();
+            else if (!bitfield.any())
+                sendHaveNone();
+            else
+                sendBitfield();
+
+            // Let the peer bootstrap from the pieces of its allowed fast set that the client has
+            m_allowedFastSet = generateAllowedFastSet(getTCPEndpoint().address(), m_torrentState->getTorrentFile()->getInfoHash(),
+                                                      bitfield.size(), AllowedFastSetSize);
+            for (uint32_t pieceIdx : m_allowedFastSet)
+            {
+                if (bitfield.test(pieceIdx))
+                    sendAllowedFast(pieceIdx);
+            }
+        }
+
+        if (m_supportsExtensions)
+            sendExtendedHandshake();
+
+        uint16_t dhtPort = eTorrentMgr.getDHTPort();
+        if (m_supportsDHT && dhtPort != 0)
+            sendPort(dhtPort);
+
+        // The endpoint of an outgoing connection is the one the peer listens on
+        if (!m_isIncoming)
+            setListenEndpoint(getTCPEndpoint());
     }
 
     void Peer::sendBitfield()
     {
-        const boost::dynamic_bitset<> &bitset = m_torrentState->getBitsetHave();
-        if (!bitset.any())
+        // With nothing to send, the bitfield may still be sent later in place of the first have messages
+        const PieceBitfield &bitfield = m_torrentState->getBitsetHave();
+        if (!bitfield.any())
+        {
+            m_haveVersion = 0;
+            m_bitfieldAllowed = true;
             return;
+        }
 
-        const size_t bytesToSend = (size_t)ceil((float)bitset.size() / 8.0f);
-        size_t bitsetPos = 0;
+        const uint32_t bytesToSend = bitfield.getNumBytes();
 
         MutableBuffer mb(4 + 1 + bytesToSend);
         mb << uint32_t(1 + bytesToSend);        // Length
         mb << uint8_t(5);                       // Message ID
-        for (size_t i = 0; i < bytesToSend; ++i)
-        {
-            if (bitsetPos + 7 >= bitset.size())
-            {
-                mb << uint8_t(0);
-                break;
-            }
-            uint8_t currentByte = ((bitset.test(bitsetPos) ? uint8_t(0x80) : uint8_t(0x00))
-                    | (bitset.test(bitsetPos + 1) ? uint8_t(0x40) : uint8_t(0x00))
-                    | (bitset.test(bitsetPos + 2) ? uint8_t(0x20) : uint8_t(0x00))
-                    | (bitset.test(bitsetPos + 3) ? uint8_t(0x10) : uint8_t(0x00))
-                    | (bitset.test(bitsetPos + 4) ? uint8_t(0x08) : uint8_t(0x00))
-                    | (bitset.test(bitsetPos + 5) ? uint8_t(0x04) : uint8_t(0x00))
-                    | (bitset.test(bitsetPos + 6) ? uint8_t(0x02) : uint8_t(0x00))
-                    | (bitset.test(bitsetPos + 7) ? uint8_t(0x01) : uint8_t(0x00)));
-            mb << currentByte;
 
-            bitsetPos += 8;
-        }
+        // The bitfield is stored in wire format, copy a consistent snapshot of it straight into the message
+        m_haveVersion = bitfield.copyTo((uint8_t*)mb.getWritePointer());
+        mb.advanceWritePosition(bytesToSend);
+        m_bitfieldAllowed = false;
 
         send(std::move(mb));
     }
@@ -421,6 +1079,7 @@ namespace network
         MutableBuffer mb(4 + 1);
         mb << uint32_t(1);       // Length
         mb << uint8_t(2);        // Message ID
+        m_bitfieldAllowed = false;
         send(std::move(mb));
     }
 
@@ -429,7 +1088,21 @@ namespace network
         MutableBuffer mb(4 + 1);
         mb << uint32_t(1);      // Length
         mb << uint8_t(0);       // Message ID
+        m_amChoking = true;
+        m_bitfieldAllowed = false;
         send(std::move(mb));
+
+        // Queued requests are dropped, except for pieces in the allowed fast set. A peer with the fast
+        // extension is told of each request dropped, others assume all of them were
+        auto it = std::remove_if(m_uploadQueue.begin(), m_uploadQueue.end(), [this](const PeerRequest &request)
+        {
+            if (std::find(m_allowedFastSet.begin(), m_allowedFastSet.end(), request.PieceIdx) != m_allowedFastSet.end())
+                return false;
+            if (m_supportsFast)
+                sendRejectRequest(request.PieceIdx, request.Offset, request.Length);
+            return true;
+        });
+        m_uploadQueue.erase(it, m_uploadQueue.end());
     }
 
     void Peer::sendUnchoke()
@@ -437,6 +1110,8 @@ namespace network
         MutableBuffer mb(4 + 1);
         mb << uint32_t(1);       // Length
         mb << uint8_t(1);        // Message ID
+        m_amChoking = false;
+        m_bitfieldAllowed = false;
         send(std::move(mb));
     }
 
@@ -444,7 +1119,11 @@ namespace network
     {
         std::shared_ptr<TorrentFragment> fragPtr = m_torrentState->getFragmentToUpload(pieceIdx, offset, length);
         if (!fragPtr.get())
+        {
+            if (m_supportsFast)
+                sendRejectRequest(pieceIdx, offset, length);
             return;
+        }
 
         MutableBuffer mb(4 + 1 + 4 + 4 + length);
         mb << uint32_t(9 + length); // Length
@@ -452,6 +1131,7 @@ namespace network
         mb << pieceIdx;
         mb << offset;
         mb.write((char*)fragPtr->Data, length);
+        m_bitfieldAllowed = false;
         send(std::move(mb));
     }
 
@@ -464,6 +1144,27 @@ namespace network
         mb << pieceIdx;         // Piece
         mb << offset;           // Fragment Offset
         mb << length;           // Fragment Length
+        m_bitfieldAllowed = false;
+        send(std::move(mb));
+    }
+
+    void Peer::sendCancel(uint32_t pieceIdx, uint32_t offset, uint32_t length)
+    {
+        LOG_DEBUG("torrent_protocol.network", "Sending cancel for piece ", pieceIdx, ", offset ", offset, ", length ", length);
+        MutableBuffer mb(4 + 1 + 4 + 4 + 4);
+        mb << uint32_t(13);     // Length
+        mb << uint8_t(8);       // Message ID
+        mb << pieceIdx;         // Piece
+        mb << offset;           // Fragment Offset
+        mb << length;           // Fragment Length
+        send(std::move(mb));
+    }
+
+    void Peer::sendKeepAlive()
+    {
+        MutableBuffer mb(4);
+        mb << uint32_t(0);      // Length
+        time(&m_timeLastSend);
         send(std::move(mb));
     }
 
@@ -479,7 +1180,381 @@ namespace network
         mb << uint32_t(5); // Length
         mb << uint8_t(4);  // Message ID
         mb << pieceIdx;
+        m_bitfieldAllowed = false;
         send(std::move(mb));
     }
-}
 
+    void Peer::tryToRequestHashes()
+    {
+        if (!m_supportsV2 || m_awaitingMetadata)
+            return;
+
+        // Only a peer that has the piece can send the hashes of its blocks
+        auto currentPiece = m_torrentState->getCurrentPieceNum();
+        if (currentPiece >= m_piecesHave.size() || !m_piecesHave[currentPiece])
+            return;
+
+        HashRequest request;
+        if (m_torrentState->getBlockHashRequest(request))
+            sendHashRequest(request);
+    }
+
+    void Peer::sendHashRequest(const HashRequest &request)
+    {
+        LOG_DEBUG("torrent_protocol.network", "Sending hash request for ", request.Length, " hashes of layer ", request.BaseLayer, ", index ", request.Index);
+        MutableBuffer mb(4 + 1 + HashRequestFieldsLength);
+        mb << uint32_t(1 + HashRequestFieldsLength);    // Length
+        mb << uint8_t(21);                              // Message ID
+        mb.write((const char*)request.PiecesRoot.data(), SHA256_DIGEST_LENGTH);
+        mb << request.BaseLayer;
+        mb << request.Index;
+        mb << request.Length;
+        mb << uint32_t(0);                              // Proof layers
+        m_bitfieldAllowed = false;
+        send(std::move(mb));
+    }
+
+    void Peer::sendHashes(const HashRequest &request, const std::vector<merkle::Hash> &hashes)
+    {
+        const uint32_t hashesLength = static_cast<uint32_t>(hashes.size() * SHA256_DIGEST_LENGTH);
+        MutableBuffer mb(4 + 1 + HashRequestFieldsLength + hashesLength);
+        mb << uint32_t(1 + HashRequestFieldsLength + hashesLength);    // Length
+        mb << uint8_t(22);                                              // Message ID
+        mb.write((const char*)request.PiecesRoot.data(), SHA256_DIGEST_LENGTH);
+        mb << request.BaseLayer;
+        mb << request.Index;
+        mb << request.Length;
+        mb << uint32_t(0);                                              // Proof layers
+        mb.write((const char*)hashes.data(), hashesLength);
+        m_bitfieldAllowed = false;
+        send(std::move(mb));
+    }
+
+    void Peer::sendHashReject(const HashRequest &request, uint32_t proofLayers)
+    {
+        MutableBuffer mb(4 + 1 + HashRequestFieldsLength);
+        mb << uint32_t(1 + HashRequestFieldsLength);    // Length
+        mb << uint8_t(23);                              // Message ID
+        mb.write((const char*)request.PiecesRoot.data(), SHA256_DIGEST_LENGTH);
+        mb << request.BaseLayer;
+        mb << request.Index;
+        mb << request.Length;
+        mb << proofLayers;
+        send(std::move(mb));
+    }
+
+    void Peer::sendHaveAll()
+    {
+        m_haveVersion = m_torrentState->getBitsetHave().size();
+
+        MutableBuffer mb(4 + 1);
+        mb << uint32_t(1);      // Length
+        mb << uint8_t(14);      // Message ID
+        send(std::move(mb));
+    }
+
+    void Peer::sendHaveNone()
+    {
+        m_haveVersion = 0;
+
+        MutableBuffer mb(4 + 1);
+        mb << uint32_t(1);      // Length
+        mb << uint8_t(15);      // Message ID
+        send(std::move(mb));
+    }
+
+    void Peer::sendRejectRequest(uint32_t pieceIdx, uint32_t offset, uint32_t length)
+    {
+        MutableBuffer mb(4 + 1 + 4 + 4 + 4);
+        mb << uint32_t(13);     // Length
+        mb << uint8_t(16);      // Message ID
+        mb << pieceIdx;         // Piece
+        mb << offset;           // Fragment Offset
+        mb << length;           // Fragment Length
+        send(std::move(mb));
+    }
+
+    void Peer::sendAllowedFast(uint32_t pieceIdx)
+    {
+        MutableBuffer mb(4 + 1 + 4);
+        mb << uint32_t(5);      // Length
+        mb << uint8_t(17);      // Message ID
+        mb << pieceIdx;
+        send(std::move(mb));
+    }
+
+    void Peer::sendSuggestPiece(uint32_t pieceIdx)
+    {
+        MutableBuffer mb(4 + 1 + 4);
+        mb << uint32_t(5);      // Length
+        mb << uint8_t(13);      // Message ID
+        mb << pieceIdx;
+        send(std::move(mb));
+    }
+
+    std::vector<uint32_t> Peer::generateAllowedFastSet(const boost::asio::ip::address &address, const uint8_t *infoHash,
+                                                       uint32_t numPieces, uint32_t setSize)
+    {
+        std::vector<uint32_t> allowedFast;
+        boost::asio::ip::address normalized = Socket::normalizeAddress(address);
+        if (!normalized.is_v4() || numPieces == 0)
+            return allowedFast;
+
+        setSize = std::min(setSize, numPieces);
+
+        // x = (ip & 0xFFFFFF00) + info hash, then repeatedly x = SHA1(x), taking each 32-bit word modulo the piece count
+        uint8_t x[SHA_DIGEST_LENGTH + 4];
+        auto ipBytes = normalized.to_v4().to_bytes();
+        memcpy(x, ipBytes.data(), 3);
+        x[3] = 0;
+        memcpy(&x[4], infoHash, SHA_DIGEST_LENGTH);
+        size_t xLength = sizeof(x);
+
+        while (allowedFast.size() < setSize)
+        {
+            SHA1Hash hash;
+            hash.update(x, xLength);
+            hash.finalize();
+            memcpy(x, hash.getDigest(), SHA_DIGEST_LENGTH);
+            xLength = SHA_DIGEST_LENGTH;
+
+            for (size_t i = 0; i < 5 && allowedFast.size() < setSize; ++i)
+            {
+                uint32_t y = (uint32_t(x[i * 4]) << 24) | (uint32_t(x[i * 4 + 1]) << 16) | (uint32_t(x[i * 4 + 2]) << 8) | uint32_t(x[i * 4 + 3]);
+                uint32_t pieceIdx = y % numPieces;
+                if (std::find(allowedFast.begin(), allowedFast.end(), pieceIdx) == allowedFast.end())
+                    allowedFast.push_back(pieceIdx);
+            }
+        }
+        return allowedFast;
+    }
+
+    void Peer::sendPort(uint16_t port)
+    {
+        MutableBuffer mb(4 + 1 + 2);
+        mb << uint32_t(3);      // Length
+        mb << uint8_t(9);       // Message ID
+        mb << port;
+        send(std::move(mb));
+    }
+
+    void Peer::sendExtendedHandshake()
+    {
+        using namespace bencoding;
+
+        std::shared_ptr<BenDictionary> messageIDs = std::make_shared<BenDictionary>();
+        for (size_t i = 0; i < m_extensions.size(); ++i)
+            (*messageIDs)[m_extensions[i]->getName()] = std::make_shared<BenInt>(static_cast<int64_t>(i + 1));
+
+        BenDictionary handshake;
+        handshake["m"] = messageIDs;
+        handshake["v"] = std::make_shared<BenString>(ExtendedClientName);
+        handshake["reqq"] = std::make_shared<BenInt>(static_cast<int64_t>(m_uploadQueueSize));
+
+        uint16_t listenPort = eTorrentMgr.getListenPort();
+        if (listenPort != 0)
+            handshake["p"] = std::make_shared<BenInt>(static_cast<int64_t>(listenPort));
+
+        for (auto &extension : m_extensions)
+            extension->addHandshakeData(handshake);
+
+        Encoder encoder;
+        handshake.accept(encoder);
+        sendExtended(0, encoder.getData().data(), encoder.getData().size());
+    }
+
+    void Peer::sendExtended(uint8_t extendedID, const char *data, size_t length)
+    {
+        MutableBuffer mb(4 + 1 + 1 + length);
+        mb << uint32_t(2 + length);     // Length
+        mb << uint8_t(20);              // Message ID
+        mb << extendedID;               // Extended message ID
+        mb.write(data, length);
+
+        m_bitfieldAllowed = false;
+        send(std::move(mb));
+    }
+
+    uint32_t Peer::getPeerRequestQueue() const
+    {
+        return m_peerRequestQueue;
+    }
+
+    const boost::asio::ip::tcp::endpoint &Peer::getListenEndpoint() const
+    {
+        return m_listenEndpoint;
+    }
+
+    std::shared_ptr<TorrentState> Peer::getTorrentState() const
+    {
+        return m_torrentState;
+    }
+
+    void Peer::onTick()
+    {
+        if (m_isClosing)
+            return;
+
+        // The metadata may have been completed through another peer
+        if (m_awaitingMetadata && m_recvdHandshake && m_sentHandshake && m_torrentState->hasMetadata())
+            onMetadataReceived();
+
+        // Peers found to have sent corrupt data are disconnected
+        if (m_torrentState.get() && m_torrentState->isPeerBanned(getTCPEndpoint().address()))
+        {
+            LOG_INFO("torrent_protocol.network", "Closing connection to banned peer ", getTCPEndpoint().address().to_string());
+            close();
+            return;
+        }
+
+        // A peer left without a fragment to download, while a piece that failed verification waits on its block
+        // hashes or is kept from the peers that sent it, asks again
+        if (m_recvdHandshake && m_sentHandshake)
+        {
+            if (!m_fragmentDownload.get())
+                tryToRequestPiece();
+            else
+                tryToRequestHashes();
+        }
+
+        if (!m_supportsExtensions)
+            return;
+
+        for (auto &extension : m_extensions)
+            extension->onTick();
+    }
+
+    void Peer::onSend()
+    {
+        time(&m_timeLastSend);
+
+        if (m_isUploadStalled && getSendQueueSize() <= SendQueueLowWatermark)
+        {
+            m_isUploadStalled = false;
+            scheduleUploads();
+        }
+    }
+
+    void Peer::startHandshakeTimeout()
+    {
+        armConnectionTimer(HandshakeTimeout);
+    }
+
+    void Peer::armConnectionTimer(uint32_t seconds)
+    {
+        auto timerWheel = eTorrentMgr.getTimerWheel();
+        timerWheel->cancel(m_connectionTimer);
+
+        std::weak_ptr<Peer> self = std::static_pointer_cast<Peer>(shared_from_this());
+        m_connectionTimer = timerWheel->add(std::max(seconds, 1u) * 1000, [self]() {
+            if (auto peer = self.lock())
+                peer->onConnectionTimer();
+        });
+    }
+
+    void Peer::onConnectionTimer()
+    {
+        m_connectionTimer = TimerWheel::InvalidTimer;
+        if (m_isClosing)
+            return;
+
+        if (!m_recvdHandshake)
+        {
+            LOG_INFO("torrent_protocol.network", "No handshake received from peer ", getTCPEndpoint().address().to_string(), " in time, closing connection");
+            close();
+            return;
+        }
+
+        const time_t now = time(nullptr);
+        if (now - m_timeLastMessage >= IdleTimeout)
+        {
+            LOG_INFO("torrent_protocol.network", "No message received from peer ", getTCPEndpoint().address().to_string(), " in ",
+                     IdleTimeout, " seconds, closing connection");
+            close();
+            return;
+        }
+
+        if (now - m_timeLastSend >= KeepAliveInterval)
+            sendKeepAlive();
+
+        // Check again once either the idle timeout or the next keep-alive is due
+        const time_t nextCheck = std::min<time_t>(m_timeLastMessage + IdleTimeout, m_timeLastSend + KeepAliveInterval);
+        armConnectionTimer(static_cast<uint32_t>(std::max<time_t>(nextCheck - now, 1)));
+    }
+
+    void Peer::armRequestTimer()
+    {
+        auto timerWheel = eTorrentMgr.getTimerWheel();
+        timerWheel->cancel(m_requestTimer);
+
+        std::weak_ptr<Peer> self = std::static_pointer_cast<Peer>(shared_from_this());
+        m_requestTimer = timerWheel->add(RequestTimeout * 1000, [self]() {
+            if (auto peer = self.lock())
+                peer->onRequestTimeout();
+        });
+    }
+
+    void Peer::onRequestTimeout()
+    {
+        m_requestTimer = TimerWheel::InvalidTimer;
+        if (m_isClosing || !m_fragmentDownload.get())
+            return;
+
+        LOG_INFO("torrent_protocol.network", "Request for piece ", m_fragmentDownload->PieceIdx, ", offset ", m_fragmentDownload->Offset,
+                 " timed out on peer ", getTCPEndpoint().address().to_string(), ", requesting it from other peers");
+        sendCancel(m_fragmentDownload->PieceIdx, m_fragmentDownload->Offset, m_fragmentDownload->Length);
+        time(&m_timeSnubbed);
+        abandonFragmentDownload();
+    }
+
+    void Peer::abandonFragmentDownload()
+    {
+        if (!m_fragmentDownload.get())
+            return;
+
+        eTorrentMgr.getTimerWheel()->cancel(m_requestTimer);
+        m_requestTimer = TimerWheel::InvalidTimer;
+
+        m_torrentState->onFragmentRejected(m_fragmentDownload->PieceIdx, m_fragmentDownload->Offset);
+        m_fragmentDownload.reset();
+        m_fragBytesDownloaded = 0;
+    }
+
+    void Peer::scheduleUploads()
+    {
+        if (m_uploadQueue.empty() || m_isUploadScheduled || m_isUploadStalled || m_isClosing)
+            return;
+
+        eTorrentMgr.getUploadScheduler()->schedule(std::static_pointer_cast<Peer>(shared_from_this()));
+    }
+
+    uint32_t Peer::getNextUploadLength() const
+    {
+        return m_uploadQueue.empty() ? 0 : m_uploadQueue.front().Length;
+    }
+
+    bool Peer::canUpload()
+    {
+        if (getSendQueueSize() < SendQueueHighWatermark)
+            return true;
+
+        m_isUploadStalled = true;
+        return false;
+    }
+
+    void Peer::sendNextUpload()
+    {
+        PeerRequest request = m_uploadQueue.front();
+        m_uploadQueue.pop_front();
+        sendPiece(request.PieceIdx, request.Offset, request.Length);
+    }
+
+    void Peer::setListenEndpoint(const boost::asio::ip::tcp::endpoint &endpoint)
+    {
+        if (m_listenEndpoint.port() != 0)
+            m_torrentState->removeConnectedPeer(m_listenEndpoint);
+
+        m_listenEndpoint = boost::asio::ip::tcp::endpoint(Socket::normalizeAddress(endpoint.address()), endpoint.port());
+        m_torrentState->addConnectedPeer(m_listenEndpoint);
+    }
+}
@@ -27,13 +27,34 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <boost/dynamic_bitset.hpp>
 #include <ctime>
+#include <deque>
+#include <memory>
+#include <vector>
+#include "MerkleTree.h"
 #include "Socket.h"
+#include "TimerWheel.h"
 
+struct HashRequest;
 class TorrentFragment;
 class TorrentState;
 
 namespace network
 {
+    class PeerExtension;
+
+    /// A request from a peer for a fragment of a piece, queued until it is served
+    struct PeerRequest
+    {
+        /// Index of the piece
+        uint32_t PieceIdx;
+
+        /// Offset of the fragment within the piece
+        uint32_t Offset;
+
+        /// Length of the fragment
+        uint32_t Length;
+    };
+
     /**
      * @class Peer
      * @brief Represents a single remote entity in the swarm, connected
@@ -41,6 +62,8 @@ namespace network
      */
     class Peer : public Socket
     {
+        friend class UploadScheduler;
+
     public:
         /// Constructs a new peer object, given a reference to an io_service
         explicit Peer(boost::asio::io_service &ioService, Socket::Mode mode);
@@ -48,6 +71,9 @@ namespace network
         /// Constructs a peer by moving the given tcp socket
         Peer(boost::asio::ip::tcp::socket &&socket);
 
+        /// Constructs a peer on the given uTP stream, accepted from a remote peer
+        Peer(std::shared_ptr<UTPStream> stream);
+
         /// Peer destructor
         ~Peer();
 
@@ -57,9 +83,28 @@ namespace network
         /// Checks if client is eligible to request the piece being downloaded, and if so, sends a request to the peer
         void tryToRequestPiece();
 
-        /// Sends info. to the peer regarding any random piece the client has
+        /// Sends an extended message (BEP 10) with the given payload, using the message id the peer assigned to the extension
+        void sendExtended(uint8_t extendedID, const char *data, size_t length);
+
+        /// Returns the number of outstanding requests the peer is willing to queue, as given in its extended handshake
+        uint32_t getPeerRequestQueue() const;
+
+        /// Returns the endpoint the peer accepts connections on, with a port of 0 if not known
+        const boost::asio::ip::tcp::endpoint &getListenEndpoint() const;
+
+        /// Returns the state of the torrent shared with the peer
+        std::shared_ptr<TorrentState> getTorrentState() const;
+
+        /// Called periodically by the connection manager, letting extensions perform their periodic work
+        void onTick();
+
+        /// Tells the peer about every piece the client has completed since the last call, using a single write.
+        /// Pieces the peer already has are skipped
         void sendPieceHave();
 
+        /// Closes the connection unless the peer's handshake arrives within the handshake timeout
+        void startHandshakeTimeout();
+
     protected:
         /// Called after the local client has successfully initiated a connection with a remote peer
         virtual void onConnect() override;
@@ -67,11 +112,22 @@ namespace network
         /// Called after a successful read operation
         virtual void onRead() override;
 
+        /// Called after data has been written to the peer, resuming the uploads held back while its send queue was backed up
+        virtual void onSend() override;
+
     /// Functions to handle incoming data
     private:
         /// Handles the handshake message sent by the peer
         void readHandshake();
 
+        /// Handles the message at the front of the read buffer. Returns false if the message has not
+        /// arrived in its entirety, or the connection was closed
+        bool readMessage();
+
+        /// Returns true if the length prefix of a message with the given id is valid for its fixed-size
+        /// fields. Messages of variable length are checked by their handlers
+        static bool isValidMessageLength(uint8_t messageID, uint32_t length);
+
         /// Handles the unchoke message sent by the peer
         void readUnchoked();
 
@@ -81,21 +137,93 @@ namespace network
         /// Handles the piece message and contents sent by the peer
         void readPiece(uint32_t blockSize);
 
-        /// Handles the request message when received from the peer
+        /// Handles the request message when received from the peer, queueing the request to be served by the upload scheduler
         void readRequest();
 
+        /// Handles the cancel message sent by the peer, removing the request from the queue if it has not been served
+        void readCancel();
+
+        /// Handles the have all message sent by the peer (fast extension)
+        void readHaveAll();
+
+        /// Handles the have none message sent by the peer (fast extension)
+        void readHaveNone();
+
+        /// Handles the reject request message sent by the peer (fast extension)
+        void readRejectRequest();
+
+        /// Handles the allowed fast message sent by the peer (fast extension)
+        void readAllowedFast();
+
+        /// Handles the port message sent by the peer, giving the port of its DHT node
+        void readPort();
+
+        /// Handles an extended message (BEP 10) sent by the peer
+        void readExtended(uint32_t length);
+
+        /// Reads the fields shared by the hash request, hashes and hash reject messages (BEP 52)
+        void readHashRequestFields(HashRequest &request, uint32_t &proofLayers);
+
+        /// Handles the hash request message sent by the peer (BEP 52)
+        void readHashRequest(uint32_t length);
+
+        /// Handles the hashes message sent by the peer, in response to a hash request (BEP 52)
+        void readHashes(uint32_t length);
+
+        /// Handles the hash reject message sent by the peer (BEP 52)
+        void readHashReject(uint32_t length);
+
+        /// Handles the extended handshake sent by the peer
+        void readExtendedHandshake(const char *data, size_t length);
+
+        /// Sets the endpoint the peer accepts connections on and shares it with the torrent state
+        void setListenEndpoint(const boost::asio::ip::tcp::endpoint &endpoint);
+
+        /// Called once the peer's initial set of pieces is known, sending the interested
+        /// message if the peer has the piece currently being downloaded
+        void onPeerPiecesKnown();
+
+        /// Called once the metadata of a torrent added from a magnet link has been received, sizing the
+        /// peer's piece sets to the torrent and acting on the pieces it announced in the meantime
+        void onMetadataReceived();
+
     /// Functions to handle sending of data
     private:
         /// Sends the client's handshake to the peer
         void sendHandshake();
 
+        /// Called once both handshakes have been exchanged, sending the client's set of pieces
+        /// and, if the fast extension is supported, the allowed fast set
+        void onHandshakeComplete();
+
         /// Sends the client's bitfield to the peer
         void sendBitfield();
 
+        /// Sends the have all message to the peer (fast extension)
+        void sendHaveAll();
+
+        /// Sends the have none message to the peer (fast extension)
+        void sendHaveNone();
+
+        /// Sends the reject request message to the peer for a request that will not be served (fast extension)
+        void sendRejectRequest(uint32_t pieceIdx, uint32_t offset, uint32_t length);
+
+        /// Sends the allowed fast message to the peer for the piece with the given index (fast extension)
+        void sendAllowedFast(uint32_t pieceIdx);
+
+        /// Sends the suggest piece message to the peer for the piece with the given index (fast extension)
+        void sendSuggestPiece(uint32_t pieceIdx);
+
+        /// Sends the port message to the peer, giving the port of the client's DHT node
+        void sendPort(uint16_t port);
+
+        /// Sends the client's extended handshake, advertising the message ids of the registered extensions
+        void sendExtendedHandshake();
+
         /// Sends the interested message to the peer
         void sendInterested();
 
-        /// Sends the choke message to the peer
+        /// Sends the choke message to the peer, dropping the queued requests it may no longer make
         void sendChoke();
 
         /// Sends the unchoke message to the peer
@@ -109,9 +237,67 @@ namespace network
         /// fragment offset and length
         void sendRequest(uint32_t pieceIdx, uint32_t offset, uint32_t length);
 
+        /// Sends the cancel message to the peer for a previously requested fragment
+        void sendCancel(uint32_t pieceIdx, uint32_t offset, uint32_t length);
+
+        /// Sends a keep-alive message to the peer
+        void sendKeepAlive();
+
         /// Sends the "have" message to the peer for the piece with the given index
         void sendHave(uint32_t pieceIdx);
 
+        /// Requests the block hashes of the piece being downloaded from the peer, if the piece failed
+        /// verification and the peer has it (BEP 52)
+        void tryToRequestHashes();
+
+        /// Sends the hash request message to the peer, without proof layers (BEP 52)
+        void sendHashRequest(const HashRequest &request);
+
+        /// Sends the hashes message to the peer, in response to its hash request (BEP 52)
+        void sendHashes(const HashRequest &request, const std::vector<merkle::Hash> &hashes);
+
+        /// Sends the hash reject message to the peer for a hash request that will not be served (BEP 52)
+        void sendHashReject(const HashRequest &request, uint32_t proofLayers);
+
+    /// Functions used by the upload scheduler
+    private:
+        /// Hands the peer to the upload scheduler if it has queued requests that can be served
+        void scheduleUploads();
+
+        /// Returns the length of the next queued request, or 0 if no request is queued
+        uint32_t getNextUploadLength() const;
+
+        /// Returns true if the peer's send queue has room for another fragment. Otherwise, the peer's
+        /// requests are held back until the send queue drains below the low watermark
+        bool canUpload();
+
+        /// Reads the fragment of the next queued request from disk and sends it to the peer
+        void sendNextUpload();
+
+    /// Timeouts of the connection, run by the timer wheel
+    private:
+        /// Sets the connection timer to fire in the given number of seconds, replacing any pending one
+        void armConnectionTimer(uint32_t seconds);
+
+        /// Closes the connection if the handshake timed out or the peer has gone silent, otherwise
+        /// sends a keep-alive if nothing else was sent for a while
+        void onConnectionTimer();
+
+        /// Sets the request timer for the fragment being downloaded, replacing any pending one
+        void armRequestTimer();
+
+        /// Cancels the request of the fragment being downloaded, and gives the fragment to other peers
+        void onRequestTimeout();
+
+        /// Gives the fragment being downloaded, if any, back to the torrent state so that it can be requested again
+        void abandonFragmentDownload();
+
+    private:
+        /// Generates the allowed fast set of a peer with the given IPv4 address, as defined by BEP 6.
+        /// Returns an empty set for IPv6 addresses
+        static std::vector<uint32_t> generateAllowedFastSet(const boost::asio::ip::address &address, const uint8_t *infoHash,
+                                                            uint32_t numPieces, uint32_t setSize);
+
     private:
         /// The peer's identifier
         char m_peerID[20];
@@ -119,12 +305,18 @@ namespace network
         /// The timestamp of when the last message was received
         time_t m_timeLastMessage;
 
+        /// The timestamp of when data was last sent to the peer
+        time_t m_timeLastSend;
+
         /// True if the peer is choking the client, false if else
         bool m_chokedBy;
 
         /// True if the client is choking the peer, false if else
         bool m_amChoking;
 
+        /// True if unchoking the peer took one of the torrent's unchoke slots
+        bool m_holdsUnchokeSlot;
+
         /// True if the peer is interested in the client, false if else
         bool m_peerInterested;
 
@@ -140,13 +332,76 @@ namespace network
         /// Bitset representing the pieces of the torrent file this peer has
         boost::dynamic_bitset<> m_piecesHave;
 
+        /// Version of the client's bitfield that the peer has been told about
+        uint64_t m_haveVersion;
+
+        /// True while a bitfield may still be sent, i.e. nothing has followed the handshakes yet
+        bool m_bitfieldAllowed;
+
+        /// True if both sides support the fast extension
+        bool m_supportsFast;
+
+        /// Pieces the peer may request while choked by the client
+        std::vector<uint32_t> m_allowedFastSet;
+
+        /// Pieces the client may request while choked by the peer
+        boost::dynamic_bitset<> m_allowedFastByPeer;
+
+        /// True if both sides support the extension protocol
+        bool m_supportsExtensions;
+
+        /// True if the peer runs a DHT node
+        bool m_supportsDHT;
+
+        /// True if both sides support the hash messages of BitTorrent v2 for the torrent
+        bool m_supportsV2;
+
+        /// Registered extensions, the extension with local message id N being at index N - 1
+        std::vector< std::unique_ptr<PeerExtension> > m_extensions;
+
+        /// Number of outstanding requests the peer is willing to queue
+        uint32_t m_peerRequestQueue;
+
+        /// Requests from the peer waiting to be served, in the order they arrived
+        std::deque<PeerRequest> m_uploadQueue;
+
+        /// Number of requests the client queues for the peer, as advertised in the extended handshake
+        uint32_t m_uploadQueueSize;
+
+        /// True while the peer is in the upload scheduler's rotation
+        bool m_isUploadScheduled;
+
+        /// True while the peer's requests are held back because its send queue is backed up
+        bool m_isUploadStalled;
+
+        /// True if the peer initiated the connection
+        bool m_isIncoming;
+
+        /// Endpoint the peer accepts connections on
+        boost::asio::ip::tcp::endpoint m_listenEndpoint;
+
         /// Torrent state pointer
         std::shared_ptr<TorrentState> m_torrentState;
 
+        /// True while the torrent's metadata is pending, so that the number of pieces is not yet known
+        bool m_awaitingMetadata;
+
+        /// True if the peer sent the have all message while the metadata was pending
+        bool m_peerHasAll;
+
         /// Fragment (if any) being downloaded to the client
         std::shared_ptr<TorrentFragment> m_fragmentDownload;
 
         /// Total number of bytes downloaded from the current fragment
         uint32_t m_fragBytesDownloaded;
+
+        /// The timestamp of when a request to the peer last timed out, or 0 if none did since it last sent data
+        time_t m_timeSnubbed;
+
+        /// Timer of the handshake timeout, and once the handshake is received, of the idle timeout and keep-alives
+        TimerWheel::TimerID m_connectionTimer;
+
+        /// Timer of the request for the fragment being downloaded
+        TimerWheel::TimerID m_requestTimer;
     };
 }
@@ -0,0 +1,67 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "Peer.h"
+#include "PeerExtension.h"
+
+namespace network
+{
+    PeerExtension::PeerExtension(Peer &peer) :
+        m_peer(peer),
+        m_remoteID(0)
+    {
+    }
+
+    void PeerExtension::addHandshakeData(bencoding::BenDictionary &)
+    {
+    }
+
+    void PeerExtension::onHandshake(const bencoding::BenNode &)
+    {
+    }
+
+    void PeerExtension::onTick()
+    {
+    }
+
+    bool PeerExtension::isSupportedByPeer() const
+    {
+        return m_remoteID != 0;
+    }
+
+    void PeerExtension::setRemoteID(uint8_t id)
+    {
+        m_remoteID = id;
+    }
+
+    bool PeerExtension::sendMessage(const char *data, std::size_t length)
+    {
+        if (m_remoteID == 0)
+            return false;
+
+        m_peer.sendExtended(m_remoteID, data, length);
+        return true;
+    }
+}
@@ -0,0 +1,89 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace bencoding
+{
+    class BenDictionary;
+    class BenNode;
+}
+
+namespace network
+{
+    class Peer;
+
+    /**
+     * @class PeerExtension
+     * @brief Base class of the extensions built on the extension protocol (BEP 10). One
+     *        instance of each registered extension is created for every peer connection.
+     */
+    class PeerExtension
+    {
+    public:
+        /// Constructs the extension for the given peer connection
+        explicit PeerExtension(Peer &peer);
+
+        /// Virtual destructor
+        virtual ~PeerExtension() = default;
+
+        /// Returns the name of the extension, as used in the "m" dictionary of the extended handshake
+        virtual const char *getName() const = 0;
+
+        /// Adds any extension-specific keys to the client's extended handshake
+        virtual void addHandshakeData(bencoding::BenDictionary &handshake);
+
+        /// Called once the peer's extended handshake has been received. The extension's
+        /// remote message id is already known at this point
+        virtual void onHandshake(const bencoding::BenNode &handshake);
+
+        /// Handles the payload of an extended message addressed to this extension
+        virtual void onMessage(const char *data, std::size_t length) = 0;
+
+        /// Called every few seconds while the connection is open
+        virtual void onTick();
+
+        /// Returns true if the peer supports the extension
+        bool isSupportedByPeer() const;
+
+        /// Sets the message id the peer assigned to the extension, 0 meaning the extension is not supported
+        void setRemoteID(uint8_t id);
+
+    protected:
+        /// Sends an extended message with the given payload to the peer. Returns false if
+        /// the peer does not support the extension
+        bool sendMessage(const char *data, std::size_t length);
+
+    protected:
+        /// Connection the extension belongs to
+        Peer &m_peer;
+
+        /// Extended message id the peer expects for this extension
+        uint8_t m_remoteID;
+    };
+}
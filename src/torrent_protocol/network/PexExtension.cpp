@@ -0,0 +1,219 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include "LogHelper.h"
+#include "PexExtension.h"
+#include "Peer.h"
+#include "ConnectionMgr.h"
+#include "TorrentMgr.h"
+#include "TorrentState.h"
+#include "BenDictionary.h"
+#include "BenDocument.h"
+#include "BenString.h"
+#include "Encoder.h"
+
+namespace network
+{
+    /// Minimum number of seconds between two messages sent to a peer
+    const static time_t PexIntervalSeconds = 60;
+
+    /// Messages arriving sooner than this after the previous one are ignored
+    const static time_t MinPexReceiveSeconds = 45;
+
+    /// Maximum number of added or dropped peers sent in a single message
+    const static std::size_t MaxPexPeersPerMessage = 50;
+
+    /// Connections are not opened to exchanged peers once this many are open
+    const static std::size_t MaxPexConnections = 200;
+
+    /// Flag of an added peer, indicating that it accepts incoming connections
+    const static uint8_t PexFlagConnectable = 0x10;
+
+    PexExtension::PexExtension(Peer &peer) :
+        PeerExtension(peer),
+        m_advertised(),
+        m_lastSent(0),
+        m_lastReceived(0)
+    {
+    }
+
+    const char *PexExtension::getName() const
+    {
+        return "ut_pex";
+    }
+
+    void PexExtension::onTick()
+    {
+        time_t now = time(nullptr);
+        if (!isSupportedByPeer() || now - m_lastSent < PexIntervalSeconds)
+            return;
+
+        std::shared_ptr<TorrentState> torrentState = m_peer.getTorrentState();
+        if (torrentState.get() == nullptr)
+            return;
+
+        std::vector<boost::asio::ip::tcp::endpoint> connected = torrentState->getConnectedPeers();
+        std::set<boost::asio::ip::tcp::endpoint> current(connected.begin(), connected.end());
+        current.erase(m_peer.getListenEndpoint());
+
+        std::string added, addedFlags, added6, added6Flags, dropped, dropped6;
+        std::size_t numAdded = 0, numDropped = 0;
+        for (const auto &endpoint : current)
+        {
+            if (numAdded == MaxPexPeersPerMessage)
+                break;
+            if (m_advertised.find(endpoint) != m_advertised.end())
+                continue;
+
+            appendCompact(endpoint, added, added6);
+            (endpoint.address().is_v4() ? addedFlags : added6Flags).push_back(static_cast<char>(PexFlagConnectable));
+            m_advertised.insert(endpoint);
+            ++numAdded;
+        }
+
+        for (auto it = m_advertised.begin(); it != m_advertised.end() && numDropped < MaxPexPeersPerMessage;)
+        {
+            if (current.find(*it) != current.end())
+            {
+                ++it;
+                continue;
+            }
+
+            appendCompact(*it, dropped, dropped6);
+            it = m_advertised.erase(it);
+            ++numDropped;
+        }
+
+        // The first message is sent even if empty, later ones only carry changes
+        if (numAdded == 0 && numDropped == 0 && m_lastSent != 0)
+            return;
+
+        m_lastSent = now;
+
+        using namespace bencoding;
+        BenDictionary message;
+        message["added"] = std::make_shared<BenString>(added);
+        message["added.f"] = std::make_shared<BenString>(addedFlags);
+        message["added6"] = std::make_shared<BenString>(added6);
+        message["added6.f"] = std::make_shared<BenString>(added6Flags);
+        message["dropped"] = std::make_shared<BenString>(dropped);
+        message["dropped6"] = std::make_shared<BenString>(dropped6);
+
+        Encoder encoder;
+        message.accept(encoder);
+        sendMessage(encoder.getData().data(), encoder.getData().size());
+    }
+
+    void PexExtension::onMessage(const char *data, std::size_t length)
+    {
+        time_t now = time(nullptr);
+        if (m_lastReceived != 0 && now - m_lastReceived < MinPexReceiveSeconds)
+        {
+            LOG_DEBUG("torrent_protocol.network", "Ignoring peer exchange message sent too soon after the previous one");
+            return;
+        }
+        m_lastReceived = now;
+
+        std::shared_ptr<TorrentState> torrentState = m_peer.getTorrentState();
+        if (torrentState.get() == nullptr)
+            return;
+
+        bencoding::BenDocument message;
+        if (!message.parse(std::string(data, length)) || !message.getRoot().isDictionary())
+        {
+            LOG_WARNING("torrent_protocol.network", "Peer sent an invalid peer exchange message");
+            return;
+        }
+
+        bencoding::BenNode root = message.getRoot();
+        std::size_t numAccepted = 0;
+        connectToPeers(root.find("added").getString(), 6, numAccepted);
+        connectToPeers(root.find("added6").getString(), 18, numAccepted);
+    }
+
+    void PexExtension::appendCompact(const boost::asio::ip::tcp::endpoint &endpoint, std::string &compactV4, std::string &compactV6)
+    {
+        std::string &compact = endpoint.address().is_v4() ? compactV4 : compactV6;
+        if (endpoint.address().is_v4())
+        {
+            auto bytes = endpoint.address().to_v4().to_bytes();
+            compact.append(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+        }
+        else
+        {
+            auto bytes = endpoint.address().to_v6().to_bytes();
+            compact.append(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+        }
+
+        // Port in network byte order
+        compact.push_back(static_cast<char>(endpoint.port() >> 8));
+        compact.push_back(static_cast<char>(endpoint.port() & 0xff));
+    }
+
+    void PexExtension::connectToPeers(std::string_view compactPeers, std::size_t entrySize, std::size_t &numAccepted)
+    {
+        std::shared_ptr<TorrentState> torrentState = m_peer.getTorrentState();
+        std::vector<boost::asio::ip::tcp::endpoint> connected = torrentState->getConnectedPeers();
+        auto connectionMgr = eTorrentMgr.getPeerConnectionMgr();
+        if (connectionMgr.get() == nullptr)
+            return;
+
+        for (std::size_t pos = 0; pos + entrySize <= compactPeers.size(); pos += entrySize)
+        {
+            if (numAccepted >= MaxPexPeersPerMessage || connectionMgr->getNumConnected() >= MaxPexConnections)
+                return;
+
+            const uint8_t *entry = reinterpret_cast<const uint8_t*>(compactPeers.data() + pos);
+            boost::asio::ip::address address;
+            if (entrySize == 6)
+            {
+                boost::asio::ip::address_v4::bytes_type bytes;
+                memcpy(bytes.data(), entry, bytes.size());
+                address = boost::asio::ip::address_v4(bytes);
+            }
+            else
+            {
+                boost::asio::ip::address_v6::bytes_type bytes;
+                memcpy(bytes.data(), entry, bytes.size());
+                address = boost::asio::ip::address_v6(bytes);
+            }
+
+            uint16_t port = (uint16_t(entry[entrySize - 2]) << 8) | entry[entrySize - 1];
+            if (port == 0 || address.is_unspecified())
+                continue;
+
+            ++numAccepted;
+
+            // Skip peers already connected; the torrent state also rate-limits repeated attempts at the same candidate
+            boost::asio::ip::tcp::endpoint endpoint(address, port);
+            if (std::find(connected.begin(), connected.end(), endpoint) == connected.end()
+                    && torrentState->addPeerCandidate(endpoint))
+                connectionMgr->attemptConnection(address, port, torrentState);
+        }
+    }
+}
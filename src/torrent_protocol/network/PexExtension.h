@@ -0,0 +1,76 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <ctime>
+#include <set>
+#include <string>
+#include <string_view>
+#include <boost/asio/ip/tcp.hpp>
+
+#include "PeerExtension.h"
+
+namespace network
+{
+    /**
+     * @class PexExtension
+     * @brief Implements peer exchange (ut_pex). About once a minute, the peers that connected to or
+     *        disconnected from the torrent since the last message are sent as deltas, and the peers
+     *        received from the remote side are handed to the connection manager.
+     */
+    class PexExtension : public PeerExtension
+    {
+    public:
+        /// Constructs the extension for the given peer connection
+        explicit PexExtension(Peer &peer);
+
+        /// Returns "ut_pex"
+        const char *getName() const override;
+
+        /// Handles a peer exchange message
+        void onMessage(const char *data, std::size_t length) override;
+
+        /// Sends the changes in the set of connected peers, if the send interval has elapsed
+        void onTick() override;
+
+    private:
+        /// Appends the compact form of the endpoint to the IPv4 or IPv6 string, depending on its address
+        static void appendCompact(const boost::asio::ip::tcp::endpoint &endpoint, std::string &compactV4, std::string &compactV6);
+
+        /// Attempts to connect to each peer in a compact peer string with the given entry size
+        void connectToPeers(std::string_view compactPeers, std::size_t entrySize, std::size_t &numAccepted);
+
+    private:
+        /// Peers the remote side currently knows about from this connection
+        std::set<boost::asio::ip::tcp::endpoint> m_advertised;
+
+        /// Time at which the last message was sent
+        time_t m_lastSent;
+
+        /// Time at which the last message was received
+        time_t m_lastReceived;
+    };
+}
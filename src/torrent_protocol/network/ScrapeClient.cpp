@@ -0,0 +1,335 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <cstring>
+#include <ctime>
+#include <random>
+#include "ScrapeClient.h"
+
+#include "BenDocument.h"
+#include "Request.h"
+#include "Response.h"
+#include "TorrentFile.h"
+#include "TorrentState.h"
+#include "UDPTracker.h"
+
+#include "LogHelper.h"
+
+using namespace bencoding;
+
+/// Number of seconds to wait for a response from the tracker
+const static long ScrapeTimeoutSeconds = 15;
+
+namespace network
+{
+    const size_t ScrapeClient::MaxHashesHTTP;
+    const size_t ScrapeClient::MaxHashesUDP;
+
+    ScrapeClient::ScrapeClient(boost::asio::io_service &ioService, Socket::Mode mode) :
+        Socket(ioService, mode),
+        m_ioService(ioService),
+        m_url(""),
+        m_torrents(),
+        m_timeoutTimer(ioService),
+        m_transactionID(0),
+        m_connectionID(0)
+    {
+    }
+
+    void ScrapeClient::setTrackerURL(const http::URL &url)
+    {
+        m_url = url;
+    }
+
+    void ScrapeClient::addTorrent(std::shared_ptr<TorrentState> state)
+    {
+        m_torrents.push_back(state);
+    }
+
+    size_t ScrapeClient::getNumTorrents() const
+    {
+        return m_torrents.size();
+    }
+
+    bool ScrapeClient::start()
+    {
+        if (m_torrents.empty())
+            return false;
+
+        boost::system::error_code ec;
+        if (getMode() == Socket::Mode::TCP)
+        {
+            boost::asio::ip::tcp::resolver resolver(m_ioService);
+            boost::asio::ip::tcp::resolver::query query(m_url.getHostName(), m_url.getPort());
+            auto it = resolver.resolve(query, ec);
+            if (ec || it == boost::asio::ip::tcp::resolver::iterator())
+            {
+                LOG_WARNING("torrent_protocol.network", "Unable to resolve scrape endpoint ", m_url.getHost());
+                return false;
+            }
+            boost::asio::ip::tcp::endpoint endpoint = *it;
+            connect(endpoint);
+        }
+        else
+        {
+            boost::asio::ip::udp::resolver resolver(m_ioService);
+            boost::asio::ip::udp::resolver::query query(m_url.getHostName(), m_url.getPort());
+            auto it = resolver.resolve(query, ec);
+            if (ec || it == boost::asio::ip::udp::resolver::iterator())
+            {
+                LOG_WARNING("torrent_protocol.network", "Unable to resolve scrape endpoint ", m_url.getHost());
+                return false;
+            }
+            boost::asio::ip::udp::endpoint endpoint = *it;
+            connect(endpoint);
+        }
+
+        m_timeoutTimer.expires_from_now(boost::posix_time::seconds(ScrapeTimeoutSeconds));
+        m_timeoutTimer.async_wait(std::bind(&ScrapeClient::onTimeout, std::static_pointer_cast<ScrapeClient>(shared_from_this()), std::placeholders::_1));
+        return true;
+    }
+
+    void ScrapeClient::onConnect()
+    {
+        if (getMode() == Socket::Mode::TCP)
+            sendHTTPRequest();
+        else
+            sendUDPConnect();
+        read();
+    }
+
+    void ScrapeClient::onRead()
+    {
+        if (getMode() == Socket::Mode::TCP)
+            readHTTPResponse();
+        else
+            readUDPResponse();
+    }
+
+    void ScrapeClient::sendHTTPRequest()
+    {
+        http::URL scrapeURL = m_url;
+        for (auto &torrent : m_torrents)
+            scrapeURL.addParameter("info_hash", std::string((const char*)torrent->getTorrentFile()->getInfoHash(), 20));
+
+        MutableBuffer mb;
+        mb << http::Request::getText(scrapeURL);
+        send(std::move(mb));
+    }
+
+    void ScrapeClient::readHTTPResponse()
+    {
+        std::string responseStr(m_bufferRead.getReadPointer(), m_bufferRead.getSizeUnread());
+
+        // Keep reading until the payload has been received in its entirety, or the tracker closes the connection
+        if (!isClosing() && !http::Response::isComplete(responseStr))
+        {
+            read();
+            return;
+        }
+        m_bufferRead.advanceReadPosition(responseStr.size());
+
+        http::Response response(responseStr);
+        if (response.StatusCode != 200)
+        {
+            LOG_WARNING("torrent_protocol.network", "Scrape request to ", m_url.getHost(), " failed with status code ", response.StatusCode);
+            finish();
+            return;
+        }
+
+        BenDocument document;
+        BenNode dict;
+        if (document.parse(std::move(response.Payload)))
+            dict = document.getRoot();
+        if (!dict.isDictionary())
+        {
+            LOG_ERROR("torrent_protocol.network", "Unable to decode scrape response from tracker ", m_url.getHost());
+            finish();
+            return;
+        }
+
+        BenNode failure = dict.find("failure reason");
+        if (failure)
+        {
+            LOG_WARNING("torrent_protocol.network", "Scrape failure reported by tracker: ", failure.getString());
+            finish();
+            return;
+        }
+
+        // files: a dictionary of info hashes to dictionaries of { complete, downloaded, incomplete }
+        BenNode files = dict.find("files");
+        if (files.isDictionary())
+        {
+            for (std::size_t i = 0; i < files.size(); ++i)
+            {
+                std::string_view infoHash = files.getKey(i);
+                if (infoHash.size() != 20)
+                    continue;
+
+                auto torrent = findTorrent((const uint8_t*)infoHash.data());
+                if (!torrent.get())
+                    continue;
+
+                BenNode fileDict = files.getValue(i);
+                SwarmStats stats = torrent->getSwarmStats();
+
+                BenNode stat = fileDict.find("complete");
+                if (stat.isInt())
+                    stats.Complete = (uint32_t)stat.getInt();
+                stat = fileDict.find("incomplete");
+                if (stat.isInt())
+                    stats.Incomplete = (uint32_t)stat.getInt();
+                stat = fileDict.find("downloaded");
+                if (stat.isInt())
+                    stats.Downloaded = (uint32_t)stat.getInt();
+                stats.LastUpdated = time(nullptr);
+
+                torrent->setSwarmStats(stats);
+            }
+        }
+
+        finish();
+    }
+
+    void ScrapeClient::sendUDPConnect()
+    {
+        std::random_device rd;
+        m_transactionID = rd();
+
+        // Connect request: <protocol_id (64-bit)><action (32-bit)><transaction_id (32-bit)>
+        MutableBuffer mb(16);
+        mb << UDPTrackerProtocolID;
+        mb << uint32_t(UDPTrackerAction::Connect);
+        mb << m_transactionID;
+        send(std::move(mb));
+    }
+
+    void ScrapeClient::sendUDPScrape()
+    {
+        std::random_device rd;
+        m_transactionID = rd();
+
+        // Scrape request: <connection_id (64-bit)><action (32-bit)><transaction_id (32-bit)><info_hash (20 bytes) * N>
+        MutableBuffer mb(16 + 20 * m_torrents.size());
+        mb << m_connectionID;
+        mb << uint32_t(UDPTrackerAction::Scrape);
+        mb << m_transactionID;
+        for (auto &torrent : m_torrents)
+            mb.write((const char*)torrent->getTorrentFile()->getInfoHash(), 20);
+        send(std::move(mb));
+    }
+
+    void ScrapeClient::readUDPResponse()
+    {
+        if (isClosing())
+            return;
+
+        // Every response begins with <action (32-bit)><transaction_id (32-bit)>
+        if (m_bufferRead.getSizeUnread() < 8)
+        {
+            read();
+            return;
+        }
+
+        uint32_t action, transactionID;
+        m_bufferRead >> action;
+        m_bufferRead >> transactionID;
+        if (transactionID != m_transactionID)
+        {
+            // Stray datagram, discard it and wait for the response we are expecting
+            m_bufferRead.advanceReadPosition(m_bufferRead.getSizeUnread());
+            read();
+            return;
+        }
+
+        switch (action)
+        {
+            case uint32_t(UDPTrackerAction::Connect):
+            {
+                if (m_bufferRead.getSizeUnread() < 8)
+                    break;
+                m_bufferRead >> m_connectionID;
+                sendUDPScrape();
+                read();
+                return;
+            }
+            case uint32_t(UDPTrackerAction::Scrape):
+            {
+                // <seeders (32-bit)><completed (32-bit)><leechers (32-bit)> for each info hash, in order of the request
+                for (auto &torrent : m_torrents)
+                {
+                    if (m_bufferRead.getSizeUnread() < 12)
+                        break;
+
+                    SwarmStats stats;
+                    m_bufferRead >> stats.Complete;
+                    m_bufferRead >> stats.Downloaded;
+                    m_bufferRead >> stats.Incomplete;
+                    stats.LastUpdated = time(nullptr);
+                    torrent->setSwarmStats(stats);
+                }
+                break;
+            }
+            case uint32_t(UDPTrackerAction::Error):
+            {
+                std::string message(m_bufferRead.getReadPointer(), m_bufferRead.getSizeUnread());
+                LOG_WARNING("torrent_protocol.network", "Scrape failure reported by tracker: ", message);
+                break;
+            }
+            default:
+                LOG_WARNING("torrent_protocol.network", "Unexpected action ", action, " in UDP tracker response");
+                break;
+        }
+
+        m_bufferRead.advanceReadPosition(m_bufferRead.getSizeUnread());
+        finish();
+    }
+
+    void ScrapeClient::finish()
+    {
+        boost::system::error_code ec;
+        m_timeoutTimer.cancel(ec);
+        close();
+    }
+
+    void ScrapeClient::onTimeout(const boost::system::error_code &ec)
+    {
+        if (ec || isClosing())
+            return;
+
+        LOG_WARNING("torrent_protocol.network", "Scrape request to ", m_url.getHost(), " timed out");
+        close();
+    }
+
+    std::shared_ptr<TorrentState> ScrapeClient::findTorrent(const uint8_t *infoHash)
+    {
+        for (auto &torrent : m_torrents)
+        {
+            if (memcmp(torrent->getTorrentFile()->getInfoHash(), infoHash, 20) == 0)
+                return torrent;
+        }
+        return std::shared_ptr<TorrentState>(nullptr);
+    }
+}
@@ -0,0 +1,127 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "Socket.h"
+#include "URL.h"
+
+class TorrentState;
+
+namespace network
+{
+    /**
+     * @class ScrapeClient
+     * @brief Requests the swarm statistics of one or more torrents from a single tracker,
+     *        through either the HTTP scrape convention or the UDP tracker protocol, and
+     *        stores the results in each torrent's \ref TorrentState
+     */
+    class ScrapeClient : public Socket
+    {
+    public:
+        /// Maximum number of info hashes sent in one HTTP scrape request
+        static const size_t MaxHashesHTTP = 64;
+
+        /// Maximum number of info hashes sent in one UDP scrape request (BEP 15)
+        static const size_t MaxHashesUDP = 74;
+
+    public:
+        /// ScrapeClient constructor
+        explicit ScrapeClient(boost::asio::io_service &ioService, Socket::Mode mode);
+
+        /// Sets the URL of the tracker. In TCP mode, this must already be converted into the scrape URL
+        void setTrackerURL(const http::URL &url);
+
+        /// Adds a torrent whose statistics will be requested from the tracker
+        void addTorrent(std::shared_ptr<TorrentState> state);
+
+        /// Returns the number of torrents that will be scraped in a single request
+        size_t getNumTorrents() const;
+
+        /// Resolves the tracker's endpoint and connects to it. Returns false if the endpoint could not be resolved
+        bool start();
+
+        /// Dummy method
+        void sendPieceHave() { }
+
+        /// Dummy method
+        void onTick() { }
+
+    protected:
+        /// Called after forming initial connection with a tracker
+        virtual void onConnect() override;
+
+        /// Handles post-recv operations
+        virtual void onRead() override;
+
+    private:
+        /// Sends the HTTP GET request for the scrape URL, with an info_hash parameter for each torrent
+        void sendHTTPRequest();
+
+        /// Parses the bencoded HTTP scrape response once it has been received in its entirety
+        void readHTTPResponse();
+
+        /// Sends the connect request of the UDP tracker protocol
+        void sendUDPConnect();
+
+        /// Sends the UDP scrape request, after a connection ID has been received
+        void sendUDPScrape();
+
+        /// Handles a UDP tracker response (connect, scrape, or error)
+        void readUDPResponse();
+
+        /// Cancels the timeout and closes the connection with the tracker
+        void finish();
+
+        /// Called when the tracker has not responded within the allowed time
+        void onTimeout(const boost::system::error_code &ec);
+
+        /// Returns the torrent with the given info hash, or a null pointer if it is not in this request
+        std::shared_ptr<TorrentState> findTorrent(const uint8_t *infoHash);
+
+    private:
+        /// Reference to the io service
+        boost::asio::io_service &m_ioService;
+
+        /// Scrape (TCP) or tracker (UDP) URL
+        http::URL m_url;
+
+        /// Torrents whose statistics are being requested
+        std::vector< std::shared_ptr<TorrentState> > m_torrents;
+
+        /// Timer used to abandon the request if the tracker does not respond
+        boost::asio::deadline_timer m_timeoutTimer;
+
+        /// Transaction ID of the current UDP request
+        uint32_t m_transactionID;
+
+        /// Connection ID given by a UDP tracker
+        uint64_t m_connectionID;
+    };
+}
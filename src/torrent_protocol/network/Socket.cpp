@@ -25,15 +25,22 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "LogHelper.h"
 #include "Socket.h"
+#include "UTPSocketMgr.h"
+#include "UTPStream.h"
 
 namespace network
 {
     Socket::Socket(boost::asio::io_service &ioService, Socket::Mode mode) :
         m_socket(ioService),
         m_udpSocket(ioService),
+        m_utpStream(),
         m_mode(mode),
+        m_tcpEndpoint(),
         m_bufferRead(),
         m_queueSend(),
+        m_queueSendBytes(0),
+        m_queueDestinations(),
+        m_udpSender(),
         m_lockSend(),
         m_isClosing(false),
         m_isConnected(false)
@@ -43,27 +50,59 @@ namespace network
     Socket::Socket(boost::asio::ip::tcp::socket &&socket) :
         m_socket(std::move(socket)),
         m_udpSocket(m_socket.get_io_service()),
+        m_utpStream(),
         m_mode(Socket::Mode::TCP),
+        m_tcpEndpoint(),
         m_bufferRead(),
         m_queueSend(),
+        m_queueSendBytes(0),
+        m_queueDestinations(),
+        m_udpSender(),
         m_lockSend(),
         m_isClosing(false)
     {
         m_isConnected.store(m_socket.is_open());
+
+        boost::system::error_code ec;
+        m_tcpEndpoint = m_socket.remote_endpoint(ec);
+        m_tcpEndpoint.address(normalizeAddress(m_tcpEndpoint.address()));
     }
 
     Socket::Socket(boost::asio::ip::udp::socket &&socket) :
         m_socket(socket.get_io_service()),
         m_udpSocket(std::move(socket)),
+        m_utpStream(),
         m_mode(Socket::Mode::UDP),
+        m_tcpEndpoint(),
         m_bufferRead(),
         m_queueSend(),
+        m_queueSendBytes(0),
+        m_queueDestinations(),
+        m_udpSender(),
         m_lockSend(),
         m_isClosing(false)
     {
         m_isConnected.store(m_udpSocket.is_open());
     }
 
+    Socket::Socket(std::shared_ptr<UTPStream> stream) :
+        m_socket(stream->getIOService()),
+        m_udpSocket(stream->getIOService()),
+        m_utpStream(stream),
+        m_mode(Socket::Mode::UTP),
+        m_tcpEndpoint(stream->getRemoteEndpoint().address(), stream->getRemoteEndpoint().port()),
+        m_bufferRead(),
+        m_queueSend(),
+        m_queueSendBytes(0),
+        m_queueDestinations(),
+        m_udpSender(),
+        m_lockSend(),
+        m_isClosing(false),
+        m_isConnected(true)
+    {
+        m_tcpEndpoint.address(normalizeAddress(m_tcpEndpoint.address()));
+    }
+
     Socket::~Socket()
     {
         if (!isClosing())
@@ -73,6 +112,7 @@ namespace network
     void Socket::connect(boost::asio::ip::tcp::endpoint &endpoint)
     {
         m_mode = Mode::TCP;
+        m_tcpEndpoint = endpoint;
         m_socket.async_connect(endpoint, std::bind(&Socket::handleConnect, shared_from_this(), std::placeholders::_1));
     }
 
@@ -82,6 +122,21 @@ namespace network
         m_udpSocket.async_connect(endpoint, std::bind(&Socket::handleConnect, shared_from_this(), std::placeholders::_1));
     }
 
+    void Socket::connect(std::shared_ptr<UTPSocketMgr> utpSocketMgr, boost::asio::ip::tcp::endpoint &endpoint)
+    {
+        m_mode = Mode::UTP;
+        m_tcpEndpoint = endpoint;
+
+        // Streams are only touched from the io thread
+        utpSocketMgr->getIOService().post([self = shared_from_this(), utpSocketMgr]() {
+            if (self->isClosing())
+                return;
+
+            boost::asio::ip::udp::endpoint udpEndpoint(self->m_tcpEndpoint.address(), self->m_tcpEndpoint.port());
+            self->m_utpStream = utpSocketMgr->connect(udpEndpoint, std::bind(&Socket::handleConnect, self, std::placeholders::_1));
+        });
+    }
+
     bool Socket::isConnected() const
     {
         return m_isConnected;
@@ -101,6 +156,11 @@ namespace network
             //m_socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both);
             m_socket.close();
         }
+        else if (m_mode == Mode::UTP)
+        {
+            if (m_utpStream)
+                m_utpStream->close();
+        }
         else
         {
             //m_udpSocket.shutdown(boost::asio::ip::udp::socket::shutdown_both);
@@ -122,16 +182,22 @@ namespace network
             m_socket.async_read_some(boost::asio::buffer(m_bufferRead.getWritePointer(), m_bufferRead.getSizeNotWritten()),
                                      std::bind(&Socket::handleRead, shared_from_this(), std::placeholders::_1, std::placeholders::_2));
         }
+        else if (m_mode == Mode::UTP)
+        {
+            m_utpStream->asyncReadSome(m_bufferRead.getWritePointer(), m_bufferRead.getSizeNotWritten(),
+                                       std::bind(&Socket::handleRead, shared_from_this(), std::placeholders::_1, std::placeholders::_2));
+        }
         else
         {
-            m_udpSocket.async_receive(boost::asio::buffer(m_bufferRead.getWritePointer(), m_bufferRead.getSizeNotWritten()),
-                                      std::bind(&Socket::handleRead, shared_from_this(), std::placeholders::_1, std::placeholders::_2));
+            m_udpSocket.async_receive_from(boost::asio::buffer(m_bufferRead.getWritePointer(), m_bufferRead.getSizeNotWritten()), m_udpSender,
+                                           std::bind(&Socket::handleRead, shared_from_this(), std::placeholders::_1, std::placeholders::_2));
         }
     }
 
     void Socket::send(MutableBuffer &&buffer)
     {
         m_lockSend.lock();
+        m_queueSendBytes += buffer.getSizeUnread();
         m_queueSend.push_back(std::move(buffer));
         m_lockSend.unlock();
 
@@ -141,9 +207,30 @@ namespace network
         sendNextItem();
     }
 
+    void Socket::sendTo(MutableBuffer &&buffer, const boost::asio::ip::udp::endpoint &endpoint)
+    {
+        m_lockSend.lock();
+        m_queueSendBytes += buffer.getSizeUnread();
+        m_queueSend.push_back(std::move(buffer));
+        m_queueDestinations.push_back(endpoint);
+        m_lockSend.unlock();
+
+        if (m_queueSend.size() > 1)
+            return;
+
+        sendNextItem();
+    }
+
     boost::asio::ip::tcp::endpoint Socket::getTCPEndpoint() const
     {
-        return m_socket.remote_endpoint();
+        return m_tcpEndpoint;
+    }
+
+    boost::asio::ip::address Socket::normalizeAddress(const boost::asio::ip::address &address)
+    {
+        if (address.is_v6() && address.to_v6().is_v4_mapped())
+            return boost::asio::ip::address_v4(address.to_v6().to_v4());
+        return address;
     }
 
     boost::asio::ip::udp::endpoint Socket::getUDPEndpoint() const
@@ -151,11 +238,21 @@ namespace network
         return m_udpSocket.remote_endpoint();
     }
 
+    const boost::asio::ip::udp::endpoint &Socket::getUDPSender() const
+    {
+        return m_udpSender;
+    }
+
     const Socket::Mode &Socket::getMode() const
     {
         return m_mode;
     }
 
+    std::size_t Socket::getSendQueueSize() const
+    {
+        return m_queueSendBytes;
+    }
+
     void Socket::sendNextItem()
     {
         if (isClosing() || m_queueSend.empty())
@@ -168,6 +265,16 @@ namespace network
             m_socket.async_write_some(boost::asio::buffer(buffer.getReadPointer(), buffer.getSizeUnread()),
                                       std::bind(&Socket::handleWrite, shared_from_this(), std::placeholders::_1, std::placeholders::_2));
         }
+        else if (m_mode == Mode::UTP)
+        {
+            m_utpStream->asyncWrite(buffer.getReadPointer(), buffer.getSizeUnread(),
+                                    std::bind(&Socket::handleWrite, shared_from_this(), std::placeholders::_1, std::placeholders::_2));
+        }
+        else if (!m_queueDestinations.empty())
+        {
+            m_udpSocket.async_send_to(boost::asio::buffer(buffer.getReadPointer(), buffer.getSizeUnread()), m_queueDestinations.front(),
+                                      std::bind(&Socket::handleWrite, shared_from_this(), std::placeholders::_1, std::placeholders::_2));
+        }
         else
         {
             m_udpSocket.async_send(boost::asio::buffer(buffer.getReadPointer(), buffer.getSizeUnread()),
@@ -177,6 +284,16 @@ namespace network
 
     void Socket::handleConnect(const boost::system::error_code& ec)
     {
+        if (ec && m_mode == Mode::UTP && !isClosing())
+        {
+            // The remote side may not speak uTP, try again over TCP
+            LOG_DEBUG("torrent_protocol.network", "Unable to connect over uTP, falling back to TCP. Message: ", ec.message());
+            m_utpStream.reset();
+            m_mode = Mode::TCP;
+            m_socket.async_connect(m_tcpEndpoint, std::bind(&Socket::handleConnect, shared_from_this(), std::placeholders::_1));
+            return;
+        }
+
         if (ec)
         {
             LOG_WARNING("torrent_protocol.network", "Error with Socket::connect(...), error message: ", ec.message());
@@ -205,25 +322,45 @@ namespace network
         onRead();
     }
 
-    void Socket::handleWrite(const boost::system::error_code &ec, std::size_t /*bytesTransferred*/)
+    void Socket::handleWrite(const boost::system::error_code &ec, std::size_t bytesTransferred)
     {
         if (isClosing())
             return;
 
-        if (ec)
+        // A datagram that cannot be delivered to one destination does not affect the others
+        if (ec && m_queueDestinations.empty())
         {
             LOG_ERROR("torrent_protocol.network", "Error in Socket::handleWrite, message: ", ec.message());
             close();
         }
         else
         {
+            if (ec)
+                LOG_DEBUG("torrent_protocol.network", "Unable to send datagram, message: ", ec.message());
+
             m_lockSend.lock();
 
-            m_queueSend.pop_front();
+            // A stream may take only part of the buffer, the rest of which is sent next. Datagrams are sent whole or not at all
+            MutableBuffer &buffer = m_queueSend.front();
+            const std::size_t bufferSize = buffer.getSizeUnread();
+            if (m_mode != Mode::UDP && bytesTransferred < bufferSize)
+            {
+                buffer.advanceReadPosition(bytesTransferred);
+                m_queueSendBytes -= bytesTransferred;
+            }
+            else
+            {
+                m_queueSend.pop_front();
+                m_queueSendBytes -= bufferSize;
+                if (!m_queueDestinations.empty())
+                    m_queueDestinations.pop_front();
+            }
             if (!m_queueSend.empty())
                 sendNextItem();
 
             m_lockSend.unlock();
+
+            onSend();
         }
     }
 }
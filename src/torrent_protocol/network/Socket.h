@@ -34,6 +34,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 namespace network
 {
     class Listener;
+    class UTPSocketMgr;
+    class UTPStream;
 
     /**
      * @class Socket
@@ -48,7 +50,8 @@ namespace network
         enum class Mode
         {
             TCP,
-            UDP
+            UDP,
+            UTP
         };
 
     public:
@@ -61,6 +64,9 @@ namespace network
         /// Constructs a Socket with a given udp socket
         Socket(boost::asio::ip::udp::socket &&socket);
 
+        /// Constructs a Socket with a given, accepted uTP stream
+        Socket(std::shared_ptr<UTPStream> stream);
+
         /// Closes the socket if currently open
         virtual ~Socket();
 
@@ -71,6 +77,10 @@ namespace network
         /// Attempts to connect to the given udp endpoint
         void connect(boost::asio::ip::udp::endpoint &endpoint);
 
+        /// Attempts to connect to the given endpoint over uTP through the socket manager, falling
+        /// back to TCP if the remote side does not answer
+        void connect(std::shared_ptr<UTPSocketMgr> utpSocketMgr, boost::asio::ip::tcp::endpoint &endpoint);
+
         /// Returns true if the client has formed an active connection, false if else
         bool isConnected() const;
 
@@ -86,15 +96,29 @@ namespace network
         /// Moves the buffer into the queue to be sent out
         void send(MutableBuffer &&buffer);
 
+        /// Moves the buffer into the queue to be sent out as a single datagram to the given endpoint.
+        /// Used by UDP sockets that are bound to a local port without being connected
+        void sendTo(MutableBuffer &&buffer, const boost::asio::ip::udp::endpoint &endpoint);
+
         /// Returns the remote TCP endpoint of the socket
         boost::asio::ip::tcp::endpoint getTCPEndpoint() const;
 
+        /// Converts an IPv4-mapped IPv6 address (as reported by a dual-stack socket) into its IPv4
+        /// form, so that the same peer is never represented by two different addresses
+        static boost::asio::ip::address normalizeAddress(const boost::asio::ip::address &address);
+
         /// Returns the remote UDP endpoint of the socket
         boost::asio::ip::udp::endpoint getUDPEndpoint() const;
 
+        /// Returns the endpoint that sent the most recently received datagram
+        const boost::asio::ip::udp::endpoint &getUDPSender() const;
+
         /// Returns the mode of operation
         const Mode &getMode() const;
 
+        /// Returns the number of bytes queued to be sent that have not yet been written to the socket
+        std::size_t getSendQueueSize() const;
+
     protected:
         /// Called during handleConnect(..) if connection has been made successfully
         virtual void onConnect() { }
@@ -102,6 +126,9 @@ namespace network
         /// Called after a successful read operation
         virtual void onRead() = 0;
 
+        /// Called after data has been written to the socket, once the send queue has shrunk
+        virtual void onSend() { }
+
     private:
         /// Sends the item at the front of the send queue
         void sendNextItem();
@@ -122,15 +149,30 @@ namespace network
         /// The UDP socket
         boost::asio::ip::udp::socket m_udpSocket;
 
+        /// The uTP stream, when in uTP mode
+        std::shared_ptr<UTPStream> m_utpStream;
+
         /// The mode of the socket
         Mode m_mode;
 
+        /// Remote TCP endpoint, known before the connection has been established
+        boost::asio::ip::tcp::endpoint m_tcpEndpoint;
+
         /// Buffer used to store incoming data
         MutableBuffer m_bufferRead;
 
         /// Collection of buffers to be sent
         std::deque<MutableBuffer> m_queueSend;
 
+        /// Number of bytes in m_queueSend that have not yet been written
+        std::size_t m_queueSendBytes;
+
+        /// Destinations of the datagrams in m_queueSend, only used by unconnected UDP sockets
+        std::deque<boost::asio::ip::udp::endpoint> m_queueDestinations;
+
+        /// Sender of the most recently received datagram
+        boost::asio::ip::udp::endpoint m_udpSender;
+
         /// Mutex for operations on m_queueSend
         std::mutex m_lockSend;
 
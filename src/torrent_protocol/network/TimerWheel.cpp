@@ -0,0 +1,127 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <algorithm>
+#include <iterator>
+#include "TimerWheel.h"
+#include "LogHelper.h"
+
+namespace network
+{
+    TimerWheel::TimerWheel(boost::asio::io_service &ioService) :
+        m_tickTimer(ioService),
+        m_slots(NumSlots),
+        m_timers(),
+        m_currentSlot(0),
+        m_nextID(InvalidTimer + 1),
+        m_timerLock()
+    {
+    }
+
+    void TimerWheel::run()
+    {
+        m_tickTimer.expires_from_now(boost::posix_time::milliseconds(TickMillis));
+        m_tickTimer.async_wait(std::bind(&TimerWheel::onTick, this, std::placeholders::_1));
+    }
+
+    TimerWheel::TimerID TimerWheel::add(uint32_t timeoutMillis, std::function<void()> callback)
+    {
+        // Rounded up, plus the part of a tick already elapsed since the wheel last advanced, so that a timer
+        // never fires before its timeout
+        uint64_t ticks = (uint64_t(timeoutMillis) + TickMillis - 1) / TickMillis + 1;
+
+        std::lock_guard<std::mutex> lock(m_timerLock);
+        const TimerID timerID = m_nextID++;
+        const uint32_t slot = static_cast<uint32_t>((m_currentSlot + ticks) % NumSlots);
+
+        std::list<Timer> &timers = m_slots[slot];
+        timers.push_back(Timer{ timerID, static_cast<uint32_t>((ticks - 1) / NumSlots), std::move(callback) });
+        m_timers[timerID] = TimerLocation{ slot, std::prev(timers.end()) };
+        return timerID;
+    }
+
+    void TimerWheel::cancel(TimerID timerID)
+    {
+        std::lock_guard<std::mutex> lock(m_timerLock);
+        auto it = m_timers.find(timerID);
+        if (it == m_timers.end())
+            return;
+
+        m_slots[it->second.Slot].erase(it->second.Position);
+        m_timers.erase(it);
+    }
+
+    std::size_t TimerWheel::getNumTimers() const
+    {
+        std::lock_guard<std::mutex> lock(m_timerLock);
+        return m_timers.size();
+    }
+
+    void TimerWheel::onTick(const boost::system::error_code &ec)
+    {
+        if (ec)
+        {
+            LOG_ERROR("torrent_protocol.network", "Error in TimerWheel::onTick. Message: ", ec.message());
+            return;
+        }
+
+        // Expired timers stay in their slot until their callback is made, so that a callback cancelling another
+        // timer of the same tick keeps it from firing. Callbacks are made without holding the lock, as they are
+        // likely to add or cancel timers
+        std::vector<TimerID> expired;
+        {
+            std::lock_guard<std::mutex> lock(m_timerLock);
+            m_currentSlot = (m_currentSlot + 1) % NumSlots;
+
+            for (Timer &timer : m_slots[m_currentSlot])
+            {
+                if (timer.Rounds > 0)
+                    --timer.Rounds;
+                else
+                    expired.push_back(timer.ID);
+            }
+        }
+
+        for (TimerID timerID : expired)
+        {
+            std::function<void()> callback;
+            {
+                std::lock_guard<std::mutex> lock(m_timerLock);
+                auto it = m_timers.find(timerID);
+                if (it == m_timers.end())
+                    continue;
+
+                callback = std::move(it->second.Position->Callback);
+                m_slots[it->second.Slot].erase(it->second.Position);
+                m_timers.erase(it);
+            }
+            callback();
+        }
+
+        // Scheduled from the previous expiry rather than from now, so that the wheel does not drift
+        m_tickTimer.expires_at(m_tickTimer.expires_at() + boost::posix_time::milliseconds(TickMillis));
+        m_tickTimer.async_wait(std::bind(&TimerWheel::onTick, this, std::placeholders::_1));
+    }
+}
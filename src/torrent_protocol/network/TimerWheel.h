@@ -0,0 +1,125 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <boost/asio.hpp>
+
+namespace network
+{
+    /**
+     * @class TimerWheel
+     * @brief Runs the timeouts of every connection off a single deadline_timer. Timers are hashed into
+     *        the slots of a wheel by their expiry tick, and the wheel advances one slot every TickMillis,
+     *        firing the timers of the slot that are due. Adding and cancelling a timer take constant time,
+     *        and each tick only visits the timers of one slot, so the wheel keeps up with tens of thousands
+     *        of connections. Timers fire on the io thread, no earlier than their timeout and at most one tick late.
+     */
+    class TimerWheel
+    {
+    public:
+        /// Identifies a timer, for it to be cancelled
+        typedef uint64_t TimerID;
+
+        /// Identifier never given to a timer
+        static constexpr TimerID InvalidTimer = 0;
+
+        /// Milliseconds between each tick of the wheel
+        static constexpr uint32_t TickMillis = 500;
+
+        /// Number of slots in the wheel. Timers further away than a full turn wait for the wheel to come around
+        static constexpr uint32_t NumSlots = 512;
+
+    public:
+        /// Constructs the wheel, given the io_service to run on
+        explicit TimerWheel(boost::asio::io_service &ioService);
+
+        /// Starts turning the wheel
+        void run();
+
+        /// Adds a timer calling the given function, on the io thread, once the timeout has elapsed.
+        /// Returns the identifier of the timer
+        TimerID add(uint32_t timeoutMillis, std::function<void()> callback);
+
+        /// Cancels the timer with the given identifier, if it has not fired yet
+        void cancel(TimerID timerID);
+
+        /// Returns the number of timers waiting to fire
+        std::size_t getNumTimers() const;
+
+    private:
+        /// A timer, waiting in its slot
+        struct Timer
+        {
+            /// Identifier of the timer
+            TimerID ID;
+
+            /// Number of turns of the wheel left before the timer fires
+            uint32_t Rounds;
+
+            /// Function called when the timer fires
+            std::function<void()> Callback;
+        };
+
+        /// Location of a timer within the wheel
+        struct TimerLocation
+        {
+            /// Index of the slot holding the timer
+            uint32_t Slot;
+
+            /// Position of the timer within its slot
+            std::list<Timer>::iterator Position;
+        };
+
+    private:
+        /// Advances the wheel by one slot, firing the timers of the slot that are due
+        void onTick(const boost::system::error_code &ec);
+
+    private:
+        /// Timer driving \ref onTick
+        boost::asio::deadline_timer m_tickTimer;
+
+        /// Timers of each slot of the wheel
+        std::vector< std::list<Timer> > m_slots;
+
+        /// Location of each pending timer, by identifier
+        std::unordered_map<TimerID, TimerLocation> m_timers;
+
+        /// Index of the slot the wheel last advanced to
+        uint32_t m_currentSlot;
+
+        /// Identifier given to the next timer
+        TimerID m_nextID;
+
+        /// Lock for access to the slots, as timers are added from outside the io thread
+        mutable std::mutex m_timerLock;
+    };
+}
@@ -24,26 +24,37 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include <cstdint>
+#include <ctime>
+#include <random>
 #include "TrackerClient.h"
 
-#include "Decoder.h"
+#include "BenDocument.h"
 #include "Response.h"
 #include "Request.h"
 #include "TorrentFile.h"
 #include "TorrentState.h"
-#include "URL.h"
+#include "UDPTracker.h"
 
 #include "LogHelper.h"
 
 using namespace bencoding;
 
+/// Number of seconds to wait for a response from the tracker
+const static long AnnounceTimeoutSeconds = 15;
+
 namespace network
 {
     TrackerClient::TrackerClient(boost::asio::io_service &ioService, Socket::Mode mode) :
         Socket(ioService, mode),
+        m_ioService(ioService),
         m_peerID(nullptr),
         m_connectionMgr(),
-        m_torrentState()
+        m_torrentState(),
+        m_url(""),
+        m_resultHandler(),
+        m_timeoutTimer(ioService),
+        m_transactionID(0),
+        m_connectionID(0)
     {
     }
 
@@ -62,58 +73,95 @@ namespace network
         m_torrentState = state;
     }
 
-    boost::asio::ip::tcp::endpoint TrackerClient::findTrackerEndpointTCP()
+    void TrackerClient::setTrackerURL(const http::URL &url)
+    {
+        m_url = url;
+    }
+
+    void TrackerClient::setResultHandler(ResultHandler handler)
     {
-        http::URL announce = m_torrentState->getTorrentFile()->getAnnounceURL();
-        std::string host;
-        std::string port;
-        auto delimPos = announce.getHost().find_last_of(':');
-        if (delimPos != std::string::npos)
+        m_resultHandler = handler;
+    }
+
+    bool TrackerClient::start()
+    {
+        boost::system::error_code ec;
+        if (getMode() == Socket::Mode::TCP)
         {
-            host = announce.getHost().substr(0, delimPos);
-            port = announce.getHost().substr(delimPos + 1);
+            boost::asio::ip::tcp::resolver resolver(m_ioService);
+            boost::asio::ip::tcp::resolver::query query(m_url.getHostName(), m_url.getPort());
+            auto it = resolver.resolve(query, ec);
+            if (!ec && it != boost::asio::ip::tcp::resolver::iterator())
+            {
+                boost::asio::ip::tcp::endpoint endpoint = *it;
+                connect(endpoint);
+            }
         }
         else
         {
-            host = announce.getHost();
-            port = "80";
+            boost::asio::ip::udp::resolver resolver(m_ioService);
+            boost::asio::ip::udp::resolver::query query(m_url.getHostName(), m_url.getPort());
+            auto it = resolver.resolve(query, ec);
+            if (!ec && it != boost::asio::ip::udp::resolver::iterator())
+            {
+                boost::asio::ip::udp::endpoint endpoint = *it;
+                connect(endpoint);
+            }
+            else if (!ec)
+                ec = boost::asio::error::host_not_found;
         }
 
-        boost::asio::ip::tcp::resolver resolver(m_socket.get_io_service());
-        boost::asio::ip::tcp::resolver::query query(host, port);
-        return (*resolver.resolve(query));
+        if (ec)
+        {
+            LOG_WARNING("torrent_protocol.network", "Unable to resolve tracker endpoint ", m_url.getHost());
+            finish(false);
+            return false;
+        }
+
+        m_timeoutTimer.expires_from_now(boost::posix_time::seconds(AnnounceTimeoutSeconds));
+        m_timeoutTimer.async_wait(std::bind(&TrackerClient::onTimeout, std::static_pointer_cast<TrackerClient>(shared_from_this()), std::placeholders::_1));
+        return true;
     }
 
-    void TrackerClient::parsePeerString(const std::string &peerStr)
+    void TrackerClient::parsePeerString(std::string_view peerStr, bool ipv6)
     {
-        // The string consists of multiples of 6 bytes. First 4 bytes are the IP address and last 2 bytes are the port number. All in network (big endian) notation.
+        // The string consists of multiples of 6 bytes (18 bytes for IPv6). First 4 (or 16) bytes are the IP address and
+        // last 2 bytes are the port number. All in network (big endian) notation.
+        const std::string::size_type entrySize = ipv6 ? 18 : 6;
         std::string::size_type strIdx = 0;
-        const char *data = peerStr.c_str();
+        const char *data = peerStr.data();
 
-        uint32_t tmpIP;
         uint16_t tmpPort;
-        while (strIdx + 6 <= peerStr.size())
+        while (strIdx + entrySize <= peerStr.size())
         {
-            tmpIP = 0;
-            tmpPort = 0;
-
-            memcpy(&tmpIP, data, 4);
-            boost::endian::big_to_native_inplace(tmpIP);
-            data += 4;
+            boost::asio::ip::address ipAddress;
+            if (ipv6)
+            {
+                boost::asio::ip::address_v6::bytes_type bytes;
+                memcpy(bytes.data(), data, 16);
+                ipAddress = boost::asio::ip::address_v6(bytes);
+                data += 16;
+            }
+            else
+            {
+                boost::asio::ip::address_v4::bytes_type bytes;
+                memcpy(bytes.data(), data, 4);
+                ipAddress = boost::asio::ip::address_v4(bytes);
+                data += 4;
+            }
 
+            tmpPort = 0;
             memcpy(&tmpPort, data, 2);
             boost::endian::big_to_native_inplace(tmpPort);
             data += 2;
 
-            // Send info to Connection Manager
-            if (m_connectionMgr.get())
-                m_connectionMgr->attemptConnection(tmpIP, tmpPort, m_torrentState);
+            addPeer(ipAddress, tmpPort);
 
-            strIdx += 6;
+            strIdx += entrySize;
         }
     }
 
-    void TrackerClient::parsePeerList(BenList *peerList)
+    void TrackerClient::parsePeerList(const BenNode &peerList)
     {
         /*
          * The given parameter is a list of dictionaries, each with the following keys:
@@ -121,30 +169,74 @@ namespace network
          *   ip: peer's IP address either IPv6 (hexed) or IPv4 (dotted quad) or DNS name (string)
          *   port: peer's port number (integer)
          */
+        for (BenNode peerDict : peerList)
+        {
+            BenNode ip = peerDict.find("ip");
+            if (!ip.isString())
+                continue;
+
+            int64_t port = peerDict.find("port").getInt();
+            if (port <= 0 || port > 65535)
+                continue;
+
+            // DNS names are not resolved, as that would block the network thread
+            boost::system::error_code ec;
+            const std::string ipStr(ip.getString());
+            boost::asio::ip::address ipAddress = boost::asio::ip::address::from_string(ipStr, ec);
+            if (ec)
+            {
+                LOG_DEBUG("torrent_protocol.network", "Ignoring peer with unsupported address ", ipStr);
+                continue;
+            }
+
+            addPeer(ipAddress, (uint16_t)port);
+        }
+    }
+
+    void TrackerClient::addPeer(const boost::asio::ip::address &ipAddress, uint16_t port)
+    {
+        // Send info to Connection Manager, unless another tracker has already reported the peer
+        boost::asio::ip::tcp::endpoint endpoint(Socket::normalizeAddress(ipAddress), port);
+        if (m_connectionMgr.get() && m_torrentState->addPeerCandidate(endpoint))
+            m_connectionMgr->attemptConnection(endpoint.address(), port, m_torrentState);
     }
 
     void TrackerClient::onConnect()
     {
-        //todo: UDP support for trackers
-        if (getMode() != Socket::Mode::TCP)
+        // Send the announce if TorrentState and TorrentFile are both valid
+        if (!m_torrentState.get() || !m_torrentState->getTorrentFile().get())
+        {
+            finish(false);
             return;
+        }
 
-        // Send GET request if TorrentState and TorrentFile are both valid
-        if (!m_torrentState.get())
-            return;
+        if (getMode() == Socket::Mode::TCP)
+            sendHTTPAnnounce();
+        else
+            sendUDPConnect();
+        read();
+    }
+
+    void TrackerClient::onRead()
+    {
+        if (getMode() == Socket::Mode::TCP)
+            readHTTPResponse();
+        else
+            readUDPResponse();
+    }
 
+    void TrackerClient::sendHTTPAnnounce()
+    {
         auto &torrentFile = m_torrentState->getTorrentFile();
-        if (!torrentFile.get())
-            return;
 
         auto bytesDownloaded = m_torrentState->getNumPiecesHave() * torrentFile->getPieceLength();
-        http::URL announceURL = torrentFile->getAnnounceURL();
-        announceURL.setParameter("info_hash", torrentFile->getInfoHash(), 20);
+        http::URL announceURL = m_url;
+        announceURL.setParameter("info_hash", std::string((const char*)torrentFile->getInfoHash(), 20));
         announceURL.setParameter("peer_id", m_peerID, 20);
         announceURL.setParameter("port", 6881);
         announceURL.setParameter("uploaded", m_torrentState->getNumBytesUploaded());
         announceURL.setParameter("downloaded", bytesDownloaded);
-        announceURL.setParameter("left", torrentFile->getFileSize() - bytesDownloaded);
+        announceURL.setParameter("left", m_torrentState->getNumBytesLeft());
         announceURL.setParameter("compact", 1);
         announceURL.setParameter("event", "started");
         announceURL.setParameter("key", "magic");
@@ -154,82 +246,230 @@ namespace network
         MutableBuffer mb;
         mb << requestText;
         send(std::move(mb));
-        read();
     }
 
-    void TrackerClient::onRead()
+    void TrackerClient::readHTTPResponse()
     {
-        //todo: UDP support for trackers
-        if (getMode() != Socket::Mode::TCP)
-            return;
-
-        // Get HTTP response
-        std::string responseStr;
-        responseStr.reserve(m_bufferRead.getSizeUnread());
-        for (auto i = 0; i < responseStr.capacity(); ++i)
+        // Get HTTP response, reading until it has been received in its entirety or the tracker closes the connection
+        std::string responseStr(m_bufferRead.getReadPointer(), m_bufferRead.getSizeUnread());
+        if (!isClosing() && !http::Response::isComplete(responseStr))
         {
-            responseStr.push_back(*(m_bufferRead.getReadPointer()));
-            m_bufferRead.advanceReadPosition(1);
+            read();
+            return;
         }
+        m_bufferRead.advanceReadPosition(responseStr.size());
 
         http::Response response(responseStr);
 
+        LOG_DEBUG("torrent_protocol.test", "Response.Version = ", response.Version);
+        LOG_DEBUG("torrent_protocol.test", "Response.StatusCode = ", response.StatusCode);
+        LOG_DEBUG("torrent_protocol.test", "Response.Reason = ", response.Reason);
+        LOG_DEBUG("torrent_protocol.test", "Response.Payload = ", response.Payload);
+
         // If response code is good, extract dictionary from payload
-        if (response.StatusCode == 200)
+        if (response.StatusCode != 200)
+        {
+            finish(false);
+            return;
+        }
+
+        BenDocument document;
+        BenNode dict;
+        if (document.parse(std::move(response.Payload)))
+            dict = document.getRoot();
+        if (!dict.isDictionary())
+        {
+            LOG_ERROR("torrent_protocol.network", "Unable to decode response from Tracker!");
+            finish(false);
+            return;
+        }
+
+        // Check for failure or warning message
+        BenNode value = dict.find("failure reason");
+        if (value)
         {
-            Decoder decoder;
+            LOG_WARNING("torrent_protocol.network", "Failure to get torrent information from tracker. Reason given is: ",
+                        value.getString());
+            finish(false);
+            return;
+        }
+        value = dict.find("warning message");
+        if (value)
+            LOG_WARNING("torrent_protocol.network", "Warning reported by tracker: ", value.getString());
+
+        // Check for interval and min interval to send requests to tracker
+
+        /*
+         * interval: Interval in seconds that the client should wait between sending regular requests to the tracker
+         * min interval: (optional) Minimum announce interval. If present clients must not reannounce more frequently than this.
+         * tracker id: A string that the client should send back on its next announcements. If absent and a previous announce sent a tracker id, do not discard the old value; keep using it.
+         * complete: number of peers with the entire file, i.e. seeders (integer)
+         * incomplete: number of non-seeder peers, aka "leechers" (integer)
+         */
+        BenNode complete = dict.find("complete");
+        BenNode incomplete = dict.find("incomplete");
+        if (complete.isInt() && incomplete.isInt())
+        {
+            SwarmStats stats = m_torrentState->getSwarmStats();
+            stats.Complete = (uint32_t)complete.getInt();
+            stats.Incomplete = (uint32_t)incomplete.getInt();
+            stats.LastUpdated = time(nullptr);
+            m_torrentState->setSwarmStats(stats);
+        }
+
+        value = dict.find("peers");
+        if (value)
+        {
+            // Get peer info into readable format - we requested compact mode so it should be a string. Otherwise should be a list
+            if (value.isString())
+                parsePeerString(value.getString(), false);
+            else if (value.isList())
+                parsePeerList(value);
+            else
+                LOG_WARNING("torrent_protocol.network", "Unable to determine data type of peers response.");
+        }
+
+        // IPv6 peers are always sent in compact form, 18 bytes per peer (BEP 7)
+        value = dict.find("peers6");
+        if (value.isString())
+            parsePeerString(value.getString(), true);
 
-            auto benResponse = decoder.decode(response.Payload);
-            BenDictionary *dict = bencast<BenDictionary*>(benResponse);
-            if (!dict)
+        // close connection
+        finish(true);
+    }
+
+    void TrackerClient::sendUDPConnect()
+    {
+        std::random_device rd;
+        m_transactionID = rd();
+
+        // Connect request: <protocol_id (64-bit)><action (32-bit)><transaction_id (32-bit)>
+        MutableBuffer mb(16);
+        mb << UDPTrackerProtocolID;
+        mb << uint32_t(UDPTrackerAction::Connect);
+        mb << m_transactionID;
+        send(std::move(mb));
+    }
+
+    void TrackerClient::sendUDPAnnounce()
+    {
+        std::random_device rd;
+        m_transactionID = rd();
+
+        auto &torrentFile = m_torrentState->getTorrentFile();
+        uint64_t bytesDownloaded = m_torrentState->getNumPiecesHave() * torrentFile->getPieceLength();
+
+        // Announce request: <connection_id (64-bit)><action (32-bit)><transaction_id (32-bit)><info_hash (20 bytes)><peer_id (20 bytes)>
+        //                   <downloaded (64-bit)><left (64-bit)><uploaded (64-bit)><event (32-bit)><IP address (32-bit)>
+        //                   <key (32-bit)><num_want (32-bit)><port (16-bit)>
+        MutableBuffer mb(98);
+        mb << m_connectionID;
+        mb << uint32_t(UDPTrackerAction::Announce);
+        mb << m_transactionID;
+        mb.write((const char*)torrentFile->getInfoHash(), 20);
+        mb.write(m_peerID, 20);
+        mb << bytesDownloaded;
+        mb << m_torrentState->getNumBytesLeft();
+        mb << uint64_t(m_torrentState->getNumBytesUploaded());
+        mb << uint32_t(UDPTrackerEvent::Started);
+        mb << uint32_t(0);          // IP address (default)
+        mb << uint32_t(rd());       // Key
+        mb << int32_t(-1);          // Number of peers wanted (default)
+        mb << uint16_t(6881);       // Port
+        send(std::move(mb));
+    }
+
+    void TrackerClient::readUDPResponse()
+    {
+        if (isClosing())
+            return;
+
+        // Every response begins with <action (32-bit)><transaction_id (32-bit)>
+        if (m_bufferRead.getSizeUnread() < 8)
+        {
+            read();
+            return;
+        }
+
+        uint32_t action, transactionID;
+        m_bufferRead >> action;
+        m_bufferRead >> transactionID;
+        if (transactionID != m_transactionID)
+        {
+            // Stray datagram, discard it and wait for the response we are expecting
+            m_bufferRead.advanceReadPosition(m_bufferRead.getSizeUnread());
+            read();
+            return;
+        }
+
+        bool success = false;
+        switch (action)
+        {
+            case uint32_t(UDPTrackerAction::Connect):
             {
-                LOG_ERROR("torrent_protocol.network", "Unable to decode response from Tracker!");
-                close();
+                if (m_bufferRead.getSizeUnread() < 8)
+                    break;
+                m_bufferRead >> m_connectionID;
+                sendUDPAnnounce();
+                read();
                 return;
             }
-
-            // Check for failure or warning message
-            auto keyItr = dict->find("failure reason");
-            if (keyItr != dict->end())
+            case uint32_t(UDPTrackerAction::Announce):
             {
-                LOG_WARNING("torrent_protocol.network", "Failure to get torrent information from tracker. Reason given is: ",
-                            bencast<BenString*>(keyItr->second)->getValue());
-                close();
-                return;
+                // <interval (32-bit)><leechers (32-bit)><seeders (32-bit)> followed by compact peer information
+                if (m_bufferRead.getSizeUnread() < 12)
+                    break;
+
+                uint32_t interval;
+                SwarmStats stats = m_torrentState->getSwarmStats();
+                m_bufferRead >> interval;
+                m_bufferRead >> stats.Incomplete;
+                m_bufferRead >> stats.Complete;
+                stats.LastUpdated = time(nullptr);
+                m_torrentState->setSwarmStats(stats);
+
+                // Peers are 18 bytes each when announcing to a tracker over IPv6
+                parsePeerString(std::string(m_bufferRead.getReadPointer(), m_bufferRead.getSizeUnread()), getUDPEndpoint().address().is_v6());
+                success = true;
+                break;
             }
-            keyItr = dict->find("warning message");
-            if (keyItr != dict->end())
-                LOG_WARNING("torrent_protocol.network", "Warning reported by tracker: ", bencast<BenString*>(keyItr->second)->getValue());
-
-            // Check for interval and min interval to send requests to tracker
-
-            /*
-             * interval: Interval in seconds that the client should wait between sending regular requests to the tracker
-             * min interval: (optional) Minimum announce interval. If present clients must not reannounce more frequently than this.
-             * tracker id: A string that the client should send back on its next announcements. If absent and a previous announce sent a tracker id, do not discard the old value; keep using it.
-             * complete: number of peers with the entire file, i.e. seeders (integer)
-             * incomplete: number of non-seeder peers, aka "leechers" (integer)
-             */
-            keyItr = dict->find("peers");
-            if (keyItr != dict->end())
+            case uint32_t(UDPTrackerAction::Error):
             {
-                // Get peer info into readable format - we requested compact mode so it should be a string. Otherwise should be a list
-                if (BenString *peerString = bencast<BenString*>(keyItr->second))
-                    parsePeerString(peerString->getValue());
-                else if (BenList *peerList = bencast<BenList*>(keyItr->second))
-                    parsePeerList(peerList);
-                else
-                    LOG_WARNING("torrent_protocol.network", "Unable to determine data type of peers response.");
+                std::string message(m_bufferRead.getReadPointer(), m_bufferRead.getSizeUnread());
+                LOG_WARNING("torrent_protocol.network", "Failure to get torrent information from tracker. Reason given is: ", message);
+                break;
             }
+            default:
+                LOG_WARNING("torrent_protocol.network", "Unexpected action ", action, " in UDP tracker response");
+                break;
         }
 
-        LOG_DEBUG("torrent_protocol.test", "Response.Version = ", response.Version);
-        LOG_DEBUG("torrent_protocol.test", "Response.StatusCode = ", response.StatusCode);
-        LOG_DEBUG("torrent_protocol.test", "Response.Reason = ", response.Reason);
-        LOG_DEBUG("torrent_protocol.test", "Response.Payload = ", response.Payload);
+        m_bufferRead.advanceReadPosition(m_bufferRead.getSizeUnread());
+        finish(success);
+    }
 
-        // close connection
+    void TrackerClient::finish(bool success)
+    {
+        boost::system::error_code ec;
+        m_timeoutTimer.cancel(ec);
         close();
+
+        // Only report the first result
+        if (m_resultHandler)
+        {
+            ResultHandler handler = std::move(m_resultHandler);
+            m_resultHandler = nullptr;
+            handler(success);
+        }
+    }
+
+    void TrackerClient::onTimeout(const boost::system::error_code &ec)
+    {
+        if (ec || !m_resultHandler)
+            return;
+
+        LOG_WARNING("torrent_protocol.network", "Announce to tracker ", m_url.getHost(), " timed out");
+        finish(false);
     }
 }
 
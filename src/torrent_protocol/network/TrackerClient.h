@@ -25,12 +25,15 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #pragma once
 
+#include <functional>
 #include <memory>
+#include <string_view>
 #include "ConnectionMgr.h"
 #include "Peer.h"
 #include "Socket.h"
+#include "URL.h"
 
-namespace bencoding { class BenList; }
+namespace bencoding { class BenNode; }
 
 class TorrentState;
 
@@ -38,10 +41,15 @@ namespace network
 {
     /**
      * @class TrackerClient
-     * @brief Handles communications with a tracker service
+     * @brief Handles communications with a tracker service, through either HTTP or
+     *        the UDP tracker protocol
      */
     class TrackerClient : public Socket
     {
+    public:
+        /// Callback invoked once the announce has either succeeded or failed
+        typedef std::function<void(bool)> ResultHandler;
+
     public:
         /// TrackerClient constructor
         explicit TrackerClient(boost::asio::io_service &ioService, Socket::Mode mode);
@@ -56,20 +64,54 @@ namespace network
         /// which will be used to request peer information
         void setTorrentState(std::shared_ptr<TorrentState> state);
 
-        /// Attempts to determine the endpoint of the tracker service, based on the Torrent File's announce URL
-        boost::asio::ip::tcp::endpoint findTrackerEndpointTCP();
+        /// Sets the announce URL of the tracker
+        void setTrackerURL(const http::URL &url);
+
+        /// Sets the callback which is invoked exactly once, with the result of the announce
+        void setResultHandler(ResultHandler handler);
+
+        /// Resolves the tracker's endpoint and connects to it. Returns false (after invoking
+        /// the result handler) if the endpoint could not be resolved
+        bool start();
 
         /// Dummy method
         void sendPieceHave() { }
 
+        /// Dummy method
+        void onTick() { }
+
     private:
-        /// Gets peer information from the given string, sending it in a more useful format to the TorrentState
-        /// object
-        void parsePeerString(const std::string &peerStr);
+        /// Gets peer information from the given compact string of either IPv4 (6 bytes per peer) or IPv6
+        /// (18 bytes per peer) addresses, sending it in a more useful format to the TorrentState object
+        void parsePeerString(std::string_view peerStr, bool ipv6);
 
         /// Gets peer information from the given bencoded list of dictionaries, sending it to the TorrentState
         /// object.
-        void parsePeerList(bencoding::BenList *peerList);
+        void parsePeerList(const bencoding::BenNode &peerList);
+
+        /// Adds the peer to the torrent's candidates, and connects to it if it has not been attempted recently
+        void addPeer(const boost::asio::ip::address &ipAddress, uint16_t port);
+
+        /// Sends the HTTP GET announce request
+        void sendHTTPAnnounce();
+
+        /// Handles the HTTP response of the tracker once it has been received in its entirety
+        void readHTTPResponse();
+
+        /// Sends the connect request of the UDP tracker protocol
+        void sendUDPConnect();
+
+        /// Sends the UDP announce request, after a connection ID has been received
+        void sendUDPAnnounce();
+
+        /// Handles a UDP tracker response (connect, announce, or error)
+        void readUDPResponse();
+
+        /// Cancels the timeout, closes the connection and reports the result of the announce
+        void finish(bool success);
+
+        /// Called when the tracker has not responded within the allowed time
+        void onTimeout(const boost::system::error_code &ec);
 
     protected:
         /// Called after forming initial connection with a tracker
@@ -79,6 +121,9 @@ namespace network
         virtual void onRead() override;
 
     private:
+        /// Reference to the io service
+        boost::asio::io_service &m_ioService;
+
         /// Peer ID
         const char *m_peerID;
 
@@ -87,5 +132,20 @@ namespace network
 
         /// Shared pointer to the torrent state
         std::shared_ptr<TorrentState> m_torrentState;
+
+        /// Announce URL of the tracker
+        http::URL m_url;
+
+        /// Result callback
+        ResultHandler m_resultHandler;
+
+        /// Timer used to abandon the announce if the tracker does not respond
+        boost::asio::deadline_timer m_timeoutTimer;
+
+        /// Transaction ID of the current UDP request
+        uint32_t m_transactionID;
+
+        /// Connection ID given by a UDP tracker
+        uint64_t m_connectionID;
     };
 }
@@ -0,0 +1,212 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <cstdlib>
+#include "LogHelper.h"
+#include "UTPSocketMgr.h"
+
+namespace network
+{
+    /// Maximum number of streams, accepted or connected, open at a time
+    const static std::size_t MaxStreams = 1000;
+
+    UTPSocketMgr::UTPSocketMgr(boost::asio::io_service &ioService) :
+        Socket(ioService, Socket::Mode::UDP),
+        m_ioService(ioService),
+        m_tickTimer(ioService),
+        m_streams(),
+        m_acceptHandler()
+    {
+    }
+
+    bool UTPSocketMgr::start(uint16_t port)
+    {
+        boost::system::error_code ec;
+        m_udpSocket.open(boost::asio::ip::udp::v4(), ec);
+        if (!ec)
+            m_udpSocket.bind(boost::asio::ip::udp::endpoint(boost::asio::ip::udp::v4(), port), ec);
+        if (ec)
+        {
+            LOG_ERROR("torrent_protocol.network", "Unable to bind uTP socket to port ", port, ", message: ", ec.message());
+            close();
+            return false;
+        }
+
+        m_isConnected.store(true);
+        read();
+
+        m_tickTimer.expires_from_now(boost::posix_time::milliseconds(TickMillis));
+        m_tickTimer.async_wait(std::bind(&UTPSocketMgr::onTick, getSelf(), std::placeholders::_1));
+        return true;
+    }
+
+    boost::asio::io_service &UTPSocketMgr::getIOService()
+    {
+        return m_ioService;
+    }
+
+    void UTPSocketMgr::setAcceptHandler(AcceptHandler handler)
+    {
+        m_acceptHandler = handler;
+    }
+
+    std::shared_ptr<UTPStream> UTPSocketMgr::connect(const boost::asio::ip::udp::endpoint &endpoint, UTPStream::ConnectHandler handler)
+    {
+        // Pick a connection id that neither this stream's ids nor the reply id of the remote side collide with
+        uint16_t receiveID = static_cast<uint16_t>(std::rand());
+        while (m_streams.find(std::make_pair(endpoint, receiveID)) != m_streams.end()
+               || m_streams.find(std::make_pair(endpoint, uint16_t(receiveID + 1))) != m_streams.end())
+            receiveID = static_cast<uint16_t>(std::rand());
+
+        auto stream = std::make_shared<UTPStream>(m_ioService, getSelf());
+        m_streams[std::make_pair(endpoint, receiveID)] = stream;
+        stream->connect(endpoint, receiveID, handler);
+        return stream;
+    }
+
+    void UTPSocketMgr::sendPacket(const boost::asio::ip::udp::endpoint &endpoint, MutableBuffer &&packet)
+    {
+        if (isClosing())
+            return;
+
+        sendTo(std::move(packet), endpoint);
+    }
+
+    void UTPSocketMgr::onRead()
+    {
+        // Each read holds exactly one datagram
+        std::size_t length = m_bufferRead.getSizeUnread();
+        if (length > 0)
+        {
+            handlePacket(reinterpret_cast<const uint8_t*>(m_bufferRead.getReadPointer()), length, getUDPSender());
+            m_bufferRead.advanceReadPosition(length);
+        }
+
+        read();
+    }
+
+    std::shared_ptr<UTPSocketMgr> UTPSocketMgr::getSelf()
+    {
+        return std::static_pointer_cast<UTPSocketMgr>(shared_from_this());
+    }
+
+    void UTPSocketMgr::onTick(const boost::system::error_code &ec)
+    {
+        if (ec || isClosing())
+            return;
+
+        UTPStream::Clock::time_point now = UTPStream::Clock::now();
+        for (auto it = m_streams.begin(); it != m_streams.end();)
+        {
+            it->second->onTick(now, TickMillis);
+            if (it->second->isClosed())
+                it = m_streams.erase(it);
+            else
+                ++it;
+        }
+
+        m_tickTimer.expires_from_now(boost::posix_time::milliseconds(TickMillis));
+        m_tickTimer.async_wait(std::bind(&UTPSocketMgr::onTick, getSelf(), std::placeholders::_1));
+    }
+
+    void UTPSocketMgr::handlePacket(const uint8_t *data, std::size_t length, const boost::asio::ip::udp::endpoint &sender)
+    {
+        UTPStream::PacketHeader header;
+        if (!UTPStream::readHeader(data, length, header))
+            return;
+
+        // Walk the chain of extension headers, keeping the selective acknowledgement if present
+        const uint8_t *selectiveAck = nullptr;
+        std::size_t selectiveAckLength = 0;
+        std::size_t pos = UTPStream::HeaderSize;
+        uint8_t extension = header.Extension;
+        while (extension != 0)
+        {
+            if (pos + 2 > length || pos + 2 + data[pos + 1] > length)
+                return;
+
+            if (extension == 1)
+            {
+                selectiveAck = data + pos + 2;
+                selectiveAckLength = data[pos + 1];
+            }
+
+            extension = data[pos];
+            pos += 2 + data[pos + 1];
+        }
+
+        auto it = m_streams.find(std::make_pair(sender, header.ConnectionID));
+        if (header.Type == UTPStream::PacketType::Syn)
+        {
+            // The acceptor receives on the initiator's id plus one
+            auto key = std::make_pair(sender, uint16_t(header.ConnectionID + 1));
+            auto existing = m_streams.find(key);
+            if (existing != m_streams.end())
+            {
+                existing->second->onPacket(header, selectiveAck, selectiveAckLength, nullptr, 0);
+                return;
+            }
+
+            if (!m_acceptHandler || m_streams.size() >= MaxStreams)
+            {
+                sendReset(sender, header);
+                return;
+            }
+
+            auto stream = std::make_shared<UTPStream>(m_ioService, getSelf());
+            m_streams[key] = stream;
+            stream->accept(sender, header);
+            m_acceptHandler(stream);
+            return;
+        }
+
+        if (it == m_streams.end())
+        {
+            if (header.Type != UTPStream::PacketType::Reset)
+                sendReset(sender, header);
+            return;
+        }
+
+        it->second->onPacket(header, selectiveAck, selectiveAckLength, reinterpret_cast<const char*>(data + pos), length - pos);
+    }
+
+    void UTPSocketMgr::sendReset(const boost::asio::ip::udp::endpoint &endpoint, const UTPStream::PacketHeader &header)
+    {
+        UTPStream::PacketHeader reset;
+        reset.Type = UTPStream::PacketType::Reset;
+        reset.Extension = 0;
+        reset.ConnectionID = (header.Type == UTPStream::PacketType::Syn) ? header.ConnectionID : uint16_t(header.ConnectionID - 1);
+        reset.Timestamp = UTPStream::getTimestampMicros();
+        reset.TimestampDifference = 0;
+        reset.WindowSize = 0;
+        reset.SeqNr = static_cast<uint16_t>(std::rand());
+        reset.AckNr = header.SeqNr;
+
+        MutableBuffer mb(UTPStream::HeaderSize);
+        UTPStream::writeHeader(reset, reinterpret_cast<uint8_t*>(mb.getWritePointer()));
+        mb.advanceWritePosition(UTPStream::HeaderSize);
+        sendPacket(endpoint, std::move(mb));
+    }
+}
@@ -0,0 +1,104 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <utility>
+#include <boost/asio.hpp>
+
+#include "Socket.h"
+#include "UTPStream.h"
+
+namespace network
+{
+    /**
+     * @class UTPSocketMgr
+     * @brief Owns the UDP socket that carries every uTP connection of the client, passing each
+     *        received packet to the \ref UTPStream it is addressed to, and accepting streams
+     *        requested by remote peers.
+     */
+    class UTPSocketMgr : public Socket
+    {
+    public:
+        /// Handler called with each stream accepted from a remote peer
+        typedef std::function<void(std::shared_ptr<UTPStream>)> AcceptHandler;
+
+        /// Milliseconds between two ticks of the streams
+        static constexpr uint32_t TickMillis = 10;
+
+    public:
+        /// Constructs the manager, given the io_service to run on
+        explicit UTPSocketMgr(boost::asio::io_service &ioService);
+
+        /// Binds the UDP socket to the given port and begins receiving packets. Returns false on failure
+        bool start(uint16_t port);
+
+        /// Returns the io_service the manager and its streams run on
+        boost::asio::io_service &getIOService();
+
+        /// Sets the handler called with each stream accepted from a remote peer
+        void setAcceptHandler(AcceptHandler handler);
+
+        /// Starts a new connection to the given endpoint, returning its stream. Must be called from the io thread
+        std::shared_ptr<UTPStream> connect(const boost::asio::ip::udp::endpoint &endpoint, UTPStream::ConnectHandler handler);
+
+        /// Sends a packet of a stream to the given endpoint
+        void sendPacket(const boost::asio::ip::udp::endpoint &endpoint, MutableBuffer &&packet);
+
+    protected:
+        /// Handles a received packet
+        void onRead() override;
+
+    private:
+        /// Returns a shared pointer to this object
+        std::shared_ptr<UTPSocketMgr> getSelf();
+
+        /// Performs the periodic work of each stream, forgetting those that have closed
+        void onTick(const boost::system::error_code &ec);
+
+        /// Parses a packet and passes it to the stream it is addressed to
+        void handlePacket(const uint8_t *data, std::size_t length, const boost::asio::ip::udp::endpoint &sender);
+
+        /// Sends a reset packet in reply to a packet addressed to an unknown connection
+        void sendReset(const boost::asio::ip::udp::endpoint &endpoint, const UTPStream::PacketHeader &header);
+
+    private:
+        /// I/O service the object runs on
+        boost::asio::io_service &m_ioService;
+
+        /// Timer driving \ref onTick
+        boost::asio::deadline_timer m_tickTimer;
+
+        /// Streams by remote endpoint and the connection id they receive packets on
+        std::map<std::pair<boost::asio::ip::udp::endpoint, uint16_t>, std::shared_ptr<UTPStream>> m_streams;
+
+        /// Handler of accepted streams
+        AcceptHandler m_acceptHandler;
+    };
+}
@@ -0,0 +1,640 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <algorithm>
+#include <cstring>
+#include "LogHelper.h"
+#include "MutableBuffer.h"
+#include "UTPSocketMgr.h"
+#include "UTPStream.h"
+
+namespace network
+{
+    /// Version of the protocol, in the low nibble of the first header byte
+    const static uint8_t ProtocolVersion = 1;
+
+    /// Extension type of a selective acknowledgement
+    const static uint8_t SelectiveAckExtension = 1;
+
+    /// Number of bytes of data the stream buffers for sending before writes are held back
+    const static std::size_t SendBufferSize = 256 * 1024;
+
+    /// Number of bytes of data the stream can buffer on the receiving side
+    const static std::size_t ReceiveBufferSize = 1024 * 1024;
+
+    /// Number of packets beyond the cumulative acknowledgement described by a selective acknowledgement
+    const static uint16_t MaxSelectiveAckBits = 512;
+
+    /// Number of duplicate acknowledgements, or of later packets selectively acknowledged, after which a packet is lost
+    const static uint32_t LossThreshold = 3;
+
+    /// Number of SYN transmissions before the connection attempt fails
+    const static uint32_t MaxSynTransmissions = 2;
+
+    /// Number of consecutive retransmission timeouts after which the connection fails
+    const static uint32_t MaxConsecutiveTimeouts = 6;
+
+    /// Number of data packets received before an acknowledgement is sent without waiting for the next tick
+    const static uint32_t AckEveryPackets = 2;
+
+    /// Seconds without any packet from the remote side after which the connection fails
+    const static long IdleTimeoutSeconds = 120;
+
+    /// Returns true if sequence number a comes before b, accounting for wrap-around
+    static bool isSeqBefore(uint16_t a, uint16_t b)
+    {
+        return a != b && uint16_t(b - a) < 0x8000;
+    }
+
+    UTPStream::UTPStream(boost::asio::io_service &ioService, std::weak_ptr<UTPSocketMgr> socketMgr) :
+        m_ioService(ioService),
+        m_socketMgr(socketMgr),
+        m_state(State::Idle),
+        m_remoteEndpoint(),
+        m_receiveID(0),
+        m_sendID(0),
+        m_seqNr(1),
+        m_ackNr(0),
+        m_replyMicros(0),
+        m_congestion(MaxPayloadSize),
+        m_outstanding(),
+        m_bytesInFlight(0),
+        m_remoteWindow(MaxPayloadSize),
+        m_pacingBudget(MaxPayloadSize * 2),
+        m_lastAckNr(0),
+        m_numDuplicateAcks(0),
+        m_numTimeouts(0),
+        m_sendBuffer(),
+        m_sendOffset(0),
+        m_receiveBuffer(),
+        m_receiveOffset(0),
+        m_outOfOrder(),
+        m_outOfOrderBytes(0),
+        m_numUnacked(0),
+        m_windowWasClosed(false),
+        m_finReceived(false),
+        m_finSeqNr(0),
+        m_closeRequested(false),
+        m_connectHandler(),
+        m_readData(nullptr),
+        m_readSize(0),
+        m_readHandler(),
+        m_writeSize(0),
+        m_writeHandler(),
+        m_lastReceived(Clock::now())
+    {
+    }
+
+    boost::asio::io_service &UTPStream::getIOService()
+    {
+        return m_ioService;
+    }
+
+    void UTPStream::connect(const boost::asio::ip::udp::endpoint &endpoint, uint16_t receiveID, ConnectHandler handler)
+    {
+        m_remoteEndpoint = endpoint;
+        m_receiveID = receiveID;
+        m_sendID = receiveID + 1;
+        m_connectHandler = handler;
+        m_state = State::SynSent;
+
+        // The SYN is addressed with the id the stream receives on, and takes a sequence number
+        OutgoingPacket syn { PacketType::Syn, m_seqNr++, std::string(), Clock::now(), 1, false, false };
+        m_outstanding.push_back(syn);
+        sendPacket(PacketType::Syn, syn.SeqNr, syn.Payload);
+    }
+
+    void UTPStream::accept(const boost::asio::ip::udp::endpoint &endpoint, const PacketHeader &syn)
+    {
+        m_remoteEndpoint = endpoint;
+        m_sendID = syn.ConnectionID;
+        m_receiveID = syn.ConnectionID + 1;
+        m_seqNr = static_cast<uint16_t>(std::rand());
+        m_ackNr = syn.SeqNr;
+        m_lastAckNr = m_seqNr - 1;
+        m_remoteWindow = syn.WindowSize;
+        m_replyMicros = getTimestampMicros() - syn.Timestamp;
+        m_state = State::Connected;
+
+        // The state packet answering the SYN does not take a sequence number
+        sendAck();
+    }
+
+    void UTPStream::asyncReadSome(char *data, std::size_t size, IOHandler handler)
+    {
+        m_readData = data;
+        m_readSize = size;
+        m_readHandler = handler;
+        completeRead();
+    }
+
+    void UTPStream::asyncWrite(const char *data, std::size_t size, IOHandler handler)
+    {
+        if (m_state == State::Closed || m_closeRequested)
+        {
+            post(handler, boost::asio::error::not_connected, 0);
+            return;
+        }
+
+        // Reclaim the space of data that was already packetized
+        if (m_sendOffset > 0 && m_sendOffset >= m_sendBuffer.size() / 2)
+        {
+            m_sendBuffer.erase(0, m_sendOffset);
+            m_sendOffset = 0;
+        }
+
+        m_sendBuffer.append(data, size);
+        m_writeSize = size;
+        m_writeHandler = handler;
+        completeWrite();
+        flushSend();
+    }
+
+    void UTPStream::close()
+    {
+        if (m_readHandler)
+            post(m_readHandler, boost::asio::error::operation_aborted, 0);
+        if (m_writeHandler)
+            post(m_writeHandler, boost::asio::error::operation_aborted, 0);
+        if (m_connectHandler)
+            m_ioService.post(std::bind(m_connectHandler, boost::system::error_code(boost::asio::error::operation_aborted)));
+        m_readHandler = nullptr;
+        m_writeHandler = nullptr;
+        m_connectHandler = nullptr;
+
+        if (m_state == State::Connected)
+        {
+            m_closeRequested = true;
+            flushSend();
+        }
+        else if (m_state != State::FinSent)
+            m_state = State::Closed;
+    }
+
+    bool UTPStream::isClosed() const
+    {
+        return m_state == State::Closed;
+    }
+
+    const boost::asio::ip::udp::endpoint &UTPStream::getRemoteEndpoint() const
+    {
+        return m_remoteEndpoint;
+    }
+
+    uint16_t UTPStream::getReceiveID() const
+    {
+        return m_receiveID;
+    }
+
+    void UTPStream::onPacket(const PacketHeader &header, const uint8_t *selectiveAck, std::size_t selectiveAckLength,
+                             const char *payload, std::size_t payloadLength)
+    {
+        if (m_state == State::Closed || m_state == State::Idle)
+            return;
+
+        Clock::time_point now = Clock::now();
+        m_lastReceived = now;
+        m_replyMicros = getTimestampMicros() - header.Timestamp;
+        m_remoteWindow = header.WindowSize;
+
+        if (header.Type == PacketType::Reset)
+        {
+            fail(boost::asio::error::connection_reset);
+            return;
+        }
+
+        if (m_state == State::SynSent)
+        {
+            if (header.Type != PacketType::State)
+                return;
+
+            // The remote side's next packet takes the sequence number of this one
+            m_ackNr = header.SeqNr - 1;
+            m_state = State::Connected;
+            processAcks(header, selectiveAck, selectiveAckLength, now);
+
+            if (m_connectHandler)
+                m_ioService.post(std::bind(m_connectHandler, boost::system::error_code()));
+            m_connectHandler = nullptr;
+            flushSend();
+            return;
+        }
+
+        // A retransmitted SYN means the state packet answering it was lost
+        if (header.Type == PacketType::Syn)
+        {
+            sendAck();
+            return;
+        }
+
+        processAcks(header, selectiveAck, selectiveAckLength, now);
+
+        if (header.Type == PacketType::Data || header.Type == PacketType::Fin)
+            processData(header.SeqNr, payload, payloadLength, header.Type == PacketType::Fin);
+
+        // Everything sent, including the FIN, has been acknowledged
+        if (m_state == State::FinSent && m_outstanding.empty())
+            m_state = State::Closed;
+        else
+            flushSend();
+    }
+
+    void UTPStream::onTick(Clock::time_point now, uint32_t tickMillis)
+    {
+        if (m_state == State::Closed)
+            return;
+
+        if (now - m_lastReceived > std::chrono::seconds(IdleTimeoutSeconds))
+        {
+            fail(boost::asio::error::timed_out);
+            return;
+        }
+
+        // Spread the window over one round trip
+        uint32_t window = std::min(m_congestion.getWindow(), std::max<uint32_t>(m_remoteWindow, MaxPayloadSize));
+        uint32_t rtt = std::max<uint32_t>(m_congestion.getRTTMillis(), tickMillis);
+        m_pacingBudget = std::min(m_pacingBudget + double(window) * tickMillis / rtt, double(std::max<uint32_t>(window, MaxPayloadSize)));
+
+        if (!m_outstanding.empty())
+        {
+            OutgoingPacket &oldest = m_outstanding.front();
+            if (now - oldest.SentTime >= std::chrono::milliseconds(m_congestion.getTimeoutMillis()))
+            {
+                uint32_t maxTransmissions = (oldest.Type == PacketType::Syn) ? MaxSynTransmissions : MaxConsecutiveTimeouts;
+                if (++m_numTimeouts >= maxTransmissions)
+                {
+                    fail(boost::asio::error::timed_out);
+                    return;
+                }
+
+                m_congestion.onTimeout();
+                oldest.SentTime = now;
+                ++oldest.NumTransmissions;
+                sendPacket(oldest.Type, oldest.SeqNr, oldest.Payload);
+            }
+        }
+
+        if (m_numUnacked > 0)
+            sendAck();
+
+        flushSend();
+    }
+
+    void UTPStream::writeHeader(const PacketHeader &header, uint8_t *data)
+    {
+        data[0] = static_cast<uint8_t>((static_cast<uint8_t>(header.Type) << 4) | ProtocolVersion);
+        data[1] = header.Extension;
+        data[2] = static_cast<uint8_t>(header.ConnectionID >> 8);
+        data[3] = static_cast<uint8_t>(header.ConnectionID);
+        for (int i = 0; i < 4; ++i)
+        {
+            data[4 + i] = static_cast<uint8_t>(header.Timestamp >> (24 - i * 8));
+            data[8 + i] = static_cast<uint8_t>(header.TimestampDifference >> (24 - i * 8));
+            data[12 + i] = static_cast<uint8_t>(header.WindowSize >> (24 - i * 8));
+        }
+        data[16] = static_cast<uint8_t>(header.SeqNr >> 8);
+        data[17] = static_cast<uint8_t>(header.SeqNr);
+        data[18] = static_cast<uint8_t>(header.AckNr >> 8);
+        data[19] = static_cast<uint8_t>(header.AckNr);
+    }
+
+    bool UTPStream::readHeader(const uint8_t *data, std::size_t length, PacketHeader &header)
+    {
+        if (length < HeaderSize || (data[0] & 0x0f) != ProtocolVersion || (data[0] >> 4) > static_cast<uint8_t>(PacketType::Syn))
+            return false;
+
+        auto read32 = [data](std::size_t pos) {
+            return (uint32_t(data[pos]) << 24) | (uint32_t(data[pos + 1]) << 16) | (uint32_t(data[pos + 2]) << 8) | uint32_t(data[pos + 3]);
+        };
+
+        header.Type = static_cast<PacketType>(data[0] >> 4);
+        header.Extension = data[1];
+        header.ConnectionID = static_cast<uint16_t>((data[2] << 8) | data[3]);
+        header.Timestamp = read32(4);
+        header.TimestampDifference = read32(8);
+        header.WindowSize = read32(12);
+        header.SeqNr = static_cast<uint16_t>((data[16] << 8) | data[17]);
+        header.AckNr = static_cast<uint16_t>((data[18] << 8) | data[19]);
+        return true;
+    }
+
+    uint32_t UTPStream::getTimestampMicros()
+    {
+        auto sinceEpoch = Clock::now().time_since_epoch();
+        return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(sinceEpoch).count());
+    }
+
+    void UTPStream::processAcks(const PacketHeader &header, const uint8_t *selectiveAck, std::size_t selectiveAckLength, Clock::time_point now)
+    {
+        uint32_t bytesAcked = 0, numPacketsAcked = 0;
+
+        // Cumulative acknowledgement
+        while (!m_outstanding.empty() && !isSeqBefore(header.AckNr, m_outstanding.front().SeqNr))
+        {
+            OutgoingPacket &packet = m_outstanding.front();
+            if (!packet.Acked)
+            {
+                ++numPacketsAcked;
+                bytesAcked += static_cast<uint32_t>(packet.Payload.size());
+                m_bytesInFlight -= static_cast<uint32_t>(packet.Payload.size());
+                if (packet.NumTransmissions == 1)
+                    m_congestion.onRTTSample(static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(now - packet.SentTime).count()));
+            }
+            m_outstanding.pop_front();
+        }
+
+        // Selective acknowledgement: bit i stands for sequence number AckNr + 2 + i. A packet is lost once
+        // LossThreshold packets sent after it have arrived, which also finds retransmissions that were lost
+        Clock::time_point latestAcked[LossThreshold] = {};
+        uint32_t numAckedAfter = 0;
+        if (selectiveAck != nullptr)
+        {
+            for (auto it = m_outstanding.rbegin(); it != m_outstanding.rend(); ++it)
+            {
+                uint16_t bit = uint16_t(it->SeqNr - header.AckNr - 2);
+                bool isAcked = it->Acked;
+                if (!isAcked && bit < selectiveAckLength * 8 && (selectiveAck[bit / 8] & (1 << (bit % 8))) != 0)
+                {
+                    it->Acked = true;
+                    isAcked = true;
+                    ++numPacketsAcked;
+                    bytesAcked += static_cast<uint32_t>(it->Payload.size());
+                    m_bytesInFlight -= static_cast<uint32_t>(it->Payload.size());
+                    if (it->NumTransmissions == 1)
+                        m_congestion.onRTTSample(static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(now - it->SentTime).count()));
+                }
+
+                if (isAcked)
+                {
+                    // Keep the send times of the latest LossThreshold packets that arrived, latest first
+                    Clock::time_point sentTime = it->SentTime;
+                    for (uint32_t i = 0; i < LossThreshold; ++i)
+                    {
+                        if (sentTime > latestAcked[i])
+                            std::swap(sentTime, latestAcked[i]);
+                    }
+                    ++numAckedAfter;
+                }
+                else if (numAckedAfter >= LossThreshold && latestAcked[LossThreshold - 1] > it->SentTime)
+                {
+                    it->FastResent = true;
+                    it->SentTime = now;
+                    ++it->NumTransmissions;
+                    m_congestion.onLoss(now);
+                    sendPacket(it->Type, it->SeqNr, it->Payload);
+                }
+            }
+        }
+
+        // Duplicate acknowledgements
+        if (numPacketsAcked == 0 && header.AckNr == m_lastAckNr && header.Type == PacketType::State && !m_outstanding.empty())
+        {
+            if (++m_numDuplicateAcks == LossThreshold && !m_outstanding.front().FastResent)
+            {
+                OutgoingPacket &packet = m_outstanding.front();
+                packet.FastResent = true;
+                packet.SentTime = now;
+                ++packet.NumTransmissions;
+                m_congestion.onLoss(now);
+                sendPacket(packet.Type, packet.SeqNr, packet.Payload);
+            }
+        }
+        else if (header.AckNr != m_lastAckNr)
+        {
+            m_lastAckNr = header.AckNr;
+            m_numDuplicateAcks = 0;
+        }
+
+        if (numPacketsAcked > 0)
+        {
+            m_numTimeouts = 0;
+            m_congestion.onAck(bytesAcked, header.TimestampDifference, now);
+            completeWrite();
+        }
+    }
+
+    void UTPStream::processData(uint16_t seqNr, const char *payload, std::size_t length, bool isFin)
+    {
+        uint16_t distance = uint16_t(seqNr - m_ackNr);
+        if (distance == 0 || distance >= 0x8000)
+        {
+            // Already received, the acknowledgement must have been lost
+            sendAck();
+            return;
+        }
+        if (isFin)
+        {
+            m_finReceived = true;
+            m_finSeqNr = seqNr;
+        }
+
+        if (distance > 1)
+        {
+            if (!isFin && m_outOfOrder.find(seqNr) == m_outOfOrder.end() && m_outOfOrderBytes + length <= ReceiveBufferSize)
+            {
+                m_outOfOrder.emplace(seqNr, std::string(payload, length));
+                m_outOfOrderBytes += length;
+            }
+
+            // Let the sender know about the gap right away
+            sendAck();
+            return;
+        }
+
+        m_receiveBuffer.append(payload, length);
+        m_ackNr = seqNr;
+
+        // Move the packets that were waiting for this one into the stream
+        for (auto it = m_outOfOrder.find(uint16_t(m_ackNr + 1)); it != m_outOfOrder.end(); it = m_outOfOrder.find(uint16_t(m_ackNr + 1)))
+        {
+            m_receiveBuffer.append(it->second);
+            m_outOfOrderBytes -= it->second.size();
+            m_ackNr = it->first;
+            m_outOfOrder.erase(it);
+        }
+
+        if (m_finReceived && uint16_t(m_ackNr + 1) == m_finSeqNr)
+            m_ackNr = m_finSeqNr;
+
+        if (++m_numUnacked >= AckEveryPackets || isFin || !m_outOfOrder.empty())
+            sendAck();
+
+        completeRead();
+    }
+
+    void UTPStream::flushSend()
+    {
+        if (m_state != State::Connected)
+            return;
+
+        uint32_t window = std::min(m_congestion.getWindow(), m_remoteWindow);
+        while (m_sendOffset < m_sendBuffer.size())
+        {
+            std::size_t payloadSize = std::min(MaxPayloadSize, m_sendBuffer.size() - m_sendOffset);
+
+            // At least one packet is always allowed in flight, so a zero window is probed
+            if (m_bytesInFlight > 0 && m_bytesInFlight + payloadSize > window)
+                break;
+            if (m_pacingBudget < payloadSize)
+                break;
+
+            OutgoingPacket packet { PacketType::Data, m_seqNr++, m_sendBuffer.substr(m_sendOffset, payloadSize), Clock::now(), 1, false, false };
+            m_sendOffset += payloadSize;
+            m_bytesInFlight += static_cast<uint32_t>(payloadSize);
+            m_pacingBudget -= payloadSize;
+            m_outstanding.push_back(packet);
+            sendPacket(PacketType::Data, packet.SeqNr, packet.Payload);
+        }
+
+        completeWrite();
+
+        if (m_closeRequested && m_sendOffset == m_sendBuffer.size())
+        {
+            OutgoingPacket fin { PacketType::Fin, m_seqNr++, std::string(), Clock::now(), 1, false, false };
+            m_outstanding.push_back(fin);
+            sendPacket(PacketType::Fin, fin.SeqNr, fin.Payload);
+            m_state = State::FinSent;
+        }
+    }
+
+    void UTPStream::sendPacket(PacketType type, uint16_t seqNr, const std::string &payload)
+    {
+        std::shared_ptr<UTPSocketMgr> socketMgr = m_socketMgr.lock();
+        if (!socketMgr)
+            return;
+
+        // Describe the packets received beyond a gap with a selective acknowledgement
+        std::size_t selectiveAckLength = 0;
+        uint8_t selectiveAck[MaxSelectiveAckBits / 8] = { 0 };
+        for (const auto &packet : m_outOfOrder)
+        {
+            uint16_t bit = uint16_t(packet.first - m_ackNr - 2);
+            if (bit >= MaxSelectiveAckBits)
+                continue;
+            selectiveAck[bit / 8] |= static_cast<uint8_t>(1 << (bit % 8));
+            selectiveAckLength = std::max<std::size_t>(selectiveAckLength, (bit / 32 + 1) * 4);
+        }
+
+        PacketHeader header;
+        header.Type = type;
+        header.Extension = (selectiveAckLength > 0) ? SelectiveAckExtension : 0;
+        header.ConnectionID = (type == PacketType::Syn) ? m_receiveID : m_sendID;
+        header.Timestamp = getTimestampMicros();
+        header.TimestampDifference = m_replyMicros;
+        header.WindowSize = getReceiveWindow();
+        header.SeqNr = seqNr;
+        header.AckNr = m_ackNr;
+
+        std::size_t extensionSize = (selectiveAckLength > 0) ? 2 + selectiveAckLength : 0;
+        MutableBuffer mb(HeaderSize + extensionSize + payload.size());
+        writeHeader(header, reinterpret_cast<uint8_t*>(mb.getWritePointer()));
+        mb.advanceWritePosition(HeaderSize);
+        if (selectiveAckLength > 0)
+        {
+            mb << uint8_t(0);                                   // No further extension
+            mb << static_cast<uint8_t>(selectiveAckLength);
+            mb.write(reinterpret_cast<const char*>(selectiveAck), selectiveAckLength);
+        }
+        mb.write(payload.data(), payload.size());
+
+        m_windowWasClosed = (header.WindowSize < MaxPayloadSize);
+        socketMgr->sendPacket(m_remoteEndpoint, std::move(mb));
+    }
+
+    void UTPStream::sendAck()
+    {
+        m_numUnacked = 0;
+        sendPacket(PacketType::State, m_seqNr, std::string());
+    }
+
+    uint32_t UTPStream::getReceiveWindow() const
+    {
+        std::size_t buffered = m_receiveBuffer.size() - m_receiveOffset + m_outOfOrderBytes;
+        return static_cast<uint32_t>(buffered < ReceiveBufferSize ? ReceiveBufferSize - buffered : 0);
+    }
+
+    void UTPStream::completeRead()
+    {
+        if (!m_readHandler)
+            return;
+
+        std::size_t available = m_receiveBuffer.size() - m_receiveOffset;
+        if (available > 0)
+        {
+            std::size_t numBytes = std::min(available, m_readSize);
+            memcpy(m_readData, m_receiveBuffer.data() + m_receiveOffset, numBytes);
+            m_receiveOffset += numBytes;
+            if (m_receiveOffset == m_receiveBuffer.size())
+            {
+                m_receiveBuffer.clear();
+                m_receiveOffset = 0;
+            }
+
+            IOHandler handler = std::move(m_readHandler);
+            m_readHandler = nullptr;
+            post(handler, boost::system::error_code(), numBytes);
+
+            // Tell a sender that was stalled by a full receive window that there is room again
+            if (m_windowWasClosed && getReceiveWindow() >= MaxPayloadSize)
+                sendAck();
+        }
+        else if (m_finReceived && m_ackNr == m_finSeqNr)
+        {
+            IOHandler handler = std::move(m_readHandler);
+            m_readHandler = nullptr;
+            post(handler, boost::asio::error::eof, 0);
+        }
+    }
+
+    void UTPStream::completeWrite()
+    {
+        if (!m_writeHandler || m_sendBuffer.size() - m_sendOffset > SendBufferSize)
+            return;
+
+        IOHandler handler = std::move(m_writeHandler);
+        m_writeHandler = nullptr;
+        post(handler, boost::system::error_code(), m_writeSize);
+    }
+
+    void UTPStream::fail(const boost::system::error_code &ec)
+    {
+        if (m_connectHandler)
+            m_ioService.post(std::bind(m_connectHandler, ec));
+        if (m_readHandler)
+            post(m_readHandler, ec, 0);
+        if (m_writeHandler)
+            post(m_writeHandler, ec, 0);
+
+        m_connectHandler = nullptr;
+        m_readHandler = nullptr;
+        m_writeHandler = nullptr;
+        m_state = State::Closed;
+    }
+
+    void UTPStream::post(IOHandler handler, const boost::system::error_code &ec, std::size_t bytesTransferred)
+    {
+        m_ioService.post(std::bind(handler, ec, bytesTransferred));
+    }
+}
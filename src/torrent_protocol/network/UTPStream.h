@@ -0,0 +1,328 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <boost/asio.hpp>
+
+#include "LedbatController.h"
+
+namespace network
+{
+    class UTPSocketMgr;
+
+    /**
+     * @class UTPStream
+     * @brief One connection of the Micro Transport Protocol (BEP 29), a reliable ordered byte stream
+     *        carried over UDP. Its packets are sent and received through the \ref UTPSocketMgr that
+     *        created it, paced over each round trip and limited by a \ref LedbatController window.
+     *        Lost packets are found through duplicate and selective acknowledgements, or timeouts.
+     */
+    class UTPStream : public std::enable_shared_from_this<UTPStream>
+    {
+    public:
+        /// Handler called once a connection attempt completes
+        typedef std::function<void(const boost::system::error_code&)> ConnectHandler;
+
+        /// Handler called once a read or write completes, with the number of bytes transferred
+        typedef std::function<void(const boost::system::error_code&, std::size_t)> IOHandler;
+
+        /// Clock used for all time points
+        typedef LedbatController::Clock Clock;
+
+        /// Packet types
+        enum class PacketType : uint8_t
+        {
+            Data  = 0,
+            Fin   = 1,
+            State = 2,
+            Reset = 3,
+            Syn   = 4
+        };
+
+        /// Fixed-size header at the start of every packet
+        struct PacketHeader
+        {
+            /// Type of the packet
+            PacketType Type;
+
+            /// Type of the first extension header, 0 if none
+            uint8_t Extension;
+
+            /// Connection id the packet is addressed to
+            uint16_t ConnectionID;
+
+            /// Time of sending, in microseconds
+            uint32_t Timestamp;
+
+            /// One-way delay of the last packet received by the sender, in microseconds
+            uint32_t TimestampDifference;
+
+            /// Number of bytes the sender can still receive
+            uint32_t WindowSize;
+
+            /// Sequence number of the packet
+            uint16_t SeqNr;
+
+            /// Sequence number of the last packet the sender received in order
+            uint16_t AckNr;
+        };
+
+        /// Size of the packet header
+        static constexpr std::size_t HeaderSize = 20;
+
+        /// Largest payload of a packet, keeping datagrams below common path MTUs
+        static constexpr std::size_t MaxPayloadSize = 1200;
+
+    public:
+        /// Constructs a stream, given the io_service it runs on and the manager it sends packets through
+        UTPStream(boost::asio::io_service &ioService, std::weak_ptr<UTPSocketMgr> socketMgr);
+
+        /// Returns the io_service the stream runs on
+        boost::asio::io_service &getIOService();
+
+        /// Starts connecting to the remote endpoint, receiving packets on the given connection id
+        void connect(const boost::asio::ip::udp::endpoint &endpoint, uint16_t receiveID, ConnectHandler handler);
+
+        /// Accepts the connection requested by the given SYN packet
+        void accept(const boost::asio::ip::udp::endpoint &endpoint, const PacketHeader &syn);
+
+        /// Reads up to size bytes of the stream into data, calling the handler once at least one byte,
+        /// the end of the stream or an error has arrived
+        void asyncReadSome(char *data, std::size_t size, IOHandler handler);
+
+        /// Queues size bytes of data to be sent, calling the handler once the stream's send buffer has
+        /// taken all of them
+        void asyncWrite(const char *data, std::size_t size, IOHandler handler);
+
+        /// Closes the stream once the queued data has been sent. Pending handlers are aborted
+        void close();
+
+        /// Returns true once the stream has shut down and can be forgotten
+        bool isClosed() const;
+
+        /// Returns the remote endpoint of the stream
+        const boost::asio::ip::udp::endpoint &getRemoteEndpoint() const;
+
+        /// Returns the connection id the stream receives packets on
+        uint16_t getReceiveID() const;
+
+        /// Handles a packet addressed to the stream, with its selective acknowledgement bitmask if any
+        void onPacket(const PacketHeader &header, const uint8_t *selectiveAck, std::size_t selectiveAckLength,
+                      const char *payload, std::size_t payloadLength);
+
+        /// Performs periodic work: pacing, retransmissions and delayed acknowledgements
+        void onTick(Clock::time_point now, uint32_t tickMillis);
+
+        /// Encodes a header at the start of a packet buffer of at least HeaderSize bytes
+        static void writeHeader(const PacketHeader &header, uint8_t *data);
+
+        /// Decodes the header of a packet, returning false if the packet is malformed
+        static bool readHeader(const uint8_t *data, std::size_t length, PacketHeader &header);
+
+        /// Returns the current time in microseconds, truncated to 32 bits
+        static uint32_t getTimestampMicros();
+
+    private:
+        /// State of the connection
+        enum class State
+        {
+            Idle,
+            SynSent,
+            Connected,
+            FinSent,
+            Closed
+        };
+
+        /// A packet sent and not yet acknowledged
+        struct OutgoingPacket
+        {
+            /// Type of the packet, Data, Fin or Syn
+            PacketType Type;
+
+            /// Sequence number
+            uint16_t SeqNr;
+
+            /// Payload
+            std::string Payload;
+
+            /// Time of the last transmission
+            Clock::time_point SentTime;
+
+            /// Number of times the packet was sent
+            uint32_t NumTransmissions;
+
+            /// True if the packet was acknowledged selectively, ahead of the cumulative acknowledgement
+            bool Acked;
+
+            /// True if the packet was resent after being found lost through acknowledgements
+            bool FastResent;
+        };
+
+    private:
+        /// Processes the cumulative and selective acknowledgements of a packet
+        void processAcks(const PacketHeader &header, const uint8_t *selectiveAck, std::size_t selectiveAckLength, Clock::time_point now);
+
+        /// Handles the payload of a data packet, or the end of the stream if isFin is true
+        void processData(uint16_t seqNr, const char *payload, std::size_t length, bool isFin);
+
+        /// Sends queued data while the window, the remote receive window and the pacing budget allow
+        void flushSend();
+
+        /// Sends a packet of the given type and sequence number
+        void sendPacket(PacketType type, uint16_t seqNr, const std::string &payload);
+
+        /// Sends a state packet acknowledging the data received so far
+        void sendAck();
+
+        /// Returns the number of bytes the stream can still receive
+        uint32_t getReceiveWindow() const;
+
+        /// Completes the pending read, if any, with the data received so far
+        void completeRead();
+
+        /// Completes the pending write once the send buffer has room
+        void completeWrite();
+
+        /// Shuts the stream down, failing the pending handlers with the given error
+        void fail(const boost::system::error_code &ec);
+
+        /// Posts a handler to the io_service
+        void post(IOHandler handler, const boost::system::error_code &ec, std::size_t bytesTransferred);
+
+    private:
+        /// I/O service the stream runs on
+        boost::asio::io_service &m_ioService;
+
+        /// Manager that packets are sent through
+        std::weak_ptr<UTPSocketMgr> m_socketMgr;
+
+        /// State of the connection
+        State m_state;
+
+        /// Remote endpoint
+        boost::asio::ip::udp::endpoint m_remoteEndpoint;
+
+        /// Connection id of received packets
+        uint16_t m_receiveID;
+
+        /// Connection id of sent packets
+        uint16_t m_sendID;
+
+        /// Sequence number of the next packet
+        uint16_t m_seqNr;
+
+        /// Sequence number of the last packet received in order
+        uint16_t m_ackNr;
+
+        /// Delay of the last received packet, echoed back to the remote side
+        uint32_t m_replyMicros;
+
+        /// Congestion control
+        LedbatController m_congestion;
+
+        /// Packets sent and not yet acknowledged, in sequence order
+        std::deque<OutgoingPacket> m_outstanding;
+
+        /// Number of payload bytes in m_outstanding
+        uint32_t m_bytesInFlight;
+
+        /// Receive window last advertised by the remote side
+        uint32_t m_remoteWindow;
+
+        /// Number of bytes that may still be sent before the next tick, spreading packets over the round trip
+        double m_pacingBudget;
+
+        /// Last cumulative acknowledgement received
+        uint16_t m_lastAckNr;
+
+        /// Number of duplicate acknowledgements of m_lastAckNr
+        uint32_t m_numDuplicateAcks;
+
+        /// Number of consecutive retransmission timeouts
+        uint32_t m_numTimeouts;
+
+        /// Data waiting to be packetized, starting at m_sendOffset
+        std::string m_sendBuffer;
+
+        /// Offset of the first unsent byte in m_sendBuffer
+        std::size_t m_sendOffset;
+
+        /// Data received in order and not yet read, starting at m_receiveOffset
+        std::string m_receiveBuffer;
+
+        /// Offset of the first unread byte in m_receiveBuffer
+        std::size_t m_receiveOffset;
+
+        /// Packets received ahead of a missing one, by sequence number
+        std::map<uint16_t, std::string> m_outOfOrder;
+
+        /// Number of bytes in m_outOfOrder
+        std::size_t m_outOfOrderBytes;
+
+        /// Number of data packets received since the last acknowledgement was sent
+        uint32_t m_numUnacked;
+
+        /// True if the last advertised receive window could not fit a full packet
+        bool m_windowWasClosed;
+
+        /// True once the remote side's FIN was received
+        bool m_finReceived;
+
+        /// Sequence number of the remote side's FIN
+        uint16_t m_finSeqNr;
+
+        /// True if close() was called and a FIN is to be sent after the queued data
+        bool m_closeRequested;
+
+        /// Handler of the connection attempt
+        ConnectHandler m_connectHandler;
+
+        /// Destination of the pending read
+        char *m_readData;
+
+        /// Capacity of the pending read
+        std::size_t m_readSize;
+
+        /// Handler of the pending read
+        IOHandler m_readHandler;
+
+        /// Number of bytes of the pending write, waiting for room in the send buffer
+        std::size_t m_writeSize;
+
+        /// Handler of the pending write
+        IOHandler m_writeHandler;
+
+        /// Time the last packet was received
+        Clock::time_point m_lastReceived;
+    };
+}
@@ -0,0 +1,95 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "UploadScheduler.h"
+#include "Peer.h"
+
+namespace network
+{
+    UploadScheduler::UploadScheduler(boost::asio::io_service &ioService) :
+        m_ioService(ioService),
+        m_rotation(),
+        m_isServing(false)
+    {
+    }
+
+    void UploadScheduler::schedule(std::shared_ptr<Peer> peer)
+    {
+        if (peer->m_isUploadScheduled)
+            return;
+
+        peer->m_isUploadScheduled = true;
+        m_rotation.push_back(Entry{ peer, 0 });
+
+        if (!m_isServing)
+        {
+            m_isServing = true;
+            m_ioService.post(std::bind(&UploadScheduler::serve, this));
+        }
+    }
+
+    void UploadScheduler::serve()
+    {
+        uint32_t bytesServed = 0;
+        while (!m_rotation.empty() && bytesServed < MaxBytesPerPass)
+        {
+            Entry entry = m_rotation.front();
+            m_rotation.pop_front();
+
+            std::shared_ptr<Peer> peer = entry.Connection.lock();
+            if (!peer.get())
+                continue;
+            if (peer->isClosing())
+            {
+                peer->m_isUploadScheduled = false;
+                continue;
+            }
+
+            // Requests are served while the peer's allowance lasts, and its socket keeps up
+            entry.Deficit += Quantum;
+            uint32_t length = peer->getNextUploadLength();
+            while (length != 0 && length <= entry.Deficit && peer->canUpload())
+            {
+                peer->sendNextUpload();
+                entry.Deficit -= length;
+                bytesServed += length;
+                length = peer->getNextUploadLength();
+            }
+
+            // A peer leaves the rotation, and gives up its allowance, once it has nothing more to be sent for now
+            if (length == 0 || !peer->canUpload())
+            {
+                peer->m_isUploadScheduled = false;
+                continue;
+            }
+            m_rotation.push_back(entry);
+        }
+
+        if (m_rotation.empty())
+            m_isServing = false;
+        else
+            m_ioService.post(std::bind(&UploadScheduler::serve, this));
+    }
+}
@@ -0,0 +1,87 @@
+/*
+Copyright (c) 2017, Timothy Vaccarelli
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <boost/asio.hpp>
+
+namespace network
+{
+    class Peer;
+
+    /**
+     * @class UploadScheduler
+     * @brief Serves the requests queued by peers, reading the requested fragments from disk in
+     *        deficit round robin order: each round, a peer may be sent up to Quantum more bytes than
+     *        it was sent in the previous rounds, so that peers share the disk and the network thread
+     *        evenly, whatever the number and size of their requests. The scheduler yields to the other
+     *        handlers of the io_service after every MaxBytesPerPass bytes. Only used from the io thread.
+     */
+    class UploadScheduler
+    {
+    public:
+        /// Number of bytes added to the allowance of each peer every round
+        static const uint32_t Quantum = 16384;
+
+        /// Number of bytes served before the scheduler lets the io_service run other handlers
+        static const uint32_t MaxBytesPerPass = 1024 * 1024;
+
+    public:
+        /// Constructs the scheduler, given the io_service to run on
+        explicit UploadScheduler(boost::asio::io_service &ioService);
+
+        /// Adds a peer with queued requests to the rotation, if it is not already in it
+        void schedule(std::shared_ptr<Peer> peer);
+
+    private:
+        /// A peer in the rotation, and the number of bytes it may still be sent
+        struct Entry
+        {
+            /// The peer whose requests are served
+            std::weak_ptr<Peer> Connection;
+
+            /// Number of bytes the peer may be sent before its turn ends
+            uint32_t Deficit;
+        };
+
+    private:
+        /// Serves the requests of the peers in the rotation, round after round, until the peers have
+        /// no more requests that can be served or MaxBytesPerPass bytes have been served
+        void serve();
+
+    private:
+        /// IO service reference
+        boost::asio::io_service &m_ioService;
+
+        /// Peers with queued requests, in the order their turns come
+        std::deque<Entry> m_rotation;
+
+        /// True while a pass of serve() is posted to the io_service
+        bool m_isServing;
+    };
+}